@@ -21,27 +21,81 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <string.h>
+#include <math.h>
 #include <errno.h>
 #include <unistd.h>
 #include <getopt.h>
 #include <limits.h>
 #include <tiffio.h>
+#include <zlib.h>
 #include <time.h>
 #include <errno.h>
 #include <fitsio.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 #include "asi_util.h"
+#include "frame.h"
+#include "ring.h"
+#include "writer.h"
+#include "parallel.h"
+#include "ser.h"
+#include "spool.h"
+#include "aio.h"
+#include "stripe.h"
+#include "bufpool.h"
+#include "fitn.h"
+#include "planar.h"
+#include "debayer.h"
+#include "resample.h"
+#include "stack.h"
+#include "calib.h"
+#include "stats.h"
+#include "lucky.h"
+#include "autoexp.h"
+#include "track.h"
 #include "log.h"
 
 #if HAVE_CONFIG_H
 #include <config.h>
 #endif
 
+#ifdef HAVE_LIBZSTD
+#include <zstd.h>
+#endif
+
 #ifndef PACKAGE_VERSION
 #define PACKAGE_VERSION "NA"
 #endif
 
 #define MAX_IMG_TYPE_LENGTH	5 /* RAW8, RAW16, RGB24, Y8 */
-#define MAX_LEN_ISO8601 32
+#define SNAP_RING_SLOTS		2
+#define VIDEO_RING_SLOTS	8
+#define VIDEO_MAX_TIMEOUT	3
+#define WRITER_STALL		0.2	/* Seconds. */
+#define TIFF_STRIP_SIZE		(256 * 1024)
+#define TIFF_DEFLATE_LEVEL	6
+#define TIFF_ZSTD_LEVEL		9	/* Default of libtiff. */
+#define TIFF_MEM_HEADER		(64 * 1024)
+#define FIT_BLOCK_SIZE		2880
+#define SERVE_MAX_CAMERAS	128
+#define MULTI_MAX_CAMERAS	8
+#define STATS_JSON_LEN		512
+#define SERVE_BACKLOG		8
+
+/* Exposure timing in seconds, readout rate in bytes per second. */
+#define EXP_START_DELAY		0.01
+#define EXP_POLL_LEAD		0.05
+#define EXP_POLL_MIN		0.001
+#define EXP_POLL_MAX		0.1
+#define EXP_READOUT_SLACK	2.0
+#define EXP_READOUT_RATE	10e6	/* Worst case USB2 throughput. */
+#define EXP_RETRY_DELAY		0.5
+#define EXP_MIN			32e-6	/* Shortest exposure of the SDK. */
+#define EXP_METER_ROI		512	/* Side of the test frames. */
+#define TEMP_INTERVAL		1.0	/* Seconds between sensor reads. */
 
 #define FITS_ERROR(status) 						\
 do {		   							\
@@ -67,11 +121,43 @@ do {		   							\
 typedef enum {
 	TYPE_UNKNOWN = 0,
 	TYPE_FIT     = 1,
-	TYPE_TIF     = 2
+	TYPE_TIF     = 2,
+	TYPE_SER     = 3,
+	TYPE_SPOOL   = 4
 } img_outtype_e;
 
 static img_outtype_e img_outtype = TYPE_UNKNOWN;
 
+/* Frame buffers of all captures, recycled across captures. */
+static struct bufpool bufpool;
+
+/* Layout of a sequence written into a single fit file. */
+typedef enum {
+	FIT_STREAM_NONE = 0,
+	FIT_STREAM_CUBE = 1,	/* Frames are planes of a NAXIS3 cube. */
+	FIT_STREAM_EXT  = 2	/* Frames are image extensions. */
+} fit_stream_e;
+
+/* Policy when the writers cannot keep up with acquisition. */
+typedef enum {
+	QUEUE_AUTO  = 0,	/* Block in snap, drop in video mode. */
+	QUEUE_BLOCK = 1,	/* Wait for a free frame. */
+	QUEUE_DROP  = 2		/* Drop the oldest queued frame. */
+} queue_policy_e;
+
+/* How fit and tif files are written. */
+typedef enum {
+	IO_SYNC  = 0,		/* Blocking writes by cfitsio/libtiff. */
+	IO_URING = 1		/* Encoded in memory, written via io_uring. */
+} io_backend_e;
+
+/* Result of a daemon request. */
+enum {
+	SERVE_CONTINUE = 0,
+	SERVE_CLOSE    = 1,
+	SERVE_SHUTDOWN = 2
+};
+
 const char *BOOL_NO_YES[]   = {"no", "yes"};
 const char *BOOL_STR[]	    = {"false", "true"};
 const char *BAYER_PATTERN[] = {"RG","BG","GR","GB"};
@@ -94,6 +180,7 @@ struct options {
 	char o_get[MAX_PV_LENGTH + 1];
 	char o_set[MAX_PV_SET_LENGTH + 1];
 	bool o_capture;
+	bool o_video;
 	int o_width;
 	int o_height;
 	int o_binning;
@@ -103,6 +190,46 @@ struct options {
 	bool o_color;
 	int o_verbose;
 	double o_exposure;
+	int o_count;
+	double o_interval;
+	int o_retries;
+	int o_compress;
+	float o_quantize;
+	fit_stream_e o_fit_stream;
+	int o_tiff_compress;
+	int o_threads;
+	int o_writers;
+	int o_queue;
+	queue_policy_e o_policy;
+	io_backend_e o_io;
+	bool o_stripe_rate;
+	int o_pool_flags;
+	enum debayer_algo o_debayer;
+	int o_bayer;		/* ASI_BAYER_PATTERN, -1 for mono cameras. */
+	double o_soft_bin;
+	bool o_bin_sum;
+	char o_full_filename[PATH_MAX + 1];
+	char o_stack[PATH_MAX + 1];
+	float o_stack_kappa;
+	int o_stack_every;
+	char o_bias[PATH_MAX + 1];
+	char o_darks[PATH_MAX + 1];
+	char o_flat[PATH_MAX + 1];
+	bool o_dark_scale;
+	bool o_stats;
+	int o_lucky_k;
+	double o_lucky_pct;
+	int o_lucky_window;
+	int o_lucky_roi;
+	double o_auto_exp;
+	double o_ae_percentile;
+	double o_ae_max;
+	int o_track;
+	char o_serve[PATH_MAX + 1];
+	int o_cam_ids[MULTI_MAX_CAMERAS];
+	int o_n_cams;
+	char o_cam_opts[MULTI_MAX_CAMERAS][MAX_PV_SET_LENGTH + 1];
+	int o_n_cam_opts;
 };
 
 /* Default settings. */
@@ -113,6 +240,7 @@ struct options opt = {
 	.o_get = {0},
 	.o_set = {0},
 	.o_capture = false,
+	.o_video = false,
 	.o_width = 640,
 	.o_height = 480,
 	.o_binning = 1,		/* 1 x 1 */
@@ -122,18 +250,46 @@ struct options opt = {
 	.o_color = false,
 	.o_verbose = API_MSG_NORMAL,
 	.o_exposure = 0.01,	/* 0.01 sec */
-};
-
-static struct params_vals pvs = {.N = 0,
-				 .pv = NULL};
-
-struct fit_head_s {
-	char date_obs[MAX_LEN_ISO8601];
-	double exp_time;
-	unsigned int x_binning;
-	unsigned int y_binning;
-	float x_pix_sz;
-	float y_pix_sz;;
+	.o_count = 1,
+	.o_interval = 0,	/* back to back */
+	.o_retries = 2,
+	.o_compress = NOCOMPRESS,
+	.o_quantize = 0,	/* cfitsio default */
+	.o_fit_stream = FIT_STREAM_NONE,
+	.o_tiff_compress = COMPRESSION_NONE,
+	.o_threads = 0,		/* Number of online CPUs. */
+	.o_writers = 1,
+	.o_queue = 0,		/* Depending on capture mode. */
+	.o_policy = QUEUE_AUTO,
+	.o_io = IO_SYNC,
+	.o_stripe_rate = true,
+	.o_pool_flags = 0,
+	.o_debayer = DEBAYER_NONE,
+	.o_bayer = -1,
+	.o_soft_bin = 0,	/* No software binning. */
+	.o_bin_sum = false,
+	.o_full_filename = {0},
+	.o_stack = {0},
+	.o_stack_kappa = 3,
+	.o_stack_every = 10,
+	.o_bias = {0},
+	.o_darks = {0},
+	.o_flat = {0},
+	.o_dark_scale = false,
+	.o_stats = false,
+	.o_lucky_k = 0,		/* No frame selection. */
+	.o_lucky_pct = 0,
+	.o_lucky_window = 0,	/* All frames of the capture. */
+	.o_lucky_roi = 256,
+	.o_auto_exp = 0,	/* Fixed exposure time. */
+	.o_ae_percentile = 50,
+	.o_ae_max = 60,
+	.o_track = -1,		/* ROI at a fixed position. */
+	.o_serve = {0},
+	.o_cam_ids = {0},
+	.o_n_cams = 0,
+	.o_cam_opts = {{0}},
+	.o_n_cam_opts = 0,
 };
 
 static void tiff_error_handler(const char *module, const char *fmt, va_list ap)
@@ -157,24 +313,92 @@ static void tiff_warn_handler(const char *module, const char *fmt, va_list ap)
 
 static void usage(const char *cmd_name, const int rc)
 {
-	fprintf(stdout, "usage: %s [options] <camera_id>\n"
+	fprintf(stdout, "usage: %s [options] <camera_id> [camera_id ...]\n"
+		"       %s convert [options] -f <filename> <spool>\n"
 		"\t-l, --list\t\t\t\t list properties of connected cameras\n"
 		"\t-p, --capabilities <camera_id>\t\t list capabilities and values\n"
 		"\t-s, --set <param=val> <camera_id>\t set value of parameter name\n"
 		"\t-g, --get <param> <camera_id>\t\t get value of parameter name\n"
 		"\t-c, --capture <camera_id>\t\t start single image capture\n"
+		"\t-V, --video\t\t\t\t capture in video mode (use with -c and -n)\n"
+		"\t-n, --count <int>\t\t\t number of images to capture [default: %d]\n"
+		"\t-i, --interval <double>\t\t\t seconds between exposure starts [default: %.2f]\n"
+		"\t-r, --retries <int>\t\t\t restarts of a failed or timed out exposure [default: %d]\n"
+		"\t-W, --writers <int>\t\t\t number of writer threads [default: %d]\n"
+		"\t-q, --queue <int>\t\t\t frames queued for the writers [default: %d (snap), %d (video)]\n"
+		"\t-P, --policy {block, drop}\t\t full queue policy [default: block (snap, spool), drop (video)]\n"
+		"\t-H, --hugepages\t\t\t\t back frame buffers by huge pages\n"
+		"\t-M, --mlock\t\t\t\t lock frame buffers into memory\n"
+		"\t-I, --io {sync, uring}\t\t\t write fit and tif files blocking or encode them\n"
+		"\t\t\t\t\t\t in memory and write via io_uring [default: sync]\n"
 		"\t-e, --exposure <double>\t\t\t set exposure time in seconds [default: %.2f]\n"
 		"\t-w, --width <int>\t\t\t image width [default: %d]\n"
 		"\t-h, --height <int>\t\t\t image height [default: %d]\n"
 		"\t-b, --binning <int>\t\t\t pixel binning [default: %d]\n"
 		"\t-t, --type <string>\t\t\t image type {RAW8, RAW16, RGB24, Y8} [default: %s]\n"
-		"\t-f, --filename <string>\t\t\t tif or fit filename of captured data\n"
+		"\t-f, --filename <string>\t\t\t tif or fit filename of captured data, numbered\n"
+		"\t\t\t\t\t\t as <name>_%%05d.<ext> if count > 1, or ser filename\n"
+		"\t\t\t\t\t\t of a video file holding all images, or spool\n"
+		"\t\t\t\t\t\t filename of raw frames for later conversion. A comma\n"
+		"\t\t\t\t\t\t separated list of tif or fit filenames stripes the\n"
+		"\t\t\t\t\t\t frames across them, recorded in <name>.manifest\n"
+		"\t-R, --stripe {rr, rate}\t\t\t distribute striped frames round-robin or by\n"
+		"\t\t\t\t\t\t measured throughput [default: rate]\n"
+		"\t-z, --compress {rice, gzip, gzip2, hcompress, none}\n"
+		"\t\t\t\t\t\t tile compression of fit files [default: none]\n"
+		"\t-Z, --quantize <float>\t\t\t quantize level of float data and hcompress scale\n"
+		"\t-F, --fit-stream {cube, ext}\t\t write a sequence into a single fit file as cube\n"
+		"\t\t\t\t\t\t or image extensions, frame times in table FRAMES\n"
+		"\t-T, --tiff-compress {lzw, deflate, zstd, none}\n"
+		"\t\t\t\t\t\t compression of tif files, deflate and zstd strips\n"
+		"\t\t\t\t\t\t are compressed in parallel (-j), lzw serially\n"
+		"\t\t\t\t\t\t [default: none]\n"
+		"\t-D, --debayer {bilinear, edge, none}\t interpolate RAW8 and RAW16 frames of color\n"
+		"\t\t\t\t\t\t cameras to R, G, B planes [default: none]\n"
+		"\t-B, --soft-bin <float>\t\t\t bin frames on the host by a factor in (1, %d],\n"
+		"\t\t\t\t\t\t fractional factors downsample by area averaging\n"
+		"\t-U, --bin-sum\t\t\t\t sum binned pixels with saturation instead of averaging\n"
+		"\t-O, --full-filename <string>\t\t additionally write the frames before software\n"
+		"\t\t\t\t\t\t binning, filename of the same type as -f\n"
+		"\t-k, --stack <string>\t\t\t register frames on their stars and stack them\n"
+		"\t\t\t\t\t\t in memory, snapshots written to fit filename\n"
+		"\t-K, --stack-kappa <float>\t\t reject samples farther than kappa sigma from\n"
+		"\t\t\t\t\t\t the running mean, 0 sums all [default: %.1f]\n"
+		"\t-N, --stack-every <int>\t\t\t frames between snapshots, 0 at the end only\n"
+		"\t\t\t\t\t\t [default: %d]\n"
+		"\t-A, --bias <string>\t\t\t subtract master bias fit file\n"
+		"\t-d, --dark <string>\t\t\t subtract master dark fit file, a comma separated\n"
+		"\t\t\t\t\t\t list selects the dark of the nearest sensor\n"
+		"\t\t\t\t\t\t temperature and exposure time per frame\n"
+		"\t-L, --flat <string>\t\t\t divide by master flat fit file normalized to its mean\n"
+		"\t-X, --dark-scale\t\t\t scale the bias subtracted dark by exposure time\n"
+		"\t-Y, --stats\t\t\t\t write histogram statistics of each frame into its\n"
+		"\t\t\t\t\t\t header and as json lines into <name>.jsonl\n"
+		"\t-Q, --lucky <int | float%%>\t\t write only the sharpest frames, best count or\n"
+		"\t\t\t\t\t\t percent of each selection window\n"
+		"\t-E, --lucky-window <int>\t\t frames per selection window [default: count]\n"
+		"\t-G, --lucky-roi <int>\t\t\t side of the region scored for sharpness\n"
+		"\t\t\t\t\t\t [default: %d]\n"
+		"\t-a, --auto-exposure <float>\t\t meter with test frames and adjust the exposure\n"
+		"\t\t\t\t\t\t of each snap frame, such that the percentile\n"
+		"\t\t\t\t\t\t is at this fraction of full scale, -e is the start\n"
+		"\t-x, --ae-percentile <float>\t\t histogram percentile of auto exposure [default: %.1f]\n"
+		"\t-m, --ae-max <double>\t\t\t longest auto exposure in seconds [default: %.1f]\n"
+		"\t-u, --track <int>\t\t\t locate the target on a full frame and move the ROI\n"
+		"\t\t\t\t\t\t with it once it is more than <int> pixels off center\n"
+		"\t-j, --threads <int>\t\t\t threads for compression and image processing\n"
+		"\t\t\t\t\t\t [default: number of online cpus]\n"
+		"\t-C, --camera <id:option=val,...>\t capture options of camera id when capturing with\n"
+		"\t\t\t\t\t\t multiple cameras, e.g. 1:exposure=0.5,type=RAW16\n"
+		"\t-S, --serve <socket>\t\t\t keep cameras open and serve requests on unix socket\n"
 		"\t-v, --verbose {error, warn, message, info, debug} [default: message]\n"
 		"version: %s (%s) © by Thomas Stibor <thomas@stibor.net>\n",
-		cmd_name, opt.o_exposure,
+		cmd_name, cmd_name, opt.o_count, opt.o_interval, opt.o_retries,
+		opt.o_writers, SNAP_RING_SLOTS, VIDEO_RING_SLOTS, opt.o_exposure,
 		opt.o_width, opt.o_height,
-		opt.o_binning, IMG_TYPE[opt.o_img_type],
-		PACKAGE_VERSION, __DATE__);
+		opt.o_binning, IMG_TYPE[opt.o_img_type], BIN_MAX_FACTOR,
+		opt.o_stack_kappa, opt.o_stack_every, opt.o_lucky_roi,
+		opt.o_ae_percentile, opt.o_ae_max, PACKAGE_VERSION, __DATE__);
 	exit(rc);
 }
 
@@ -199,21 +423,206 @@ static void set_img_outtype(const char *filename)
 		img_outtype = TYPE_TIF;
 	else if (STRNCMP(s + 1, "fit") || STRNCMP(s + 1, "fits"))
 		img_outtype = TYPE_FIT;
+	else if (STRNCMP(s + 1, "ser"))
+		img_outtype = TYPE_SER;
+	else if (STRNCMP(s + 1, "spool"))
+		img_outtype = TYPE_SPOOL;
+}
+
+/* Whether all filenames of a stripe list have the same per frame
+   output type. */
+static bool stripe_check(const struct options *o, const char *list)
+{
+	char dup[PATH_MAX + 1] = {0};
+	char *saveptr = NULL;
+	img_outtype_e type = TYPE_UNKNOWN;
+	bool valid = o->o_fit_stream == FIT_STREAM_NONE;
+
+	snprintf(dup, sizeof(dup), "%s", list);
+	for (char *tok = strtok_r(dup, ",", &saveptr); tok && valid;
+	     tok = strtok_r(NULL, ",", &saveptr)) {
+		set_img_outtype(tok);
+		if (type == TYPE_UNKNOWN)
+			type = img_outtype;
+		valid = img_outtype == type &&
+			(type == TYPE_FIT || type == TYPE_TIF);
+	}
+	img_outtype = valid ? type : TYPE_UNKNOWN;
+
+	return valid;
+}
+
+static bool stack_check(char *filename)
+{
+	const img_outtype_e type = img_outtype;
+	bool valid;
+
+	set_img_outtype(filename);
+	valid = img_outtype == TYPE_FIT;
+	img_outtype = type;
+
+	return valid;
+}
+
+/* Unbinned frames are written by a second output of the same type. */
+static bool full_check(const struct options *o, char *filename)
+{
+	const img_outtype_e type = img_outtype;
+	bool valid;
+
+	set_img_outtype(filename);
+	valid = o->o_soft_bin > 0 && img_outtype == type &&
+		type != TYPE_SPOOL && !strchr(filename, ',');
+	img_outtype = type;
+
+	return valid;
+}
+
+static int parse_img_type(const char *str)
+{
+	if (STRNCMP("RAW8", str))
+		return ASI_IMG_RAW8;
+	else if (STRNCMP("RAW16", str))
+		return ASI_IMG_RAW16;
+	else if (STRNCMP("RGB24", str))
+		return ASI_IMG_RGB24;
+	else if (STRNCMP("Y8", str))
+		return ASI_IMG_Y8;
+
+	return -EINVAL;
+}
+
+static bool lucky_enabled(const struct options *opt)
+{
+	return opt->o_lucky_k > 0 || opt->o_lucky_pct > 0;
+}
+
+static int lucky_window(const struct options *opt)
+{
+	return opt->o_lucky_window > 0 && opt->o_lucky_window < opt->o_count ?
+		opt->o_lucky_window : opt->o_count;
+}
+
+/* Frames selected per full window. */
+static int lucky_capacity(const struct options *opt)
+{
+	const int window = lucky_window(opt);
+	const int k = opt->o_lucky_k > 0 ? opt->o_lucky_k :
+		ceil(opt->o_lucky_pct / 100 * window);
+
+	return k < window ? k : window;
+}
+
+/* Frames reaching the writers, the selected ones are renumbered. */
+static int output_count(const struct options *opt)
+{
+	if (!lucky_enabled(opt))
+		return opt->o_count;
+
+	const int window = lucky_window(opt);
+	const int k = lucky_capacity(opt);
+	const int rest = opt->o_count % window;
+
+	return opt->o_count / window * k + (rest < k ? rest : k);
+}
+
+/* Constraints of a capture, checked for the command line and for each
+   capture request of the daemon. Returns -EINVAL and the reason in msg
+   if o is not valid, img_outtype has to be set from o->o_filename. */
+static int capture_check(struct options *o, char *msg, const size_t len)
+{
+	if (!strlen(o->o_filename) && !strlen(o->o_stack)) {
+		snprintf(msg, len, "missing output filename");
+		return -EINVAL;
+	}
+	if (strlen(o->o_stack) && !stack_check(o->o_stack)) {
+		snprintf(msg, len, "stack requires fit filename");
+		return -EINVAL;
+	}
+	if (strlen(o->o_filename) && img_outtype == TYPE_UNKNOWN) {
+		snprintf(msg, len, "unkown image output type filename, "
+			"valid types are <filename>.fit, "
+			"<filename>.tif, <filename>.ser or "
+			"<filename>.spool");
+		return -EINVAL;
+	}
+	if (o->o_count < 1) {
+		snprintf(msg, len, "count must be at least 1");
+		return -EINVAL;
+	}
+	if (strchr(o->o_filename, ',') && !stripe_check(o, o->o_filename)) {
+		snprintf(msg, len, "striping requires tif or fit filenames "
+			"of the same type and no fit stream");
+		return -EINVAL;
+	}
+	if (o->o_debayer != DEBAYER_NONE &&
+	    (img_outtype == TYPE_SER || img_outtype == TYPE_SPOOL)) {
+		snprintf(msg, len, "debayer requires tif or fit filename, "
+			"a spool is debayered on convert");
+		return -EINVAL;
+	}
+	if ((strlen(o->o_bias) || strlen(o->o_darks) ||
+	     strlen(o->o_flat)) && img_outtype == TYPE_SPOOL) {
+		snprintf(msg, len, "calibration requires tif, fit or ser "
+			"filename, a spool is calibrated on convert");
+		return -EINVAL;
+	}
+	if (o->o_auto_exp > 0 && o->o_video) {
+		snprintf(msg, len, "auto exposure requires snap mode");
+		return -EINVAL;
+	}
+	if (lucky_enabled(o) && img_outtype == TYPE_SPOOL) {
+		snprintf(msg, len, "lucky imaging requires tif, fit or ser "
+			"filename");
+		return -EINVAL;
+	}
+	if (lucky_enabled(o) && lucky_capacity(o) > LUCKY_MAX_FRAMES) {
+		snprintf(msg, len, "lucky imaging selects at most %d frames "
+			"per window", LUCKY_MAX_FRAMES);
+		return -EINVAL;
+	}
+	if (o->o_dark_scale && !strlen(o->o_bias)) {
+		snprintf(msg, len, "dark scaling requires a master bias");
+		return -EINVAL;
+	}
+	if (o->o_soft_bin > 0 && img_outtype == TYPE_SPOOL) {
+		snprintf(msg, len, "soft binning requires tif, fit or ser "
+			"filename, a spool is binned on convert");
+		return -EINVAL;
+	}
+	if (strlen(o->o_full_filename) && !full_check(o, o->o_full_filename)) {
+		snprintf(msg, len, "full resolution filename requires soft "
+			"binning and the type of the filename");
+		return -EINVAL;
+	}
+	if (o->o_writers < 1 || o->o_writers > WRITER_MAX_THREADS) {
+		snprintf(msg, len, "writers must be in range [1, %d]",
+			WRITER_MAX_THREADS);
+		return -EINVAL;
+	}
+	if (o->o_queue < 0) {
+		snprintf(msg, len, "queue must not be negative");
+		return -EINVAL;
+	}
+	if (o->o_retries < 0) {
+		snprintf(msg, len, "retries must not be negative");
+		return -EINVAL;
+	}
+	if (o->o_interval < 0) {
+		snprintf(msg, len, "interval must not be negative");
+		return -EINVAL;
+	}
+
+	return 0;
 }
 
 static void sanity_arg_check(const char *argv)
 {
-	if (opt.o_capture) {
-		if (!strlen(opt.o_filename)) {
-			fprintf(stdout, "missing output filename\n");
-			usage(argv, 1);
-		}
-		if (img_outtype == TYPE_UNKNOWN) {
-			fprintf(stdout, "unkown image output type filename, "
-				"valid types are <filename>.fit or "
-				"<filename>.tif\n");
-			usage(argv, 1);
-		}
+	char msg[256];
+
+	if (opt.o_capture && capture_check(&opt, msg, sizeof(msg))) {
+		fprintf(stdout, "%s\n", msg);
+		usage(argv, 1);
 	}
 }
 
@@ -225,18 +634,55 @@ static int parseopts(int argc, char *argv[])
 		{"set",          required_argument, 0, 's'},
 		{"get",          required_argument, 0, 'g'},
 		{"capture",      no_argument,       0, 'c'},
+		{"video",        no_argument,       0, 'V'},
+		{"count",        required_argument, 0, 'n'},
+		{"interval",     required_argument, 0, 'i'},
+		{"retries",      required_argument, 0, 'r'},
+		{"writers",      required_argument, 0, 'W'},
+		{"queue",        required_argument, 0, 'q'},
+		{"policy",       required_argument, 0, 'P'},
+		{"io",           required_argument, 0, 'I'},
+		{"hugepages",    no_argument,       0, 'H'},
+		{"mlock",        no_argument,       0, 'M'},
+		{"stripe",       required_argument, 0, 'R'},
 		{"exposure",     required_argument, 0, 'e'},
 		{"width",        required_argument, 0, 'w'},
 		{"height",       required_argument, 0, 'h'},
 		{"binning",      required_argument, 0, 'b'},
 		{"type",         required_argument, 0, 't'},
 		{"filename",     required_argument, 0, 'f'},
+		{"compress",     required_argument, 0, 'z'},
+		{"quantize",     required_argument, 0, 'Z'},
+		{"fit-stream",   required_argument, 0, 'F'},
+		{"tiff-compress", required_argument, 0, 'T'},
+		{"threads",      required_argument, 0, 'j'},
+		{"debayer",      required_argument, 0, 'D'},
+		{"soft-bin",     required_argument, 0, 'B'},
+		{"bin-sum",      no_argument,       0, 'U'},
+		{"full-filename", required_argument, 0, 'O'},
+		{"stack",        required_argument, 0, 'k'},
+		{"stack-kappa",  required_argument, 0, 'K'},
+		{"stack-every",  required_argument, 0, 'N'},
+		{"bias",         required_argument, 0, 'A'},
+		{"dark",         required_argument, 0, 'd'},
+		{"flat",         required_argument, 0, 'L'},
+		{"dark-scale",   no_argument,       0, 'X'},
+		{"stats",        no_argument,       0, 'Y'},
+		{"lucky",        required_argument, 0, 'Q'},
+		{"lucky-window", required_argument, 0, 'E'},
+		{"lucky-roi",    required_argument, 0, 'G'},
+		{"auto-exposure", required_argument, 0, 'a'},
+		{"ae-percentile", required_argument, 0, 'x'},
+		{"ae-max",       required_argument, 0, 'm'},
+		{"track",        required_argument, 0, 'u'},
+		{"camera",       required_argument, 0, 'C'},
+		{"serve",        required_argument, 0, 'S'},
 		{"verbose",	 required_argument, 0, 'v'},
 		{0, 0, 0, 0}
 	};
 
 	int c;
-	while ((c = getopt_long(argc, argv, "lpg:s:ce:w:h:b:t:f:v:",
+	while ((c = getopt_long(argc, argv, "lpg:s:cVHMUXYn:i:r:W:q:P:I:R:e:w:h:b:t:f:z:Z:F:T:j:D:B:O:k:K:N:A:d:L:Q:E:G:a:x:m:u:C:S:v:",
 				long_opts, NULL)) != -1) {
 		switch (c) {
 		case 'l': {
@@ -259,6 +705,80 @@ static int parseopts(int argc, char *argv[])
 			opt.o_capture = true;
 			break;
 		}
+		case 'V': {
+			opt.o_video = true;
+			break;
+		}
+		case 'H': {
+			opt.o_pool_flags |= BUFPOOL_HUGETLB;
+			break;
+		}
+		case 'M': {
+			opt.o_pool_flags |= BUFPOOL_MLOCK;
+			break;
+		}
+		case 'n': {
+			opt.o_count = atoi(optarg);
+			break;
+		}
+		case 'i': {
+			opt.o_interval = atof(optarg);
+			break;
+		}
+		case 'r': {
+			opt.o_retries = atoi(optarg);
+			break;
+		}
+		case 'W': {
+			opt.o_writers = atoi(optarg);
+			break;
+		}
+		case 'q': {
+			opt.o_queue = atoi(optarg);
+			break;
+		}
+		case 'P': {
+			if (STRNCMP("block", optarg))
+				opt.o_policy = QUEUE_BLOCK;
+			else if (STRNCMP("drop", optarg))
+				opt.o_policy = QUEUE_DROP;
+			else {
+				fprintf(stdout, "wrong argument for -P, "
+					"--policy '%s'\n", optarg);
+				usage(argv[0], 1);
+			}
+			break;
+		}
+		case 'R': {
+			if (STRNCMP("rr", optarg))
+				opt.o_stripe_rate = false;
+			else if (STRNCMP("rate", optarg))
+				opt.o_stripe_rate = true;
+			else {
+				fprintf(stdout, "wrong argument for -R, "
+					"--stripe '%s'\n", optarg);
+				usage(argv[0], 1);
+			}
+			break;
+		}
+		case 'I': {
+			if (STRNCMP("sync", optarg))
+				opt.o_io = IO_SYNC;
+			else if (STRNCMP("uring", optarg)) {
+#ifdef HAVE_LIBURING
+				opt.o_io = IO_URING;
+#else
+				fprintf(stdout, "io_uring is not supported, "
+					"rebuild with liburing\n");
+				usage(argv[0], 1);
+#endif
+			} else {
+				fprintf(stdout, "wrong argument for -I, "
+					"--io '%s'\n", optarg);
+				usage(argv[0], 1);
+			}
+			break;
+		}
 		case 'e': {
 			opt.o_exposure = atof(optarg);
 			break;
@@ -276,18 +796,12 @@ static int parseopts(int argc, char *argv[])
 			break;
 		}
 		case 't': {
-			if (STRNCMP("RAW8", optarg))
-				opt.o_img_type = ASI_IMG_RAW8;
-			else if (STRNCMP("RAW16", optarg))
-				opt.o_img_type = ASI_IMG_RAW16;
-			else if (STRNCMP("RGB24", optarg))
-				opt.o_img_type = ASI_IMG_RGB24;
-			else if (STRNCMP("Y8", optarg))
-				opt.o_img_type = ASI_IMG_Y8;
-			else {
+			int img_type = parse_img_type(optarg);
+			if (img_type < 0) {
 				fprintf(stderr, "unknown image type parameter: %s\n", optarg);
 				usage(argv[0], 1);
 			}
+			opt.o_img_type = img_type;
 			break;
 		}
 		case 'f': {
@@ -295,6 +809,230 @@ static int parseopts(int argc, char *argv[])
 			set_img_outtype(opt.o_filename);
 			break;
 		}
+		case 'z': {
+			if (STRNCMP("rice", optarg))
+				opt.o_compress = RICE_1;
+			else if (STRNCMP("gzip", optarg))
+				opt.o_compress = GZIP_1;
+			else if (STRNCMP("gzip2", optarg))
+				opt.o_compress = GZIP_2;
+			else if (STRNCMP("hcompress", optarg))
+				opt.o_compress = HCOMPRESS_1;
+			else if (STRNCMP("none", optarg))
+				opt.o_compress = NOCOMPRESS;
+			else {
+				fprintf(stdout, "wrong argument for -z, "
+					"--compress '%s'\n", optarg);
+				usage(argv[0], 1);
+			}
+			break;
+		}
+		case 'Z': {
+			opt.o_quantize = atof(optarg);
+			break;
+		}
+		case 'F': {
+			if (STRNCMP("cube", optarg))
+				opt.o_fit_stream = FIT_STREAM_CUBE;
+			else if (STRNCMP("ext", optarg))
+				opt.o_fit_stream = FIT_STREAM_EXT;
+			else {
+				fprintf(stdout, "wrong argument for -F, "
+					"--fit-stream '%s'\n", optarg);
+				usage(argv[0], 1);
+			}
+			break;
+		}
+		case 'T': {
+			if (STRNCMP("lzw", optarg))
+				opt.o_tiff_compress = COMPRESSION_LZW;
+			else if (STRNCMP("deflate", optarg))
+				opt.o_tiff_compress = COMPRESSION_ADOBE_DEFLATE;
+#ifdef COMPRESSION_ZSTD
+			else if (STRNCMP("zstd", optarg))
+				opt.o_tiff_compress = COMPRESSION_ZSTD;
+#endif
+			else if (STRNCMP("none", optarg))
+				opt.o_tiff_compress = COMPRESSION_NONE;
+			else {
+				fprintf(stdout, "wrong argument for -T, "
+					"--tiff-compress '%s'\n", optarg);
+				usage(argv[0], 1);
+			}
+			if (!TIFFIsCODECConfigured(opt.o_tiff_compress)) {
+				fprintf(stdout, "tiff compression '%s' is not "
+					"supported by libtiff\n", optarg);
+				usage(argv[0], 1);
+			}
+			break;
+		}
+		case 'j': {
+			opt.o_threads = atoi(optarg);
+			if (opt.o_threads < 0) {
+				fprintf(stdout, "threads must not be negative\n");
+				usage(argv[0], 1);
+			}
+			parallel_set_threads(opt.o_threads);
+			break;
+		}
+		case 'D': {
+			if (STRNCMP("bilinear", optarg))
+				opt.o_debayer = DEBAYER_BILINEAR;
+			else if (STRNCMP("edge", optarg))
+				opt.o_debayer = DEBAYER_EDGE;
+			else if (STRNCMP("none", optarg))
+				opt.o_debayer = DEBAYER_NONE;
+			else {
+				fprintf(stdout, "wrong argument for -D, "
+					"--debayer '%s'\n", optarg);
+				usage(argv[0], 1);
+			}
+			break;
+		}
+		case 'B': {
+			opt.o_soft_bin = atof(optarg);
+			if (opt.o_soft_bin <= 1 || opt.o_soft_bin > BIN_MAX_FACTOR) {
+				fprintf(stdout, "soft binning must be in range "
+					"(1, %d]\n", BIN_MAX_FACTOR);
+				usage(argv[0], 1);
+			}
+			break;
+		}
+		case 'U': {
+			opt.o_bin_sum = true;
+			break;
+		}
+		case 'O': {
+			strncpy(opt.o_full_filename, optarg, PATH_MAX);
+			break;
+		}
+		case 'k': {
+			strncpy(opt.o_stack, optarg, PATH_MAX);
+			break;
+		}
+		case 'K': {
+			opt.o_stack_kappa = atof(optarg);
+			if (opt.o_stack_kappa < 0) {
+				fprintf(stdout, "stack kappa must not be negative\n");
+				usage(argv[0], 1);
+			}
+			break;
+		}
+		case 'N': {
+			opt.o_stack_every = atoi(optarg);
+			if (opt.o_stack_every < 0) {
+				fprintf(stdout, "stack snapshot interval must not be "
+					"negative\n");
+				usage(argv[0], 1);
+			}
+			break;
+		}
+		case 'A': {
+			strncpy(opt.o_bias, optarg, PATH_MAX);
+			break;
+		}
+		case 'd': {
+			strncpy(opt.o_darks, optarg, PATH_MAX);
+			break;
+		}
+		case 'L': {
+			strncpy(opt.o_flat, optarg, PATH_MAX);
+			break;
+		}
+		case 'X': {
+			opt.o_dark_scale = true;
+			break;
+		}
+		case 'Y': {
+			opt.o_stats = true;
+			break;
+		}
+		case 'Q': {
+			if (optarg[strlen(optarg) - 1] == '%') {
+				opt.o_lucky_pct = atof(optarg);
+				opt.o_lucky_k = 0;
+				if (opt.o_lucky_pct <= 0 || opt.o_lucky_pct > 100) {
+					fprintf(stdout, "lucky percentage must be in "
+						"range (0, 100]\n");
+					usage(argv[0], 1);
+				}
+			} else {
+				opt.o_lucky_k = atoi(optarg);
+				opt.o_lucky_pct = 0;
+				if (opt.o_lucky_k < 1) {
+					fprintf(stdout, "lucky count must be at "
+						"least 1\n");
+					usage(argv[0], 1);
+				}
+			}
+			break;
+		}
+		case 'E': {
+			opt.o_lucky_window = atoi(optarg);
+			if (opt.o_lucky_window < 1) {
+				fprintf(stdout, "lucky window must be at least 1\n");
+				usage(argv[0], 1);
+			}
+			break;
+		}
+		case 'G': {
+			opt.o_lucky_roi = atoi(optarg);
+			if (opt.o_lucky_roi < LUCKY_MIN_ROI) {
+				fprintf(stdout, "lucky roi must be at least %d\n",
+					LUCKY_MIN_ROI);
+				usage(argv[0], 1);
+			}
+			break;
+		}
+		case 'a': {
+			opt.o_auto_exp = atof(optarg);
+			if (opt.o_auto_exp <= 0 || opt.o_auto_exp >= 1) {
+				fprintf(stdout, "auto exposure level must be in "
+					"range (0, 1)\n");
+				usage(argv[0], 1);
+			}
+			break;
+		}
+		case 'x': {
+			opt.o_ae_percentile = atof(optarg);
+			if (opt.o_ae_percentile <= 0 || opt.o_ae_percentile > 100) {
+				fprintf(stdout, "auto exposure percentile must be "
+					"in range (0, 100]\n");
+				usage(argv[0], 1);
+			}
+			break;
+		}
+		case 'm': {
+			opt.o_ae_max = atof(optarg);
+			if (opt.o_ae_max < EXP_MIN) {
+				fprintf(stdout, "longest auto exposure must be at "
+					"least %g sec\n", EXP_MIN);
+				usage(argv[0], 1);
+			}
+			break;
+		}
+		case 'u': {
+			opt.o_track = atoi(optarg);
+			if (opt.o_track < 0) {
+				fprintf(stdout, "tracking margin must not be "
+					"negative\n");
+				usage(argv[0], 1);
+			}
+			break;
+		}
+		case 'C': {
+			if (opt.o_n_cam_opts == MULTI_MAX_CAMERAS) {
+				fprintf(stdout, "too many camera options\n");
+				usage(argv[0], 1);
+			}
+			strncpy(opt.o_cam_opts[opt.o_n_cam_opts++], optarg,
+				MAX_PV_SET_LENGTH);
+			break;
+		}
+		case 'S': {
+			strncpy(opt.o_serve, optarg, PATH_MAX);
+			break;
+		}
 		case 'v': {
 			if (STRNCMP("error", optarg))
 				opt.o_verbose = API_MSG_ERROR;
@@ -327,85 +1065,392 @@ static int parseopts(int argc, char *argv[])
 	return 0;
 }
 
-int write_fit(uint8_t *img_buf, const struct fit_head_s *fit_head)
+static const char *fit_compress_name(const int compress)
 {
-	int rc = 0;
-	int status = 0;
-	fitsfile *fitfile = NULL;
-	const long naxis = 2;
-	long naxes[2] = {opt.o_width, opt.o_height};
-	const long size = naxes[0] * naxes[1];
-	int bitpix;
-
-	switch (opt.o_img_type) {
-	case ASI_IMG_RAW8: {
-		bitpix = BYTE_IMG;
-		break;
-	}
-	case ASI_IMG_RAW16: {
-		bitpix = USHORT_IMG;
-		break;
-	}
+	switch (compress) {
+	case RICE_1:
+		return "rice";
+	case GZIP_1:
+		return "gzip";
+	case GZIP_2:
+		return "gzip2";
+	case HCOMPRESS_1:
+		return "hcompress";
 	default:
-		rc = -EINVAL;
-		C_ERROR(rc, "unsupported ASI image type '%s' for fit format",
-			IMG_TYPE[opt.o_img_type]);
-		return rc;
+		return "none";
 	}
+}
 
-	status = 0;
-	fits_create_file(&fitfile, opt.o_filename, &status);
-	if (status) {
-		FITS_ERROR(status);
-		return -EPERM;
+static int fit_bitpix(const ASI_IMG_TYPE img_type)
+{
+	switch (img_type) {
+	case ASI_IMG_RAW8:
+		return BYTE_IMG;
+	case ASI_IMG_RAW16:
+		return USHORT_IMG;
+	case ASI_IMG_RGB24:
+		return BYTE_IMG;
+	default:
+		C_ERROR(EINVAL, "unsupported ASI image type '%s' for fit format",
+			IMG_TYPE[img_type]);
+		return -EINVAL;
 	}
+}
 
-	status = 0;
-	fits_create_img(fitfile, bitpix, naxis, naxes, &status);
-	if (status) {
-		rc = -EPERM;
-		FITS_ERROR(status);
-		goto cleanup;
-	}
+/* Tile compression applies to the HDU created next, cfitsio then
+   writes the image as compressed binary table extension. */
+static void fit_set_compression(fitsfile *fitfile, int *status)
+{
+	if (opt.o_compress == NOCOMPRESS)
+		return;
 
-	status = 0;
-	fits_write_img(fitfile, bitpix == BYTE_IMG ? TBYTE : USHORT_IMG,
-		       1, size, img_buf, &status);
-	if (status) {
-		rc = -EPERM;
-		FITS_ERROR(status);
-		goto cleanup;
+	fits_set_compression_type(fitfile, opt.o_compress, status);
+	if (opt.o_quantize > 0) {
+		fits_set_quantize_level(fitfile, opt.o_quantize, status);
+		if (opt.o_compress == HCOMPRESS_1)
+			fits_set_hcomp_scale(fitfile, opt.o_quantize, status);
 	}
+}
 
-	status = 0;
-	fits_update_key(fitfile, TSTRING, "DATE-OBS", (char *)fit_head->date_obs,
-			"UTC of exposure start", &status);
-	fits_update_key(fitfile, TDOUBLE, "EXPTIME", (double *)&fit_head->exp_time,
-			"Exposure time (seconds)", &status);
-
-	fits_update_key(fitfile, TUINT, "XBINNING",
-			(unsigned int *)&fit_head->x_binning,
-			"Binning factor in width", &status);
-	fits_update_key(fitfile, TUINT, "YBINNING",
-			(unsigned int *)&fit_head->y_binning,
-			"Binning factor in height", &status);
+static void fit_write_keys(fitsfile *fitfile, const struct frame *frame,
+			   int *status)
+{
+	unsigned int binning = frame->bin;
+
+	fits_update_key(fitfile, TSTRING, "DATE-OBS", (char *)frame->date_obs,
+			"UTC of exposure start", status);
+	fits_update_key(fitfile, TDOUBLE, "EXPTIME", (double *)&frame->exp_time,
+			"Exposure time (seconds)", status);
+
+	fits_update_key(fitfile, TUINT, "XBINNING", &binning,
+			"Binning factor in width", status);
+	fits_update_key(fitfile, TUINT, "YBINNING", &binning,
+			"Binning factor in height", status);
 	fits_update_key(fitfile, TFLOAT,
-			"XPIXSZ", (float *)&fit_head->x_pix_sz,
-			"Pixel width in microns (after binning)", &status);
+			"XPIXSZ", (float *)&frame->x_pix_sz,
+			"Pixel width in microns (after binning)", status);
 	fits_update_key(fitfile, TFLOAT,
-			"YPIXSZ", (float *)&fit_head->y_pix_sz,
-			"Pixel height in microns (after binning)", &status);
+			"YPIXSZ", (float *)&frame->y_pix_sz,
+			"Pixel height in microns (after binning)", status);
 
+	if (frame->x_org >= 0 && frame->y_org >= 0) {
+		fits_update_key(fitfile, TINT, "XORGSUBF", (int *)&frame->x_org,
+				"ROI start on the sensor in width", status);
+		fits_update_key(fitfile, TINT, "YORGSUBF", (int *)&frame->y_org,
+				"ROI start on the sensor in height", status);
+	}
+
+	const struct frame_stats *stats = frame->stats;
+	if (!stats)
+		return;
+	fits_update_key(fitfile, TUINT, "STATMIN", (uint32_t *)&stats->min,
+			"Minimum sample as captured", status);
+	fits_update_key(fitfile, TUINT, "STATMAX", (uint32_t *)&stats->max,
+			"Maximum sample as captured", status);
+	fits_update_key(fitfile, TDOUBLE, "STATMEAN", (double *)&stats->mean,
+			"Mean sample as captured", status);
+	fits_update_key(fitfile, TUINT, "STATMED", (uint32_t *)&stats->median,
+			"Median sample as captured", status);
+	fits_update_key(fitfile, TDOUBLE, "STATSDEV", (double *)&stats->stddev,
+			"Standard deviation of samples as captured", status);
+	fits_update_key(fitfile, TUINT, "SATLEVEL", (uint32_t *)&stats->sat_level,
+			"Saturation level of samples", status);
+	fits_update_key(fitfile, TULONGLONG, "NSATUR",
+			(unsigned long long *)&stats->n_saturated,
+			"Number of saturated samples", status);
+	fits_update_key(fitfile, TDOUBLE, "CLIPFRAC", (double *)&stats->clipped,
+			"Fraction of samples at 0 or saturated", status);
+}
+
+static void fit_write_comments(fitsfile *fitfile, int *status)
+{
 	char str[64] = {0};
 	snprintf(str, 64, "Generated by %s version %s", "asic",
 		 PACKAGE_VERSION);
-	fits_write_comment(fitfile, str, &status);
-	fits_write_comment(fitfile, "See: https://github.com/tstibor/asic", &status);
+	fits_write_comment(fitfile, str, status);
+	fits_write_comment(fitfile, "See: https://github.com/tstibor/asic", status);
+}
+
+/* RGB24 and debayered frames are written as NAXIS3 cube of an R, G
+   and B plane. */
+static long fit_planes(const struct frame *frame)
+{
+	return frame->img_type == ASI_IMG_RGB24 ? 3 : frame->planes;
+}
+
+/* Image data in fit layout: the deinterleaved planes of an RGB24 frame
+   in a buffer of the pool, otherwise the frame buffer itself. Returned
+   by fit_data_put(). */
+static uint8_t *fit_data_get(const struct frame *frame)
+{
+	if (frame->img_type != ASI_IMG_RGB24)
+		return frame->buf;
+
+	uint8_t *planar = bufpool_get(&bufpool, frame->size);
+	if (!planar) {
+		C_ERROR(ENOMEM, "bufpool_get");
+		return NULL;
+	}
+	bgr_to_planar_rows(planar, frame->buf, frame->width, frame->height);
+
+	return planar;
+}
+
+static void fit_data_put(const struct frame *frame, uint8_t *data)
+{
+	if (data != frame->buf)
+		bufpool_put(&bufpool, data);
+}
+
+static int fit_encode(fitsfile *fitfile, const struct frame *frame)
+{
+	int rc = 0;
+	int status = 0;
+	const long planes = fit_planes(frame);
+	const long naxis = planes > 1 ? 3 : 2;
+	long naxes[3] = {frame->width, frame->height, planes};
+	const long size = naxes[0] * naxes[1] * planes;
+	uint8_t *data = NULL;
+
+	const int bitpix = fit_bitpix(frame->img_type);
+	if (bitpix == -EINVAL)
+		return -EINVAL;
+
+	status = 0;
+	fit_set_compression(fitfile, &status);
+	if (status) {
+		FITS_ERROR(status);
+		return -EPERM;
+	}
+
+	status = 0;
+	fits_create_img(fitfile, bitpix, naxis, naxes, &status);
+	if (status) {
+		FITS_ERROR(status);
+		return -EPERM;
+	}
+
+	data = fit_data_get(frame);
+	if (!data)
+		return -ENOMEM;
+
+	status = 0;
+	fits_write_img(fitfile, bitpix == BYTE_IMG ? TBYTE : TUSHORT,
+		       1, size, data, &status);
+	fit_data_put(frame, data);
+	if (status) {
+		FITS_ERROR(status);
+		return -EPERM;
+	}
+
+	status = 0;
+	fit_write_keys(fitfile, frame, &status);
+	fit_write_comments(fitfile, &status);
 
 	if (status)
 		FITS_ERROR(status);
 
-cleanup:
+	return rc;
+}
+
+/* Uncompressed images are written by the native writer, compressed
+   ones by cfitsio. */
+static bool fit_native(const struct frame *frame)
+{
+	return opt.o_compress == NOCOMPRESS &&
+		(frame->img_type == ASI_IMG_RAW8 ||
+		 frame->img_type == ASI_IMG_RAW16 ||
+		 frame->img_type == ASI_IMG_RGB24);
+}
+
+static void fit_native_header(struct fitn_hdr *hdr, const struct frame *frame)
+{
+	char str[64] = {0};
+
+	fitn_init(hdr, frame->img_type == ASI_IMG_RAW16 ? 2 : 1,
+		  frame->width, frame->height, fit_planes(frame));
+	fitn_key_str(hdr, "DATE-OBS", frame->date_obs, "UTC of exposure start");
+	fitn_key_double(hdr, "EXPTIME", frame->exp_time, 15,
+			"Exposure time (seconds)");
+	fitn_key_long(hdr, "XBINNING", frame->bin, "Binning factor in width");
+	fitn_key_long(hdr, "YBINNING", frame->bin, "Binning factor in height");
+	fitn_key_double(hdr, "XPIXSZ", frame->x_pix_sz, 7,
+			"Pixel width in microns (after binning)");
+	fitn_key_double(hdr, "YPIXSZ", frame->y_pix_sz, 7,
+			"Pixel height in microns (after binning)");
+	if (frame->x_org >= 0 && frame->y_org >= 0) {
+		fitn_key_long(hdr, "XORGSUBF", frame->x_org,
+			      "ROI start on the sensor in width");
+		fitn_key_long(hdr, "YORGSUBF", frame->y_org,
+			      "ROI start on the sensor in height");
+	}
+	if (frame->stats) {
+		const struct frame_stats *stats = frame->stats;
+
+		fitn_key_long(hdr, "STATMIN", stats->min,
+			      "Minimum sample as captured");
+		fitn_key_long(hdr, "STATMAX", stats->max,
+			      "Maximum sample as captured");
+		fitn_key_double(hdr, "STATMEAN", stats->mean, 7,
+				"Mean sample as captured");
+		fitn_key_long(hdr, "STATMED", stats->median,
+			      "Median sample as captured");
+		fitn_key_double(hdr, "STATSDEV", stats->stddev, 7,
+				"Standard deviation of samples as captured");
+		fitn_key_long(hdr, "SATLEVEL", stats->sat_level,
+			      "Saturation level of samples");
+		fitn_key_long(hdr, "NSATUR", stats->n_saturated,
+			      "Number of saturated samples");
+		fitn_key_double(hdr, "CLIPFRAC", stats->clipped, 7,
+				"Fraction of samples at 0 or saturated");
+	}
+
+	snprintf(str, 64, "Generated by %s version %s", "asic",
+		 PACKAGE_VERSION);
+	fitn_comment(hdr, str);
+	fitn_comment(hdr, "See: https://github.com/tstibor/asic");
+}
+
+static int write_fit_native(const struct frame *frame, const char *filename)
+{
+	int rc;
+	struct fitn_hdr hdr;
+	uint8_t *data = fit_data_get(frame);
+
+	if (!data)
+		return -ENOMEM;
+
+	fit_native_header(&hdr, frame);
+	rc = fitn_write(filename, &hdr, data, (size_t)frame->width *
+			frame->height * fit_planes(frame),
+			frame->img_type == ASI_IMG_RAW16 ? 2 : 1);
+	fit_data_put(frame, data);
+	if (!rc)
+		C_MESSAGE("created successfully '%s'", filename);
+
+	return rc;
+}
+
+int write_fit(const struct frame *frame, const char *filename)
+{
+	int rc = 0;
+	int status = 0;
+	fitsfile *fitfile = NULL;
+	const double t_start = mono_now();
+
+	if (fit_bitpix(frame->img_type) == -EINVAL)
+		return -EINVAL;
+
+	if (fit_native(frame))
+		return write_fit_native(frame, filename);
+
+	status = 0;
+	fits_create_file(&fitfile, filename, &status);
+	if (status) {
+		FITS_ERROR(status);
+		return -EPERM;
+	}
+
+	rc = fit_encode(fitfile, frame);
+
+	status = 0;
+	fits_close_file(fitfile, &status);
+	if (status) {
+		FITS_ERROR(status);
+		rc = -EPERM;
+	}
+
+	if (!rc)
+		C_MESSAGE("created successfully '%s'", filename);
+
+	struct stat st;
+	if (!rc && opt.o_compress != NOCOMPRESS && !stat(filename, &st)) {
+		const double t_write = mono_now() - t_start;
+		const long raw = calc_buf_size(frame->width, frame->height,
+					       frame->img_type);
+
+		C_INFO("%s compressed %ld to %ld bytes, ratio: %.3f, %.2f MB/s",
+		       fit_compress_name(opt.o_compress), raw, (long)st.st_size,
+		       st.st_size ? (double)raw / st.st_size : 0,
+		       t_write > 0 ? raw / t_write / 1e6 : 0);
+	}
+
+	return rc;
+}
+
+/* Encode a frame as fit file into memory, on success *buf holds *len
+   bytes and is freed by the caller. */
+static int fit_encode_mem(const struct frame *frame, void **buf, size_t *len)
+{
+	int rc = 0;
+	int status = 0;
+	fitsfile *fitfile = NULL;
+	LONGLONG head_start, data_start, data_end = 0;
+	/* Header blocks plus data, a bit more for compressed tiles. */
+	size_t mem_size = (frame->size / FIT_BLOCK_SIZE + 4) * FIT_BLOCK_SIZE;
+	void *mem = malloc(mem_size);
+
+	if (!mem)
+		return -ENOMEM;
+
+	if (fit_bitpix(frame->img_type) == -EINVAL) {
+		free(mem);
+		return -EINVAL;
+	}
+
+	if (fit_native(frame)) {
+		struct fitn_hdr hdr;
+		const int bpp = frame->img_type == ASI_IMG_RAW16 ? 2 : 1;
+		const size_t n_pix = (size_t)frame->width * frame->height *
+			fit_planes(frame);
+
+		fit_native_header(&hdr, frame);
+		if (hdr.rc) {
+			free(mem);
+			return hdr.rc;
+		}
+		*len = fitn_size(&hdr, n_pix, bpp);
+		if (*len > mem_size) {
+			void *p = realloc(mem, *len);
+			if (!p) {
+				free(mem);
+				return -ENOMEM;
+			}
+			mem = p;
+		}
+		uint8_t *data = fit_data_get(frame);
+		if (!data) {
+			free(mem);
+			return -ENOMEM;
+		}
+		fitn_encode(mem, &hdr, data, n_pix, bpp);
+		fit_data_put(frame, data);
+		*buf = mem;
+
+		return 0;
+	}
+
+	fits_create_memfile(&fitfile, &mem, &mem_size, 16 * FIT_BLOCK_SIZE,
+			    realloc, &status);
+	if (status) {
+		FITS_ERROR(status);
+		free(mem);
+		return -EPERM;
+	}
+
+	rc = fit_encode(fitfile, frame);
+
+	/* The memory is larger than the file, its length is the end of
+	   the last (current) HDU once everything is flushed. */
+	status = 0;
+	fits_flush_file(fitfile, &status);
+	fits_get_hduaddrll(fitfile, &head_start, &data_start, &data_end,
+			   &status);
+	if (status) {
+		FITS_ERROR(status);
+		rc = -EPERM;
+	}
+
 	status = 0;
 	fits_close_file(fitfile, &status);
 	if (status) {
@@ -413,13 +1458,259 @@ cleanup:
 		rc = -EPERM;
 	}
 
+	if (rc || data_end <= 0 || (size_t)data_end > mem_size) {
+		free(mem);
+		return rc ? rc : -EPERM;
+	}
+
+	*buf = mem;
+	*len = data_end;
+
+	return 0;
+}
+
+/* Meta data of a frame appended to a fit stream, stored in the
+   FRAMES binary table when the stream is closed. */
+struct fit_stream_rec {
+	uint32_t seq;
+	char date_obs[MAX_LEN_ISO8601];
+	double exp_time;
+};
+
+/* A single fit file kept open for a whole sequence, frames are
+   appended as planes of a NAXIS3 cube or as image extensions. */
+struct fit_stream {
+	fitsfile *fitfile;
+	char filename[PATH_MAX + 1];
+	fit_stream_e mode;
+	int bitpix;
+	long naxes[3];
+	long planes;		/* Per frame, 3 for color. */
+	uint32_t n_frames;
+	uint32_t n_recs;	/* Frames written, also the next plane. */
+	struct fit_stream_rec *recs;
+	pthread_mutex_t mutex;
+};
+
+static int fit_stream_open(struct fit_stream *stream, const fit_stream_e mode,
+			   const struct frame *tmpl, const char *filename,
+			   const uint32_t n_frames)
+{
+	int rc = 0;
+	int status = 0;
+
+	memset(stream, 0, sizeof(struct fit_stream));
+	stream->mode = mode;
+	stream->n_frames = n_frames;
+	stream->naxes[0] = tmpl->width;
+	stream->naxes[1] = tmpl->height;
+	stream->naxes[2] = n_frames;
+	snprintf(stream->filename, sizeof(stream->filename), "%s", filename);
+
+	stream->bitpix = fit_bitpix(tmpl->img_type);
+	if (stream->bitpix == -EINVAL)
+		return -EINVAL;
+
+	/* A cube of color frames would need four axes. */
+	stream->planes = fit_planes(tmpl);
+	if (stream->planes > 1 && mode == FIT_STREAM_CUBE) {
+		C_ERROR(EINVAL, "color frames require fit stream of extensions");
+		return -EINVAL;
+	}
+
+	stream->recs = calloc(n_frames, sizeof(struct fit_stream_rec));
+	if (!stream->recs) {
+		C_ERROR(errno, "calloc");
+		return -ENOMEM;
+	}
+
+	fits_create_file(&stream->fitfile, filename, &status);
+	if (status) {
+		FITS_ERROR(status);
+		rc = -EPERM;
+		goto out;
+	}
+
+	/* The cube is the primary HDU, extensions follow an empty one. */
+	if (mode == FIT_STREAM_CUBE) {
+		fit_set_compression(stream->fitfile, &status);
+		fits_create_img(stream->fitfile, stream->bitpix, 3,
+				stream->naxes, &status);
+	} else
+		fits_create_img(stream->fitfile, stream->bitpix, 0, NULL,
+				&status);
+	fit_write_keys(stream->fitfile, tmpl, &status);
+	fit_write_comments(stream->fitfile, &status);
+	if (status) {
+		FITS_ERROR(status);
+		rc = -EPERM;
+		status = 0;
+		fits_close_file(stream->fitfile, &status);
+		stream->fitfile = NULL;
+	}
+
+out:
+	if (rc) {
+		free(stream->recs);
+		stream->recs = NULL;
+	} else
+		pthread_mutex_init(&stream->mutex, NULL);
+
+	return rc;
+}
+
+static int fit_stream_write(struct fit_stream *stream, const struct frame *frame)
+{
+	int status = 0;
+	const int datatype = stream->bitpix == BYTE_IMG ? TBYTE : TUSHORT;
+	const long size = stream->naxes[0] * stream->naxes[1] * stream->planes;
+	long naxes[3] = {stream->naxes[0], stream->naxes[1], stream->planes};
+	uint8_t *data;
+
+	data = fit_data_get(frame);
+	if (!data)
+		return -ENOMEM;
+
+	/* cfitsio does not allow concurrent access to one file. */
+	pthread_mutex_lock(&stream->mutex);
+	if (stream->n_recs >= stream->n_frames) {
+		pthread_mutex_unlock(&stream->mutex);
+		fit_data_put(frame, data);
+		return -EINVAL;
+	}
+	if (stream->mode == FIT_STREAM_CUBE) {
+		/* Planes are filled densely in the order the frames arrive,
+		   dropped frames leave no gaps. The sequence number of each
+		   plane is kept in the FRAMES table. */
+		long fpixel[3] = {1, 1, stream->n_recs + 1};
+		fits_write_pix(stream->fitfile, datatype, fpixel, size,
+			       data, &status);
+	} else {
+		fit_set_compression(stream->fitfile, &status);
+		fits_create_img(stream->fitfile, stream->bitpix,
+				stream->planes > 1 ? 3 : 2, naxes, &status);
+		fits_write_img(stream->fitfile, datatype, 1, size, data,
+			       &status);
+		fits_update_key(stream->fitfile, TUINT, "FRAME",
+				(uint32_t *)&frame->seq,
+				"Sequence number of frame", &status);
+		fit_write_keys(stream->fitfile, frame, &status);
+	}
+
+	struct fit_stream_rec *rec = &stream->recs[stream->n_recs++];
+	rec->seq = frame->seq;
+	rec->exp_time = frame->exp_time;
+	snprintf(rec->date_obs, sizeof(rec->date_obs), "%s", frame->date_obs);
+	pthread_mutex_unlock(&stream->mutex);
+	fit_data_put(frame, data);
+
+	if (status) {
+		FITS_ERROR(status);
+		return -EPERM;
+	}
+
+	return 0;
+}
+
+static int fit_stream_close(struct fit_stream *stream)
+{
+	int rc = 0;
+	int status = 0;
+	int hdutype;
+
+	if (!stream->fitfile)
+		return 0;
+
+	/* Shrink the cube when frames were dropped or the sequence ended
+	   early. Compressed images cannot be resized, their trailing
+	   planes stay empty. */
+	if (stream->mode == FIT_STREAM_CUBE && stream->n_recs &&
+	    stream->n_recs < stream->n_frames) {
+		if (opt.o_compress == NOCOMPRESS) {
+			stream->naxes[2] = stream->n_recs;
+			fits_movabs_hdu(stream->fitfile, 1, &hdutype, &status);
+			fits_resize_img(stream->fitfile, stream->bitpix, 3,
+					stream->naxes, &status);
+		} else
+			C_WARN("%u of %u planes written", stream->n_recs,
+			       stream->n_frames);
+	}
+
+	char *ttype[] = {"SEQ", "DATE-OBS", "EXPTIME"};
+	char *tform[] = {"1V", "32A", "1D"};
+	char *tunit[] = {"", "", "s"};
+	uint32_t *seq = calloc(stream->n_recs + 1, sizeof(uint32_t));
+	char **date_obs = calloc(stream->n_recs + 1, sizeof(char *));
+	double *exp_time = calloc(stream->n_recs + 1, sizeof(double));
+
+	if (!seq || !date_obs || !exp_time) {
+		C_ERROR(ENOMEM, "calloc");
+		rc = -ENOMEM;
+		goto cleanup;
+	}
+	for (uint32_t n = 0; n < stream->n_recs; n++) {
+		seq[n] = stream->recs[n].seq;
+		date_obs[n] = stream->recs[n].date_obs;
+		exp_time[n] = stream->recs[n].exp_time;
+	}
+
+	fits_create_tbl(stream->fitfile, BINARY_TBL, stream->n_recs, 3,
+			ttype, tform, tunit, "FRAMES", &status);
+	if (stream->n_recs) {
+		fits_write_col(stream->fitfile, TUINT, 1, 1, 1, stream->n_recs,
+			       seq, &status);
+		fits_write_col(stream->fitfile, TSTRING, 2, 1, 1, stream->n_recs,
+			       date_obs, &status);
+		fits_write_col(stream->fitfile, TDOUBLE, 3, 1, 1, stream->n_recs,
+			       exp_time, &status);
+	}
+	if (status) {
+		FITS_ERROR(status);
+		rc = -EPERM;
+	}
+
+cleanup:
+	free(seq);
+	free(date_obs);
+	free(exp_time);
+
+	status = 0;
+	fits_close_file(stream->fitfile, &status);
+	if (status) {
+		FITS_ERROR(status);
+		rc = -EPERM;
+	}
+	stream->fitfile = NULL;
+
 	if (!rc)
-		C_MESSAGE("created successfully '%s'", opt.o_filename);
+		C_MESSAGE("created successfully '%s' with %u frame(s)",
+			  stream->filename, stream->n_recs);
+
+	free(stream->recs);
+	stream->recs = NULL;
+	pthread_mutex_destroy(&stream->mutex);
 
 	return rc;
 }
 
-static void set_tiff_fields(TIFF *tiff_img, int8_t bps, int8_t spp)
+/* Statistics of a frame as json object, a line of the sidecar and the
+   description of a tif file. */
+static int stats_json(char *dst, const size_t len, const struct frame *frame)
+{
+	const struct frame_stats *stats = frame->stats;
+
+	return snprintf(dst, len, "{\"seq\":%u,\"date_obs\":\"%s\","
+			"\"exp_time\":%.6f,\"min\":%u,\"max\":%u,"
+			"\"mean\":%.3f,\"median\":%u,\"stddev\":%.3f,"
+			"\"sat_level\":%u,\"saturated\":%lu,"
+			"\"clipped\":%.6f}", frame->seq, frame->date_obs,
+			frame->exp_time, stats->min, stats->max, stats->mean,
+			stats->median, stats->stddev, stats->sat_level,
+			(unsigned long)stats->n_saturated, stats->clipped);
+}
+
+static void set_tiff_fields(TIFF *tiff_img, const struct frame *frame,
+			    int8_t bps, int8_t spp, uint32_t rows_per_strip)
 {
 	const time_t _time = time(NULL);
 	char time_str[24 + 1] = {0};
@@ -427,18 +1718,25 @@ static void set_tiff_fields(TIFF *tiff_img, int8_t bps, int8_t spp)
 
 	/* Write TIFF tags. */
 	TIFFSetField(tiff_img, TIFFTAG_DATETIME, time_str);
-	TIFFSetField(tiff_img, TIFFTAG_IMAGEWIDTH, opt.o_width);
-	TIFFSetField(tiff_img, TIFFTAG_IMAGELENGTH, opt.o_height);
-	TIFFSetField(tiff_img, TIFFTAG_BITSPERSAMPLE, bps);
+	TIFFSetField(tiff_img, TIFFTAG_IMAGEWIDTH, frame->width);
+	TIFFSetField(tiff_img, TIFFTAG_IMAGELENGTH, frame->height);
+	TIFFSetField(tiff_img, TIFFTAG_BITSPERSAMPLE, bps / spp);
 	TIFFSetField(tiff_img, TIFFTAG_SAMPLESPERPIXEL, spp);
-	TIFFSetField(tiff_img, TIFFTAG_COMPRESSION, COMPRESSION_NONE);
-	TIFFSetField(tiff_img, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
-	TIFFSetField(tiff_img, TIFFTAG_PHOTOMETRIC, is_color(opt.o_img_type) ?
+	TIFFSetField(tiff_img, TIFFTAG_COMPRESSION, opt.o_tiff_compress);
+	if (opt.o_tiff_compress != COMPRESSION_NONE)
+		TIFFSetField(tiff_img, TIFFTAG_PREDICTOR, PREDICTOR_HORIZONTAL);
+	TIFFSetField(tiff_img, TIFFTAG_PLANARCONFIG, frame->planes > 1 ?
+		     PLANARCONFIG_SEPARATE : PLANARCONFIG_CONTIG);
+	TIFFSetField(tiff_img, TIFFTAG_PHOTOMETRIC,
+		     is_color(frame->img_type) || frame->planes > 1 ?
 		     PHOTOMETRIC_RGB : PHOTOMETRIC_MINISBLACK);
-#if 0
-	TIFFSetField(tiff_img, TIFFTAG_ROWSPERSTRIP,
-		     TIFFDefaultStripSize(tiff_img, opt.o_width * spp));
-#endif
+	TIFFSetField(tiff_img, TIFFTAG_ROWSPERSTRIP, rows_per_strip);
+	if (frame->stats) {
+		char desc[STATS_JSON_LEN] = {0};
+
+		stats_json(desc, sizeof(desc), frame);
+		TIFFSetField(tiff_img, TIFFTAG_IMAGEDESCRIPTION, desc);
+	}
 
 	/* Write EXIF tags. */
 	uint64 exif_dir_offset = 0;
@@ -446,7 +1744,7 @@ static void set_tiff_fields(TIFF *tiff_img, int8_t bps, int8_t spp)
 	TIFFCheckpointDirectory(tiff_img);
 	TIFFSetDirectory(tiff_img, 0);
 	TIFFCreateEXIFDirectory(tiff_img);
-	TIFFSetField(tiff_img, EXIFTAG_EXPOSURETIME, opt.o_exposure);
+	TIFFSetField(tiff_img, EXIFTAG_EXPOSURETIME, frame->exp_time);
 	TIFFWriteCustomDirectory(tiff_img, &exif_dir_offset);
 	TIFFSetDirectory(tiff_img, 0);
 	TIFFSetField(tiff_img, TIFFTAG_EXIFIFD, exif_dir_offset);
@@ -456,42 +1754,383 @@ static void set_tiff_fields(TIFF *tiff_img, int8_t bps, int8_t spp)
 
 }
 
-int write_tiff(TIFF *tiff_img, uint8_t *img_buf, int8_t bps, int8_t spp)
-{
-	int rc = 0;
-
-	tiff_img = TIFFOpen(opt.o_filename, "w");
-	if (!tiff_img)
-		/* Error message handled by tiff_error_handler */
-		return -ECANCELED;
+/* Strips of an image compressed with deflate or zstd outside of
+   libtiff, such that they can be compressed in parallel and written
+   raw. */
+struct tiff_strips {
+	const struct frame *frame;
+	uint16_t compress;
+	uint32_t row_bytes;
+	uint32_t rows_per_strip;
+	uint32_t n_strips;	/* Per plane. */
+	uint8_t bytes_per_sample;
+	uint8_t spp;
+	size_t bound;
+	uint8_t *dst;		/* n_strips x bound bytes. */
+	size_t *dst_len;
+	int rc;
+};
 
-	set_tiff_fields(tiff_img, bps, spp);
-	const uint16_t factor = opt.o_width * bits_per_sample(opt.o_img_type) / 8;
+/* Horizontal differencing (TIFF predictor 2) of a row, in place. */
+static void tiff_predict_row(uint8_t *row, const uint32_t width,
+			     const uint8_t bytes_per_sample, const uint8_t spp)
+{
+	const uint32_t n = width * spp;
 
-	for (int y = 0; y < opt.o_height; ++y) {
-		rc = TIFFWriteScanline(tiff_img, img_buf + y * factor, y, 0);
-		if (rc == -1) {
-			rc = -ECANCELED;
-			/* Error message handled by tiff_error_handler */
-			break;
-		}
+	if (bytes_per_sample == 2) {
+		uint16_t *p = (uint16_t *)row;
+		for (uint32_t i = n - 1; i >= spp; i--)
+			p[i] -= p[i - spp];
+	} else {
+		for (uint32_t i = n - 1; i >= spp; i--)
+			row[i] -= row[i - spp];
 	}
+}
 
-	TIFFClose(tiff_img);
-	if (rc == -ECANCELED)
-		C_ERROR(rc, "tiff image creation failed");
-	else {
-		C_MESSAGE("created successfully '%s'", opt.o_filename);
-		rc = 0;
-	}
+/* Whether strips of this compression are compressed in parallel,
+   LZW is left to libtiff. */
+static bool tiff_parallel(const uint16_t compress)
+{
+#if defined(HAVE_LIBZSTD) && defined(COMPRESSION_ZSTD)
+	if (compress == COMPRESSION_ZSTD)
+		return true;
+#endif
+	return compress == COMPRESSION_ADOBE_DEFLATE;
+}
 
-	return rc;
+static size_t tiff_bound(const uint16_t compress, const size_t len)
+{
+#if defined(HAVE_LIBZSTD) && defined(COMPRESSION_ZSTD)
+	if (compress == COMPRESSION_ZSTD)
+		return ZSTD_compressBound(len);
+#endif
+	UNUSED(compress);
+
+	return compressBound(len);
 }
 
-static void list_devices(const int n_devices)
+/* A zstd strip is a single zstd frame, as written by libtiff. */
+static int tiff_compress(const uint16_t compress, uint8_t *dst,
+			 size_t *dst_len, const uint8_t *src, const size_t len)
 {
-	ASI_CAMERA_INFO ASI_camera_info;
-	for (int i = 0; i < n_devices; ++i) {
+#if defined(HAVE_LIBZSTD) && defined(COMPRESSION_ZSTD)
+	if (compress == COMPRESSION_ZSTD) {
+		const size_t n = ZSTD_compress(dst, *dst_len, src, len,
+					       TIFF_ZSTD_LEVEL);
+		if (ZSTD_isError(n))
+			return -ECANCELED;
+		*dst_len = n;
+		return 0;
+	}
+#endif
+	UNUSED(compress);
+	uLongf n = *dst_len;
+
+	if (compress2(dst, &n, src, len, TIFF_DEFLATE_LEVEL) != Z_OK)
+		return -ECANCELED;
+	*dst_len = n;
+
+	return 0;
+}
+
+static void tiff_compress_strips(const uint32_t begin, const uint32_t end,
+				 void *arg)
+{
+	struct tiff_strips *strips = arg;
+	const struct frame *frame = strips->frame;
+	const uint32_t strip_bytes = strips->row_bytes * strips->rows_per_strip;
+	uint8_t *tmp = malloc(strip_bytes);
+
+	if (!tmp) {
+		strips->rc = -ENOMEM;
+		return;
+	}
+
+	for (uint32_t s = begin; s < end; s++) {
+		const uint32_t p = s / strips->n_strips;
+		const uint32_t y = s % strips->n_strips * strips->rows_per_strip;
+		const uint32_t rows = y + strips->rows_per_strip > (uint32_t)frame->height ?
+			frame->height - y : strips->rows_per_strip;
+		const uint32_t len = rows * strips->row_bytes;
+
+		/* The predictor must not modify the frame buffer. */
+		memcpy(tmp, frame->buf + ((size_t)p * frame->height + y) *
+		       strips->row_bytes, len);
+		for (uint32_t r = 0; r < rows; r++)
+			tiff_predict_row(tmp + r * strips->row_bytes, frame->width,
+					 strips->bytes_per_sample, strips->spp);
+
+		strips->dst_len[s] = strips->bound;
+		if (tiff_compress(strips->compress,
+				  strips->dst + (size_t)s * strips->bound,
+				  &strips->dst_len[s], tmp, len))
+			strips->rc = -ECANCELED;
+	}
+
+	free(tmp);
+}
+
+static int write_tiff_strips(TIFF *tiff_img, struct tiff_strips *strips)
+{
+	int rc = 0;
+	const uint32_t strip_bytes = strips->row_bytes * strips->rows_per_strip;
+	const uint32_t n_strips = strips->n_strips * strips->frame->planes;
+
+	strips->bound = tiff_bound(strips->compress, strip_bytes);
+	strips->dst = malloc((size_t)n_strips * strips->bound);
+	strips->dst_len = calloc(n_strips, sizeof(size_t));
+	if (!strips->dst || !strips->dst_len) {
+		rc = -ENOMEM;
+		C_ERROR(rc, "malloc");
+		goto cleanup;
+	}
+
+	parallel_for(n_strips, tiff_compress_strips, strips);
+	if (strips->rc) {
+		rc = strips->rc;
+		C_ERROR(rc, "compress strips");
+		goto cleanup;
+	}
+
+	for (uint32_t s = 0; s < n_strips; s++) {
+		if (TIFFWriteRawStrip(tiff_img, s,
+				      strips->dst + (size_t)s * strips->bound,
+				      strips->dst_len[s]) == -1) {
+			/* Error message handled by tiff_error_handler */
+			rc = -ECANCELED;
+			break;
+		}
+	}
+
+cleanup:
+	free(strips->dst);
+	free(strips->dst_len);
+
+	return rc;
+}
+
+static int tiff_encode(TIFF *tiff_img, const struct frame *frame)
+{
+	int rc = 0;
+	uint8_t *tmp = NULL;
+	const int8_t bps = bits_per_sample(frame->img_type);
+	const int8_t spp = samples_per_pixel(frame->img_type);
+	const uint32_t row_bytes = frame->width * bps / 8;
+
+	/* Strips of about TIFF_STRIP_SIZE bytes instead of one strip per
+	   row, which has a lot of per strip overhead in libtiff. */
+	uint32_t rows_per_strip = TIFF_STRIP_SIZE / row_bytes;
+	if (rows_per_strip < 1)
+		rows_per_strip = 1;
+	if (rows_per_strip > (uint32_t)frame->height)
+		rows_per_strip = frame->height;
+	const uint32_t n_strips = (frame->height + rows_per_strip - 1) /
+		rows_per_strip;
+
+	/* Debayered frames are written plane by plane, the strips of
+	   plane p follow those of plane p - 1. */
+	set_tiff_fields(tiff_img, frame, bps * frame->planes,
+			spp * frame->planes, rows_per_strip);
+
+	if (tiff_parallel(opt.o_tiff_compress) &&
+	    parallel_get_threads() > 1 && n_strips > 1) {
+		struct tiff_strips strips = {
+			.frame = frame,
+			.compress = opt.o_tiff_compress,
+			.row_bytes = row_bytes,
+			.rows_per_strip = rows_per_strip,
+			.n_strips = n_strips,
+			.bytes_per_sample = bps / spp / 8,
+			.spp = spp,
+			.bound = 0,
+			.dst = NULL,
+			.dst_len = NULL,
+			.rc = 0
+		};
+		rc = write_tiff_strips(tiff_img, &strips);
+		goto out;
+	}
+
+	/* libtiff applies the predictor in place, thus encode a copy. */
+	if (opt.o_tiff_compress != COMPRESSION_NONE) {
+		tmp = malloc((size_t)rows_per_strip * row_bytes);
+		if (!tmp) {
+			rc = -ENOMEM;
+			C_ERROR(rc, "malloc");
+			goto out;
+		}
+	}
+
+	for (uint32_t s = 0; s < n_strips * frame->planes; s++) {
+		const uint32_t p = s / n_strips;
+		const uint32_t y = s % n_strips * rows_per_strip;
+		const uint32_t rows = y + rows_per_strip > (uint32_t)frame->height ?
+			frame->height - y : rows_per_strip;
+		uint8_t *buf = frame->buf + ((size_t)p * frame->height + y) *
+			row_bytes;
+
+		if (tmp) {
+			memcpy(tmp, buf, (size_t)rows * row_bytes);
+			buf = tmp;
+		}
+		if (TIFFWriteEncodedStrip(tiff_img, s, buf,
+					  (tmsize_t)rows * row_bytes) == -1) {
+			/* Error message handled by tiff_error_handler */
+			rc = -ECANCELED;
+			break;
+		}
+	}
+
+out:
+	free(tmp);
+
+	return rc;
+}
+
+int write_tiff(const struct frame *frame, const char *filename)
+{
+	int rc;
+	TIFF *tiff_img = NULL;
+
+	tiff_img = TIFFOpen(filename, "w");
+	if (!tiff_img)
+		/* Error message handled by tiff_error_handler */
+		return -ECANCELED;
+
+	rc = tiff_encode(tiff_img, frame);
+
+	TIFFClose(tiff_img);
+	if (rc)
+		C_ERROR(rc, "tiff image creation failed");
+	else
+		C_MESSAGE("created successfully '%s'", filename);
+
+	return rc;
+}
+
+/* Growing memory buffer, the file of TIFFClientOpen(). */
+struct tiff_mem {
+	uint8_t *buf;
+	size_t size;		/* Bytes of the file. */
+	size_t alloc;
+	size_t pos;
+};
+
+static tmsize_t tiff_mem_read(thandle_t h, void *data, tmsize_t len)
+{
+	struct tiff_mem *mem = h;
+
+	if (mem->pos >= mem->size)
+		return 0;
+	if ((size_t)len > mem->size - mem->pos)
+		len = mem->size - mem->pos;
+	memcpy(data, mem->buf + mem->pos, len);
+	mem->pos += len;
+
+	return len;
+}
+
+static tmsize_t tiff_mem_write(thandle_t h, void *data, tmsize_t len)
+{
+	struct tiff_mem *mem = h;
+
+	if (mem->pos + len > mem->alloc) {
+		size_t alloc = mem->alloc ? mem->alloc : 64 * 1024;
+		while (alloc < mem->pos + len)
+			alloc *= 2;
+		uint8_t *buf = realloc(mem->buf, alloc);
+		if (!buf)
+			return -1;
+		mem->buf = buf;
+		mem->alloc = alloc;
+	}
+	/* libtiff may seek beyond the end before writing. */
+	if (mem->pos > mem->size)
+		memset(mem->buf + mem->size, 0, mem->pos - mem->size);
+	memcpy(mem->buf + mem->pos, data, len);
+	mem->pos += len;
+	if (mem->pos > mem->size)
+		mem->size = mem->pos;
+
+	return len;
+}
+
+static toff_t tiff_mem_seek(thandle_t h, toff_t off, int whence)
+{
+	struct tiff_mem *mem = h;
+
+	if (whence == SEEK_CUR)
+		off += mem->pos;
+	else if (whence == SEEK_END)
+		off += mem->size;
+	mem->pos = off;
+
+	return off;
+}
+
+static int tiff_mem_close(thandle_t h)
+{
+	return 0;
+}
+
+static toff_t tiff_mem_size(thandle_t h)
+{
+	return ((struct tiff_mem *)h)->size;
+}
+
+static int tiff_mem_map(thandle_t h, void **base, toff_t *size)
+{
+	return 0;
+}
+
+static void tiff_mem_unmap(thandle_t h, void *base, toff_t size)
+{
+}
+
+/* Encode a frame as tif file into memory, on success *buf holds *len
+   bytes and is freed by the caller. */
+static int tiff_encode_mem(const struct frame *frame, void **buf, size_t *len)
+{
+	int rc;
+	TIFF *tiff_img = NULL;
+	struct tiff_mem mem = {
+		.buf = malloc(frame->size + TIFF_MEM_HEADER),
+		.size = 0,
+		.alloc = frame->size + TIFF_MEM_HEADER,
+		.pos = 0
+	};
+
+	if (!mem.buf)
+		return -ENOMEM;
+
+	tiff_img = TIFFClientOpen("memory", "w", (thandle_t)&mem,
+				  tiff_mem_read, tiff_mem_write, tiff_mem_seek,
+				  tiff_mem_close, tiff_mem_size, tiff_mem_map,
+				  tiff_mem_unmap);
+	if (!tiff_img) {
+		/* Error message handled by tiff_error_handler */
+		free(mem.buf);
+		return -ECANCELED;
+	}
+
+	rc = tiff_encode(tiff_img, frame);
+	TIFFClose(tiff_img);
+	if (rc) {
+		C_ERROR(rc, "tiff image creation failed");
+		free(mem.buf);
+		return rc;
+	}
+
+	*buf = mem.buf;
+	*len = mem.size;
+
+	return 0;
+}
+
+static void list_devices(const int n_devices)
+{
+	ASI_CAMERA_INFO ASI_camera_info;
+	for (int i = 0; i < n_devices; ++i) {
 		ASIGetCameraProperty(&ASI_camera_info, i);
 		fprintf(stdout, "camera id     : %d\n", ASI_camera_info.CameraID);
 		fprintf(stdout, "name          : %s\n", ASI_camera_info.Name);
@@ -530,232 +2169,2670 @@ static void list_ctrl_caps(const int cam_id, const int n_ctrl)
 	char min_val[len + 1];
 	char def_val[len + 1];
 
-	bzero(max_val, len + 1);
-	bzero(min_val, len + 1);
-	bzero(def_val, len + 1);
+	bzero(max_val, len + 1);
+	bzero(min_val, len + 1);
+	bzero(def_val, len + 1);
+
+	fprintf(stdout, format,
+		"name", "description", "max value", "min value", "default value", "support auto set", "writable");
+	fprintf(stdout, "|%-24s+%-50s+%-15s+%-15s+%-14s+%-17s+%-8s|\n",
+		"-------------------------",
+		"---------------------------------------------------",
+		"----------------",
+		"----------------",
+		"---------------",
+		"------------------",
+		"----------");
+
+	for (int i = 0; i < n_ctrl; ++i) {
+		int rc;
+		rc = ASIGetControlCaps(cam_id, i, &ctrl_caps);
+		C_DEBUG("[rc:%d, id:%d] ASIGetControlCaps", rc, cam_id);
+		if (rc) {
+			ASI_C_ERROR(rc, "ASIGetControlCaps");
+			return;
+		}
+
+		snprintf(max_val, len, "%ld", ctrl_caps.MaxValue);
+		snprintf(min_val, len, "%ld", ctrl_caps.MinValue);
+		snprintf(def_val, len, "%ld", ctrl_caps.DefaultValue);
+
+		fprintf(stdout, format,
+			ctrl_caps.Name,
+			ctrl_caps.Description,
+			max_val,
+			min_val,
+			def_val,
+			BOOL_NO_YES[ctrl_caps.IsAutoSupported],
+			BOOL_NO_YES[ctrl_caps.IsWritable]);
+	}
+}
+
+static int split_pvs(char *str, struct params_vals *pvs)
+{
+	if (!pvs)
+		return -EINVAL;
+
+	const char *delim = ", ";
+	char *token = NULL;
+
+	token = strtok(str, delim);
+	while (token != NULL) {
+		char *p = strstr(token, "=");
+		if (!p)
+			return -EINVAL;
+
+		pvs->pv = realloc(pvs->pv, sizeof(struct param_val) * (pvs->N + 1));
+		if (!pvs->pv)
+			return -EINVAL;
+
+		bzero(pvs->pv[pvs->N].param, MAX_PV_LENGTH + 1);
+		bzero(pvs->pv[pvs->N].val, MAX_PV_LENGTH + 1);
+
+		snprintf(pvs->pv[pvs->N].param, sizeof(pvs->pv[pvs->N].param),
+			 "%.*s", (int)(p - token), token);
+		snprintf(pvs->pv[pvs->N].val, sizeof(pvs->pv[pvs->N].val),
+			 "%s", p + 1);
+		pvs->N++;
+		token = strtok(NULL, delim);
+	}
+
+	return 0;
+}
+
+/* States of a single snap exposure. */
+enum exp_state {
+	EXP_START,		/* Start the exposure. */
+	EXP_WAIT,		/* Sleep until the exposure is almost over. */
+	EXP_POLL,		/* Poll the status with increasing intervals. */
+	EXP_RETRY		/* Exposure failed or timed out, start again. */
+};
+
+static int expose(const struct options *opt, const double exp_time,
+		  const long size)
+{
+	int rc;
+	enum exp_state state = EXP_START;
+	ASI_EXPOSURE_STATUS status = ASI_EXP_IDLE;
+	const int cam_id = opt->o_cam_id;
+	const int max_attempt = 1 + opt->o_retries;
+	int cur_attempt = 1;
+	uint32_t n_poll = 0;
+	double t_start = 0;
+	double t_deadline = 0;
+	double backoff = EXP_POLL_MIN;
+
+	while (1) {
+		switch (state) {
+		case EXP_START: {
+			rc = ASIStartExposure(cam_id, ASI_FALSE);
+			C_DEBUG("[rc:%d, id:%d] ASIStartExposure", rc, cam_id);
+			if (rc) {
+				ASI_C_ERROR(rc, "ASIStartExposure");
+				return rc;
+			}
+			/* Give up when the frame is not ready after the exposure
+			   plus a generous estimate of the readout time. */
+			t_start = mono_now();
+			t_deadline = t_start + exp_time +
+				EXP_READOUT_SLACK + (double)size / EXP_READOUT_RATE;
+			backoff = EXP_POLL_MIN;
+			n_poll = 0;
+			state = EXP_WAIT;
+			break;
+		}
+		case EXP_WAIT: {
+			/* Nothing can be done while the sensor integrates, thus
+			   sleep instead of spinning on ASIGetExpStatus. The SDK
+			   needs a few ms to leave the idle state after start. */
+			double t_wake = t_start + exp_time - EXP_POLL_LEAD;
+			if (t_wake < t_start + EXP_START_DELAY)
+				t_wake = t_start + EXP_START_DELAY;
+
+			const double t_left = t_wake - mono_now();
+			C_DEBUG("[id:%d] exposure wait %.3f sec", cam_id, t_left);
+			if (t_left > 0)
+				usleep(t_left * 1e6);
+			state = EXP_POLL;
+			break;
+		}
+		case EXP_POLL: {
+			rc = ASIGetExpStatus(cam_id, &status);
+			n_poll++;
+			if (rc) {
+				ASI_C_ERROR(rc, "ASIGetExpStatus");
+				return rc;
+			}
+
+			if (status == ASI_EXP_WORKING) {
+				if (mono_now() > t_deadline) {
+					C_WARN("exposure not finished %.3f sec after start",
+					       mono_now() - t_start);
+					rc = ASIStopExposure(cam_id);
+					C_DEBUG("[rc:%d, id:%d] ASIStopExposure", rc, cam_id);
+					state = EXP_RETRY;
+					break;
+				}
+				usleep(backoff * 1e6);
+				backoff *= 2;
+				if (backoff > EXP_POLL_MAX)
+					backoff = EXP_POLL_MAX;
+			} else if (status == ASI_EXP_SUCCESS) {
+				C_DEBUG("[id:%d, polls:%u] ASIGetExpStatus, status: %s",
+					cam_id, n_poll, ASI_EXP_STATUS_MSG(status));
+				C_MESSAGE("%s", ASI_EXP_STATUS_MSG(status));
+				return 0;
+			} else if (status == ASI_EXP_FAILED) {
+				C_WARN("ASIGetExpStatus %s", ASI_EXP_STATUS_MSG(status));
+				state = EXP_RETRY;
+			} else {	/* We should never be in this state (ASI_EXP_IDLE). */
+				ASI_C_ERROR(ASI_ERROR_TIMEOUT, "invalid exposure state");
+				return ASI_ERROR_TIMEOUT;
+			}
+			break;
+		}
+		case EXP_RETRY: {
+			if (cur_attempt >= max_attempt) {
+				C_ERROR(ECANCELED, "exposure failed after %d attempt(s)",
+					cur_attempt);
+				return -ECANCELED;
+			}
+			cur_attempt++;
+			C_WARN("restarting exposure attempt %d of %d",
+			       cur_attempt, max_attempt);
+			usleep(EXP_RETRY_DELAY * 1e6);
+			state = EXP_START;
+			break;
+		}
+		}
+	}
+}
+
+static int set_exposure(const struct options *opt, const double exp_time)
+{
+	int rc;
+
+	rc = ASISetControlValue(opt->o_cam_id, ASI_EXPOSURE, exp_time * 1e6,
+				ASI_FALSE);
+	C_DEBUG("[rc:%d, id:%d] ASISetControlValue", rc, opt->o_cam_id);
+	if (rc)
+		ASI_C_ERROR(rc, "ASISetControlValue");
+
+	return rc;
+}
+
+static int write_frame(const struct frame *frame, const char *filename)
+{
+	int rc;
+
+	if (img_outtype == TYPE_TIF) {
+		rc = write_tiff(frame, filename);
+		if (rc)
+			C_ERROR(rc, "write_tiff");
+	} else if (img_outtype == TYPE_FIT) {
+		rc = write_fit(frame, filename);
+		if (rc)
+			C_ERROR(rc, "write_fit");
+	} else if (img_outtype == TYPE_SER || img_outtype == TYPE_SPOOL) {
+		/* Always a stream, see output_open(). */
+		rc = -EINVAL;
+		C_ERROR(rc, "ser and spool require an open output");
+	} else {
+		rc = -EINVAL;
+		C_ERROR(rc, "unknown image type");
+	}
+
+	return rc;
+}
+
+/* Output state of a capture run, shared by its writer threads. */
+struct output {
+	const struct options *opt;
+	struct fit_stream fit_stream;
+	struct ser ser;
+	struct spool spool;
+	bool streaming;
+	struct aio *aio;	/* Set if files are written via io_uring. */
+	struct stripe stripe;
+	bool striping;
+	struct calib calib;
+	bool calibrating;
+	double temp;		/* Last sensor temperature read, */
+	double t_temp;		/* at this time. */
+	FILE *stats_file;	/* Json lines of the frame statistics. */
+	pthread_mutex_t stats_mutex;
+	struct lucky lucky;	/* Ring slots of the sharpest frames. */
+	bool selecting;
+	void **selected;
+	uint32_t n_window;	/* Frames scored in the current window. */
+	uint32_t n_scored;
+	uint32_t n_selected;
+	struct track track;	/* ROI following the target. */
+	bool tracking;
+	struct output *full;	/* Frames before software binning. */
+	struct options *full_opt;
+	struct stack stack;
+	bool stacking;
+	struct frame stack_frame;	/* Keys of the snapshots. */
+	double stack_exp_time;
+	pthread_mutex_t stack_mutex;
+	uint32_t stack_written;	/* Frames of the newest snapshot file. */
+	pthread_mutex_t stack_file_mutex;
+};
+
+/* Copy of the stack taken under stack_mutex, written to disk after
+   the mutex is released. */
+struct stack_snap {
+	float *img;
+	struct frame keys;
+	double exp_time;
+	uint32_t n_frames;
+	uint32_t width;
+	uint32_t height;
+	uint32_t planes;
+	float kappa;
+};
+
+/* Sidecar file next to the first target <name><ext> of filename. */
+static void sidecar_filename(char *dst, const char *filename, const char *ext)
+{
+	strncpy(dst, filename, PATH_MAX);
+	dst[PATH_MAX] = '\0';
+	if (strchr(dst, ','))
+		*strchr(dst, ',') = '\0';
+	char *dot = rindex(dst, '.');
+	if (!dot)
+		dot = dst + strlen(dst);
+	snprintf(dot, PATH_MAX + 1 - (dot - dst), "%s", ext);
+}
+
+/* Geometry of a frame binned in software by opt->o_soft_bin. Integer
+   factors drop remaining rows and columns. */
+static void soft_bin_geometry(const struct options *opt, struct frame *frame)
+{
+	const double factor = opt->o_soft_bin;
+	const int width = frame->width / factor;
+	const int height = frame->height / factor;
+
+	if (factor == (int)factor) {
+		frame->bin *= factor;
+		frame->x_pix_sz *= factor;
+		frame->y_pix_sz *= factor;
+	} else {
+		/* Fractional binning is recorded by the pixel size only. */
+		frame->x_pix_sz *= (float)frame->width / width;
+		frame->y_pix_sz *= (float)frame->height / height;
+	}
+	frame->width = width;
+	frame->height = height;
+	frame->size = calc_buf_size(width, height, frame->img_type) *
+		frame->planes;
+}
+
+static int output_target_open(struct output *out, const struct options *opt,
+			      const struct frame *tmpl)
+{
+	int rc;
+
+	memset(out, 0, sizeof(struct output));
+	out->opt = opt;
+
+	/* Frames as written, see output_frame(). */
+	struct frame written = *tmpl;
+	if (opt->o_debayer != DEBAYER_NONE) {
+		if (opt->o_bayer < 0) {
+			C_ERROR(EINVAL, "debayer requires a color camera");
+			return -EINVAL;
+		}
+		if (tmpl->img_type != ASI_IMG_RAW8 &&
+		    tmpl->img_type != ASI_IMG_RAW16) {
+			C_ERROR(EINVAL, "debayer requires image type RAW8 or "
+				"RAW16");
+			return -EINVAL;
+		}
+		written.planes = 3;
+		written.size *= 3;
+	}
+	if (opt->o_soft_bin > 0) {
+		if (opt->o_bayer >= 0 && opt->o_debayer == DEBAYER_NONE &&
+		    tmpl->img_type != ASI_IMG_RGB24 &&
+		    tmpl->img_type != ASI_IMG_Y8)
+			C_WARN("soft binning mixes the colors of the bayer "
+			       "mosaic, consider debayering");
+		soft_bin_geometry(opt, &written);
+		if (written.width < 1 || written.height < 1) {
+			C_ERROR(EINVAL, "soft binning of %d x %d frame by %.2f",
+				tmpl->width, tmpl->height, opt->o_soft_bin);
+			return -EINVAL;
+		}
+	}
+
+	if (strlen(opt->o_stack)) {
+		if (written.img_type == ASI_IMG_RGB24) {
+			C_ERROR(EINVAL, "stacking requires image type RAW8, "
+				"RAW16, Y8 or debayered frames");
+			return -EINVAL;
+		}
+		rc = stack_init(&out->stack, written.width, written.height,
+				written.planes,
+				written.img_type == ASI_IMG_RAW16 ? 2 : 1,
+				opt->o_stack_kappa);
+		if (rc) {
+			C_ERROR(rc, "stack_init");
+			return rc;
+		}
+		pthread_mutex_init(&out->stack_mutex, NULL);
+		pthread_mutex_init(&out->stack_file_mutex, NULL);
+		out->stack_written = 0;
+		out->stack_frame = written;
+		out->stacking = true;
+	}
+
+	if (img_outtype == TYPE_FIT && opt->o_fit_stream != FIT_STREAM_NONE &&
+	    opt->o_count > 1) {
+		rc = fit_stream_open(&out->fit_stream, opt->o_fit_stream,
+				     &written, opt->o_filename,
+				     output_count(opt));
+		if (rc) {
+			C_ERROR(rc, "fit_stream_open '%s'", opt->o_filename);
+			return rc;
+		}
+		out->streaming = true;
+		return 0;
+	}
+
+	if (strchr(opt->o_filename, ',')) {
+		char manifest[PATH_MAX + 1] = {0};
+		sidecar_filename(manifest, opt->o_filename, ".manifest");
+
+		rc = stripe_init(&out->stripe, opt->o_filename,
+				 opt->o_stripe_rate, WRITER_STALL, manifest);
+		if (rc) {
+			C_ERROR(rc, "stripe_init '%s'", opt->o_filename);
+			return rc;
+		}
+		out->striping = true;
+	}
+
+	if (opt->o_io == IO_URING &&
+	    (img_outtype == TYPE_FIT || img_outtype == TYPE_TIF)) {
+		rc = aio_create(&out->aio, AIO_BUFS, AIO_BUF_SIZE, true);
+		if (rc)
+			C_ERROR(rc, "aio_create");
+		return rc;
+	}
+
+	if (img_outtype != TYPE_SER && img_outtype != TYPE_SPOOL)
+		return 0;
+
+	ASI_CAMERA_INFO ASI_camera_info;
+
+	rc = ASIGetCameraProperty(&ASI_camera_info, opt->o_cam_id);
+	if (rc) {
+		ASI_C_ERROR(rc, "ASIGetCameraProperty");
+		return rc;
+	}
+
+	if (img_outtype == TYPE_SER) {
+		rc = ser_open(&out->ser, opt->o_filename, &written,
+			      ser_color_id(tmpl->img_type,
+					   ASI_camera_info.IsColorCam,
+					   ASI_camera_info.BayerPattern),
+			      ASI_camera_info.Name, output_count(opt));
+		if (rc) {
+			C_ERROR(rc, "ser_open '%s'", opt->o_filename);
+			return rc;
+		}
+	} else {
+		rc = spool_create(&out->spool, opt->o_filename, tmpl,
+				  opt->o_count, ASI_camera_info.Name,
+				  ASI_camera_info.IsColorCam,
+				  ASI_camera_info.BayerPattern);
+		if (rc) {
+			C_ERROR(rc, "spool_create '%s'", opt->o_filename);
+			return rc;
+		}
+	}
+	out->streaming = true;
+
+	return 0;
+}
+
+/* Copy the stack image and its keys, called with stack_mutex held. */
+static int stack_snapshot(struct output *out, struct stack_snap *snap)
+{
+	const struct stack *stack = &out->stack;
+
+	snap->img = malloc((size_t)stack->width * stack->height *
+			   stack->planes * sizeof(float));
+	if (!snap->img) {
+		C_ERROR(ENOMEM, "malloc");
+		return -ENOMEM;
+	}
+	stack_image(stack, snap->img);
+	snap->keys = out->stack_frame;
+	snap->exp_time = out->stack_exp_time;
+	snap->n_frames = stack->n_frames;
+	snap->width = stack->width;
+	snap->height = stack->height;
+	snap->planes = stack->planes;
+	snap->kappa = stack->kappa;
+
+	return 0;
+}
+
+/* Snapshot of the stack as float fit file. Written to <name>.tmp and
+   renamed, thus readers never see a partial snapshot. Snapshots of
+   several writer threads are written one after the other, one older
+   than the file already written is skipped. Frees the image. */
+static int write_stack(struct output *out, struct stack_snap *snap)
+{
+	int rc = 0;
+	int status = 0;
+	fitsfile *fitfile = NULL;
+	const char *filename = out->opt->o_stack;
+	const long naxis = snap->planes > 1 ? 3 : 2;
+	long naxes[3] = {snap->width, snap->height, snap->planes};
+	const long size = naxes[0] * naxes[1] * snap->planes;
+	char tmp[PATH_MAX + 8] = {0};
+
+	pthread_mutex_lock(&out->stack_file_mutex);
+	if (snap->n_frames <= out->stack_written)
+		goto cleanup;
+
+	snprintf(tmp, sizeof(tmp), "!%s.tmp", filename);
+	fits_create_file(&fitfile, tmp, &status);
+	if (status) {
+		FITS_ERROR(status);
+		rc = -EPERM;
+		goto cleanup;
+	}
+
+	fits_create_img(fitfile, FLOAT_IMG, naxis, naxes, &status);
+	fits_write_img(fitfile, TFLOAT, 1, size, snap->img, &status);
+	fit_write_keys(fitfile, &snap->keys, &status);
+	fits_update_key(fitfile, TDOUBLE, "EXPTIME", &snap->exp_time,
+			"Total exposure time of stacked frames (seconds)",
+			&status);
+	fits_update_key(fitfile, TUINT, "NCOMBINE", &snap->n_frames,
+			"Number of stacked frames", &status);
+	if (snap->kappa > 0)
+		fits_update_key(fitfile, TFLOAT, "CLIPSIG", &snap->kappa,
+				"Sigma clipping threshold (kappa)", &status);
+	fit_write_comments(fitfile, &status);
+	if (status) {
+		FITS_ERROR(status);
+		rc = -EPERM;
+	}
+
+	status = 0;
+	fits_close_file(fitfile, &status);
+	if (status) {
+		FITS_ERROR(status);
+		rc = -EPERM;
+	}
+	if (rc)
+		goto cleanup;
+
+	if (rename(tmp + 1, filename)) {
+		rc = -errno;
+		C_ERROR(errno, "rename '%s'", tmp + 1);
+		goto cleanup;
+	}
+	out->stack_written = snap->n_frames;
+	C_MESSAGE("created successfully '%s' of %u stacked frame(s)",
+		  filename, snap->n_frames);
+
+cleanup:
+	pthread_mutex_unlock(&out->stack_file_mutex);
+	free(snap->img);
+	snap->img = NULL;
+
+	return rc;
+}
+
+/* Register and accumulate a frame, frames of the writer threads are
+   stacked one after the other. Periodic snapshots are copied under the
+   stack mutex but written without it. */
+static int output_stack(struct output *out, const struct frame *frame)
+{
+	int rc;
+	struct stack_xform xf;
+	struct stack_snap snap = {0};
+	const struct options *opt = out->opt;
+
+	pthread_mutex_lock(&out->stack_mutex);
+	rc = stack_add(&out->stack, frame->buf, &xf);
+	if (rc == -EAGAIN) {
+		C_WARN("frame %u could not be registered, not stacked",
+		       frame->seq);
+		rc = 0;
+	} else if (rc)
+		C_ERROR(rc, "stack_add");
+	else {
+		C_INFO("stacked frame %u, %u star(s) matched, rotation %.3f "
+		       "deg, shift %.2f x %.2f", frame->seq, xf.n_matched,
+		       atan2(xf.sin, xf.cos) * 180 / M_PI, xf.tx, xf.ty);
+		out->stack_exp_time += frame->exp_time;
+		/* Keys only, the buffer and the statistics of the frame
+		   do not outlive this call. */
+		if (out->stack.n_frames == 1) {
+			out->stack_frame = *frame;
+			out->stack_frame.buf = NULL;
+			out->stack_frame.stats = NULL;
+		}
+		if (opt->o_stack_every > 0 &&
+		    out->stack.n_frames % opt->o_stack_every == 0)
+			rc = stack_snapshot(out, &snap);
+	}
+	pthread_mutex_unlock(&out->stack_mutex);
+
+	if (!rc && snap.img)
+		rc = write_stack(out, &snap);
+
+	return rc;
+}
+
+static int output_close(struct output *out)
+{
+	int rc = 0;
+
+	if (out->calibrating) {
+		calib_destroy(&out->calib);
+		out->calibrating = false;
+	}
+	if (out->selecting) {
+		C_MESSAGE("selected %u of %u frame(s)", out->n_selected,
+			  out->n_scored);
+		lucky_destroy(&out->lucky);
+		free(out->selected);
+		out->selecting = false;
+	}
+	if (out->stats_file) {
+		if (fclose(out->stats_file) && !rc) {
+			rc = -errno;
+			C_ERROR(errno, "fclose");
+		}
+		pthread_mutex_destroy(&out->stats_mutex);
+		out->stats_file = NULL;
+	}
+
+	if (out->stacking) {
+		if (out->stack.n_frames) {
+			struct stack_snap snap = {0};
+			int rc_stack;
+
+			pthread_mutex_lock(&out->stack_mutex);
+			rc_stack = stack_snapshot(out, &snap);
+			pthread_mutex_unlock(&out->stack_mutex);
+			if (!rc_stack)
+				rc_stack = write_stack(out, &snap);
+			if (!rc)
+				rc = rc_stack;
+		}
+		C_MESSAGE("stacked %u frame(s), %u not registered, %lu "
+			  "sample(s) rejected", out->stack.n_frames,
+			  out->stack.n_failed,
+			  (unsigned long)out->stack.n_rejected);
+		stack_destroy(&out->stack);
+		pthread_mutex_destroy(&out->stack_mutex);
+		pthread_mutex_destroy(&out->stack_file_mutex);
+		out->stacking = false;
+	}
+
+	/* The first error is reported, later closes still run. */
+	if (out->full) {
+		int rc_full = output_close(out->full);
+		if (!rc)
+			rc = rc_full;
+		free(out->full);
+		free(out->full_opt);
+		out->full = NULL;
+		out->full_opt = NULL;
+	}
+
+	if (out->streaming) {
+		int rc_stream;
+
+		if (img_outtype == TYPE_SER)
+			rc_stream = ser_close(&out->ser);
+		else if (img_outtype == TYPE_SPOOL)
+			rc_stream = spool_close(&out->spool);
+		else
+			rc_stream = fit_stream_close(&out->fit_stream);
+		if (!rc)
+			rc = rc_stream;
+		out->streaming = false;
+	}
+	if (out->aio) {
+		int rc_aio = aio_destroy(out->aio);
+		if (!rc)
+			rc = rc_aio;
+		out->aio = NULL;
+	}
+	if (out->striping) {
+		stripe_report(&out->stripe);
+		int rc_stripe = stripe_destroy(&out->stripe);
+		if (!rc)
+			rc = rc_stripe;
+		out->striping = false;
+	}
+
+	return rc;
+}
+
+/* Map the master frames, calibration is the first stage of
+   output_frame() and shared by the full resolution output. */
+static int output_calib_open(struct output *out, const struct options *opt,
+			     const struct frame *tmpl)
+{
+	int rc;
+	const struct calib_master *master;
+
+	if (!strlen(opt->o_bias) && !strlen(opt->o_darks) &&
+	    !strlen(opt->o_flat))
+		return 0;
+
+	if (tmpl->img_type == ASI_IMG_RGB24) {
+		C_ERROR(EINVAL, "calibration requires image type RAW8, RAW16 "
+			"or Y8");
+		return -EINVAL;
+	}
+
+	rc = calib_init(&out->calib, opt->o_bias, opt->o_darks, opt->o_flat,
+			opt->o_dark_scale);
+	if (rc)
+		return rc;
+	out->calibrating = true;
+
+	master = out->calib.has_bias ? &out->calib.bias :
+		out->calib.n_darks ? &out->calib.darks[0] : &out->calib.flat;
+	if (master->width != (uint32_t)tmpl->width ||
+	    master->height != (uint32_t)tmpl->height) {
+		C_ERROR(EINVAL, "master frames %u x %u do not match frames "
+			"%d x %d", master->width, master->height,
+			tmpl->width, tmpl->height);
+		return -EINVAL;
+	}
+	if (master->bitpix == 16 && tmpl->img_type != ASI_IMG_RAW16)
+		C_WARN("16 bit master frames calibrate 8 bit frames");
+
+	return 0;
+}
+
+static int output_stats_open(struct output *out, const struct options *opt)
+{
+	char filename[PATH_MAX + 1] = {0};
+
+	sidecar_filename(filename, strlen(opt->o_filename) ?
+			 opt->o_filename : opt->o_stack, ".jsonl");
+	out->stats_file = fopen(filename, "w");
+	if (!out->stats_file) {
+		int rc = -errno;
+		C_ERROR(errno, "fopen '%s'", filename);
+		return rc;
+	}
+	pthread_mutex_init(&out->stats_mutex, NULL);
+
+	return 0;
+}
+
+static int output_lucky_open(struct output *out, const struct options *opt)
+{
+	int rc;
+	const uint32_t capacity = lucky_capacity(opt);
+
+	rc = lucky_init(&out->lucky, capacity);
+	if (rc) {
+		C_ERROR(rc, "lucky_init");
+		return rc;
+	}
+	out->selected = calloc(capacity, sizeof(void *));
+	if (!out->selected) {
+		rc = -ENOMEM;
+		C_ERROR(rc, "calloc");
+		lucky_destroy(&out->lucky);
+		return rc;
+	}
+	out->selecting = true;
+
+	C_MESSAGE("select the %u sharpest of every %d frame(s)", capacity,
+		  lucky_window(opt));
+
+	return 0;
+}
+
+/* Open the output of opt->o_filename and, if requested, a second
+   output of the frames before software binning. */
+static int output_open(struct output *out, const struct options *opt,
+		       const struct frame *tmpl)
+{
+	int rc;
+	struct options *full_opt;
+
+	rc = output_target_open(out, opt, tmpl);
+	if (!rc)
+		rc = output_calib_open(out, opt, tmpl);
+	if (!rc && opt->o_stats)
+		rc = output_stats_open(out, opt);
+	if (!rc && lucky_enabled(opt))
+		rc = output_lucky_open(out, opt);
+	if (rc) {
+		output_close(out);
+		return rc;
+	}
+	if (!strlen(opt->o_full_filename))
+		return 0;
+
+	full_opt = malloc(sizeof(struct options));
+	out->full = malloc(sizeof(struct output));
+	if (!full_opt || !out->full) {
+		rc = -ENOMEM;
+		C_ERROR(rc, "malloc");
+		free(full_opt);
+		goto cleanup;
+	}
+
+	*full_opt = *opt;
+	snprintf(full_opt->o_filename, sizeof(full_opt->o_filename), "%s",
+		 opt->o_full_filename);
+	full_opt->o_full_filename[0] = '\0';
+	full_opt->o_soft_bin = 0;
+	full_opt->o_stack[0] = '\0';
+	full_opt->o_bias[0] = '\0';
+	full_opt->o_darks[0] = '\0';
+	full_opt->o_flat[0] = '\0';
+	full_opt->o_stats = false;
+
+	rc = output_target_open(out->full, full_opt, tmpl);
+	if (rc) {
+		free(full_opt);
+		goto cleanup;
+	}
+	out->full_opt = full_opt;
+
+	return 0;
+
+cleanup:
+	free(out->full);
+	out->full = NULL;
+	output_close(out);
+
+	return rc;
+}
+
+/* Encode a frame into memory and queue it for writing, the file is
+   complete once aio_drain() or aio_destroy() returned. */
+static int write_frame_aio(struct aio *aio, const struct frame *frame,
+			   const char *filename)
+{
+	int rc;
+	void *buf = NULL;
+	size_t len = 0;
+	bool overwrite = true;
+
+	/* Tif files are overwritten as by TIFFOpen(), fit files as by
+	   fits_create_file() only if prefixed by '!'. */
+	if (img_outtype == TYPE_TIF)
+		rc = tiff_encode_mem(frame, &buf, &len);
+	else {
+		overwrite = fitn_clobber(&filename);
+		rc = fit_encode_mem(frame, &buf, &len);
+	}
+	if (rc) {
+		C_ERROR(rc, "encode '%s'", filename);
+		return rc;
+	}
+
+	rc = aio_write(aio, filename, buf, len, overwrite);
+	free(buf);
+	if (rc)
+		C_ERROR(rc, "aio_write '%s'", filename);
+
+	return rc;
+}
+
+static int output_write(struct output *out, const struct frame *frame)
+{
+	int rc;
+	char filename[PATH_MAX + 1] = {0};
+	const struct options *opt = out->opt;
+
+	if (out->streaming) {
+		if (img_outtype == TYPE_SER)
+			return ser_write(&out->ser, frame);
+		else if (img_outtype == TYPE_SPOOL)
+			return spool_commit(&out->spool, frame);
+		return fit_stream_write(&out->fit_stream, frame);
+	}
+
+	const char *name = opt->o_filename;
+	uint32_t target = 0;
+	const double t_start = mono_now();
+	if (out->striping) {
+		target = stripe_pick(&out->stripe);
+		name = out->stripe.targets[target].filename;
+	}
+
+	if (opt->o_count > 1) {
+		rc = frame_filename(filename, sizeof(filename), name,
+				    frame->seq);
+		if (rc) {
+			C_ERROR(rc, "frame_filename");
+			goto out;
+		}
+	} else
+		snprintf(filename, sizeof(filename), "%s", name);
+
+	if (out->aio)
+		rc = write_frame_aio(out->aio, frame, filename);
+	else
+		rc = write_frame(frame, filename);
+out:
+	if (out->striping)
+		stripe_done(&out->stripe, target, frame->seq, filename,
+			    frame->size, mono_now() - t_start, rc);
+
+	return rc;
+}
+
+/* Bin src into dst, plane by plane, by the integer or fractional
+   factor of opt->o_soft_bin. */
+static int soft_bin(const struct options *opt, struct frame *dst,
+		    const struct frame *src)
+{
+	int rc = 0;
+	const double factor = opt->o_soft_bin;
+	const uint8_t bps = src->img_type == ASI_IMG_RAW16 ? 2 : 1;
+	const uint8_t spp = src->img_type == ASI_IMG_RGB24 ? 3 : 1;
+	const size_t src_plane = src->size / src->planes;
+	const size_t dst_plane = dst->size / dst->planes;
+
+	for (uint8_t p = 0; p < src->planes && !rc; p++) {
+		if (factor == (int)factor)
+			rc = bin_soft(dst->buf + p * dst_plane,
+				      src->buf + p * src_plane, src->width,
+				      src->height, bps, spp, factor,
+				      !opt->o_bin_sum);
+		else
+			rc = downsample(dst->buf + p * dst_plane, dst->width,
+					dst->height, src->buf + p * src_plane,
+					src->width, src->height, bps, spp);
+	}
+
+	return rc;
+}
+
+/* Write a frame, calibrated, debayered into R, G, B planes and binned
+   in software into buffers of the pool if requested. */
+static int output_process(struct output *out, const struct frame *frame)
+{
+	int rc = 0;
+	const struct options *opt = out->opt;
+	const struct frame *written = frame;
+	struct frame calibrated = *frame;
+	struct frame rgb = *frame;
+	struct frame binned = *frame;
+
+	calibrated.buf = NULL;
+	rgb.buf = NULL;
+	binned.buf = NULL;
+
+	/* The frame buffer may be a read-only mapping of a spool. */
+	if (out->calibrating) {
+		calibrated.buf = bufpool_get(&bufpool, frame->size);
+		if (!calibrated.buf) {
+			rc = -ENOMEM;
+			C_ERROR(rc, "bufpool_get");
+			goto cleanup;
+		}
+
+		rc = calib_apply(&out->calib, calibrated.buf, frame->buf,
+				 frame->width, frame->height,
+				 frame->img_type == ASI_IMG_RAW16 ? 2 : 1,
+				 frame->exp_time, frame->temp);
+		if (rc) {
+			C_ERROR(rc, "calib_apply");
+			goto cleanup;
+		}
+		written = &calibrated;
+	}
+
+	if (opt->o_debayer != DEBAYER_NONE) {
+		rgb.planes = 3;
+		rgb.size = frame->size * 3;
+		rgb.buf = bufpool_get(&bufpool, rgb.size);
+		if (!rgb.buf) {
+			rc = -ENOMEM;
+			C_ERROR(rc, "bufpool_get");
+			goto cleanup;
+		}
+
+		rc = debayer(rgb.buf, written->buf, frame->width, frame->height,
+			     frame->img_type == ASI_IMG_RAW16 ? 2 : 1,
+			     opt->o_bayer, opt->o_debayer);
+		if (rc) {
+			C_ERROR(rc, "debayer");
+			goto cleanup;
+		}
+		written = &rgb;
+	}
+
+	if (out->full) {
+		rc = output_write(out->full, written);
+		if (rc)
+			goto cleanup;
+	}
+
+	if (opt->o_soft_bin > 0) {
+		binned = *written;
+		soft_bin_geometry(opt, &binned);
+		binned.buf = bufpool_get(&bufpool, binned.size);
+		if (!binned.buf) {
+			rc = -ENOMEM;
+			C_ERROR(rc, "bufpool_get");
+			goto cleanup;
+		}
+
+		rc = soft_bin(opt, &binned, written);
+		if (rc) {
+			C_ERROR(rc, "soft_bin");
+			goto cleanup;
+		}
+		written = &binned;
+	}
+
+	if (out->stacking) {
+		rc = output_stack(out, written);
+		if (rc)
+			goto cleanup;
+	}
+
+	/* Stacked only. */
+	if (strlen(opt->o_filename))
+		rc = output_write(out, written);
+
+cleanup:
+	if (calibrated.buf)
+		bufpool_put(&bufpool, calibrated.buf);
+	if (rgb.buf)
+		bufpool_put(&bufpool, rgb.buf);
+	if (binned.buf)
+		bufpool_put(&bufpool, binned.buf);
+
+	return rc;
+}
+
+/* Histogram statistics of the frame as captured, carried along by the
+   frame into the headers and appended to the sidecar. */
+static int output_frame(struct output *out, const struct frame *frame)
+{
+	int rc;
+	const uint8_t bps = frame->img_type == ASI_IMG_RAW16 ? 2 : 1;
+	struct frame measured = *frame;
+	struct frame_stats stats;
+	char line[STATS_JSON_LEN] = {0};
+
+	if (!out->stats_file)
+		return output_process(out, frame);
+
+	uint32_t *hist = bufpool_get(&bufpool, stats_scratch_size(bps));
+	if (!hist) {
+		rc = -ENOMEM;
+		C_ERROR(rc, "bufpool_get");
+		return rc;
+	}
+	rc = stats_compute(&stats, hist, frame->buf, frame->size / bps, bps);
+	bufpool_put(&bufpool, hist);
+	if (rc) {
+		C_ERROR(rc, "stats_compute");
+		return rc;
+	}
+	measured.stats = &stats;
+
+	stats_json(line, sizeof(line), &measured);
+	pthread_mutex_lock(&out->stats_mutex);
+	fprintf(out->stats_file, "%s\n", line);
+	fflush(out->stats_file);
+	pthread_mutex_unlock(&out->stats_mutex);
+
+	if (stats.n_saturated)
+		C_INFO("frame %u: %lu saturated sample(s), %.3f%% clipped",
+		       frame->seq, (unsigned long)stats.n_saturated,
+		       100 * stats.clipped);
+
+	return output_process(out, &measured);
+}
+
+/* Frames of a spool are downloaded by the SDK directly into their
+   slot, the ring then only passes them on to the writers. Frames
+   held for selection occupy slots in addition to n_slots. */
+static int output_ring_init(struct output *out, struct ring *ring,
+			    const uint32_t n_slots, const struct frame *tmpl)
+{
+	if (out->streaming && img_outtype == TYPE_SPOOL)
+		return ring_init_external(ring, n_slots, tmpl);
+
+	return ring_init(ring, n_slots + (out->selecting ?
+					  out->lucky.capacity : 0),
+			 tmpl, &bufpool);
+}
+
+/* Move the ROI to the start position of the tracker. */
+static int track_apply(const struct options *opt, const struct track *track)
+{
+	int rc;
+
+	rc = ASISetStartPos(opt->o_cam_id, track->x, track->y);
+	C_DEBUG("[rc:%d, id:%d, x:%d, y:%d] ASISetStartPos", rc,
+		opt->o_cam_id, track->x, track->y);
+	if (rc)
+		ASI_C_ERROR(rc, "ASISetStartPos");
+
+	return rc;
+}
+
+/* Restore the ROI of the capture after test frames, the SDK centers
+   it unless the target is tracked. */
+static int output_roi_restore(const struct output *out)
+{
+	int rc;
+	const struct options *opt = out->opt;
+
+	rc = ASISetROIFormat(opt->o_cam_id, opt->o_width, opt->o_height,
+			     opt->o_binning, opt->o_img_type);
+	C_DEBUG("[rc:%d, id:%d] ASISetROIFormat", rc, opt->o_cam_id);
+	if (rc) {
+		ASI_C_ERROR(rc, "ASISetROIFormat");
+		return rc;
+	}
+	if (out->tracking)
+		rc = track_apply(opt, &out->track);
+
+	return rc;
+}
+
+/* Locate the target on a full frame and center the ROI on it. */
+static int output_track_open(struct output *out, const struct options *opt)
+{
+	int rc;
+	int rc_roi;
+	double cx, cy;
+	ASI_CAMERA_INFO ASI_camera_info;
+	struct frame full = {
+		.img_type = opt->o_img_type
+	};
+
+	rc = ASIGetCameraProperty(&ASI_camera_info, opt->o_cam_id);
+	if (rc) {
+		ASI_C_ERROR(rc, "ASIGetCameraProperty");
+		return rc;
+	}
+	full.width = ASI_camera_info.MaxWidth / opt->o_binning / 8 * 8;
+	full.height = ASI_camera_info.MaxHeight / opt->o_binning / 2 * 2;
+	if (opt->o_width >= full.width && opt->o_height >= full.height) {
+		C_ERROR(EINVAL, "tracking requires a ROI smaller than %d x %d",
+			full.width, full.height);
+		return -EINVAL;
+	}
+	track_init(&out->track, full.width, full.height, opt->o_width,
+		   opt->o_height, opt->o_track,
+		   opt->o_video ? TRACK_SETTLE : 0);
+
+	full.size = calc_buf_size(full.width, full.height, full.img_type);
+	full.buf = bufpool_get(&bufpool, full.size);
+	if (!full.buf) {
+		rc = -ENOMEM;
+		C_ERROR(rc, "bufpool_get");
+		return rc;
+	}
+
+	rc = ASISetROIFormat(opt->o_cam_id, full.width, full.height,
+			     opt->o_binning, opt->o_img_type);
+	C_DEBUG("[rc:%d, id:%d, width:%d, height:%d] ASISetROIFormat", rc,
+		opt->o_cam_id, full.width, full.height);
+	if (rc) {
+		ASI_C_ERROR(rc, "ASISetROIFormat");
+		goto cleanup;
+	}
+	rc = set_exposure(opt, opt->o_exposure);
+	if (rc)
+		goto cleanup;
+	rc = expose(opt, opt->o_exposure, full.size);
+	if (rc)
+		goto cleanup;
+	rc = ASIGetDataAfterExp(opt->o_cam_id, full.buf, full.size);
+	C_DEBUG("[rc:%d, id:%d] ASIGetDataAfterExp", rc, opt->o_cam_id);
+	if (rc) {
+		ASI_C_ERROR(rc, "ASIGetDataAfterExp");
+		goto cleanup;
+	}
+
+	if (track_centroid(full.buf, full.width, full.height,
+			   full.img_type == ASI_IMG_RAW16 ? 2 : 1,
+			   full.img_type == ASI_IMG_RGB24 ? 3 : 1, &cx, &cy)) {
+		C_WARN("no target found, ROI centered");
+	} else {
+		C_MESSAGE("target at %.1f, %.1f", cx, cy);
+		track_center(&out->track, cx, cy);
+	}
+	out->tracking = true;
+
+cleanup:
+	rc_roi = output_roi_restore(out);
+	if (!rc)
+		rc = rc_roi;
+	if (rc)
+		out->tracking = false;
+	else
+		C_MESSAGE("tracking with ROI %d x %d at %d, %d", opt->o_width,
+			  opt->o_height, out->track.x, out->track.y);
+	bufpool_put(&bufpool, full.buf);
+
+	return rc;
+}
+
+/* Record the ROI start of a captured frame and follow the target. The
+   ROI moves between frames, in video mode frames still being read out
+   were taken at the previous position, which track_frame() reports and
+   which are not evaluated. */
+static void output_track(struct output *out, struct frame *frame)
+{
+	double cx, cy;
+	const struct options *opt = out->opt;
+
+	if (!out->tracking)
+		return;
+
+	if (!track_frame(&out->track, &frame->x_org, &frame->y_org))
+		return;
+	if (track_centroid(frame->buf, frame->width, frame->height,
+			   frame->img_type == ASI_IMG_RAW16 ? 2 : 1,
+			   frame->img_type == ASI_IMG_RGB24 ? 3 : 1, &cx, &cy))
+		return;
+	if (!track_update(&out->track, cx, cy))
+		return;
+
+	if (!track_apply(opt, &out->track)) {
+		C_INFO("frame %u: ROI moved to %d, %d", frame->seq,
+		       out->track.x, out->track.y);
+		return;
+	}
+
+	/* The ROI stays where it was. */
+	out->track.x = out->track.x_prev;
+	out->track.y = out->track.y_prev;
+	out->track.settle = 0;
+	out->track.n_moves--;
+}
+
+static int seq_cmp(const void *a, const void *b)
+{
+	const struct frame *fa = *(const struct frame **)a;
+	const struct frame *fb = *(const struct frame **)b;
+
+	return fa->seq < fb->seq ? -1 : fa->seq > fb->seq;
+}
+
+/* Pass the selected frames of the window in capture order to the
+   writers, numbered consecutively. */
+static void output_select_flush(struct output *out, struct ring *ring)
+{
+	if (!out->selecting)
+		return;
+
+	const uint32_t n = lucky_drain(&out->lucky, out->selected);
+	qsort(out->selected, n, sizeof(void *), seq_cmp);
+	for (uint32_t i = 0; i < n; i++) {
+		struct frame *frame = out->selected[i];
+
+		frame->seq = ++out->n_selected;
+		ring_put_ready(ring, frame);
+	}
+	out->n_window = 0;
+}
+
+/* Hand a captured frame to the writers, or with lucky imaging keep it
+   in its slot while it is among the sharpest of the window. Scoring a
+   ROI is cheap compared to the frame time, losers never reach the
+   writers. */
+static void output_select(struct output *out, struct ring *ring,
+			  struct frame *frame)
+{
+	const struct options *opt = out->opt;
+
+	if (!out->selecting) {
+		ring_put_ready(ring, frame);
+		return;
+	}
+
+	const double score = lucky_score(frame->buf, frame->width,
+					 frame->height,
+					 frame->img_type == ASI_IMG_RAW16 ? 2 : 1,
+					 frame->img_type == ASI_IMG_RGB24 ? 3 : 1,
+					 opt->o_lucky_roi);
+	C_DEBUG("frame %u: score %g", frame->seq, score);
+
+	struct frame *evicted = lucky_offer(&out->lucky, score, frame);
+	if (evicted)
+		ring_put_free(ring, evicted);
+
+	out->n_scored++;
+	if (++out->n_window == (uint32_t)lucky_window(opt))
+		output_select_flush(out, ring);
+}
+
+/* Sensor temperature of a captured frame to select among several
+   darks. Read by the capture thread, the writer threads would race with
+   its use of the SDK and see the temperature at write time. The
+   temperature changes slowly, thus it is read at most every
+   TEMP_INTERVAL seconds. */
+static void output_temp(struct output *out, struct frame *frame)
+{
+	long val;
+	ASI_BOOL is_auto;
+	int rc;
+
+	frame->temp = NAN;
+	if (!out->calibrating || out->calib.n_darks < 2)
+		return;
+
+	if (frame->t_obs - out->t_temp < TEMP_INTERVAL) {
+		frame->temp = out->temp;
+		return;
+	}
+
+	rc = ASIGetControlValue(out->opt->o_cam_id, ASI_TEMPERATURE, &val,
+				&is_auto);
+	C_DEBUG("[rc:%d, id:%d, val:%ld] ASIGetControlValue ASI_TEMPERATURE",
+		rc, out->opt->o_cam_id, val);
+	if (rc)
+		return;
+
+	out->temp = val / 10.0;
+	out->t_temp = frame->t_obs;
+	frame->temp = out->temp;
+}
+
+/* Point frame->buf to the storage of frame->seq, if not owned by
+   the ring. */
+static void output_buffer(struct output *out, struct frame *frame)
+{
+	if (out->streaming && img_outtype == TYPE_SPOOL)
+		frame->buf = spool_slot(&out->spool, frame->seq);
+}
+
+static int setup_capture(struct options *opt, struct frame *tmpl)
+{
+	int rc;
+
+	rc = ASISetROIFormat(opt->o_cam_id, opt->o_width, opt->o_height, opt->o_binning, opt->o_img_type);
+	C_DEBUG("[rc:%d, id:%d, width:%d, height:%d, type:%s] ASISetROIFormat",
+		rc, opt->o_cam_id, opt->o_width, opt->o_height, IMG_TYPE[opt->o_img_type]);
+	if (rc) {
+		ASI_C_ERROR(rc, "ASISetROIFormat");
+		return rc;
+	}
+
+	rc = ASIGetROIFormat(opt->o_cam_id, &opt->o_width, &opt->o_height, &opt->o_binning, &opt->o_img_type);
+	C_DEBUG("[rc:%d, id:%d, width:%d, height:%d, binning:%dx%d, type:%s] "
+		"ASIGetROIFormat", rc, opt->o_cam_id, opt->o_width, opt->o_height,
+		opt->o_binning, opt->o_binning, IMG_TYPE[opt->o_img_type]);
+	if (rc) {
+		ASI_C_ERROR(rc, "ASIGetROIFormat");
+		return rc;
+	}
+
+	const long size = calc_buf_size(opt->o_width, opt->o_height, opt->o_img_type);
+	if (size < 0) {
+		C_ERROR(EINVAL, "calc_buf_size");
+		return -EINVAL;
+	}
+
+	int8_t bps = bits_per_sample(opt->o_img_type);
+	C_DEBUG("[bps:%d] bits_per_sample", bps);
+	if (bps < 0) {
+		C_ERROR(EINVAL, "bits_per_sample");
+		return -EINVAL;
+	}
+
+	int8_t spp = samples_per_pixel(opt->o_img_type);
+	C_DEBUG("[spp:%d] samples_per_pixel", spp);
+	if (spp < 0) {
+		C_ERROR(EINVAL, "samples_per_pixel");
+		return -EINVAL;
+	}
+
+	C_MESSAGE("capture %d image(s) %d x %d, exposure (sec): %5.25f, "
+		  "binning: %d x %d, type: %s, size (bytes): %ld",
+		  opt->o_count, opt->o_width , opt->o_height, opt->o_exposure,
+		  opt->o_binning, opt->o_binning,
+		  IMG_TYPE[opt->o_img_type], size);
+
+	ASI_CAMERA_INFO ASI_camera_info;
+	ASIGetCameraProperty(&ASI_camera_info, opt->o_cam_id);
+	opt->o_bayer = ASI_camera_info.IsColorCam ?
+		(int)ASI_camera_info.BayerPattern : -1;
+
+	int x_org = -1;
+	int y_org = -1;
+	rc = ASIGetStartPos(opt->o_cam_id, &x_org, &y_org);
+	C_DEBUG("[rc:%d, id:%d, x:%d, y:%d] ASIGetStartPos", rc, opt->o_cam_id,
+		x_org, y_org);
+	if (rc) {
+		ASI_C_ERROR(rc, "ASIGetStartPos");
+		return rc;
+	}
+
+	*tmpl = (struct frame) {
+		.buf = NULL,
+		.size = size,
+		.width = opt->o_width,
+		.height = opt->o_height,
+		.bin = opt->o_binning,
+		.img_type = opt->o_img_type,
+		.planes = 1,
+		.seq = 0,
+		.t_obs = 0,
+		.exp_time = opt->o_exposure,
+		.date_obs = {0},
+		.x_pix_sz = ASI_camera_info.PixelSize * opt->o_binning,
+		.y_pix_sz = ASI_camera_info.PixelSize * opt->o_binning,
+		.x_org = x_org,
+		.y_org = y_org,
+		.temp = NAN
+	};
+
+	return 0;
+}
+
+static int frame_write(const struct frame *frame, void *arg)
+{
+	return output_frame(arg, frame);
+}
+
+static void frame_done(const struct frame *frame, const int rc,
+		       const double t_write, void *arg)
+{
+	UNUSED(arg);
+
+	C_DEBUG("[rc:%d, seq:%u] frame written in %.3f ms",
+		rc, frame->seq, t_write * 1e3);
+	if (!rc && t_write > WRITER_STALL)
+		C_WARN("writing frame %u stalled for %.3f ms",
+		       frame->seq, t_write * 1e3);
+}
+
+/* Number of frames the queue between acquisition and writers holds,
+   at least one more than writer threads to keep acquisition going. */
+static uint32_t queue_slots(const struct options *opt, const uint32_t slots)
+{
+	if (opt->o_queue > 0)
+		return opt->o_queue;
+
+	return (uint32_t)opt->o_writers + 1 > slots ? opt->o_writers + 1 : slots;
+}
+
+static bool queue_drop(const struct options *opt, const bool drop)
+{
+	/* A spooled frame is already in its mapped slot when it is queued,
+	   dropping it would discard captured data to save only the index
+	   update, thus a spool blocks unless asked otherwise. */
+	if (opt->o_policy == QUEUE_AUTO)
+		return drop && img_outtype != TYPE_SPOOL;
+
+	return opt->o_policy == QUEUE_DROP;
+}
+
+static void writer_report(const struct writer *writer)
+{
+	const uint32_t n = writer->n_written + writer->n_failed;
+
+	C_MESSAGE("written %u frame(s), failed %u, write time mean: %.3f ms, "
+		  "max: %.3f ms", writer->n_written, writer->n_failed,
+		  n ? writer->t_write_sum / n * 1e3 : 0,
+		  writer->t_write_max * 1e3);
+}
+
+/* Barrier shared by the capture threads of multiple cameras, such that
+   exposures start at the same time. Unlike pthread_barrier a camera can
+   leave early (error or shorter sequence) without blocking the others. */
+struct cam_sync {
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	int n_cams;
+	int n_waiting;
+	uint64_t generation;
+	int n_frames;
+	double *t_start;	/* Exposure starts, n_cams x n_frames. */
+};
+
+static void sync_wait(struct cam_sync *sync)
+{
+	pthread_mutex_lock(&sync->mutex);
+	const uint64_t generation = sync->generation;
+	if (++sync->n_waiting >= sync->n_cams) {
+		sync->generation++;
+		sync->n_waiting = 0;
+		pthread_cond_broadcast(&sync->cond);
+	} else {
+		while (generation == sync->generation)
+			pthread_cond_wait(&sync->cond, &sync->mutex);
+	}
+	pthread_mutex_unlock(&sync->mutex);
+}
+
+static void sync_leave(struct cam_sync *sync)
+{
+	pthread_mutex_lock(&sync->mutex);
+	sync->n_cams--;
+	if (sync->n_waiting > 0 && sync->n_waiting >= sync->n_cams) {
+		sync->generation++;
+		sync->n_waiting = 0;
+		pthread_cond_broadcast(&sync->cond);
+	}
+	pthread_mutex_unlock(&sync->mutex);
+}
+
+/* Sample value at the auto exposure percentile, hist provides
+   stats_scratch_size() bytes. */
+static int frame_level(const struct frame *frame, uint32_t *hist,
+		       const double percentile, double *level)
+{
+	int rc;
+	const uint8_t bps = frame->img_type == ASI_IMG_RAW16 ? 2 : 1;
+	struct frame_stats stats;
+
+	rc = stats_compute(&stats, hist, frame->buf, frame->size / bps, bps);
+	if (rc) {
+		C_ERROR(rc, "stats_compute");
+		return rc;
+	}
+	*level = stats_percentile(hist, STATS_BINS(bps), stats.n, percentile);
+
+	return 0;
+}
+
+/* Converge on the exposure time with test frames of a centered ROI of
+   at most EXP_METER_ROI x EXP_METER_ROI pixels, which download in a
+   fraction of the full frame time. */
+static int meter_exposure(const struct output *out, struct autoexp *ae,
+			  uint32_t *hist)
+{
+	int rc;
+	const struct options *opt = out->opt;
+	int rc_roi;
+	bool converged = false;
+	struct frame test = {
+		.width = opt->o_width > EXP_METER_ROI ?
+			EXP_METER_ROI : opt->o_width,
+		.height = opt->o_height > EXP_METER_ROI ?
+			EXP_METER_ROI : opt->o_height,
+		.img_type = opt->o_img_type
+	};
+
+	test.size = calc_buf_size(test.width, test.height, test.img_type);
+	test.buf = bufpool_get(&bufpool, test.size);
+	if (!test.buf) {
+		rc = -ENOMEM;
+		C_ERROR(rc, "bufpool_get");
+		return rc;
+	}
+
+	/* The SDK centers the ROI, a tracked one is centered on the
+	   target. */
+	rc = ASISetROIFormat(opt->o_cam_id, test.width, test.height,
+			     opt->o_binning, opt->o_img_type);
+	C_DEBUG("[rc:%d, id:%d, width:%d, height:%d] ASISetROIFormat", rc,
+		opt->o_cam_id, test.width, test.height);
+	if (rc) {
+		ASI_C_ERROR(rc, "ASISetROIFormat");
+		goto cleanup;
+	}
+	if (out->tracking) {
+		struct track test_track = out->track;
+
+		test_track.width = test.width;
+		test_track.height = test.height;
+		track_center(&test_track, out->track.x + out->track.width / 2.0,
+			     out->track.y + out->track.height / 2.0);
+		rc = track_apply(opt, &test_track);
+		if (rc)
+			goto cleanup;
+	}
+
+	for (int n = 0; n < AUTOEXP_MAX_ITER && !converged; n++) {
+		const double t = ae->t;
+		double level;
+
+		rc = set_exposure(opt, t);
+		if (rc)
+			break;
+		rc = expose(opt, t, test.size);
+		if (rc)
+			break;
+		rc = ASIGetDataAfterExp(opt->o_cam_id, test.buf, test.size);
+		C_DEBUG("[rc:%d, id:%d] ASIGetDataAfterExp", rc, opt->o_cam_id);
+		if (rc) {
+			ASI_C_ERROR(rc, "ASIGetDataAfterExp");
+			break;
+		}
+		rc = frame_level(&test, hist, ae->percentile, &level);
+		if (rc)
+			break;
+
+		converged = autoexp_update(ae, t, level, false);
+		C_INFO("test exposure (sec): %.6f, level: %.0f, target: %.0f",
+		       t, level, ae->target);
+		/* Clamped at the limits. */
+		if (!converged && ae->t == t)
+			break;
+	}
+
+	if (!rc) {
+		if (!converged)
+			C_WARN("auto exposure did not converge");
+		C_MESSAGE("auto exposure (sec): %.6f", ae->t);
+	}
+
+cleanup:
+	rc_roi = output_roi_restore(out);
+	if (!rc)
+		rc = rc_roi;
+	bufpool_put(&bufpool, test.buf);
+
+	return rc;
+}
+
+static int capture_snap(struct output *out, const struct frame *tmpl,
+			struct cam_sync *sync, const int idx)
+{
+	int rc;
+	const struct options *opt = out->opt;
+	struct ring ring;
+	struct writer writer;
+	const bool drop = queue_drop(opt, false);
+	uint32_t slots = queue_slots(opt, SNAP_RING_SLOTS);
+	struct autoexp ae;
+	uint32_t *hist = NULL;
+
+	if (opt->o_auto_exp > 0) {
+		const uint8_t bps = tmpl->img_type == ASI_IMG_RAW16 ? 2 : 1;
+		const double full_scale = STATS_BINS(bps) - 1;
+
+		hist = bufpool_get(&bufpool, stats_scratch_size(bps));
+		if (!hist) {
+			rc = -ENOMEM;
+			C_ERROR(rc, "bufpool_get");
+			return rc;
+		}
+		autoexp_init(&ae, opt->o_ae_percentile,
+			     opt->o_auto_exp * full_scale, full_scale,
+			     opt->o_exposure, EXP_MIN, opt->o_ae_max);
+		rc = meter_exposure(out, &ae, hist);
+		if (rc) {
+			bufpool_put(&bufpool, hist);
+			return rc;
+		}
+	}
+
+	/* At least double buffering: while one frame is written by a writer
+	   thread, the next exposure is downloaded into the other one. */
+	if (slots > (uint32_t)opt->o_count)
+		slots = opt->o_count;
+	rc = output_ring_init(out, &ring, slots, tmpl);
+	if (rc) {
+		C_ERROR(rc, "ring_init");
+		goto cleanup;
+	}
+
+	rc = writer_start(&writer, &ring, opt->o_writers, frame_write,
+			  frame_done, out);
+	if (rc) {
+		C_ERROR(rc, "writer_start");
+		ring_destroy(&ring);
+		goto cleanup;
+	}
+
+	/* For whatever reason, sometimes the exposure fails for exposure time
+	 > 0.5 sec. However by first creating a very short exposure and subsequently the
+	 desired exposure, the ASI library seems to be working more reliably. */
+	const double t_begin = c_now();
+
+	int rc_cap = 0;
+
+	for (int n = 1; n <= opt->o_count; n++) {
+		/* Blocks while all buffers are still being written, unless
+		   the oldest queued frame is dropped. */
+		struct frame *frame = ring_get_free(&ring, drop);
+		if (!frame)
+			break;
+
+		if (sync)
+			sync_wait(sync);
+
+		const double t_start = c_now();
+		if (sync && n <= sync->n_frames)
+			sync->t_start[idx * sync->n_frames + n - 1] = t_start;
+
+		/* Setup DATE-OBS field as current date/time UTC. */
+		frame->t_obs = t_start;
+		iso8601_utc(frame->date_obs, MAX_LEN_ISO8601, frame->t_obs);
+		frame->seq = n;
+		output_buffer(out, frame);
+
+		if (hist) {
+			rc_cap = set_exposure(opt, ae.t);
+			if (rc_cap) {
+				ring_put_free(&ring, frame);
+				break;
+			}
+			frame->exp_time = ae.t;
+		}
+
+		rc_cap = expose(opt, frame->exp_time, frame->size);
+		if (rc_cap) {
+			ring_put_free(&ring, frame);
+			break;
+		}
+
+		rc_cap = ASIGetDataAfterExp(opt->o_cam_id, frame->buf, frame->size);
+		C_DEBUG("[rc:%d, id:%d] ASIGetDataAfterExp", rc_cap, opt->o_cam_id);
+		if (rc_cap) {
+			ASI_C_ERROR(rc_cap, "ASIGetDataAfterExp");
+			ring_put_free(&ring, frame);
+			break;
+		}
+
+		output_temp(out, frame);
+		output_track(out, frame);
+
+		/* Track a changing scene, e.g. the sky brightness at dusk,
+		   with the next exposure. */
+		double level;
+		if (hist && !frame_level(frame, hist, ae.percentile, &level)) {
+			autoexp_update(&ae, frame->exp_time, level, true);
+			C_INFO("frame %d exposure (sec): %.6f, level: %.0f, "
+			       "next: %.6f", n, frame->exp_time, level, ae.t);
+		}
+
+		output_select(out, &ring, frame);
+
+		/* Keep the requested cadence between exposure starts. */
+		const double t_left = t_start + opt->o_interval - c_now();
+		if (n < opt->o_count && t_left > 0)
+			usleep(t_left * 1e6);
+	}
+
+	output_select_flush(out, &ring);
+	ring_close(&ring);
+	writer_stop(&writer);
+
+	if (opt->o_count > 1) {
+		C_MESSAGE("captured %u of %d images in %.3f sec, dropped: %lu",
+			  writer.n_written, opt->o_count, c_now() - t_begin,
+			  (unsigned long)ring.n_dropped);
+		writer_report(&writer);
+	}
+
+	ring_destroy(&ring);
+
+	rc = ASIStopExposure(opt->o_cam_id);
+	C_DEBUG("[rc:%d, id:%d] ASIStopExposure", rc, opt->o_cam_id);
+	if (rc)
+		ASI_C_ERROR(rc, "ASIStopExposure");
+	rc = rc_cap ? rc_cap : writer.rc;
+
+cleanup:
+	if (hist)
+		bufpool_put(&bufpool, hist);
+
+	return rc;
+}
+
+struct video_ctx {
+	const struct options *opt;
+	struct output *out;
+	struct ring *ring;
+	bool drop;
+	uint32_t n_captured;
+	double t_first;
+	double t_last;
+	int rc;
+};
+
+static void *video_acquire(void *arg)
+{
+	struct video_ctx *ctx = arg;
+	const struct options *opt = ctx->opt;
+	/* As recommended by the SDK: twice the exposure plus 500 ms. */
+	const int wait_ms = opt->o_exposure * 2000 + 500;
+	uint8_t n_timeout = 0;
+	double t_report = c_now();
+	int rc;
+
+	rc = ASIStartVideoCapture(opt->o_cam_id);
+	C_DEBUG("[rc:%d, id:%d] ASIStartVideoCapture", rc, opt->o_cam_id);
+	if (rc) {
+		ASI_C_ERROR(rc, "ASIStartVideoCapture");
+		ctx->rc = rc;
+		goto out;
+	}
+
+	while (ctx->n_captured < (uint32_t)opt->o_count) {
+		/* Returns NULL if the writer closed the ring on error. */
+		struct frame *frame = ring_get_free(ctx->ring, ctx->drop);
+		if (!frame)
+			break;
+
+		frame->seq = ctx->n_captured + 1;
+		output_buffer(ctx->out, frame);
+
+		rc = ASIGetVideoData(opt->o_cam_id, frame->buf, frame->size,
+				     wait_ms);
+		if (rc) {
+			ring_put_free(ctx->ring, frame);
+			if (rc == ASI_ERROR_TIMEOUT &&
+			    ++n_timeout < VIDEO_MAX_TIMEOUT) {
+				C_WARN("ASIGetVideoData timeout after %d ms", wait_ms);
+				continue;
+			}
+			ASI_C_ERROR(rc, "ASIGetVideoData");
+			ctx->rc = rc;
+			break;
+		}
+		n_timeout = 0;
+
+		/* The frame left the sensor now, thus the exposure started
+		   one exposure time ago. */
+		const double t_now = c_now();
+		frame->t_obs = t_now - opt->o_exposure;
+		iso8601_utc(frame->date_obs, MAX_LEN_ISO8601, frame->t_obs);
+		ctx->n_captured = frame->seq;
+		if (frame->seq == 1)
+			ctx->t_first = t_now;
+		ctx->t_last = t_now;
+
+		output_temp(ctx->out, frame);
+		output_track(ctx->out, frame);
+		output_select(ctx->out, ctx->ring, frame);
+
+		if (t_now - t_report >= 1.0 && ctx->t_last > ctx->t_first) {
+			C_INFO("captured %u frames, %.2f fps", ctx->n_captured,
+			       (ctx->n_captured - 1) / (ctx->t_last - ctx->t_first));
+			t_report = t_now;
+		}
+	}
+
+	rc = ASIStopVideoCapture(opt->o_cam_id);
+	C_DEBUG("[rc:%d, id:%d] ASIStopVideoCapture", rc, opt->o_cam_id);
+	if (rc)
+		ASI_C_ERROR(rc, "ASIStopVideoCapture");
+out:
+	output_select_flush(ctx->out, ctx->ring);
+	ring_close(ctx->ring);
+
+	return NULL;
+}
+
+static int capture_video(struct output *out, const struct frame *tmpl)
+{
+	int rc;
+	const struct options *opt = out->opt;
+	struct ring ring;
+	struct writer writer;
+	pthread_t thread;
+	struct video_ctx ctx = {
+		.opt = opt,
+		.out = out,
+		.ring = &ring,
+		/* By default never stall the camera, drop the oldest
+		   queued frame instead (except for a spool). */
+		.drop = queue_drop(opt, true),
+		.n_captured = 0,
+		.t_first = 0,
+		.t_last = 0,
+		.rc = 0
+	};
+
+	rc = output_ring_init(out, &ring, queue_slots(opt, VIDEO_RING_SLOTS),
+			      tmpl);
+	if (rc) {
+		C_ERROR(rc, "ring_init");
+		return rc;
+	}
+
+	/* Acquisition is decoupled from the (slower) writers by the ring
+	   slots. */
+	rc = writer_start(&writer, &ring, opt->o_writers, frame_write,
+			  frame_done, out);
+	if (rc) {
+		C_ERROR(rc, "writer_start");
+		ring_destroy(&ring);
+		return rc;
+	}
+
+	rc = pthread_create(&thread, NULL, video_acquire, &ctx);
+	if (rc) {
+		C_ERROR(rc, "pthread_create");
+		ring_close(&ring);
+		writer_stop(&writer);
+		ring_destroy(&ring);
+		return -rc;
+	}
+
+	pthread_join(thread, NULL);
+	writer_stop(&writer);
+
+	int n_dropped = 0;
+	rc = ASIGetDroppedFrames(opt->o_cam_id, &n_dropped);
+	C_DEBUG("[rc:%d, id:%d] ASIGetDroppedFrames", rc, opt->o_cam_id);
+	if (rc)
+		ASI_C_ERROR(rc, "ASIGetDroppedFrames");
+
+	C_MESSAGE("captured %u frames, written %u frames, %.2f fps, "
+		  "dropped frames camera: %d, host: %lu",
+		  ctx.n_captured, writer.n_written,
+		  ctx.t_last > ctx.t_first ?
+		  (ctx.n_captured - 1) / (ctx.t_last - ctx.t_first) : 0,
+		  n_dropped, (unsigned long)ring.n_dropped);
+	writer_report(&writer);
+
+	ring_destroy(&ring);
+
+	return ctx.rc ? ctx.rc : writer.rc;
+}
+
+static int capture_run(struct options *opt, struct cam_sync *sync,
+		       const int idx, long *size)
+{
+	int rc;
+	int rc_close;
+	struct frame frame;
+	struct output out;
+
+	rc = setup_capture(opt, &frame);
+	if (rc)
+		return rc;
+	if (size)
+		*size = frame.size;
+
+	rc = output_open(&out, opt, &frame);
+	if (rc)
+		return rc;
+
+	if (opt->o_track >= 0) {
+		rc = output_track_open(&out, opt);
+		if (rc) {
+			output_close(&out);
+			return rc;
+		}
+	}
+
+	if (opt->o_video)
+		rc = capture_video(&out, &frame);
+	else
+		rc = capture_snap(&out, &frame, sync, idx);
+
+	rc_close = output_close(&out);
+	bufpool_report(&bufpool);
+
+	return rc ? rc : rc_close;
+}
+
+static int capture(struct options opt)
+{
+	return capture_run(&opt, NULL, 0, NULL);
+}
+
+static int set_defaults(struct options opt)
+{
+	int rc;
+	long val = opt.o_exposure * (long)1e6;
+
+	rc = ASISetControlValue(opt.o_cam_id, ASI_EXPOSURE, val, ASI_FALSE);
+	C_DEBUG("[rc:%d, id:%d] ASISetControlValue", rc, opt.o_cam_id);
+	if (rc)
+		ASI_C_ERROR(rc, "ASISetControlValue");
+
+	return rc;
+}
+
+static int open_camera(const int cam_id)
+{
+	int rc;
+
+	rc = ASIOpenCamera(cam_id);
+	C_DEBUG("[rc:%d, id:%d] ASIOpenCamera", rc, cam_id);
+	if (rc) {
+		ASI_C_ERROR(rc, "ASIOpenCamera");
+		return rc;
+	}
+
+	rc = ASIInitCamera(cam_id);
+	C_DEBUG("[rc:%d, id:%d] ASIInitCamera", rc, cam_id);
+	if (rc)
+		ASI_C_ERROR(rc, "ASIInitCamera");
+
+	return rc;
+}
+
+static int close_camera(const int cam_id)
+{
+	int rc;
+
+	rc = ASICloseCamera(cam_id);
+	C_DEBUG("[rc:%d, id:%d] ASICloseCamera", rc, cam_id);
+	if (rc)
+		ASI_C_ERROR(rc, "ASICloseCamera");
+
+	return rc;
+}
+
+static int get_ctrl(const int cam_id, char *param, long *val, ASI_BOOL *asi_bool)
+{
+	int rc;
+	int ctrl_type;
+
+	ctrl_type = lookup_ctrl_type(param);
+	if (ctrl_type < 0) {
+		C_ERROR(ctrl_type, "unknown parameter '%s'", param);
+		return ctrl_type;
+	}
+
+	rc = ASIGetControlValue(cam_id, ctrl_type, val, asi_bool);
+	C_DEBUG("[rc:%d, id:%d] ASIGetControlValue", rc, cam_id);
+	if (rc)
+		ASI_C_ERROR(rc, "ASIGetControlValue");
+
+	return rc;
+}
+
+static int set_ctrls(const int cam_id, char *str)
+{
+	int rc;
+	struct params_vals pvs = {.N = 0,
+				  .pv = NULL};
+
+	rc = split_pvs(str, &pvs);
+	if (rc) {
+		C_ERROR(rc, "split_pvs");
+		goto cleanup;
+	}
+
+	for (uint8_t n = 0; n < pvs.N; n++) {
+		int ctrl_type;
+		ASI_BOOL set_auto = ASI_FALSE;
+		long val;
+		fprintf(stdout, "%s %s\n",
+			pvs.pv[n].param,
+			pvs.pv[n].val);
+
+		ctrl_type = lookup_ctrl_type(pvs.pv[n].param);
+		if (ctrl_type < 0) {
+			rc = ctrl_type;
+			C_ERROR(rc, "unknown parameter '%s'", pvs.pv[n].param);
+			goto cleanup;
+		}
+
+		if (strlen(pvs.pv[n].val) == 4 && !strncmp("auto", pvs.pv[n].val, 4)) {
+			/* Get previous value and set again previous value and set_auto (TRUE). */
+			rc = ASIGetControlValue(cam_id, ctrl_type, &val, &set_auto);
+			C_DEBUG("[rc:%d, id:%d] ASIGetControlValue", rc, cam_id);
+			if (rc) {
+				ASI_C_ERROR(rc, "ASIGetControlValue");
+				goto cleanup;
+			}
+			set_auto = ASI_TRUE;
+		} else
+			val = atol(pvs.pv[n].val);
+
+		rc = ASISetControlValue(cam_id, ctrl_type, val, set_auto);
+		C_DEBUG("[rc:%d, id:%d] ASISetControlValue", rc, cam_id);
+		if (rc)
+			ASI_C_ERROR(rc, "ASISetControlValue");
+	}
+
+cleanup:
+	free(pvs.pv);
+
+	return rc;
+}
+
+static int capture_options(struct options *o, char *str)
+{
+	int rc;
+	struct params_vals pvs = {.N = 0,
+				  .pv = NULL};
+
+	rc = split_pvs(str, &pvs);
+	if (rc) {
+		C_ERROR(rc, "split_pvs");
+		goto cleanup;
+	}
+
+	for (uint8_t n = 0; n < pvs.N; n++) {
+		const char *param = pvs.pv[n].param;
+		const char *val = pvs.pv[n].val;
+
+		if (STRNCMP(param, "exposure"))
+			o->o_exposure = atof(val);
+		else if (STRNCMP(param, "width"))
+			o->o_width = atoi(val);
+		else if (STRNCMP(param, "height"))
+			o->o_height = atoi(val);
+		else if (STRNCMP(param, "binning"))
+			o->o_binning = atoi(val);
+		else if (STRNCMP(param, "count"))
+			o->o_count = atoi(val);
+		else if (STRNCMP(param, "interval"))
+			o->o_interval = atof(val);
+		else if (STRNCMP(param, "retries"))
+			o->o_retries = atoi(val);
+		else if (STRNCMP(param, "video"))
+			o->o_video = atoi(val) != 0;
+		else if (STRNCMP(param, "type")) {
+			int img_type = parse_img_type(val);
+			if (img_type < 0) {
+				rc = img_type;
+				C_ERROR(rc, "unknown image type '%s'", val);
+				goto cleanup;
+			}
+			o->o_img_type = img_type;
+		} else {
+			rc = -EINVAL;
+			C_ERROR(rc, "unknown capture option '%s'", param);
+			goto cleanup;
+		}
+	}
+
+cleanup:
+	free(pvs.pv);
+
+	return rc;
+}
+
+struct multi_ctx {
+	struct options opt;
+	struct cam_sync *sync;
+	int idx;
+	long size;
+	int rc;
+};
+
+static void *capture_cam(void *arg)
+{
+	struct multi_ctx *ctx = arg;
+
+	ctx->rc = capture_run(&ctx->opt, ctx->sync, ctx->idx, &ctx->size);
+	sync_leave(ctx->sync);
+
+	return NULL;
+}
+
+/* Each camera writes <name>_cam<id>.<ext> */
+static int cam_filename(char *dst, const char *filename, const int cam_id)
+{
+	const char *ext = rindex(filename, '.');
+
+	if (!ext)
+		ext = filename + strlen(filename);
+	if (snprintf(dst, PATH_MAX, "%.*s_cam%d%s", (int)(ext - filename),
+		     filename, cam_id, ext) >= PATH_MAX) {
+		C_ERROR(ENAMETOOLONG, "filename");
+		return -ENAMETOOLONG;
+	}
+
+	return 0;
+}
+
+/* Capture with several cameras in parallel, one thread per camera,
+   exposures are started together on a shared barrier. */
+static int capture_multi(const struct options *opt)
+{
+	int rc = 0;
+	const int n_cams = opt->o_n_cams;
+	struct multi_ctx ctx[MULTI_MAX_CAMERAS];
+	pthread_t thread[MULTI_MAX_CAMERAS];
+	struct cam_sync sync = {
+		.n_cams = 0,
+		.n_waiting = 0,
+		.generation = 0,
+		.n_frames = 0,
+		.t_start = NULL
+	};
+
+	if (opt->o_video) {
+		C_ERROR(EINVAL, "video mode is not supported with multiple cameras");
+		return -EINVAL;
+	}
+	if (strchr(opt->o_filename, ',')) {
+		C_ERROR(EINVAL, "striping is not supported with multiple cameras");
+		return -EINVAL;
+	}
+
+	memset(ctx, 0, sizeof(ctx));
+	for (int i = 0; i < n_cams; i++) {
+		const int cam_id = opt->o_cam_ids[i];
+
+		ctx[i].opt = *opt;
+		ctx[i].opt.o_cam_id = cam_id;
+		ctx[i].sync = &sync;
+		ctx[i].idx = i;
+
+		/* Apply the options given as -C <camera_id>:<option=val,...> */
+		for (int n = 0; n < opt->o_n_cam_opts; n++) {
+			char str[MAX_PV_SET_LENGTH + 1] = {0};
+			char *p = strchr(opt->o_cam_opts[n], ':');
+
+			if (!p || atoi(opt->o_cam_opts[n]) != cam_id)
+				continue;
+			strncpy(str, p + 1, MAX_PV_SET_LENGTH);
+			rc = capture_options(&ctx[i].opt, str);
+			if (rc)
+				return rc;
+		}
+
+		if (strlen(opt->o_filename))
+			rc = cam_filename(ctx[i].opt.o_filename,
+					  opt->o_filename, cam_id);
+		if (!rc && strlen(opt->o_stack))
+			rc = cam_filename(ctx[i].opt.o_stack, opt->o_stack,
+					  cam_id);
+		if (!rc && strlen(opt->o_full_filename))
+			rc = cam_filename(ctx[i].opt.o_full_filename,
+					  opt->o_full_filename, cam_id);
+		if (rc)
+			return rc;
 
-	fprintf(stdout, format,
-		"name", "description", "max value", "min value", "default value", "support auto set", "writable");
-	fprintf(stdout, "|%-24s+%-50s+%-15s+%-15s+%-14s+%-17s+%-8s|\n",
-		"-------------------------",
-		"---------------------------------------------------",
-		"----------------",
-		"----------------",
-		"---------------",
-		"------------------",
-		"----------");
+		if (ctx[i].opt.o_count > sync.n_frames)
+			sync.n_frames = ctx[i].opt.o_count;
+	}
 
-	for (int i = 0; i < n_ctrl; ++i) {
-		int rc;
-		rc = ASIGetControlCaps(cam_id, i, &ctrl_caps);
-		C_DEBUG("[rc:%d, id:%d] ASIGetControlCaps", rc, cam_id);
+	sync.t_start = calloc(n_cams * sync.n_frames, sizeof(double));
+	if (!sync.t_start) {
+		C_ERROR(errno, "calloc");
+		return -ENOMEM;
+	}
+	pthread_mutex_init(&sync.mutex, NULL);
+	pthread_cond_init(&sync.cond, NULL);
+
+	int n_open = 0;
+	for ( ; n_open < n_cams; n_open++) {
+		rc = open_camera(ctx[n_open].opt.o_cam_id);
+		if (!rc)
+			rc = set_defaults(ctx[n_open].opt);
+		if (rc)
+			goto cleanup;
+	}
+
+	const double t_begin = c_now();
+
+	sync.n_cams = n_cams;
+	int n_started = 0;
+	for ( ; n_started < n_cams; n_started++) {
+		rc = pthread_create(&thread[n_started], NULL, capture_cam,
+				    &ctx[n_started]);
 		if (rc) {
-			ASI_C_ERROR(rc, "ASIGetControlCaps");
-			return;
+			C_ERROR(rc, "pthread_create");
+			rc = -rc;
+			/* Release threads waiting for the missing ones. */
+			for (int i = n_started; i < n_cams; i++)
+				sync_leave(&sync);
+			break;
 		}
+	}
+	for (int i = 0; i < n_started; i++) {
+		pthread_join(thread[i], NULL);
+		if (ctx[i].rc && !rc)
+			rc = ctx[i].rc;
+	}
 
-		snprintf(max_val, len, "%ld", ctrl_caps.MaxValue);
-		snprintf(min_val, len, "%ld", ctrl_caps.MinValue);
-		snprintf(def_val, len, "%ld", ctrl_caps.DefaultValue);
+	/* Report start time skew between cameras and aggregate throughput. */
+	const double t_total = c_now() - t_begin;
+	double skew_sum = 0;
+	double skew_max = 0;
+	int n_synced = 0;
+	long n_frames = 0;
+	double n_bytes = 0;
 
-		fprintf(stdout, format,
-			ctrl_caps.Name,
-			ctrl_caps.Description,
-			max_val,
-			min_val,
-			def_val,
-			BOOL_NO_YES[ctrl_caps.IsAutoSupported],
-			BOOL_NO_YES[ctrl_caps.IsWritable]);
+	for (int n = 0; n < sync.n_frames; n++) {
+		double t_min = 0;
+		double t_max = 0;
+		int n_taken = 0;
+
+		for (int i = 0; i < n_cams; i++) {
+			const double t = sync.t_start[i * sync.n_frames + n];
+			if (t == 0)
+				continue;
+			if (!n_taken || t < t_min)
+				t_min = t;
+			if (!n_taken || t > t_max)
+				t_max = t;
+			n_taken++;
+			n_frames++;
+			n_bytes += ctx[i].size;
+		}
+		if (n_taken > 1) {
+			skew_sum += t_max - t_min;
+			if (t_max - t_min > skew_max)
+				skew_max = t_max - t_min;
+			n_synced++;
+		}
 	}
+	C_MESSAGE("captured %ld frames with %d cameras in %.3f sec, "
+		  "%.2f frames/sec, %.2f MB/sec, start skew mean: %.3f ms, "
+		  "max: %.3f ms", n_frames, n_cams, t_total,
+		  n_frames / t_total, n_bytes / t_total / 1e6,
+		  n_synced ? skew_sum / n_synced * 1e3 : 0, skew_max * 1e3);
+
+cleanup:
+	for (int i = 0; i < n_open; i++)
+		close_camera(ctx[i].opt.o_cam_id);
+
+	pthread_mutex_destroy(&sync.mutex);
+	pthread_cond_destroy(&sync.cond);
+	free(sync.t_start);
+
+	return rc;
 }
 
-static int split_pvs(char *str, struct params_vals *pvs)
+static volatile sig_atomic_t serve_stop = 0;
+
+static void serve_signal(int sig)
 {
-	if (!pvs)
-		return -EINVAL;
+	UNUSED(sig);
+	serve_stop = 1;
+}
 
-	const char *delim = ", ";
-	char *token = NULL;
+struct serve_ctx {
+	const struct options *opt;	/* Defaults from the command line. */
+	bool cam_open[SERVE_MAX_CAMERAS];
+};
 
-	token = strtok(str, delim);
-	while (token != NULL) {
-		char *p = strstr(token, "=");
-		if (!p)
-			return -EINVAL;
+/* Cameras are opened on first use and stay open until 'close' or
+   the daemon terminates, such that subsequent requests do not pay
+   for ASIOpenCamera/ASIInitCamera. */
+static int serve_camera(struct serve_ctx *ctx, const char *str, int *cam_id)
+{
+	int rc;
 
-		pvs->pv = realloc(pvs->pv, sizeof(struct param_val) * (pvs->N + 1));
-		if (!pvs->pv)
-			return -EINVAL;
+	if (!str)
+		return -EINVAL;
 
-		bzero(pvs->pv[pvs->N].param, MAX_PV_LENGTH + 1);
-		bzero(pvs->pv[pvs->N].val, MAX_PV_LENGTH + 1);
+	*cam_id = atoi(str);
+	if (*cam_id < 0 || *cam_id >= SERVE_MAX_CAMERAS)
+		return -EINVAL;
+	if (ctx->cam_open[*cam_id])
+		return 0;
 
-		strncpy(pvs->pv[pvs->N].param, token, strlen(token) - strlen(p));
-		strncpy(pvs->pv[pvs->N].val, p + 1, strlen(p) - 1);
-		pvs->N++;
-		token = strtok(NULL, delim);
+	rc = open_camera(*cam_id);
+	if (rc)
+		return rc;
+
+	struct options o = *ctx->opt;
+	o.o_cam_id = *cam_id;
+	rc = set_defaults(o);
+	if (rc) {
+		close_camera(*cam_id);
+		return rc;
 	}
+	ctx->cam_open[*cam_id] = true;
 
 	return 0;
 }
 
-static void capture(struct options opt)
+/* Close a camera opened by an earlier request, a camera which is not
+   open is not opened just to close it. */
+static int serve_close(struct serve_ctx *ctx, const char *str)
 {
 	int rc;
-	uint8_t *img_buf = NULL;
+	int cam_id;
 
-	rc = ASISetROIFormat(opt.o_cam_id, opt.o_width, opt.o_height, opt.o_binning, opt.o_img_type);
-	C_DEBUG("[rc:%d, id:%d, width:%d, height:%d, type:%s] ASISetROIFormat",
-		rc, opt.o_cam_id, opt.o_width, opt.o_height, IMG_TYPE[opt.o_img_type]);
-	if (rc) {
-		ASI_C_ERROR(rc, "ASISetROIFormat");
-		return;
+	if (!str)
+		return -EINVAL;
+
+	cam_id = atoi(str);
+	if (cam_id < 0 || cam_id >= SERVE_MAX_CAMERAS)
+		return -EINVAL;
+	if (!ctx->cam_open[cam_id])
+		return -ENODEV;
+
+	rc = close_camera(cam_id);
+	ctx->cam_open[cam_id] = false;
+
+	return rc;
+}
+
+static int serve_capture(struct serve_ctx *ctx, const int cam_id,
+			 const char *filename, const int count, char *str)
+{
+	int rc;
+	char msg[256];
+	struct options o = *ctx->opt;
+
+	if (!filename)
+		return -EINVAL;
+
+	o.o_cam_id = cam_id;
+	o.o_capture = true;
+	strncpy(o.o_filename, filename, PATH_MAX);
+	o.o_full_filename[0] = '\0';
+	o.o_stack[0] = '\0';
+	if (count)
+		o.o_count = count;
+	if (str) {
+		rc = capture_options(&o, str);
+		if (rc)
+			return rc;
 	}
 
-	rc = ASIGetROIFormat(opt.o_cam_id, &opt.o_width, &opt.o_height, &opt.o_binning, &opt.o_img_type);
-	C_DEBUG("[rc:%d, id:%d, width:%d, height:%d, binning:%dx%d, type:%s] "
-		"ASIGetROIFormat", rc, opt.o_cam_id, opt.o_width, opt.o_height,
-		opt.o_binning, opt.o_binning, IMG_TYPE[opt.o_img_type]);
+	/* Same constraints as on the command line. */
+	set_img_outtype(o.o_filename);
+	rc = capture_check(&o, msg, sizeof(msg));
 	if (rc) {
-		ASI_C_ERROR(rc, "ASIGetROIFormat");
-		return;
+		C_ERROR(-rc, "capture request: %s", msg);
+		return rc;
 	}
+	if (o.o_exposure <= 0)
+		return -EINVAL;
 
-	const long size = calc_buf_size(opt.o_width, opt.o_height, opt.o_img_type);
-	if (size < 0) {
-		C_ERROR(EINVAL, "calc_buf_size");
-		return;
+	rc = ASISetControlValue(cam_id, ASI_EXPOSURE, o.o_exposure * 1e6, ASI_FALSE);
+	C_DEBUG("[rc:%d, id:%d] ASISetControlValue", rc, cam_id);
+	if (rc) {
+		ASI_C_ERROR(rc, "ASISetControlValue");
+		return rc;
 	}
 
-	int8_t bps = bits_per_sample(opt.o_img_type);
-	C_DEBUG("[bps:%d] bits_per_sample", bps);
-	if (bps < 0) {
-		C_ERROR(EINVAL, "bits_per_sample");
-		return;
-	}
+	return capture(o);
+}
 
-	int8_t spp = samples_per_pixel(opt.o_img_type);
-	C_DEBUG("[spp:%d] samples_per_pixel", spp);
-	if (bps < 0) {
-		C_ERROR(EINVAL, "samples_per_pixel");
-		return;
+/* Handle a single request line and write the response, either
+   'OK [result]' or 'ERR <rc>'. Requests are:
+     get <camera_id> <param>
+     set <camera_id> <param=val,...>
+     capture <camera_id> <filename> [option=val,...]
+     sequence <camera_id> <filename> <count> [option=val,...]
+     close <camera_id>
+     quit
+     shutdown
+   where options are exposure, width, height, binning, type, count,
+   interval, retries and video. Captures are checked against the
+   constraints of the command line, closing a camera which is not
+   open fails with -ENODEV. */
+static int serve_request(struct serve_ctx *ctx, char *line, FILE *out)
+{
+	int rc = 0;
+	int cam_id;
+	char *save = NULL;
+	const char *delim = " \t\r\n";
+	char *cmd = strtok_r(line, delim, &save);
+
+	if (!cmd)
+		return SERVE_CONTINUE;
+
+	if (STRNCMP(cmd, "quit"))
+		return SERVE_CLOSE;
+	else if (STRNCMP(cmd, "shutdown")) {
+		fprintf(out, "OK\n");
+		return SERVE_SHUTDOWN;
 	}
 
-	img_buf = calloc(size, sizeof(uint8_t));
-	if (!img_buf) {
-		C_ERROR(errno, "calloc");
-		return;
+	if (STRNCMP(cmd, "close")) {
+		rc = serve_close(ctx, strtok_r(NULL, delim, &save));
+		goto out;
 	}
 
-	/* For whatever reason, sometimes the exposure fails for exposure time
-	 > 0.5 sec. However by first creating a very short exposure and subsequently the
-	 desired exposure, the ASI library seems to be working more reliably. */
-	C_MESSAGE("capture image %d x %d, exposure (sec): %5.25f, "
-		  "binning: %d x %d, type: %s, size (bytes): %ld",
-		  opt.o_width , opt.o_height, opt.o_exposure,
-		  opt.o_binning, opt.o_binning,
-		  IMG_TYPE[opt.o_img_type], size);
+	rc = serve_camera(ctx, strtok_r(NULL, delim, &save), &cam_id);
+	if (rc)
+		goto out;
 
-	uint8_t cur_attempt = 1;
-	uint8_t max_attempt = 3;
-	ASI_EXPOSURE_STATUS status = ASI_EXP_WORKING;
+	if (STRNCMP(cmd, "get")) {
+		long val = 0;
+		ASI_BOOL asi_bool;
+		char *param = strtok_r(NULL, delim, &save);
+		if (!param) {
+			rc = -EINVAL;
+			goto out;
+		}
+		rc = get_ctrl(cam_id, param, &val, &asi_bool);
+		if (!rc) {
+			fprintf(out, "OK %s %ld %s\n", param, val,
+				BOOL_STR[asi_bool]);
+			return SERVE_CONTINUE;
+		}
+	} else if (STRNCMP(cmd, "set")) {
+		char *pvs = strtok_r(NULL, delim, &save);
+		rc = pvs ? set_ctrls(cam_id, pvs) : -EINVAL;
+	} else if (STRNCMP(cmd, "capture")) {
+		char *filename = strtok_r(NULL, delim, &save);
+		rc = serve_capture(ctx, cam_id, filename, 0,
+				   strtok_r(NULL, delim, &save));
+	} else if (STRNCMP(cmd, "sequence")) {
+		char *filename = strtok_r(NULL, delim, &save);
+		char *count = strtok_r(NULL, delim, &save);
+		if (!count || atoi(count) < 1) {
+			rc = -EINVAL;
+			goto out;
+		}
+		rc = serve_capture(ctx, cam_id, filename, atoi(count),
+				   strtok_r(NULL, delim, &save));
+	} else
+		rc = -EINVAL;
 
-	ASI_CAMERA_INFO ASI_camera_info;
-	ASIGetCameraProperty(&ASI_camera_info, opt.o_cam_id);
+out:
+	if (rc)
+		fprintf(out, "ERR %d\n", rc);
+	else
+		fprintf(out, "OK\n");
 
-	struct fit_head_s fit_head = {
-		.date_obs = {0},
-		.exp_time = opt.o_exposure,
-		.x_binning = opt.o_binning,
-		.y_binning = opt.o_binning,
-		.x_pix_sz = ASI_camera_info.PixelSize * opt.o_binning,
-		.y_pix_sz = ASI_camera_info.PixelSize * opt.o_binning
+	return SERVE_CONTINUE;
+}
+
+static int serve(const struct options *opt, const int n_devs)
+{
+	int rc = 0;
+	int fd;
+	struct stat st;
+	struct sockaddr_un addr;
+	struct serve_ctx ctx = {
+		.opt = opt,
+		.cam_open = {false}
+	};
+	struct sigaction sa = {
+		.sa_handler = serve_signal
 	};
 
-	/* Setup DATE-OBS field as current date/time UTC. */
-	time_t cur_time = time(NULL);
-	strftime(fit_head.date_obs, MAX_LEN_ISO8601 * sizeof(char),
-		 "%Y-%m-%dT%H:%M:%S", gmtime(&cur_time));
+	/* No SA_RESTART, such that accept and reads are interrupted. */
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	signal(SIGPIPE, SIG_IGN);
 
-	while (1) {
-		rc = ASIStartExposure(opt.o_cam_id, ASI_FALSE);
-		C_DEBUG("[rc:%d, id:%d] ASIStartExposure", rc, opt.o_cam_id);
-		if (rc) {
-			ASI_C_ERROR(rc, "ASIStartExposure");
-			goto cleanup;
-		}
-		usleep(10000);	/* 10ms. */
-		while (status == ASI_EXP_WORKING) {
-			rc = ASIGetExpStatus(opt.o_cam_id, &status);
-			C_DEBUG("[rc:%d, id:%d] ASIGetExpStatus, status: %s",
-				rc, opt.o_cam_id, ASI_EXP_STATUS_MSG(status));
-			if (rc) {
-				ASI_C_ERROR(rc, "ASIGetExpStatus");
-				goto cleanup;
-			}
-		}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (strlen(opt->o_serve) >= sizeof(addr.sun_path)) {
+		C_ERROR(ENAMETOOLONG, "socket path '%s'", opt->o_serve);
+		return -ENAMETOOLONG;
+	}
+	strncpy(addr.sun_path, opt->o_serve, sizeof(addr.sun_path) - 1);
+
+	/* Remove a stale socket of a previous run, but nothing else. */
+	if (!stat(opt->o_serve, &st) && S_ISSOCK(st.st_mode))
+		unlink(opt->o_serve);
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) {
+		C_ERROR(errno, "socket");
+		return -errno;
+	}
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) ||
+	    listen(fd, SERVE_BACKLOG)) {
+		rc = -errno;
+		C_ERROR(errno, "bind '%s'", opt->o_serve);
+		close(fd);
+		return rc;
+	}
+	C_MESSAGE("serving %d camera(s) on '%s'", n_devs, opt->o_serve);
+
+	char *line = NULL;
+	size_t len = 0;
+	int state = SERVE_CONTINUE;
 
-		if (status == ASI_EXP_SUCCESS) {
-			C_MESSAGE("%s", ASI_EXP_STATUS_MSG(status));
+	while (!serve_stop && state != SERVE_SHUTDOWN) {
+		int cfd = accept(fd, NULL, NULL);
+		if (cfd < 0) {
+			if (errno == EINTR)
+				continue;
+			rc = -errno;
+			C_ERROR(errno, "accept");
 			break;
+		}
 
-		} else if (status == ASI_EXP_FAILED) {
-			if (cur_attempt == max_attempt) {
-				C_ERROR(ECANCELED, "ASIGetExpStatus %s",
-					ASI_EXP_STATUS_MSG(status));
-				goto cleanup;
-			}
-			C_WARN("ASIGetExpStatus %s. Restarting exposure attempt %d.",
-			       ASI_EXP_STATUS_MSG(status), cur_attempt);
-			cur_attempt++;
-		} else {	/* We should never be in this state (ASI_EXP_IDLE). */
-			ASI_C_ERROR(ASI_ERROR_TIMEOUT, "invalid exposure state");
-			goto cleanup;
+		FILE *in = fdopen(cfd, "r");
+		FILE *out = fdopen(dup(cfd), "w");
+		if (!in || !out) {
+			C_ERROR(errno, "fdopen");
+			if (in)
+				fclose(in);
+			else
+				close(cfd);
+			if (out)
+				fclose(out);
+			continue;
 		}
-	}
 
-	rc = ASIGetDataAfterExp(opt.o_cam_id, img_buf, size);
-	C_DEBUG("[rc:%d, id:%d] ASIGetDataAfterExp", rc, opt.o_cam_id);
-	if (rc) {
-		ASI_C_ERROR(rc, "ASIGetDataAfterExp");
-		goto cleanup;
+		state = SERVE_CONTINUE;
+		while (state == SERVE_CONTINUE && !serve_stop &&
+		       getline(&line, &len, in) > 0) {
+			const double t_start = mono_now();
+			C_DEBUG("request '%.*s'", (int)strcspn(line, "\r\n"), line);
+			state = serve_request(&ctx, line, out);
+			fflush(out);
+			C_INFO("request served in %.3f ms",
+			       (mono_now() - t_start) * 1e3);
+		}
+		fclose(in);
+		fclose(out);
 	}
 
-	if (img_outtype == TYPE_TIF) {
-		TIFF *tiff_img = NULL;
-		rc = write_tiff(tiff_img, img_buf, bps, spp);
-		if (rc)
-			C_ERROR(rc, "write_tiff");
-	} else if (img_outtype == TYPE_FIT) {
-		rc = write_fit(img_buf, &fit_head);
-		if (rc)
-			C_ERROR(rc, "write_fit");
-	} else
-		C_ERROR(-EINVAL, "unknown image type");
+	free(line);
+	close(fd);
+	unlink(opt->o_serve);
 
-cleanup:
-	if (img_buf) {
-		free(img_buf);
-		img_buf = NULL;
-	}
+	for (int n = 0; n < SERVE_MAX_CAMERAS; n++)
+		if (ctx.cam_open[n])
+			close_camera(n);
 
-	rc = ASIStopExposure(opt.o_cam_id);
-	C_DEBUG("[rc:%d, id:%d] ASIStopExposure", rc, opt.o_cam_id);
-	if (rc)
-		ASI_C_ERROR(rc, "ASIStopExposure");
+	return rc;
 }
 
-static int set_defaults(struct options opt)
+/* Convert the frames of a spool offline into fit or tif files, or
+   a fit stream. */
+static int convert(int argc, char *argv[])
 {
 	int rc;
-	long val = opt.o_exposure * (long)1e6;
+	int rc_close;
+	struct spool spool;
+	struct output out;
+	struct options o;
+	uint32_t n_converted = 0;
+	uint32_t n_missing = 0;
 
-	rc = ASISetControlValue(opt.o_cam_id, ASI_EXPOSURE, val, ASI_FALSE);
-	C_DEBUG("[rc:%d, id:%d] ASISetControlValue", rc, opt.o_cam_id);
+	rc = parseopts(argc, argv);
+	if (rc || optind >= argc) {
+		fprintf(stdout, "try '%s --help' for more information\n", argv[0]);
+		return 1;
+	}
+	if (img_outtype != TYPE_FIT && img_outtype != TYPE_TIF) {
+		fprintf(stdout, "spool can be converted to <filename>.fit or "
+			"<filename>.tif only\n");
+		return 1;
+	}
+	if (strlen(opt.o_full_filename) && !full_check(&opt, opt.o_full_filename)) {
+		fprintf(stdout, "full resolution filename requires soft "
+			"binning and the type of the filename\n");
+		return 1;
+	}
+	if (lucky_enabled(&opt)) {
+		fprintf(stdout, "lucky imaging selects frames while "
+			"capturing\n");
+		return 1;
+	}
+
+	rc = spool_open(&spool, argv[optind]);
 	if (rc)
-		ASI_C_ERROR(rc, "ASISetControlValue");
+		return rc;
+	/* RGB24 frames are deinterleaved for fit into pool buffers. */
+	bufpool_init(&bufpool, opt.o_pool_flags);
 
-	return rc;
+	const struct spool_header *hdr = spool.hdr;
+	const struct frame tmpl = {
+		.buf = NULL,
+		.size = hdr->frame_size,
+		.width = hdr->width,
+		.height = hdr->height,
+		.bin = hdr->bin,
+		.img_type = hdr->img_type,
+		.planes = 1,
+		.seq = 0,
+		.t_obs = 0,
+		.exp_time = hdr->exp_time,
+		.date_obs = {0},
+		.x_pix_sz = hdr->x_pix_sz,
+		.y_pix_sz = hdr->y_pix_sz,
+		.x_org = -1,
+		.y_org = -1,
+		.temp = NAN
+	};
+
+	C_MESSAGE("convert %u frame(s) %d x %d, type: %s of '%s' (%s)",
+		  hdr->n_frames, tmpl.width, tmpl.height,
+		  IMG_TYPE[tmpl.img_type], argv[optind], hdr->camera);
+
+	o = opt;
+	o.o_width = tmpl.width;
+	o.o_height = tmpl.height;
+	o.o_binning = tmpl.bin;
+	o.o_img_type = tmpl.img_type;
+	o.o_count = hdr->n_frames;
+	o.o_bayer = hdr->is_color ? hdr->bayer : -1;
+	if (o.o_count < 1) {
+		C_WARN("no frames in spool '%s'", argv[optind]);
+		goto cleanup;
+	}
+
+	rc = output_open(&out, &o, &tmpl);
+	if (rc)
+		goto cleanup;
+
+	for (uint32_t n = 0; n < hdr->n_frames; n++) {
+		struct frame frame;
+
+		rc = spool_frame(&spool, n, &frame);
+		if (rc == -ENOENT) {
+			/* Dropped or failed during capture. */
+			n_missing++;
+			rc = 0;
+			continue;
+		}
+		if (!rc)
+			rc = output_frame(&out, &frame);
+		if (rc)
+			break;
+		n_converted++;
+	}
+
+	rc_close = output_close(&out);
+	if (!rc)
+		rc = rc_close;
+
+	C_MESSAGE("converted %u frame(s), missing %u", n_converted, n_missing);
+
+cleanup:
+	bufpool_destroy(&bufpool);
+	rc_close = spool_close(&spool);
+
+	return rc ? rc : rc_close;
 }
 
 int main(int argc, char *argv[])
@@ -767,15 +4844,23 @@ int main(int argc, char *argv[])
 	TIFFSetErrorHandler(&tiff_error_handler);
 	TIFFSetWarningHandler(&tiff_warn_handler);
 
+	if (STRNCMP(argv[1], "convert"))
+		return convert(argc - 1, argv + 1);
+
 	int rc;
+	int rc_close;
 	rc = parseopts(argc, argv);
 	if (rc) {
 		fprintf(stdout, "try '%s --help' for more information\n", argv[0]);
 		return 1;
 	}
 
-	if (argc > optind)
-		opt.o_cam_id = atoi(argv[optind]);
+	bufpool_init(&bufpool, opt.o_pool_flags);
+
+	for (int n = optind; n < argc && opt.o_n_cams < MULTI_MAX_CAMERAS; n++)
+		opt.o_cam_ids[opt.o_n_cams++] = atoi(argv[n]);
+	if (opt.o_n_cams > 0)
+		opt.o_cam_id = opt.o_cam_ids[0];
 
 	int devs_id = 0;
 	devs_id = ASIGetNumOfConnectedCameras();
@@ -783,26 +4868,26 @@ int main(int argc, char *argv[])
 	if (devs_id <= 0) {
 		rc = ASI_ERROR_INVALID_INDEX;
 		ASI_C_ERROR(rc, "ASIGetNumOfConnectedCameras");
-		return rc;
+		goto out;
 	}
 
 	if (opt.o_list)
 		list_devices(devs_id);
 
-	rc = ASIOpenCamera(opt.o_cam_id);
-	C_DEBUG("[rc:%d, id:%d] ASIOpenCamera", rc, opt.o_cam_id);
-	if (rc) {
-		ASI_C_ERROR(rc, "ASIOpenCamera");
-		goto cleanup;
+	if (strlen(opt.o_serve)) {
+		rc = serve(&opt, devs_id);
+		goto out;
 	}
 
-	rc = ASIInitCamera(opt.o_cam_id);
-	C_DEBUG("[rc:%d, id:%d] ASIInitCamera", rc, opt.o_cam_id);
-	if (rc) {
-		ASI_C_ERROR(rc, "ASIInitCamera");
-		goto cleanup;
+	if (opt.o_capture && opt.o_n_cams > 1) {
+		rc = capture_multi(&opt);
+		goto out;
 	}
 
+	rc = open_camera(opt.o_cam_id);
+	if (rc)
+		goto cleanup;
+
 	rc = set_defaults(opt);
 	if (rc)
 		goto cleanup;
@@ -817,39 +4902,9 @@ int main(int argc, char *argv[])
 		list_ctrl_caps(opt.o_cam_id, n_ctrl);
 	}
 	if (strlen(opt.o_set)) {
-		rc = split_pvs(opt.o_set, &pvs);
-		if (rc) {
-			C_ERROR(rc, "split_pvs");
+		rc = set_ctrls(opt.o_cam_id, opt.o_set);
+		if (rc)
 			goto cleanup;
-		}
-
-		for (uint8_t n = 0; n < pvs.N; n++) {
-			int ctrl_type;
-			ASI_BOOL set_auto = ASI_FALSE;
-			long val;
-			fprintf(stdout, "%s %s\n",
-				pvs.pv[n].param,
-				pvs.pv[n].val);
-
-			ctrl_type = lookup_ctrl_type(pvs.pv[n].param);
-
-			if (strlen(pvs.pv[n].val) == 4 && !strncmp("auto", pvs.pv[n].val, 4)) {
-				/* Get previous value and set again previous value and set_auto (TRUE). */
-				rc = ASIGetControlValue(opt.o_cam_id, ctrl_type, &val, &set_auto);
-				C_DEBUG("[rc:%d, id:%d] ASIGetControlValue", rc, opt.o_cam_id);
-				if (rc) {
-					ASI_C_ERROR(rc, "ASIGetControlValue");
-					goto cleanup;
-				}
-				set_auto = ASI_TRUE;
-			} else
-				val = atol(pvs.pv[n].val);
-
-			rc = ASISetControlValue(opt.o_cam_id, ctrl_type, val, set_auto);
-			C_DEBUG("[rc:%d, id:%d] ASISetControlValue", rc, opt.o_cam_id);
-			if (rc)
-				ASI_C_ERROR(rc, "ASISetControlValue");
-		}
 	}
 	if (opt.o_exposure > 0) {
 		long val = opt.o_exposure * 1e6;
@@ -861,32 +4916,23 @@ int main(int argc, char *argv[])
 		}
 	}
 	if (strlen(opt.o_get)) {
-		int ctrl_type;
 		long val = 0;
 		ASI_BOOL asi_bool;
-		ctrl_type = lookup_ctrl_type(opt.o_get);
-		rc = ASIGetControlValue(opt.o_cam_id, ctrl_type, &val, &asi_bool);
-		C_DEBUG("[rc:%d, id:%d] ASIGetControlValue", rc, opt.o_cam_id);
-		if (rc) {
-			ASI_C_ERROR(rc, "ASIGetControlValue");
+		rc = get_ctrl(opt.o_cam_id, opt.o_get, &val, &asi_bool);
+		if (rc)
 			goto cleanup;
-		}
 		fprintf(stdout, "%s %ld %s\n", opt.o_get, val, BOOL_STR[asi_bool]);
 	}
 	if (opt.o_capture)
-		capture(opt);
+		rc = capture(opt);
 
 cleanup:
-	rc = ASICloseCamera(opt.o_cam_id);
-	C_DEBUG("[rc:%d, id:%d] ASICloseCamera", rc, opt.o_cam_id);
-	if (rc)
-		ASI_C_ERROR(rc, "ASICloseCamera");
-
-	if (pvs.pv) {
-		free(pvs.pv);
-		pvs.pv = NULL;
-		pvs.N = 0;
-	}
+	/* Close in any case, but keep the first error. */
+	rc_close = close_camera(opt.o_cam_id);
+	if (!rc)
+		rc = rc_close;
+out:
+	bufpool_destroy(&bufpool);
 
 	return rc;
 }
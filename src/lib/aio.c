@@ -0,0 +1,352 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 only,
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License version 2 for more details (a copy is included
+ * in the LICENSE file that accompanied this code).
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Copyright (c) 2017, Thomas Stibor <thomas@stibor.net>
+ */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include "aio.h"
+
+#ifdef HAVE_LIBURING
+
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/uio.h>
+#include <liburing.h>
+#include "log.h"
+
+enum aio_op {
+	AIO_WRITE,
+	AIO_FSYNC
+};
+
+struct aio_file;
+
+/* User data of a submission. Write requests are tied to their fixed
+   buffer, the fsync request of a file is part of the file. */
+struct aio_req {
+	enum aio_op op;
+	uint32_t buf;
+	size_t len;
+	struct aio_file *file;
+};
+
+struct aio_file {
+	int fd;
+	char filename[PATH_MAX + 1];
+	uint32_t n_pending;
+	bool submitted;		/* All writes of the file are submitted. */
+	int rc;
+	struct aio_req fsync_req;
+};
+
+struct aio {
+	struct io_uring uring;
+	uint8_t *bufs;
+	uint32_t n_bufs;
+	size_t buf_size;
+	struct aio_req *reqs;	/* Write request of each buffer. */
+	uint32_t *free;		/* Stack of free buffer indices. */
+	uint32_t n_free;
+	uint32_t n_inflight;
+	bool fsync;
+	int rc;			/* Status of the first failed file. */
+	pthread_mutex_t mutex;
+};
+
+static struct io_uring_sqe *aio_get_sqe(struct aio *aio)
+{
+	struct io_uring_sqe *sqe = io_uring_get_sqe(&aio->uring);
+
+	/* Submission queue is full, hand it over to the kernel. */
+	if (!sqe) {
+		io_uring_submit(&aio->uring);
+		sqe = io_uring_get_sqe(&aio->uring);
+	}
+
+	return sqe;
+}
+
+static void aio_file_close(struct aio *aio, struct aio_file *file)
+{
+	if (close(file->fd) < 0 && !file->rc)
+		file->rc = -errno;
+
+	if (file->rc) {
+		C_ERROR(-file->rc, "write '%s'", file->filename);
+		if (!aio->rc)
+			aio->rc = file->rc;
+	} else
+		C_MESSAGE("created successfully '%s'", file->filename);
+
+	free(file);
+}
+
+/* All writes of a file completed, sync it or close it right away. */
+static void aio_file_done(struct aio *aio, struct aio_file *file)
+{
+	struct io_uring_sqe *sqe = NULL;
+
+	if (aio->fsync && !file->rc)
+		sqe = aio_get_sqe(aio);
+	if (!sqe) {
+		aio_file_close(aio, file);
+		return;
+	}
+
+	file->fsync_req.op = AIO_FSYNC;
+	file->fsync_req.file = file;
+	io_uring_prep_fsync(sqe, file->fd, IORING_FSYNC_DATASYNC);
+	io_uring_sqe_set_data(sqe, &file->fsync_req);
+	file->n_pending++;
+	aio->n_inflight++;
+}
+
+static void aio_complete(struct aio *aio, struct io_uring_cqe *cqe)
+{
+	struct aio_req *req = io_uring_cqe_get_data(cqe);
+	struct aio_file *file = req->file;
+	const int res = cqe->res;
+
+	io_uring_cqe_seen(&aio->uring, cqe);
+	aio->n_inflight--;
+	file->n_pending--;
+
+	if (res < 0 && !file->rc)
+		file->rc = res;
+
+	if (req->op == AIO_FSYNC) {
+		aio_file_close(aio, file);
+		return;
+	}
+
+	/* Short writes of regular files happen on ENOSPC only. */
+	if (res >= 0 && (size_t)res != req->len && !file->rc)
+		file->rc = -ENOSPC;
+	aio->free[aio->n_free++] = req->buf;
+
+	if (file->submitted && file->n_pending == 0)
+		aio_file_done(aio, file);
+}
+
+/* Process completions, if wait is set block until at least one
+   completed. Queued requests are submitted before waiting, otherwise
+   the completion waited for may never be issued. */
+static void aio_reap(struct aio *aio, const bool wait)
+{
+	struct io_uring_cqe *cqe;
+
+	if (wait && aio->n_inflight > 0) {
+		io_uring_submit(&aio->uring);
+		if (io_uring_wait_cqe(&aio->uring, &cqe) == 0)
+			aio_complete(aio, cqe);
+	}
+	while (aio->n_inflight > 0 &&
+	       io_uring_peek_cqe(&aio->uring, &cqe) == 0)
+		aio_complete(aio, cqe);
+}
+
+int aio_create(struct aio **aio, const uint32_t n_bufs, const size_t buf_size,
+	       const bool fsync)
+{
+	int rc;
+	struct aio *a;
+	struct iovec *iovs = NULL;
+
+	if (!aio || n_bufs == 0 || buf_size == 0)
+		return -EINVAL;
+
+	a = calloc(1, sizeof(struct aio));
+	if (!a)
+		return -ENOMEM;
+
+	a->n_bufs = n_bufs;
+	a->buf_size = buf_size;
+	a->fsync = fsync;
+	a->reqs = calloc(n_bufs, sizeof(struct aio_req));
+	a->free = calloc(n_bufs, sizeof(uint32_t));
+	iovs = calloc(n_bufs, sizeof(struct iovec));
+	if (!a->reqs || !a->free || !iovs ||
+	    posix_memalign((void **)&a->bufs, 4096, (size_t)n_bufs * buf_size)) {
+		rc = -ENOMEM;
+		goto cleanup;
+	}
+
+	for (uint32_t n = 0; n < n_bufs; n++) {
+		iovs[n].iov_base = a->bufs + (size_t)n * buf_size;
+		iovs[n].iov_len = buf_size;
+		a->free[n_bufs - 1 - n] = n;
+	}
+	a->n_free = n_bufs;
+
+	/* Room for a write per buffer plus the fsyncs of their files. */
+	rc = io_uring_queue_init(2 * n_bufs, &a->uring, 0);
+	if (rc) {
+		C_ERROR(-rc, "io_uring_queue_init");
+		goto cleanup;
+	}
+
+	rc = io_uring_register_buffers(&a->uring, iovs, n_bufs);
+	if (rc) {
+		C_ERROR(-rc, "io_uring_register_buffers");
+		io_uring_queue_exit(&a->uring);
+		goto cleanup;
+	}
+
+	pthread_mutex_init(&a->mutex, NULL);
+	free(iovs);
+	*aio = a;
+
+	return 0;
+
+cleanup:
+	free(iovs);
+	free(a->bufs);
+	free(a->reqs);
+	free(a->free);
+	free(a);
+
+	return rc;
+}
+
+int aio_write(struct aio *aio, const char *filename, const void *data,
+	      const size_t len, const bool overwrite)
+{
+	int rc;
+	struct aio_file *file;
+	const uint8_t *p = data;
+
+	file = calloc(1, sizeof(struct aio_file));
+	if (!file)
+		return -ENOMEM;
+	strncpy(file->filename, filename, PATH_MAX);
+
+	file->fd = open(filename, O_WRONLY | O_CREAT |
+			(overwrite ? O_TRUNC : O_EXCL), 0644);
+	if (file->fd < 0) {
+		rc = -errno;
+		C_ERROR(errno, "open '%s'", filename);
+		free(file);
+		return rc;
+	}
+
+	pthread_mutex_lock(&aio->mutex);
+	for (size_t off = 0; off < len; ) {
+		while (aio->n_free == 0)
+			aio_reap(aio, true);
+
+		struct io_uring_sqe *sqe = aio_get_sqe(aio);
+		if (!sqe) {
+			file->rc = -EBUSY;
+			break;
+		}
+
+		const uint32_t buf = aio->free[--aio->n_free];
+		const size_t chunk = len - off < aio->buf_size ?
+			len - off : aio->buf_size;
+		uint8_t *dst = aio->bufs + (size_t)buf * aio->buf_size;
+		struct aio_req *req = &aio->reqs[buf];
+
+		memcpy(dst, p + off, chunk);
+		req->op = AIO_WRITE;
+		req->buf = buf;
+		req->len = chunk;
+		req->file = file;
+		io_uring_prep_write_fixed(sqe, file->fd, dst, chunk, off, buf);
+		io_uring_sqe_set_data(sqe, req);
+		file->n_pending++;
+		aio->n_inflight++;
+		off += chunk;
+	}
+	file->submitted = true;
+	if (file->n_pending == 0)
+		aio_file_done(aio, file);
+
+	io_uring_submit(&aio->uring);
+	aio_reap(aio, false);
+	rc = aio->rc;
+	pthread_mutex_unlock(&aio->mutex);
+
+	return rc;
+}
+
+/* Wait for all submitted files, returns the status of the first
+   failed one. */
+int aio_drain(struct aio *aio)
+{
+	int rc;
+
+	pthread_mutex_lock(&aio->mutex);
+	while (aio->n_inflight > 0)
+		aio_reap(aio, true);
+	rc = aio->rc;
+	pthread_mutex_unlock(&aio->mutex);
+
+	return rc;
+}
+
+int aio_destroy(struct aio *aio)
+{
+	int rc;
+
+	if (!aio)
+		return 0;
+
+	rc = aio_drain(aio);
+
+	io_uring_unregister_buffers(&aio->uring);
+	io_uring_queue_exit(&aio->uring);
+	pthread_mutex_destroy(&aio->mutex);
+	free(aio->bufs);
+	free(aio->reqs);
+	free(aio->free);
+	free(aio);
+
+	return rc;
+}
+
+#else
+
+int aio_create(struct aio **aio, const uint32_t n_bufs, const size_t buf_size,
+	       const bool fsync)
+{
+	return -ENOSYS;
+}
+
+int aio_write(struct aio *aio, const char *filename, const void *data,
+	      const size_t len, const bool overwrite)
+{
+	return -ENOSYS;
+}
+
+int aio_drain(struct aio *aio)
+{
+	return -ENOSYS;
+}
+
+int aio_destroy(struct aio *aio)
+{
+	return 0;
+}
+
+#endif	/* HAVE_LIBURING */
@@ -0,0 +1,45 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 only,
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License version 2 for more details (a copy is included
+ * in the LICENSE file that accompanied this code).
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Copyright (c) 2017, Thomas Stibor <thomas@stibor.net>
+ */
+
+#ifndef AIO_H
+#define AIO_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define AIO_BUFS	16
+#define AIO_BUF_SIZE	(4 * 1024 * 1024)
+
+/* Asynchronous file output through io_uring. Files encoded in memory
+   are copied into a fixed set of registered buffers and written (and
+   optionally fsync'ed) without blocking the caller, unless all buffers
+   are in flight. An existing file is truncated if overwrite is set,
+   otherwise aio_write() fails with -EEXIST. Errors of a file are
+   reported by a later call to aio_write() or by aio_drain(). Only available if built with
+   liburing, otherwise aio_create() fails with -ENOSYS. */
+struct aio;
+
+int aio_create(struct aio **aio, const uint32_t n_bufs, const size_t buf_size,
+	       const bool fsync);
+int aio_write(struct aio *aio, const char *filename, const void *data,
+	      const size_t len, const bool overwrite);
+int aio_drain(struct aio *aio);
+int aio_destroy(struct aio *aio);
+
+#endif	/* AIO_H */
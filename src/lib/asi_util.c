@@ -16,6 +16,7 @@
  * Copyright (c) 2017, Thomas Stibor <thomas@stibor.net>
  */
 
+#include <time.h>
 #include "asi_util.h"
 
 static void __asilog(int err, const char *fmt, va_list ap)
@@ -229,3 +230,43 @@ bool is_color(const ASI_IMG_TYPE asi_img_type)
 	return color;
 
 }
+
+int frame_filename(char *dst, const size_t len, const char *filename,
+		   const uint32_t seq)
+{
+	/* Insert the zero padded sequence number in front of the
+	   extension, e.g. frame.fit -> frame_00042.fit */
+	const char *ext = rindex(filename, '.');
+	int n;
+
+	if (!ext)
+		ext = filename + strlen(filename);
+
+	n = snprintf(dst, len, "%.*s_%05u%s", (int)(ext - filename),
+		     filename, seq, ext);
+	if (n < 0 || (size_t)n >= len)
+		return -ENAMETOOLONG;
+
+	return 0;
+}
+
+void iso8601_utc(char *dst, const size_t len, const double t)
+{
+	/* Format t (seconds since epoch) as UTC with milliseconds, e.g.
+	   2017-10-30T21:13:45.120 */
+	time_t sec = (time_t)t;
+	int msec = (int)((t - sec) * 1000);
+	struct tm tm;
+	char str[32] = {0};
+
+	gmtime_r(&sec, &tm);
+	strftime(str, sizeof(str), "%Y-%m-%dT%H:%M:%S", &tm);
+	snprintf(dst, len, "%s.%03d", str, msec);
+}
+
+double mono_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + 0.000000001 * ts.tv_nsec;
+}
@@ -27,6 +27,7 @@
 #include <stdlib.h>
 #include <stdarg.h>
 #include <errno.h>
+#include <strings.h>
 #include <ASICamera2.h>
 
 #define MAX_PV_LENGTH 64
@@ -49,6 +50,10 @@ long calc_buf_size(const int width, const int height, const ASI_IMG_TYPE asi_img
 int8_t bits_per_sample(const ASI_IMG_TYPE asi_img_type);
 int8_t samples_per_pixel(const ASI_IMG_TYPE asi_img_type);
 bool is_color(const ASI_IMG_TYPE asi_img_type);
+double mono_now(void);
+void iso8601_utc(char *dst, const size_t len, const double t);
+int frame_filename(char *dst, const size_t len, const char *filename,
+		   const uint32_t seq);
 void _asilog(int err, const char *fmt, ...);
 
 #endif	/* ASI_UTIL_H */
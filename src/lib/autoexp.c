@@ -0,0 +1,93 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 only,
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License version 2 for more details (a copy is included
+ * in the LICENSE file that accompanied this code).
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Copyright (c) 2017, Thomas Stibor <thomas@stibor.net>
+ */
+
+#include <math.h>
+#include "autoexp.h"
+
+void autoexp_init(struct autoexp *ae, const double percentile,
+		  const double target, const double sat_level,
+		  const double t, const double t_min, const double t_max)
+{
+	*ae = (struct autoexp) {
+		.percentile = percentile,
+		.target = target,
+		.sat_level = sat_level,
+		.t_min = t_min,
+		.t_max = t_max,
+		.t = fmin(fmax(t, t_min), t_max),
+		.offset = 0,
+		.has_last = false,
+		.has_rate = false
+	};
+}
+
+static double clamp_step(const struct autoexp *ae, const double t,
+			 double t_next)
+{
+	t_next = fmin(fmax(t_next, t / AUTOEXP_MAX_STEP),
+		      t * AUTOEXP_MAX_STEP);
+
+	return fmin(fmax(t_next, ae->t_min), ae->t_max);
+}
+
+/* Account the level measured at exposure time t and compute the next
+   exposure time ae->t. Returns true if level is within AUTOEXP_TOL of
+   the target. */
+bool autoexp_update(struct autoexp *ae, const double t, const double level,
+		    const bool track)
+{
+	const bool converged = fabs(level - ae->target) <=
+		AUTOEXP_TOL * ae->target;
+
+	/* Beyond the linear range, the model is of no use. */
+	if (level >= AUTOEXP_SATURATED * ae->sat_level) {
+		ae->t = clamp_step(ae, t, t / AUTOEXP_MAX_STEP);
+		return converged;
+	}
+
+	/* While tracking, the rate changes between measurements. */
+	double rate = 0;
+	if (!track && ae->has_last && fabs(t - ae->t_last) > 0.01 * t) {
+		rate = (level - ae->level_last) / (t - ae->t_last);
+		if (rate > 0)
+			ae->offset = fmin(fmax(level - rate * t, 0), level);
+	}
+	if (rate <= 0)
+		rate = (level - ae->offset) / t;
+
+	if (rate <= 0) {
+		ae->t = clamp_step(ae, t, t * AUTOEXP_MAX_STEP);
+	} else {
+		double predicted = rate;
+
+		if (track && ae->has_rate)
+			predicted *= fmin(fmax(rate / ae->rate,
+					       1.0 / AUTOEXP_MAX_TREND),
+					  AUTOEXP_MAX_TREND);
+		ae->t = clamp_step(ae, t, (ae->target - ae->offset) /
+				   predicted);
+		ae->rate = rate;
+		ae->has_rate = true;
+	}
+
+	ae->t_last = t;
+	ae->level_last = level;
+	ae->has_last = true;
+
+	return converged;
+}
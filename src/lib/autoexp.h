@@ -0,0 +1,58 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 only,
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License version 2 for more details (a copy is included
+ * in the LICENSE file that accompanied this code).
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Copyright (c) 2017, Thomas Stibor <thomas@stibor.net>
+ */
+
+#ifndef AUTOEXP_H
+#define AUTOEXP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define AUTOEXP_MAX_ITER	8	/* Test frames before giving up. */
+#define AUTOEXP_TOL		0.05	/* Converged within this fraction. */
+#define AUTOEXP_MAX_STEP	16	/* Largest change of exposure time. */
+#define AUTOEXP_SATURATED	0.98	/* Of the saturation level. */
+#define AUTOEXP_MAX_TREND	2	/* Largest change of signal rate. */
+
+/* Exposure time which places a percentile of the histogram at a target
+   level, from the linear model level = offset + rate * t. Two
+   measurements at different exposure times determine offset and rate,
+   a single one assumes the last offset. A rate which changes from
+   frame to frame, like the sky brightness at dusk, is extrapolated
+   when tracking a sequence. */
+struct autoexp {
+	double percentile;
+	double target;
+	double sat_level;
+	double t_min;
+	double t_max;
+	double t;		/* Exposure time to use next. */
+	double t_last;
+	double level_last;
+	double offset;
+	double rate;
+	bool has_last;
+	bool has_rate;
+};
+
+void autoexp_init(struct autoexp *ae, const double percentile,
+		  const double target, const double sat_level,
+		  const double t, const double t_min, const double t_max);
+bool autoexp_update(struct autoexp *ae, const double t, const double level,
+		    const bool track);
+
+#endif	/* AUTOEXP_H */
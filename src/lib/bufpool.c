@@ -0,0 +1,217 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 only,
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License version 2 for more details (a copy is included
+ * in the LICENSE file that accompanied this code).
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Copyright (c) 2017, Thomas Stibor <thomas@stibor.net>
+ */
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "log.h"
+#include "bufpool.h"
+
+#define BUFPOOL_HUGE_PAGE	(2 * 1024 * 1024)
+
+static size_t round_up(const size_t size, const size_t align)
+{
+	return (size + align - 1) / align * align;
+}
+
+/* Map a new buffer, falls back to regular pages if no huge pages are
+   available. Called with the pool mutex held. */
+static void *bufpool_map(struct bufpool *pool, const size_t size,
+			 size_t *mapped)
+{
+	void *addr = MAP_FAILED;
+	const int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE;
+
+	if (pool->flags & BUFPOOL_HUGETLB) {
+		*mapped = round_up(size, BUFPOOL_HUGE_PAGE);
+		addr = mmap(NULL, *mapped, PROT_READ | PROT_WRITE,
+			    flags | MAP_HUGETLB, -1, 0);
+		if (addr == MAP_FAILED) {
+			C_WARN("no huge pages for %zu bytes, using regular "
+			       "pages: %s", *mapped, strerror(errno));
+			pool->flags &= ~BUFPOOL_HUGETLB;
+		}
+	}
+	if (addr == MAP_FAILED) {
+		*mapped = round_up(size, sysconf(_SC_PAGESIZE));
+		addr = mmap(NULL, *mapped, PROT_READ | PROT_WRITE, flags, -1, 0);
+		if (addr == MAP_FAILED) {
+			C_ERROR(errno, "mmap %zu bytes", *mapped);
+			return NULL;
+		}
+	}
+
+	if ((pool->flags & BUFPOOL_MLOCK) && mlock(addr, *mapped)) {
+		C_WARN("mlock %zu bytes failed, buffers are not locked: %s",
+		       *mapped, strerror(errno));
+		pool->flags &= ~BUFPOOL_MLOCK;
+	}
+
+	return addr;
+}
+
+int bufpool_init(struct bufpool *pool, const int flags)
+{
+	if (!pool)
+		return -EINVAL;
+
+	memset(pool, 0, sizeof(struct bufpool));
+	pool->flags = flags;
+	pool->bytes_free_max = BUFPOOL_FREE_MAX;
+	pthread_mutex_init(&pool->mutex, NULL);
+
+	return 0;
+}
+
+/* Unmap the least recently used free buffers until no more than
+   bytes_free_max bytes are free. Called with the pool mutex held. */
+static void bufpool_trim(struct bufpool *pool)
+{
+	if (!pool->bytes_free_max)
+		return;
+
+	while (pool->bytes - pool->bytes_used > pool->bytes_free_max) {
+		struct bufpool_entry *lru = NULL;
+
+		for (uint32_t n = 0; n < pool->n_entries; n++) {
+			struct bufpool_entry *e = &pool->entries[n];
+
+			if (e->used || !e->addr)
+				continue;
+			if (!lru || e->last_used < lru->last_used)
+				lru = e;
+		}
+		if (!lru)
+			break;
+
+		munmap(lru->addr, lru->size);
+		pool->bytes -= lru->size;
+		lru->addr = NULL;
+	}
+}
+
+void *bufpool_get(struct bufpool *pool, const size_t size)
+{
+	struct bufpool_entry *entry = NULL;
+	void *addr = NULL;
+	bool grown = false;
+
+	if (size == 0)
+		return NULL;
+
+	pthread_mutex_lock(&pool->mutex);
+
+	/* Smallest free buffer which is large enough. */
+	for (uint32_t n = 0; n < pool->n_entries; n++) {
+		struct bufpool_entry *e = &pool->entries[n];
+
+		if (e->used || !e->addr || e->size < size)
+			continue;
+		if (!entry || e->size < entry->size)
+			entry = e;
+	}
+
+	if (!entry) {
+		/* Reuse a released entry or grow the table. */
+		for (uint32_t n = 0; n < pool->n_entries && !entry; n++)
+			if (!pool->entries[n].addr)
+				entry = &pool->entries[n];
+		if (!entry) {
+			struct bufpool_entry *entries =
+				realloc(pool->entries, (pool->n_entries + 1) *
+					sizeof(struct bufpool_entry));
+			if (!entries) {
+				C_ERROR(ENOMEM, "realloc");
+				goto out;
+			}
+			pool->entries = entries;
+			entry = &pool->entries[pool->n_entries++];
+			memset(entry, 0, sizeof(struct bufpool_entry));
+		}
+
+		entry->addr = bufpool_map(pool, size, &entry->size);
+		if (!entry->addr)
+			goto out;
+		pool->bytes += entry->size;
+		grown = true;
+	}
+
+	entry->used = 1;
+	entry->last_used = ++pool->tick;
+	addr = entry->addr;
+	pool->bytes_used += entry->size;
+	if (pool->bytes_used > pool->bytes_used_max)
+		pool->bytes_used_max = pool->bytes_used;
+	if (++pool->n_used > pool->n_used_max)
+		pool->n_used_max = pool->n_used;
+
+	if (grown)
+		bufpool_trim(pool);
+out:
+	pthread_mutex_unlock(&pool->mutex);
+
+	return addr;
+}
+
+void bufpool_put(struct bufpool *pool, void *buf)
+{
+	if (!buf)
+		return;
+
+	pthread_mutex_lock(&pool->mutex);
+	for (uint32_t n = 0; n < pool->n_entries; n++) {
+		struct bufpool_entry *e = &pool->entries[n];
+
+		if (e->addr == buf && e->used) {
+			e->used = 0;
+			pool->n_used--;
+			pool->bytes_used -= e->size;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&pool->mutex);
+}
+
+void bufpool_report(struct bufpool *pool)
+{
+	pthread_mutex_lock(&pool->mutex);
+	C_INFO("buffer pool high-water: %u buffer(s), %.2f MB, mapped: "
+	       "%.2f MB%s%s", pool->n_used_max, pool->bytes_used_max / 1e6,
+	       pool->bytes / 1e6,
+	       pool->flags & BUFPOOL_HUGETLB ? ", huge pages" : "",
+	       pool->flags & BUFPOOL_MLOCK ? ", locked" : "");
+	pthread_mutex_unlock(&pool->mutex);
+}
+
+void bufpool_destroy(struct bufpool *pool)
+{
+	for (uint32_t n = 0; n < pool->n_entries; n++) {
+		struct bufpool_entry *e = &pool->entries[n];
+
+		if (e->used)
+			C_WARN("buffer %p still in use", e->addr);
+		if (e->addr)
+			munmap(e->addr, e->size);
+	}
+	free(pool->entries);
+	pthread_mutex_destroy(&pool->mutex);
+	memset(pool, 0, sizeof(struct bufpool));
+}
@@ -0,0 +1,66 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 only,
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License version 2 for more details (a copy is included
+ * in the LICENSE file that accompanied this code).
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Copyright (c) 2017, Thomas Stibor <thomas@stibor.net>
+ */
+
+#ifndef BUFPOOL_H
+#define BUFPOOL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#define BUFPOOL_HUGETLB	0x1	/* Back buffers by huge pages. */
+#define BUFPOOL_MLOCK	0x2	/* Lock buffers into memory. */
+#define BUFPOOL_FREE_MAX	(1024UL * 1024 * 1024)	/* Free bytes kept. */
+
+struct bufpool_entry {
+	void *addr;
+	size_t size;		/* Mapped size, multiple of the page size. */
+	int used;
+	uint64_t last_used;	/* Pool tick of the last bufpool_get(). */
+};
+
+/* Page aligned frame buffers which are recycled instead of freed.
+   Buffers are mapped anonymous and prefaulted when created, thus
+   neither zero filled by calloc nor faulted in on the hot path.
+   Buffers of any size can be requested, the smallest free buffer which
+   is large enough is handed out before a new one is created. Free
+   buffers are kept mapped, also when smaller than a request, thus
+   frames of alternating sizes do not remap on every frame. Only when
+   the pool grows and more than bytes_free_max bytes are free, the
+   least recently used free buffers are unmapped. */
+struct bufpool {
+	struct bufpool_entry *entries;
+	uint32_t n_entries;
+	uint32_t n_used;
+	uint32_t n_used_max;	/* High-water mark of buffers in use. */
+	size_t bytes;		/* Mapped by the pool. */
+	size_t bytes_used;
+	size_t bytes_used_max;	/* High-water mark of bytes in use. */
+	size_t bytes_free_max;	/* Free bytes kept mapped, 0 for no limit. */
+	uint64_t tick;
+	int flags;
+	pthread_mutex_t mutex;
+};
+
+int bufpool_init(struct bufpool *pool, const int flags);
+void *bufpool_get(struct bufpool *pool, const size_t size);
+void bufpool_put(struct bufpool *pool, void *buf);
+void bufpool_report(struct bufpool *pool);
+void bufpool_destroy(struct bufpool *pool);
+
+#endif	/* BUFPOOL_H */
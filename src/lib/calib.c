@@ -0,0 +1,463 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 only,
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License version 2 for more details (a copy is included
+ * in the LICENSE file that accompanied this code).
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Copyright (c) 2017, Thomas Stibor <thomas@stibor.net>
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "log.h"
+#include "parallel.h"
+#include "vec.h"
+#include "calib.h"
+
+#define CALIB_BLOCK	2880
+#define CALIB_CARD	80
+
+typedef uint32_t v4su __attribute__((vector_size(16)));
+
+/* Value of card key, NULL if the card is another one. */
+static const char *card_value(const char *card, const char *key)
+{
+	const size_t len = strlen(key);
+
+	if (strncmp(card, key, len) || (len < 8 && card[len] != ' ') ||
+	    strncmp(card + 8, "= ", 2))
+		return NULL;
+
+	return card + 10;
+}
+
+/* Parse the primary header, data follows at the next block boundary. */
+static int master_header(struct calib_master *master)
+{
+	long naxis = -1;
+	double bzero = 0;
+	double bscale = 1;
+	size_t off = 0;
+
+	master->bitpix = 0;
+	master->exp_time = 0;
+	master->temp = NAN;
+
+	for (;;) {
+		char card[CALIB_CARD + 1] = {0};
+		const char *val;
+
+		if (off + CALIB_CARD > master->map_size)
+			return -EINVAL;
+		memcpy(card, master->map + off, CALIB_CARD);
+		off += CALIB_CARD;
+
+		if (!strncmp(card, "END     ", 8))
+			break;
+		if ((val = card_value(card, "BITPIX")))
+			master->bitpix = atoi(val);
+		else if ((val = card_value(card, "NAXIS")))
+			naxis = atol(val);
+		else if ((val = card_value(card, "NAXIS1")))
+			master->width = atol(val);
+		else if ((val = card_value(card, "NAXIS2")))
+			master->height = atol(val);
+		else if ((val = card_value(card, "BZERO")))
+			bzero = atof(val);
+		else if ((val = card_value(card, "BSCALE")))
+			bscale = atof(val);
+		else if ((val = card_value(card, "EXPTIME")) ||
+			 (val = card_value(card, "EXPOSURE")))
+			master->exp_time = atof(val);
+		else if ((val = card_value(card, "CCD-TEMP")))
+			master->temp = atof(val);
+	}
+
+	if (naxis != 2 || bscale != 1 ||
+	    (master->bitpix != 8 && master->bitpix != 16 &&
+	     master->bitpix != -32)) {
+		C_ERROR(EINVAL, "'%s' is no uncompressed 2 axis 8, 16 or -32 "
+			"bit image", master->filename);
+		return -EINVAL;
+	}
+	master->bzero = master->bitpix == 16 && bzero == 32768;
+
+	off = (off + CALIB_BLOCK - 1) / CALIB_BLOCK * CALIB_BLOCK;
+	if (off + (size_t)master->width * master->height *
+	    abs(master->bitpix) / 8 > master->map_size) {
+		C_ERROR(EINVAL, "'%s' is truncated", master->filename);
+		return -EINVAL;
+	}
+	master->data = master->map + off;
+
+	return 0;
+}
+
+static inline float master_sample(const struct calib_master *master,
+				  const size_t i)
+{
+	const uint8_t *p;
+	uint32_t u;
+	float f;
+
+	switch (master->bitpix) {
+	case 8:
+		return master->data[i];
+	case 16:
+		p = master->data + 2 * i;
+		u = p[0] << 8 | p[1];
+		return master->bzero ? (float)(u ^ 0x8000) : (float)(int16_t)u;
+	default:
+		p = master->data + 4 * i;
+		u = (uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+		memcpy(&f, &u, sizeof(f));
+		return f;
+	}
+}
+
+/* Samples i, ..., i + 3 from big endian. */
+static inline __attribute__((always_inline))
+v4sf master_load(const struct calib_master *master, const size_t i)
+{
+	v4si v;
+	v4su u;
+
+	switch (master->bitpix) {
+	case 8:
+		return __builtin_convertvector(vec_load(master->data, i, 1), v4sf);
+	case 16:
+		v = vec_load(master->data, i, 2);
+		v = ((v >> 8) & 0xff) | ((v & 0xff) << 8);
+		v = master->bzero ? v ^ 0x8000 : (v ^ 0x8000) - 0x8000;
+		return __builtin_convertvector(v, v4sf);
+	default:
+		memcpy(&u, master->data + 4 * i, sizeof(u));
+		u = (u >> 24) | ((u >> 8) & 0xff00) | ((u << 8) & 0xff0000) |
+			(u << 24);
+		return (v4sf)u;
+	}
+}
+
+int calib_master_open(struct calib_master *master, const char *filename)
+{
+	int rc;
+	int fd;
+	struct stat st;
+
+	memset(master, 0, sizeof(struct calib_master));
+	strncpy(master->filename, filename, PATH_MAX);
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0) {
+		rc = -errno;
+		C_ERROR(errno, "open '%s'", filename);
+		return rc;
+	}
+	if (fstat(fd, &st)) {
+		rc = -errno;
+		C_ERROR(errno, "fstat '%s'", filename);
+		close(fd);
+		return rc;
+	}
+
+	/* The mapping holds the file, the descriptor is not needed. */
+	master->map_size = st.st_size;
+	master->map = mmap(NULL, master->map_size, PROT_READ, MAP_PRIVATE,
+			   fd, 0);
+	close(fd);
+	if (master->map == MAP_FAILED) {
+		rc = -errno;
+		master->map = NULL;
+		C_ERROR(errno, "mmap '%s'", filename);
+		return rc;
+	}
+	madvise(master->map, master->map_size, MADV_WILLNEED);
+
+	rc = master_header(master);
+	if (rc) {
+		calib_master_close(master);
+		return rc;
+	}
+
+	C_INFO("master '%s' %u x %u, bitpix %d, exposure %.3f, temperature "
+	       "%.1f", filename, master->width, master->height,
+	       master->bitpix, master->exp_time, master->temp);
+
+	return 0;
+}
+
+void calib_master_close(struct calib_master *master)
+{
+	if (master->map)
+		munmap(master->map, master->map_size);
+	master->map = NULL;
+	master->data = NULL;
+}
+
+static bool same_size(const struct calib_master *a,
+		      const struct calib_master *b)
+{
+	if (a->width == b->width && a->height == b->height)
+		return true;
+
+	C_ERROR(EINVAL, "master '%s' %u x %u does not match '%s' %u x %u",
+		b->filename, b->width, b->height, a->filename, a->width,
+		a->height);
+	return false;
+}
+
+/* Open the masters, darks is a comma separated list of which the dark
+   closest in temperature and exposure is used per frame. */
+int calib_init(struct calib *calib, const char *bias, const char *darks,
+	       const char *flat, const bool scale)
+{
+	int rc = 0;
+	const struct calib_master *first = NULL;
+
+	memset(calib, 0, sizeof(struct calib));
+	calib->scale = scale;
+
+	if (scale && !(bias && strlen(bias))) {
+		C_ERROR(EINVAL, "scaling darks requires a master bias");
+		return -EINVAL;
+	}
+
+	if (bias && strlen(bias)) {
+		rc = calib_master_open(&calib->bias, bias);
+		if (rc)
+			goto cleanup;
+		calib->has_bias = true;
+		first = &calib->bias;
+	}
+
+	if (darks && strlen(darks)) {
+		char dup[PATH_MAX + 1] = {0};
+		char *saveptr = NULL;
+
+		strncpy(dup, darks, PATH_MAX);
+		for (char *tok = strtok_r(dup, ",", &saveptr); tok;
+		     tok = strtok_r(NULL, ",", &saveptr)) {
+			if (calib->n_darks == CALIB_MAX_DARKS) {
+				rc = -E2BIG;
+				C_ERROR(rc, "more than %d darks", CALIB_MAX_DARKS);
+				goto cleanup;
+			}
+			rc = calib_master_open(&calib->darks[calib->n_darks], tok);
+			if (rc)
+				goto cleanup;
+			calib->n_darks++;
+			if (!first)
+				first = &calib->darks[0];
+			if (!same_size(first, &calib->darks[calib->n_darks - 1])) {
+				rc = -EINVAL;
+				goto cleanup;
+			}
+		}
+	}
+
+	if (flat && strlen(flat)) {
+		rc = calib_master_open(&calib->flat, flat);
+		if (rc)
+			goto cleanup;
+		calib->has_flat = true;
+		if (first && !same_size(first, &calib->flat)) {
+			rc = -EINVAL;
+			goto cleanup;
+		}
+
+		const size_t n = (size_t)calib->flat.width * calib->flat.height;
+		double sum = 0;
+		for (size_t i = 0; i < n; i++)
+			sum += master_sample(&calib->flat, i);
+		calib->flat.mean = sum / n;
+		if (!(calib->flat.mean > 0)) {
+			rc = -EINVAL;
+			C_ERROR(rc, "master flat '%s' has mean %f", flat,
+				calib->flat.mean);
+			goto cleanup;
+		}
+	}
+
+	return 0;
+
+cleanup:
+	calib_destroy(calib);
+
+	return rc;
+}
+
+/* Dark of the nearest temperature if known, of the nearest exposure
+   time among those. */
+const struct calib_master *calib_dark(const struct calib *calib,
+				      const double exp_time,
+				      const double temp)
+{
+	const struct calib_master *best = NULL;
+	double best_temp = INFINITY;
+	double best_exp = INFINITY;
+
+	for (uint32_t n = 0; n < calib->n_darks; n++) {
+		const struct calib_master *dark = &calib->darks[n];
+		const double d_temp = isnan(temp) || isnan(dark->temp) ?
+			0 : fabs(dark->temp - temp);
+		const double d_exp = fabs(dark->exp_time - exp_time);
+
+		if (d_temp < best_temp ||
+		    (d_temp == best_temp && d_exp < best_exp)) {
+			best = dark;
+			best_temp = d_temp;
+			best_exp = d_exp;
+		}
+	}
+
+	return best;
+}
+
+struct calib_job {
+	const struct calib *calib;
+	const struct calib_master *dark;
+	uint8_t *dst;
+	const uint8_t *src;
+	uint32_t width;
+	uint8_t bps;
+	float k_bias;		/* Weight of the bias, 1 - s with a dark. */
+	float s;		/* Weight of the dark. */
+	float max;
+};
+
+static inline float calib_sample(const struct calib_job *job, const size_t i)
+{
+	const struct calib *calib = job->calib;
+	float v = job->bps == 2 ? ((const uint16_t *)job->src)[i] :
+		job->src[i];
+
+	if (calib->has_bias)
+		v -= job->k_bias * master_sample(&calib->bias, i);
+	if (job->dark)
+		v -= job->s * master_sample(job->dark, i);
+	if (calib->has_flat) {
+		const float f = master_sample(&calib->flat, i);
+		if (f > 0)
+			v *= calib->flat.mean / f;
+	}
+
+	return v < 0 ? 0 : v > job->max ? job->max : v + 0.5f;
+}
+
+static inline v4sf fsel(const v4si m, const v4sf a, const v4sf b)
+{
+	return (v4sf)(((v4si)a & m) | ((v4si)b & ~m));
+}
+
+static inline __attribute__((always_inline))
+void calib_row(const struct calib_job *job, const uint32_t y,
+	       const uint8_t bps)
+{
+	const struct calib *calib = job->calib;
+	const size_t row = (size_t)y * job->width;
+	const v4sf zero = {0};
+	const v4sf vmax = zero + job->max;
+	const v4sf mean = zero + (float)calib->flat.mean;
+	uint32_t x = 0;
+
+	for (; x + VEC_LANES <= job->width; x += VEC_LANES) {
+		const size_t i = row + x;
+		v4sf v = __builtin_convertvector(vec_load(job->src, i, bps), v4sf);
+
+		if (calib->has_bias)
+			v -= job->k_bias * master_load(&calib->bias, i);
+		if (job->dark)
+			v -= job->s * master_load(job->dark, i);
+		if (calib->has_flat) {
+			const v4sf f = master_load(&calib->flat, i);
+			v = fsel(f > zero, v * (mean / f), v);
+		}
+		v = fsel(v < zero, zero, v);
+		v = fsel(v > vmax, vmax, v + 0.5f);
+
+		vec_store(job->dst, i, __builtin_convertvector(v, v4si), bps);
+	}
+	for (; x < job->width; x++) {
+		const size_t i = row + x;
+		const uint32_t v = calib_sample(job, i);
+
+		if (bps == 2)
+			((uint16_t *)job->dst)[i] = v;
+		else
+			job->dst[i] = v;
+	}
+}
+
+static void calib_rows(const uint32_t begin, const uint32_t end, void *arg)
+{
+	const struct calib_job *job = arg;
+
+	for (uint32_t y = begin; y < end; y++) {
+		if (job->bps == 2)
+			calib_row(job, y, 2);
+		else
+			calib_row(job, y, 1);
+	}
+}
+
+/* Calibrate a frame of exposure exp_time taken at sensor temperature
+   temp (NAN if unknown) from src into dst, saturating at the range of
+   bytes_per_sample. */
+int calib_apply(const struct calib *calib, uint8_t *dst, const uint8_t *src,
+		const uint32_t width, const uint32_t height,
+		const uint8_t bytes_per_sample, const double exp_time,
+		const double temp)
+{
+	const struct calib_master *dark = calib_dark(calib, exp_time, temp);
+	const struct calib_master *master = calib->has_bias ? &calib->bias :
+		dark ? dark : calib->has_flat ? &calib->flat : NULL;
+
+	if (!master || (bytes_per_sample != 1 && bytes_per_sample != 2))
+		return -EINVAL;
+	if (master->width != width || master->height != height)
+		return -ERANGE;
+
+	struct calib_job job = {
+		.calib = calib,
+		.dark = dark,
+		.dst = dst,
+		.src = src,
+		.width = width,
+		.bps = bytes_per_sample,
+		.k_bias = 1,
+		.s = 1,
+		.max = bytes_per_sample == 2 ? UINT16_MAX : UINT8_MAX
+	};
+	if (dark && calib->scale && dark->exp_time > 0)
+		job.s = exp_time / dark->exp_time;
+	if (dark)
+		job.k_bias = 1 - job.s;
+
+	return parallel_for(height, calib_rows, &job);
+}
+
+void calib_destroy(struct calib *calib)
+{
+	calib_master_close(&calib->bias);
+	for (uint32_t n = 0; n < calib->n_darks; n++)
+		calib_master_close(&calib->darks[n]);
+	calib_master_close(&calib->flat);
+	calib->has_bias = false;
+	calib->has_flat = false;
+	calib->n_darks = 0;
+}
@@ -0,0 +1,71 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 only,
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License version 2 for more details (a copy is included
+ * in the LICENSE file that accompanied this code).
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Copyright (c) 2017, Thomas Stibor <thomas@stibor.net>
+ */
+
+#ifndef CALIB_H
+#define CALIB_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <limits.h>
+
+#define CALIB_MAX_DARKS	16
+
+/* Master frame, a 2 axis image of a fit file which is mapped into
+   memory and read in place (big endian, BITPIX 8, 16 or -32). */
+struct calib_master {
+	char filename[PATH_MAX + 1];
+	uint8_t *map;
+	size_t map_size;
+	const uint8_t *data;
+	uint32_t width;
+	uint32_t height;
+	int bitpix;
+	bool bzero;		/* 16 bit unsigned, BZERO 32768. */
+	double exp_time;	/* EXPTIME or EXPOSURE, 0 if missing. */
+	double temp;		/* CCD-TEMP, NAN if missing. */
+	double mean;
+};
+
+/* out = (light - bias - s * (dark - bias)) * mean(flat) / flat, where
+   s is the ratio of the light and dark exposure time if scale is set,
+   otherwise 1. Each master is optional. */
+struct calib {
+	struct calib_master bias;
+	struct calib_master darks[CALIB_MAX_DARKS];
+	struct calib_master flat;
+	uint32_t n_darks;
+	bool has_bias;
+	bool has_flat;
+	bool scale;
+};
+
+int calib_master_open(struct calib_master *master, const char *filename);
+void calib_master_close(struct calib_master *master);
+int calib_init(struct calib *calib, const char *bias, const char *darks,
+	       const char *flat, const bool scale);
+const struct calib_master *calib_dark(const struct calib *calib,
+				      const double exp_time,
+				      const double temp);
+int calib_apply(const struct calib *calib, uint8_t *dst, const uint8_t *src,
+		const uint32_t width, const uint32_t height,
+		const uint8_t bytes_per_sample, const double exp_time,
+		const double temp);
+void calib_destroy(struct calib *calib);
+
+#endif	/* CALIB_H */
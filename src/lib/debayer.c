@@ -0,0 +1,423 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 only,
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License version 2 for more details (a copy is included
+ * in the LICENSE file that accompanied this code).
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Copyright (c) 2017, Thomas Stibor <thomas@stibor.net>
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include "parallel.h"
+#include "vec.h"
+#include "debayer.h"
+
+#define DEBAYER_BORDER	2	/* Rows and columns of the scalar code. */
+
+enum {
+	PLANE_R = 0,
+	PLANE_G,
+	PLANE_B
+};
+
+/* Plane of the color at (x & 1, y & 1), index 2 * (y & 1) + (x & 1). */
+static const uint8_t cfa_patterns[4][4] = {
+	[BAYER_RG] = {PLANE_R, PLANE_G, PLANE_G, PLANE_B},
+	[BAYER_BG] = {PLANE_B, PLANE_G, PLANE_G, PLANE_R},
+	[BAYER_GR] = {PLANE_G, PLANE_R, PLANE_B, PLANE_G},
+	[BAYER_GB] = {PLANE_G, PLANE_B, PLANE_R, PLANE_G}
+};
+
+struct debayer_job {
+	uint8_t *plane[3];
+	const uint8_t *raw;
+	int32_t width;
+	int32_t height;
+	uint8_t bps;
+	int32_t max;
+	uint8_t cfa[4];
+};
+
+/* Mirror at the border, which keeps the color of a position. */
+static inline int32_t reflect(int32_t i, const int32_t n)
+{
+	if (i < 0)
+		i = -i;
+	if (i >= n)
+		i = 2 * (n - 1) - i;
+
+	return i;
+}
+
+static inline int32_t clamp(const int32_t v, const int32_t max)
+{
+	return v < 0 ? 0 : v > max ? max : v;
+}
+
+static inline int32_t sample(const uint8_t *img, const struct debayer_job *job,
+			     const int32_t x, const int32_t y)
+{
+	const size_t i = (size_t)reflect(y, job->height) * job->width +
+		reflect(x, job->width);
+
+	return job->bps == 2 ? ((const uint16_t *)img)[i] : img[i];
+}
+
+static inline void put(const struct debayer_job *job, const uint8_t plane,
+		       const size_t i, const int32_t v)
+{
+	if (job->bps == 2)
+		((uint16_t *)job->plane[plane])[i] = v;
+	else
+		job->plane[plane][i] = v;
+}
+
+/* Plane of the non green positions in row y and their column parity. */
+static inline void row_color(const struct debayer_job *job, const int32_t y,
+			     uint8_t *p, int32_t *parity)
+{
+	const uint8_t *cfa = job->cfa + 2 * (y & 1);
+
+	*parity = cfa[0] == PLANE_G;
+	*p = cfa[*parity];
+}
+
+/* Lanes of the non green positions, the vector code starts at the
+   even column DEBAYER_BORDER. */
+static inline v4si lanes(const int32_t parity)
+{
+	const v4si odd = {0, -1, 0, -1};
+
+	return parity ? odd : ~odd;
+}
+
+static inline bool border_row(const struct debayer_job *job, const int32_t y)
+{
+	return y < DEBAYER_BORDER || y >= job->height - DEBAYER_BORDER;
+}
+
+/* Bilinear: average of the 2 or 4 nearest samples of a color. */
+static void bilinear_px(const struct debayer_job *job, const int32_t x,
+			const int32_t y)
+{
+	const uint8_t *m = job->raw;
+	const size_t i = (size_t)y * job->width + x;
+	const int32_t c = sample(m, job, x, y);
+	const int32_t h = sample(m, job, x - 1, y) + sample(m, job, x + 1, y);
+	const int32_t v = sample(m, job, x, y - 1) + sample(m, job, x, y + 1);
+	uint8_t p;
+	int32_t parity;
+
+	row_color(job, y, &p, &parity);
+	if ((x & 1) == parity) {
+		const int32_t d = sample(m, job, x - 1, y - 1) +
+			sample(m, job, x + 1, y - 1) +
+			sample(m, job, x - 1, y + 1) +
+			sample(m, job, x + 1, y + 1);
+
+		put(job, p, i, c);
+		put(job, PLANE_G, i, (h + v + 2) >> 2);
+		put(job, PLANE_B - p, i, (d + 2) >> 2);
+	} else {
+		put(job, p, i, (h + 1) >> 1);
+		put(job, PLANE_G, i, c);
+		put(job, PLANE_B - p, i, (v + 1) >> 1);
+	}
+}
+
+static inline __attribute__((always_inline))
+void bilinear_row(const struct debayer_job *job, const int32_t y,
+		  const uint8_t bps)
+{
+	const size_t w = job->width;
+	const uint8_t *m = job->raw;
+	uint8_t p;
+	int32_t parity;
+	int32_t x = 0;
+
+	row_color(job, y, &p, &parity);
+	const v4si mp = lanes(parity);
+
+	if (!border_row(job, y)) {
+		for (; x < DEBAYER_BORDER; x++)
+			bilinear_px(job, x, y);
+		for (; x + VEC_LANES <= job->width - DEBAYER_BORDER;
+		     x += VEC_LANES) {
+			const size_t i = y * w + x;
+			const v4si c = vec_load(m, i, bps);
+			const v4si h = vec_load(m, i - 1, bps) +
+				vec_load(m, i + 1, bps);
+			const v4si v = vec_load(m, i - w, bps) +
+				vec_load(m, i + w, bps);
+			const v4si d = vec_load(m, i - w - 1, bps) +
+				vec_load(m, i - w + 1, bps) +
+				vec_load(m, i + w - 1, bps) +
+				vec_load(m, i + w + 1, bps);
+
+			vec_store(job->plane[p], i, vec_sel(mp, c, (h + 1) >> 1), bps);
+			vec_store(job->plane[PLANE_G], i,
+			       vec_sel(mp, (h + v + 2) >> 2, c), bps);
+			vec_store(job->plane[PLANE_B - p], i,
+			       vec_sel(mp, (d + 2) >> 2, (v + 1) >> 1), bps);
+		}
+	}
+	for (; x < job->width; x++)
+		bilinear_px(job, x, y);
+}
+
+static void bilinear_rows(const uint32_t begin, const uint32_t end, void *arg)
+{
+	const struct debayer_job *job = arg;
+
+	for (uint32_t y = begin; y < end; y++) {
+		if (job->bps == 2)
+			bilinear_row(job, y, 2);
+		else
+			bilinear_row(job, y, 1);
+	}
+}
+
+/* Edge directed green: interpolated along the direction of the smaller
+   gradient and corrected by the second derivative of the center color
+   (Hamilton-Adams). */
+static void green_px(const struct debayer_job *job, const int32_t x,
+		     const int32_t y)
+{
+	const uint8_t *m = job->raw;
+	const size_t i = (size_t)y * job->width + x;
+	const int32_t c = sample(m, job, x, y);
+
+	if (job->cfa[2 * (y & 1) + (x & 1)] == PLANE_G) {
+		put(job, PLANE_G, i, c);
+		return;
+	}
+
+	const int32_t w = sample(m, job, x - 1, y);
+	const int32_t e = sample(m, job, x + 1, y);
+	const int32_t n = sample(m, job, x, y - 1);
+	const int32_t s = sample(m, job, x, y + 1);
+	const int32_t lh = 2 * c - sample(m, job, x - 2, y) -
+		sample(m, job, x + 2, y);
+	const int32_t lv = 2 * c - sample(m, job, x, y - 2) -
+		sample(m, job, x, y + 2);
+	const int32_t gh = 2 * (w + e) + lh;
+	const int32_t gv = 2 * (n + s) + lv;
+	const int32_t dh = abs(w - e) + abs(lh);
+	const int32_t dv = abs(n - s) + abs(lv);
+	int32_t g;
+
+	if (dh < dv)
+		g = (gh + 2) >> 2;
+	else if (dv < dh)
+		g = (gv + 2) >> 2;
+	else
+		g = (gh + gv + 4) >> 3;
+
+	put(job, PLANE_G, i, clamp(g, job->max));
+}
+
+static inline __attribute__((always_inline))
+void green_row(const struct debayer_job *job, const int32_t y,
+	       const uint8_t bps)
+{
+	const size_t w = job->width;
+	const uint8_t *m = job->raw;
+	uint8_t p;
+	int32_t parity;
+	int32_t x = 0;
+
+	row_color(job, y, &p, &parity);
+	const v4si mp = lanes(parity);
+
+	if (!border_row(job, y)) {
+		for (; x < DEBAYER_BORDER; x++)
+			green_px(job, x, y);
+		for (; x + VEC_LANES <= job->width - DEBAYER_BORDER;
+		     x += VEC_LANES) {
+			const size_t i = y * w + x;
+			const v4si c = vec_load(m, i, bps);
+			const v4si vw = vec_load(m, i - 1, bps);
+			const v4si ve = vec_load(m, i + 1, bps);
+			const v4si vn = vec_load(m, i - w, bps);
+			const v4si vs = vec_load(m, i + w, bps);
+			const v4si lh = 2 * c - vec_load(m, i - 2, bps) -
+				vec_load(m, i + 2, bps);
+			const v4si lv = 2 * c - vec_load(m, i - 2 * w, bps) -
+				vec_load(m, i + 2 * w, bps);
+			const v4si gh = 2 * (vw + ve) + lh;
+			const v4si gv = 2 * (vn + vs) + lv;
+			const v4si dh = vec_abs(vw - ve) + vec_abs(lh);
+			const v4si dv = vec_abs(vn - vs) + vec_abs(lv);
+			const v4si g = vec_sel(dh < dv, (gh + 2) >> 2,
+					    vec_sel(dv < dh, (gv + 2) >> 2,
+						 (gh + gv + 4) >> 3));
+
+			vec_store(job->plane[PLANE_G], i,
+			       vec_sel(mp, vec_clamp(g, job->max), c), bps);
+		}
+	}
+	for (; x < job->width; x++)
+		green_px(job, x, y);
+}
+
+static void green_rows(const uint32_t begin, const uint32_t end, void *arg)
+{
+	const struct debayer_job *job = arg;
+
+	for (uint32_t y = begin; y < end; y++) {
+		if (job->bps == 2)
+			green_row(job, y, 2);
+		else
+			green_row(job, y, 1);
+	}
+}
+
+/* Red and blue from the interpolated green plus the averaged color
+   difference of the nearest samples, which avoids color fringes at
+   edges. */
+static void chroma_px(const struct debayer_job *job, const int32_t x,
+		      const int32_t y)
+{
+	const uint8_t *m = job->raw;
+	const uint8_t *g = job->plane[PLANE_G];
+	const size_t i = (size_t)y * job->width + x;
+	const int32_t c = sample(m, job, x, y);
+	const int32_t gc = sample(g, job, x, y);
+	uint8_t p;
+	int32_t parity;
+
+	row_color(job, y, &p, &parity);
+	if ((x & 1) == parity) {
+		const int32_t d = sample(m, job, x - 1, y - 1) -
+			sample(g, job, x - 1, y - 1) +
+			sample(m, job, x + 1, y - 1) -
+			sample(g, job, x + 1, y - 1) +
+			sample(m, job, x - 1, y + 1) -
+			sample(g, job, x - 1, y + 1) +
+			sample(m, job, x + 1, y + 1) -
+			sample(g, job, x + 1, y + 1);
+
+		put(job, p, i, c);
+		put(job, PLANE_B - p, i, clamp(gc + ((d + 2) >> 2), job->max));
+	} else {
+		const int32_t h = sample(m, job, x - 1, y) -
+			sample(g, job, x - 1, y) +
+			sample(m, job, x + 1, y) -
+			sample(g, job, x + 1, y);
+		const int32_t v = sample(m, job, x, y - 1) -
+			sample(g, job, x, y - 1) +
+			sample(m, job, x, y + 1) -
+			sample(g, job, x, y + 1);
+
+		put(job, p, i, clamp(gc + ((h + 1) >> 1), job->max));
+		put(job, PLANE_B - p, i, clamp(gc + ((v + 1) >> 1), job->max));
+	}
+}
+
+static inline __attribute__((always_inline))
+void chroma_row(const struct debayer_job *job, const int32_t y,
+		const uint8_t bps)
+{
+	const size_t w = job->width;
+	const uint8_t *m = job->raw;
+	const uint8_t *g = job->plane[PLANE_G];
+	uint8_t p;
+	int32_t parity;
+	int32_t x = 0;
+
+	row_color(job, y, &p, &parity);
+	const v4si mp = lanes(parity);
+
+	if (!border_row(job, y)) {
+		for (; x < DEBAYER_BORDER; x++)
+			chroma_px(job, x, y);
+		for (; x + VEC_LANES <= job->width - DEBAYER_BORDER;
+		     x += VEC_LANES) {
+			const size_t i = y * w + x;
+			const v4si c = vec_load(m, i, bps);
+			const v4si gc = vec_load(g, i, bps);
+			const v4si h = vec_load(m, i - 1, bps) - vec_load(g, i - 1, bps) +
+				vec_load(m, i + 1, bps) - vec_load(g, i + 1, bps);
+			const v4si v = vec_load(m, i - w, bps) - vec_load(g, i - w, bps) +
+				vec_load(m, i + w, bps) - vec_load(g, i + w, bps);
+			const v4si d =
+				vec_load(m, i - w - 1, bps) - vec_load(g, i - w - 1, bps) +
+				vec_load(m, i - w + 1, bps) - vec_load(g, i - w + 1, bps) +
+				vec_load(m, i + w - 1, bps) - vec_load(g, i + w - 1, bps) +
+				vec_load(m, i + w + 1, bps) - vec_load(g, i + w + 1, bps);
+
+			vec_store(job->plane[p], i,
+			       vec_sel(mp, c, vec_clamp(gc + ((h + 1) >> 1), job->max)),
+			       bps);
+			vec_store(job->plane[PLANE_B - p], i,
+			       vec_clamp(gc + vec_sel(mp, (d + 2) >> 2, (v + 1) >> 1),
+				      job->max), bps);
+		}
+	}
+	for (; x < job->width; x++)
+		chroma_px(job, x, y);
+}
+
+static void chroma_rows(const uint32_t begin, const uint32_t end, void *arg)
+{
+	const struct debayer_job *job = arg;
+
+	for (uint32_t y = begin; y < end; y++) {
+		if (job->bps == 2)
+			chroma_row(job, y, 2);
+		else
+			chroma_row(job, y, 1);
+	}
+}
+
+/* Interpolate the mosaic raw of width x height samples with
+   bytes_per_sample 1 or 2 into an R, G, B plane cube, in parallel by
+   bands of rows. */
+int debayer(uint8_t *planar, const uint8_t *raw, const uint32_t width,
+	    const uint32_t height, const uint8_t bytes_per_sample,
+	    const enum bayer_pattern pattern, const enum debayer_algo algo)
+{
+	int rc;
+
+	if (width < 2 * DEBAYER_BORDER || height < 2 * DEBAYER_BORDER ||
+	    (bytes_per_sample != 1 && bytes_per_sample != 2) ||
+	    pattern > BAYER_GB)
+		return -EINVAL;
+
+	const size_t plane = (size_t)width * height * bytes_per_sample;
+	struct debayer_job job = {
+		.plane = {planar, planar + plane, planar + 2 * plane},
+		.raw = raw,
+		.width = width,
+		.height = height,
+		.bps = bytes_per_sample,
+		.max = bytes_per_sample == 2 ? UINT16_MAX : UINT8_MAX
+	};
+	memcpy(job.cfa, cfa_patterns[pattern], sizeof(job.cfa));
+
+	switch (algo) {
+	case DEBAYER_BILINEAR:
+		return parallel_for(height, bilinear_rows, &job);
+	case DEBAYER_EDGE:
+		/* Color differences need the green of adjacent rows, which
+		   belong to other bands. */
+		rc = parallel_for(height, green_rows, &job);
+		if (rc)
+			return rc;
+		return parallel_for(height, chroma_rows, &job);
+	default:
+		return -EINVAL;
+	}
+}
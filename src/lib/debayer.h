@@ -0,0 +1,42 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 only,
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License version 2 for more details (a copy is included
+ * in the LICENSE file that accompanied this code).
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Copyright (c) 2017, Thomas Stibor <thomas@stibor.net>
+ */
+
+#ifndef DEBAYER_H
+#define DEBAYER_H
+
+#include <stdint.h>
+
+enum debayer_algo {
+	DEBAYER_NONE = 0,
+	DEBAYER_BILINEAR,
+	DEBAYER_EDGE		/* Edge directed green, color differences. */
+};
+
+/* Color of the top left 2 x 2 cell, same order as ASI_BAYER_PATTERN. */
+enum bayer_pattern {
+	BAYER_RG = 0,
+	BAYER_BG,
+	BAYER_GR,
+	BAYER_GB
+};
+
+int debayer(uint8_t *planar, const uint8_t *raw, const uint32_t width,
+	    const uint32_t height, const uint8_t bytes_per_sample,
+	    const enum bayer_pattern pattern, const enum debayer_algo algo);
+
+#endif	/* DEBAYER_H */
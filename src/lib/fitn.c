@@ -0,0 +1,373 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 only,
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License version 2 for more details (a copy is included
+ * in the LICENSE file that accompanied this code).
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Copyright (c) 2017, Thomas Stibor <thomas@stibor.net>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+#include "log.h"
+#include "fitn.h"
+
+#define FITN_CHUNK	(256 * 1024)	/* Pixels converted at once. */
+
+static char *fitn_card(struct fitn_hdr *hdr)
+{
+	if (hdr->n_cards == FITN_MAX_CARDS) {
+		hdr->rc = -E2BIG;
+		return NULL;
+	}
+
+	char *card = hdr->cards[hdr->n_cards++];
+	memset(card, ' ', FITN_CARD);
+
+	return card;
+}
+
+/* Fixed format card, the value ends in column 30 unless it is a
+   string. */
+static void fitn_key(struct fitn_hdr *hdr, const char *key, const char *val,
+		     const char *comment)
+{
+	char line[FITN_CARD + 1];
+	char *card = fitn_card(hdr);
+
+	if (!card)
+		return;
+
+	int len = snprintf(line, sizeof(line), "%-8.8s= %20s", key, val);
+	if (comment && len < FITN_CARD)
+		len += snprintf(line + len, sizeof(line) - len, " / %s",
+				comment);
+	if (len > FITN_CARD)
+		len = FITN_CARD;
+	memcpy(card, line, len);
+}
+
+/* Image of width x height, a cube if there is more than one plane. */
+void fitn_init(struct fitn_hdr *hdr, const int bytes_per_pixel,
+	       const long width, const long height, const long planes)
+{
+	memset(hdr, 0, sizeof(struct fitn_hdr));
+
+	fitn_key(hdr, "SIMPLE", "T", "file does conform to FITS standard");
+	fitn_key_long(hdr, "BITPIX", 8 * bytes_per_pixel,
+		      "number of bits per data pixel");
+	fitn_key_long(hdr, "NAXIS", planes > 1 ? 3 : 2, "number of data axes");
+	fitn_key_long(hdr, "NAXIS1", width, "length of data axis 1");
+	fitn_key_long(hdr, "NAXIS2", height, "length of data axis 2");
+	if (planes > 1)
+		fitn_key_long(hdr, "NAXIS3", planes, "length of data axis 3");
+	fitn_key(hdr, "EXTEND", "T", "FITS dataset may contain extensions");
+	/* 16 bit is signed in FITS, unsigned is stored with an offset. */
+	if (bytes_per_pixel == 2) {
+		fitn_key_long(hdr, "BZERO", 32768,
+			      "offset data range to that of unsigned short");
+		fitn_key_long(hdr, "BSCALE", 1, "default scaling factor");
+	}
+}
+
+void fitn_key_str(struct fitn_hdr *hdr, const char *key, const char *val,
+		  const char *comment)
+{
+	char quoted[FITN_CARD + 1];
+	size_t n = 0;
+
+	/* Quotes are escaped by doubling, the string is padded to at
+	   least 8 characters. */
+	quoted[n++] = '\'';
+	for (const char *p = val; *p && n < FITN_CARD - 12; p++) {
+		if (*p == '\'')
+			quoted[n++] = '\'';
+		quoted[n++] = *p;
+	}
+	while (n < 9)
+		quoted[n++] = ' ';
+	quoted[n++] = '\'';
+	quoted[n] = '\0';
+
+	char line[FITN_CARD + 1];
+	char *card = fitn_card(hdr);
+
+	if (!card)
+		return;
+
+	int len = snprintf(line, sizeof(line), "%-8.8s= %-20s", key, quoted);
+	if (comment && len < FITN_CARD)
+		len += snprintf(line + len, sizeof(line) - len, " / %s",
+				comment);
+	if (len > FITN_CARD)
+		len = FITN_CARD;
+	memcpy(card, line, len);
+}
+
+void fitn_key_long(struct fitn_hdr *hdr, const char *key,
+		   const long long val, const char *comment)
+{
+	char str[32];
+
+	snprintf(str, sizeof(str), "%lld", val);
+	fitn_key(hdr, key, str, comment);
+}
+
+void fitn_key_double(struct fitn_hdr *hdr, const char *key, const double val,
+		     const int precision, const char *comment)
+{
+	char str[32];
+
+	snprintf(str, sizeof(str), "%.*G", precision, val);
+	/* A real must not be read as integer. */
+	if (!strpbrk(str, ".EN"))
+		strcat(str, ".");
+	fitn_key(hdr, key, str, comment);
+}
+
+void fitn_comment(struct fitn_hdr *hdr, const char *text)
+{
+	char *card = fitn_card(hdr);
+
+	if (!card)
+		return;
+
+	memcpy(card, "COMMENT ", 8);
+	size_t len = strlen(text);
+	if (len > FITN_CARD - 8)
+		len = FITN_CARD - 8;
+	memcpy(card + 8, text, len);
+}
+
+static size_t fitn_hdr_size(const struct fitn_hdr *hdr)
+{
+	const size_t len = (hdr->n_cards + 1) * FITN_CARD;
+
+	return (len + FITN_BLOCK - 1) / FITN_BLOCK * FITN_BLOCK;
+}
+
+static size_t fitn_data_size(const size_t n_pix, const int bytes_per_pixel)
+{
+	const size_t len = n_pix * bytes_per_pixel;
+
+	return (len + FITN_BLOCK - 1) / FITN_BLOCK * FITN_BLOCK;
+}
+
+size_t fitn_size(const struct fitn_hdr *hdr, const size_t n_pix,
+		 const int bytes_per_pixel)
+{
+	return fitn_hdr_size(hdr) + fitn_data_size(n_pix, bytes_per_pixel);
+}
+
+/* Header cards, END and blank padding to a full block. */
+static void fitn_hdr_copy(uint8_t *dst, const struct fitn_hdr *hdr)
+{
+	const size_t size = fitn_hdr_size(hdr);
+
+	memset(dst, ' ', size);
+	memcpy(dst, hdr->cards, hdr->n_cards * FITN_CARD);
+	memcpy(dst + hdr->n_cards * FITN_CARD, "END", 3);
+}
+
+static inline uint16_t fitn_swap16_1(const uint16_t v)
+{
+	const uint16_t s = v ^ 0x8000;
+
+	return (s << 8) | (s >> 8);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2")))
+static size_t fitn_swap16_avx2(uint16_t *dst, const uint16_t *src,
+			       const size_t n)
+{
+	const __m256i offset = _mm256_set1_epi16((short)0x8000);
+	const __m256i shuffle = _mm256_setr_epi8(
+		1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14,
+		1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+	size_t i = 0;
+
+	for (; i + 16 <= n; i += 16) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)(src + i));
+		v = _mm256_xor_si256(v, offset);
+		v = _mm256_shuffle_epi8(v, shuffle);
+		_mm256_storeu_si256((__m256i *)(dst + i), v);
+	}
+
+	return i;
+}
+
+__attribute__((target("sse2")))
+static size_t fitn_swap16_sse2(uint16_t *dst, const uint16_t *src,
+			       const size_t n)
+{
+	const __m128i offset = _mm_set1_epi16((short)0x8000);
+	size_t i = 0;
+
+	for (; i + 8 <= n; i += 8) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+		v = _mm_xor_si128(v, offset);
+		v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+		_mm_storeu_si128((__m128i *)(dst + i), v);
+	}
+
+	return i;
+}
+#elif defined(__ARM_NEON)
+static size_t fitn_swap16_neon(uint16_t *dst, const uint16_t *src,
+			       const size_t n)
+{
+	const uint16x8_t offset = vdupq_n_u16(0x8000);
+	size_t i = 0;
+
+	for (; i + 8 <= n; i += 8) {
+		uint16x8_t v = veorq_u16(vld1q_u16(src + i), offset);
+		v = vreinterpretq_u16_u8(vrev16q_u8(vreinterpretq_u8_u16(v)));
+		vst1q_u16(dst + i, v);
+	}
+
+	return i;
+}
+#endif
+
+/* Native unsigned 16 bit to big endian signed with BZERO 32768, that
+   is the sign bit flipped and bytes swapped. dst and src may be the
+   same. */
+void fitn_swap16(uint16_t *dst, const uint16_t *src, const size_t n)
+{
+	size_t i = 0;
+
+#if defined(__x86_64__) || defined(__i386__)
+	if (__builtin_cpu_supports("avx2"))
+		i = fitn_swap16_avx2(dst, src, n);
+	else if (__builtin_cpu_supports("sse2"))
+		i = fitn_swap16_sse2(dst, src, n);
+#elif defined(__ARM_NEON)
+	i = fitn_swap16_neon(dst, src, n);
+#endif
+	for (; i < n; i++)
+		dst[i] = fitn_swap16_1(src[i]);
+}
+
+void fitn_encode(uint8_t *dst, const struct fitn_hdr *hdr, const void *data,
+		 const size_t n_pix, const int bytes_per_pixel)
+{
+	const size_t hdr_size = fitn_hdr_size(hdr);
+	const size_t len = n_pix * bytes_per_pixel;
+
+	fitn_hdr_copy(dst, hdr);
+	dst += hdr_size;
+	if (bytes_per_pixel == 2)
+		fitn_swap16((uint16_t *)dst, data, n_pix);
+	else
+		memcpy(dst, data, len);
+	memset(dst + len, 0, fitn_data_size(n_pix, bytes_per_pixel) - len);
+}
+
+static int fitn_write_all(const int fd, const void *buf, size_t len)
+{
+	const uint8_t *p = buf;
+
+	while (len > 0) {
+		const ssize_t n = write(fd, p, len);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+		p += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+/* Like cfitsio an existing file is only overwritten if its name is
+   prefixed by '!', the prefix is stripped from filename. */
+bool fitn_clobber(const char **filename)
+{
+	if ((*filename)[0] != '!')
+		return false;
+	(*filename)++;
+
+	return true;
+}
+
+int fitn_write(const char *filename, const struct fitn_hdr *hdr,
+	       const void *data, const size_t n_pix,
+	       const int bytes_per_pixel)
+{
+	int rc;
+	int fd;
+	uint8_t *buf;
+	const size_t hdr_size = fitn_hdr_size(hdr);
+	const size_t len = n_pix * bytes_per_pixel;
+	const size_t pad = fitn_data_size(n_pix, bytes_per_pixel) - len;
+
+	if (hdr->rc)
+		return hdr->rc;
+	if (bytes_per_pixel != 1 && bytes_per_pixel != 2)
+		return -EINVAL;
+
+	/* Header and conversion chunks, the frame is left untouched. */
+	buf = malloc(hdr_size > FITN_CHUNK * 2 ? hdr_size : FITN_CHUNK * 2);
+	if (!buf)
+		return -ENOMEM;
+
+	const int flags = fitn_clobber(&filename) ? O_TRUNC : O_EXCL;
+	fd = open(filename, O_WRONLY | O_CREAT | flags, 0644);
+	if (fd < 0) {
+		rc = -errno;
+		C_ERROR(errno, "open '%s'", filename);
+		goto cleanup;
+	}
+
+	fitn_hdr_copy(buf, hdr);
+	rc = fitn_write_all(fd, buf, hdr_size);
+
+	if (!rc && bytes_per_pixel == 1)
+		rc = fitn_write_all(fd, data, len);
+	for (size_t i = 0; !rc && bytes_per_pixel == 2 && i < n_pix;
+	     i += FITN_CHUNK) {
+		const size_t n = n_pix - i < FITN_CHUNK ? n_pix - i : FITN_CHUNK;
+
+		fitn_swap16((uint16_t *)buf, (const uint16_t *)data + i, n);
+		rc = fitn_write_all(fd, buf, n * 2);
+	}
+
+	if (!rc && pad) {
+		memset(buf, 0, pad);
+		rc = fitn_write_all(fd, buf, pad);
+	}
+	if (rc)
+		C_ERROR(-rc, "write '%s'", filename);
+
+	if (close(fd) < 0 && !rc) {
+		rc = -errno;
+		C_ERROR(errno, "close '%s'", filename);
+	}
+
+cleanup:
+	free(buf);
+
+	return rc;
+}
@@ -0,0 +1,58 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 only,
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License version 2 for more details (a copy is included
+ * in the LICENSE file that accompanied this code).
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Copyright (c) 2017, Thomas Stibor <thomas@stibor.net>
+ */
+
+#ifndef FITN_H
+#define FITN_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define FITN_BLOCK	2880
+#define FITN_CARD	80
+#define FITN_MAX_CARDS	(2 * FITN_BLOCK / FITN_CARD)
+
+/* Primary header of a native fit writer, which handles unsigned
+   8 and 16 bit images without cfitsio. Cards beyond FITN_MAX_CARDS
+   are dropped and flagged in rc. */
+struct fitn_hdr {
+	char cards[FITN_MAX_CARDS][FITN_CARD];
+	uint32_t n_cards;
+	int rc;
+};
+
+void fitn_init(struct fitn_hdr *hdr, const int bytes_per_pixel,
+	       const long width, const long height, const long planes);
+void fitn_key_str(struct fitn_hdr *hdr, const char *key, const char *val,
+		  const char *comment);
+void fitn_key_long(struct fitn_hdr *hdr, const char *key,
+		   const long long val, const char *comment);
+void fitn_key_double(struct fitn_hdr *hdr, const char *key, const double val,
+		     const int precision, const char *comment);
+void fitn_comment(struct fitn_hdr *hdr, const char *text);
+size_t fitn_size(const struct fitn_hdr *hdr, const size_t n_pix,
+		 const int bytes_per_pixel);
+void fitn_swap16(uint16_t *dst, const uint16_t *src, const size_t n);
+bool fitn_clobber(const char **filename);
+void fitn_encode(uint8_t *dst, const struct fitn_hdr *hdr, const void *data,
+		 const size_t n_pix, const int bytes_per_pixel);
+int fitn_write(const char *filename, const struct fitn_hdr *hdr,
+	       const void *data, const size_t n_pix,
+	       const int bytes_per_pixel);
+
+#endif	/* FITN_H */
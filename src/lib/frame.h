@@ -0,0 +1,53 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 only,
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License version 2 for more details (a copy is included
+ * in the LICENSE file that accompanied this code).
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Copyright (c) 2017, Thomas Stibor <thomas@stibor.net>
+ */
+
+#ifndef FRAME_H
+#define FRAME_H
+
+#include <stdint.h>
+#include <ASICamera2.h>
+
+#define MAX_LEN_ISO8601 32
+
+struct frame_stats;
+
+/* Image data of a single exposure together with the meta data
+   required by the output writers. The buffer is owned by the
+   caller and reused across frames of a sequence. */
+struct frame {
+	uint8_t *buf;
+	long size;
+	int width;
+	int height;
+	int bin;
+	ASI_IMG_TYPE img_type;
+	uint8_t planes;		/* 3 (R, G, B) once debayered, otherwise 1. */
+	uint32_t seq;
+	double t_obs;		/* Seconds since epoch of exposure start. */
+	double exp_time;
+	char date_obs[MAX_LEN_ISO8601];
+	float x_pix_sz;
+	float y_pix_sz;
+	int x_org;		/* ROI start on the sensor in binned pixels, */
+	int y_org;		/* -1 if unknown. */
+	double temp;		/* Sensor temperature (C), NAN if unknown. */
+	const struct frame_stats *stats;	/* Of the frame as captured,
+						   NULL if not computed. */
+};
+
+#endif	/* FRAME_H */
@@ -0,0 +1,214 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 only,
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License version 2 for more details (a copy is included
+ * in the LICENSE file that accompanied this code).
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Copyright (c) 2017, Thomas Stibor <thomas@stibor.net>
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include "vec.h"
+#include "lucky.h"
+
+int lucky_init(struct lucky *lucky, const uint32_t capacity)
+{
+	memset(lucky, 0, sizeof(struct lucky));
+	if (capacity == 0 || capacity > LUCKY_MAX_FRAMES)
+		return -EINVAL;
+
+	lucky->heap = calloc(capacity, sizeof(struct lucky_entry));
+	if (!lucky->heap)
+		return -ENOMEM;
+	lucky->capacity = capacity;
+
+	return 0;
+}
+
+static void sift_down(struct lucky *lucky, uint32_t i)
+{
+	struct lucky_entry *h = lucky->heap;
+
+	for (;;) {
+		const uint32_t l = 2 * i + 1;
+		const uint32_t r = l + 1;
+		uint32_t m = i;
+
+		if (l < lucky->n && h[l].score < h[m].score)
+			m = l;
+		if (r < lucky->n && h[r].score < h[m].score)
+			m = r;
+		if (m == i)
+			return;
+
+		const struct lucky_entry t = h[i];
+		h[i] = h[m];
+		h[m] = t;
+		i = m;
+	}
+}
+
+static void sift_up(struct lucky *lucky, uint32_t i)
+{
+	struct lucky_entry *h = lucky->heap;
+
+	while (i > 0) {
+		const uint32_t p = (i - 1) / 2;
+
+		if (h[p].score <= h[i].score)
+			return;
+
+		const struct lucky_entry t = h[i];
+		h[i] = h[p];
+		h[p] = t;
+		i = p;
+	}
+}
+
+/* Keep item if it is among the capacity best scored items. Returns the
+   item which is no longer kept, which is item itself if it scores
+   below all kept ones, or NULL if none. */
+void *lucky_offer(struct lucky *lucky, const double score, void *item)
+{
+	void *evicted;
+
+	if (lucky->n < lucky->capacity) {
+		lucky->heap[lucky->n].score = score;
+		lucky->heap[lucky->n].item = item;
+		sift_up(lucky, lucky->n++);
+		return NULL;
+	}
+
+	if (score <= lucky->heap[0].score)
+		return item;
+
+	evicted = lucky->heap[0].item;
+	lucky->heap[0].score = score;
+	lucky->heap[0].item = item;
+	sift_down(lucky, 0);
+
+	return evicted;
+}
+
+/* Move the kept items into items, which holds capacity entries, and
+   empty the heap. */
+uint32_t lucky_drain(struct lucky *lucky, void **items)
+{
+	const uint32_t n = lucky->n;
+
+	for (uint32_t i = 0; i < n; i++)
+		items[i] = lucky->heap[i].item;
+	lucky->n = 0;
+
+	return n;
+}
+
+void lucky_destroy(struct lucky *lucky)
+{
+	free(lucky->heap);
+	memset(lucky, 0, sizeof(struct lucky));
+}
+
+static inline uint32_t sample(const uint8_t *img, const size_t i,
+			      const uint8_t bps)
+{
+	return bps == 2 ? ((const uint16_t *)img)[i] : img[i];
+}
+
+/* Intensity weighted centroid on a LUCKY_GRID subsampled grid, such
+   that the ROI follows a planet or star drifting across the frame. */
+static void centroid(const uint8_t *img, const uint32_t width,
+		     const uint32_t height, const uint8_t bps,
+		     const uint8_t spp, uint32_t *cx, uint32_t *cy)
+{
+	double sw = 0, sx = 0, sy = 0;
+
+	for (uint32_t y = 0; y < height; y += LUCKY_GRID) {
+		for (uint32_t x = 0; x < width; x += LUCKY_GRID) {
+			const double v = sample(img, ((size_t)y * width + x) *
+						spp, bps);
+			sw += v;
+			sx += v * x;
+			sy += v * y;
+		}
+	}
+
+	*cx = sw > 0 ? sx / sw : width / 2;
+	*cy = sw > 0 ? sy / sw : height / 2;
+}
+
+/* Energy of the discrete Laplacian over a row of n samples, horizontal
+   neighbours are spp samples apart. */
+static inline __attribute__((always_inline))
+void laplace_row(const uint8_t *img, const size_t i0, const size_t n,
+		 const size_t stride, const uint8_t spp, const uint8_t bps,
+		 v4sf *energy, v4sf *sum)
+{
+	for (size_t i = i0; i < i0 + n; i += VEC_LANES) {
+		const v4si c = vec_load(img, i, bps);
+		const v4si lap = 4 * c - vec_load(img, i - spp, bps) -
+			vec_load(img, i + spp, bps) -
+			vec_load(img, i - stride, bps) -
+			vec_load(img, i + stride, bps);
+		const v4sf f = __builtin_convertvector(lap, v4sf);
+
+		*energy += f * f;
+		*sum += __builtin_convertvector(c, v4sf);
+	}
+}
+
+/* Sharpness as mean squared Laplacian over a roi x roi region around
+   the centroid, normalized by the squared mean such that changes of
+   transparency do not rank frames. Larger is sharper. */
+double lucky_score(const uint8_t *img, const uint32_t width,
+		   const uint32_t height, const uint8_t bytes_per_sample,
+		   const uint8_t spp, const uint32_t roi)
+{
+	uint32_t cx, cy;
+	v4sf energy = {0};
+	v4sf sum = {0};
+
+	if (width < 3 || height < 3)
+		return 0;
+
+	const uint32_t w = roi < width - 2 ? roi : width - 2;
+	const uint32_t h = roi < height - 2 ? roi : height - 2;
+	centroid(img, width, height, bytes_per_sample, spp, &cx, &cy);
+	const uint32_t x0 = cx < w / 2 + 1 ? 1 : cx - w / 2 + w > width - 1 ?
+		width - 1 - w : cx - w / 2;
+	const uint32_t y0 = cy < h / 2 + 1 ? 1 : cy - h / 2 + h > height - 1 ?
+		height - 1 - h : cy - h / 2;
+	/* Whole vectors only, the neighbours stay within the frame. */
+	const size_t n = (size_t)w * spp / VEC_LANES * VEC_LANES;
+	const size_t stride = (size_t)width * spp;
+
+	if (!n)
+		return 0;
+
+	for (uint32_t y = y0; y < y0 + h; y++) {
+		const size_t i0 = y * stride + (size_t)x0 * spp;
+
+		if (bytes_per_sample == 2)
+			laplace_row(img, i0, n, stride, spp, 2, &energy, &sum);
+		else
+			laplace_row(img, i0, n, stride, spp, 1, &energy, &sum);
+	}
+
+	const double n_samples = (double)n * h;
+	const double mean = (sum[0] + sum[1] + sum[2] + sum[3]) / n_samples;
+	const double e = (energy[0] + energy[1] + energy[2] + energy[3]) /
+		n_samples;
+
+	return e / (mean * mean + 1);
+}
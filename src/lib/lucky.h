@@ -0,0 +1,51 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 only,
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License version 2 for more details (a copy is included
+ * in the LICENSE file that accompanied this code).
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Copyright (c) 2017, Thomas Stibor <thomas@stibor.net>
+ */
+
+#ifndef LUCKY_H
+#define LUCKY_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define LUCKY_MAX_FRAMES	256	/* Selected frames per window. */
+#define LUCKY_MIN_ROI		4
+#define LUCKY_GRID		4	/* Subsampling to locate the ROI. */
+
+struct lucky_entry {
+	double score;
+	void *item;
+};
+
+/* Bounded min-heap of the best scored items seen so far, the worst
+   kept item on top such that it is replaced in O(log n) once a better
+   one arrives. Not thread safe. */
+struct lucky {
+	struct lucky_entry *heap;
+	uint32_t capacity;
+	uint32_t n;
+};
+
+int lucky_init(struct lucky *lucky, const uint32_t capacity);
+void *lucky_offer(struct lucky *lucky, const double score, void *item);
+uint32_t lucky_drain(struct lucky *lucky, void **items);
+void lucky_destroy(struct lucky *lucky);
+double lucky_score(const uint8_t *img, const uint32_t width,
+		   const uint32_t height, const uint8_t bytes_per_sample,
+		   const uint8_t spp, const uint32_t roi);
+
+#endif	/* LUCKY_H */
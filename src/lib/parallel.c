@@ -0,0 +1,201 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 only,
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License version 2 for more details (a copy is included
+ * in the LICENSE file that accompanied this code).
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Copyright (c) 2017, Thomas Stibor <thomas@stibor.net>
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "log.h"
+#include "parallel.h"
+
+static uint32_t parallel_threads = 0;	/* 0: number of online CPUs. */
+
+/* The bands of a parallel_for() call, claimed one by one by the
+   workers and the calling thread. */
+struct parallel_job {
+	parallel_fn fn;
+	void *arg;
+	uint32_t n_items;
+	uint32_t n_bands;
+	uint32_t n_claimed;
+	uint32_t n_done;
+	struct parallel_job *next;	/* Queued job with unclaimed bands. */
+	pthread_cond_t cond_done;
+};
+
+/* Workers started once and shared by all callers, thus concurrent
+   callers such as several writer threads do not each start a thread
+   per CPU, and no thread is created per call. */
+static struct {
+	pthread_mutex_t mutex;
+	pthread_cond_t cond_work;
+	struct parallel_job *head;
+	struct parallel_job *tail;
+	uint32_t n_workers;
+} pool = {
+	.mutex = PTHREAD_MUTEX_INITIALIZER,
+	.cond_work = PTHREAD_COND_INITIALIZER,
+	.head = NULL,
+	.tail = NULL,
+	.n_workers = 0
+};
+
+/* Claim the next band of job, which leaves the queue once all its
+   bands are claimed. Called with the pool mutex held. */
+static uint32_t parallel_claim(struct parallel_job *job)
+{
+	const uint32_t band = job->n_claimed++;
+
+	if (job->n_claimed < job->n_bands)
+		return band;
+
+	struct parallel_job **link = &pool.head;
+	struct parallel_job *prev = NULL;
+
+	while (*link && *link != job) {
+		prev = *link;
+		link = &prev->next;
+	}
+	if (*link) {
+		*link = job->next;
+		if (pool.tail == job)
+			pool.tail = prev;
+	}
+
+	return band;
+}
+
+/* Process band of job. Called with the pool mutex held, which is
+   released while processing. */
+static void parallel_run(struct parallel_job *job, const uint32_t band)
+{
+	const uint32_t begin = (uint64_t)job->n_items * band / job->n_bands;
+	const uint32_t end = (uint64_t)job->n_items * (band + 1) / job->n_bands;
+
+	pthread_mutex_unlock(&pool.mutex);
+	job->fn(begin, end, job->arg);
+	pthread_mutex_lock(&pool.mutex);
+
+	if (++job->n_done == job->n_bands)
+		pthread_cond_signal(&job->cond_done);
+}
+
+static void *parallel_worker(void *arg)
+{
+	UNUSED(arg);
+
+	pthread_mutex_lock(&pool.mutex);
+	for (;;) {
+		while (!pool.head)
+			pthread_cond_wait(&pool.cond_work, &pool.mutex);
+
+		struct parallel_job *job = pool.head;
+		parallel_run(job, parallel_claim(job));
+	}
+
+	return NULL;
+}
+
+/* Start workers up to one less than the number of threads, the calling
+   thread is the last one. Called with the pool mutex held. */
+static void parallel_start(const uint32_t n_threads)
+{
+	while (pool.n_workers + 1 < n_threads) {
+		pthread_t thread;
+		pthread_attr_t attr;
+
+		pthread_attr_init(&attr);
+		pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+		const int rc = pthread_create(&thread, &attr, parallel_worker,
+					      NULL);
+		pthread_attr_destroy(&attr);
+		/* Fewer workers, callers process unclaimed bands. */
+		if (rc)
+			break;
+		pool.n_workers++;
+	}
+}
+
+void parallel_set_threads(const uint32_t n_threads)
+{
+	parallel_threads = n_threads > PARALLEL_MAX_THREADS ?
+		PARALLEL_MAX_THREADS : n_threads;
+}
+
+uint32_t parallel_get_threads(void)
+{
+	if (parallel_threads)
+		return parallel_threads;
+
+	const long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (n_cpus < 1)
+		return 1;
+
+	return n_cpus > PARALLEL_MAX_THREADS ? PARALLEL_MAX_THREADS : n_cpus;
+}
+
+/* Split n_items into equally sized contiguous bands, one per thread.
+   The bands are processed by the pool workers and by the calling
+   thread, which returns once all bands are done. */
+int parallel_for(const uint32_t n_items, parallel_fn fn, void *arg)
+{
+	uint32_t n_threads = parallel_get_threads();
+
+	if (!fn)
+		return -EINVAL;
+	if (n_items == 0)
+		return 0;
+	if (n_threads > n_items)
+		n_threads = n_items;
+	if (n_threads == 1) {
+		fn(0, n_items, arg);
+		return 0;
+	}
+
+	struct parallel_job job = {
+		.fn = fn,
+		.arg = arg,
+		.n_items = n_items,
+		.n_bands = n_threads,
+		.n_claimed = 0,
+		.n_done = 0,
+		.next = NULL
+	};
+	pthread_cond_init(&job.cond_done, NULL);
+
+	pthread_mutex_lock(&pool.mutex);
+	parallel_start(n_threads);
+	if (pool.tail)
+		pool.tail->next = &job;
+	else
+		pool.head = &job;
+	pool.tail = &job;
+	pthread_cond_broadcast(&pool.cond_work);
+
+	/* Bands of this job only, such that a call does not wait for
+	   the bands of other callers. */
+	while (job.n_claimed < job.n_bands)
+		parallel_run(&job, parallel_claim(&job));
+	while (job.n_done < job.n_bands)
+		pthread_cond_wait(&job.cond_done, &pool.mutex);
+	pthread_mutex_unlock(&pool.mutex);
+
+	pthread_cond_destroy(&job.cond_done);
+
+	return 0;
+}
@@ -0,0 +1,34 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 only,
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License version 2 for more details (a copy is included
+ * in the LICENSE file that accompanied this code).
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Copyright (c) 2017, Thomas Stibor <thomas@stibor.net>
+ */
+
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <stdint.h>
+
+#define PARALLEL_MAX_THREADS 64
+
+/* Process items [begin, end). */
+typedef void (*parallel_fn)(const uint32_t begin, const uint32_t end,
+			    void *arg);
+
+void parallel_set_threads(const uint32_t n_threads);
+uint32_t parallel_get_threads(void);
+int parallel_for(const uint32_t n_items, parallel_fn fn, void *arg);
+
+#endif	/* PARALLEL_H */
@@ -0,0 +1,143 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 only,
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License version 2 for more details (a copy is included
+ * in the LICENSE file that accompanied this code).
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Copyright (c) 2017, Thomas Stibor <thomas@stibor.net>
+ */
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+#include "parallel.h"
+#include "planar.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+/* 16 pixels (48 bytes) per iteration, each channel is gathered from
+   the three 16 byte loads by one shuffle each. */
+__attribute__((target("ssse3")))
+static size_t bgr_to_planar_ssse3(uint8_t *r, uint8_t *g, uint8_t *b,
+				  const uint8_t *bgr, const size_t n_pix)
+{
+	const __m128i r0 = _mm_setr_epi8(2, 5, 8, 11, 14, -1, -1, -1,
+					 -1, -1, -1, -1, -1, -1, -1, -1);
+	const __m128i r1 = _mm_setr_epi8(-1, -1, -1, -1, -1, 1, 4, 7,
+					 10, 13, -1, -1, -1, -1, -1, -1);
+	const __m128i r2 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1,
+					 -1, -1, 0, 3, 6, 9, 12, 15);
+	const __m128i g0 = _mm_setr_epi8(1, 4, 7, 10, 13, -1, -1, -1,
+					 -1, -1, -1, -1, -1, -1, -1, -1);
+	const __m128i g1 = _mm_setr_epi8(-1, -1, -1, -1, -1, 0, 3, 6,
+					 9, 12, 15, -1, -1, -1, -1, -1);
+	const __m128i g2 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1,
+					 -1, -1, -1, 2, 5, 8, 11, 14);
+	const __m128i b0 = _mm_setr_epi8(0, 3, 6, 9, 12, 15, -1, -1,
+					 -1, -1, -1, -1, -1, -1, -1, -1);
+	const __m128i b1 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, 2, 5,
+					 8, 11, 14, -1, -1, -1, -1, -1);
+	const __m128i b2 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1,
+					 -1, -1, -1, 1, 4, 7, 10, 13);
+	size_t i = 0;
+
+	for (; i + 16 <= n_pix; i += 16) {
+		const __m128i v0 = _mm_loadu_si128((const __m128i *)(bgr + 3 * i));
+		const __m128i v1 = _mm_loadu_si128((const __m128i *)(bgr + 3 * i + 16));
+		const __m128i v2 = _mm_loadu_si128((const __m128i *)(bgr + 3 * i + 32));
+
+		_mm_storeu_si128((__m128i *)(r + i),
+				 _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(v0, r0),
+							   _mm_shuffle_epi8(v1, r1)),
+					      _mm_shuffle_epi8(v2, r2)));
+		_mm_storeu_si128((__m128i *)(g + i),
+				 _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(v0, g0),
+							   _mm_shuffle_epi8(v1, g1)),
+					      _mm_shuffle_epi8(v2, g2)));
+		_mm_storeu_si128((__m128i *)(b + i),
+				 _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(v0, b0),
+							   _mm_shuffle_epi8(v1, b1)),
+					      _mm_shuffle_epi8(v2, b2)));
+	}
+
+	return i;
+}
+#elif defined(__ARM_NEON)
+static size_t bgr_to_planar_neon(uint8_t *r, uint8_t *g, uint8_t *b,
+				 const uint8_t *bgr, const size_t n_pix)
+{
+	size_t i = 0;
+
+	for (; i + 16 <= n_pix; i += 16) {
+		const uint8x16x3_t v = vld3q_u8(bgr + 3 * i);
+
+		vst1q_u8(b + i, v.val[0]);
+		vst1q_u8(g + i, v.val[1]);
+		vst1q_u8(r + i, v.val[2]);
+	}
+
+	return i;
+}
+#endif
+
+/* Packed BGR (as delivered by the SDK for RGB24) to separate R, G
+   and B planes. */
+void bgr_to_planar(uint8_t *r, uint8_t *g, uint8_t *b, const uint8_t *bgr,
+		   const size_t n_pix)
+{
+	size_t i = 0;
+
+#if defined(__x86_64__) || defined(__i386__)
+	if (__builtin_cpu_supports("ssse3"))
+		i = bgr_to_planar_ssse3(r, g, b, bgr, n_pix);
+#elif defined(__ARM_NEON)
+	i = bgr_to_planar_neon(r, g, b, bgr, n_pix);
+#endif
+	for (; i < n_pix; i++) {
+		b[i] = bgr[3 * i];
+		g[i] = bgr[3 * i + 1];
+		r[i] = bgr[3 * i + 2];
+	}
+}
+
+struct planar_job {
+	uint8_t *planar;
+	const uint8_t *bgr;
+	uint32_t width;
+	size_t plane;
+};
+
+static void planar_rows(const uint32_t begin, const uint32_t end, void *arg)
+{
+	const struct planar_job *job = arg;
+	const size_t off = (size_t)begin * job->width;
+
+	bgr_to_planar(job->planar + off, job->planar + job->plane + off,
+		      job->planar + 2 * job->plane + off, job->bgr + 3 * off,
+		      (size_t)(end - begin) * job->width);
+}
+
+/* Image of width x height packed BGR pixels to an R, G, B plane cube,
+   converted in parallel by bands of rows. */
+int bgr_to_planar_rows(uint8_t *planar, const uint8_t *bgr,
+		       const uint32_t width, const uint32_t height)
+{
+	struct planar_job job = {
+		.planar = planar,
+		.bgr = bgr,
+		.width = width,
+		.plane = (size_t)width * height
+	};
+
+	return parallel_for(height, planar_rows, &job);
+}
@@ -0,0 +1,30 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 only,
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License version 2 for more details (a copy is included
+ * in the LICENSE file that accompanied this code).
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Copyright (c) 2017, Thomas Stibor <thomas@stibor.net>
+ */
+
+#ifndef PLANAR_H
+#define PLANAR_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+void bgr_to_planar(uint8_t *r, uint8_t *g, uint8_t *b, const uint8_t *bgr,
+		   const size_t n_pix);
+int bgr_to_planar_rows(uint8_t *planar, const uint8_t *bgr,
+		       const uint32_t width, const uint32_t height);
+
+#endif	/* PLANAR_H */
@@ -0,0 +1,317 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 only,
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License version 2 for more details (a copy is included
+ * in the LICENSE file that accompanied this code).
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Copyright (c) 2017, Thomas Stibor <thomas@stibor.net>
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include "parallel.h"
+#include "vec.h"
+#include "resample.h"
+
+struct bin_job {
+	uint8_t *dst;
+	const uint8_t *src;
+	uint32_t width;		/* Of src. */
+	uint8_t bps;
+	uint8_t spp;
+	uint32_t factor;
+	bool average;
+	int rc;
+};
+
+/* acc[i] += row[i] for n samples. */
+static inline __attribute__((always_inline))
+void acc_row(int32_t *acc, const uint8_t *row, const size_t n,
+	     const uint8_t bps)
+{
+	size_t i = 0;
+
+	for (; i + VEC_LANES <= n; i += VEC_LANES) {
+		v4si a;
+		memcpy(&a, acc + i, sizeof(a));
+		a += vec_load(row, i, bps);
+		memcpy(acc + i, &a, sizeof(a));
+	}
+	for (; i < n; i++)
+		acc[i] += bps == 2 ? ((const uint16_t *)row)[i] : row[i];
+}
+
+static inline void put(uint8_t *img, const size_t i, const int32_t v,
+		       const uint8_t bps)
+{
+	if (bps == 2)
+		((uint16_t *)img)[i] = v;
+	else
+		img[i] = v;
+}
+
+/* Output rows [begin, end): the factor source rows are summed
+   vertically into a 32 bit accumulator row, then horizontally. */
+static void bin_rows(const uint32_t begin, const uint32_t end, void *arg)
+{
+	struct bin_job *job = arg;
+	const uint32_t f = job->factor;
+	const size_t n = (size_t)job->width * job->spp;
+	const uint32_t dst_width = job->width / f;
+	const int32_t max = job->bps == 2 ? UINT16_MAX : UINT8_MAX;
+	const int32_t area = f * f;
+	int32_t *acc = malloc(n * sizeof(int32_t));
+
+	if (!acc) {
+		job->rc = -ENOMEM;
+		return;
+	}
+
+	for (uint32_t y = begin; y < end; y++) {
+		memset(acc, 0, n * sizeof(int32_t));
+		for (uint32_t k = 0; k < f; k++) {
+			const uint8_t *row = job->src +
+				((size_t)y * f + k) * n * job->bps;
+			if (job->bps == 2)
+				acc_row(acc, row, n, 2);
+			else
+				acc_row(acc, row, n, 1);
+		}
+
+		const size_t out = (size_t)y * dst_width * job->spp;
+		for (uint32_t x = 0; x < dst_width; x++) {
+			for (uint8_t c = 0; c < job->spp; c++) {
+				const int32_t *a = acc + (size_t)x * f * job->spp + c;
+				int32_t sum = 0;
+
+				for (uint32_t k = 0; k < f; k++)
+					sum += a[k * job->spp];
+				if (job->average)
+					sum = (sum + area / 2) / area;
+				put(job->dst, out + (size_t)x * job->spp + c,
+				    sum > max ? max : sum, job->bps);
+			}
+		}
+	}
+
+	free(acc);
+}
+
+/* Bin blocks of factor x factor pixels of src by summing with
+   saturation or averaging. Pixels have spp interleaved samples of bps
+   bytes, dst is width / factor x height / factor, remaining rows and
+   columns are dropped. */
+int bin_soft(uint8_t *dst, const uint8_t *src, const uint32_t width,
+	     const uint32_t height, const uint8_t bps, const uint8_t spp,
+	     const uint32_t factor, const bool average)
+{
+	int rc;
+
+	if (factor < 2 || factor > BIN_MAX_FACTOR || width < factor ||
+	    height < factor || (bps != 1 && bps != 2) || spp < 1)
+		return -EINVAL;
+
+	struct bin_job job = {
+		.dst = dst,
+		.src = src,
+		.width = width,
+		.bps = bps,
+		.spp = spp,
+		.factor = factor,
+		.average = average,
+		.rc = 0
+	};
+
+	rc = parallel_for(height / factor, bin_rows, &job);
+
+	return rc ? rc : job.rc;
+}
+
+/* Source range of an output index and its fixed point weights. */
+struct taps {
+	uint32_t n_taps;	/* Maximum per output index. */
+	uint32_t *first;
+	uint32_t *count;
+	int32_t *weight;	/* n_taps per output index. */
+};
+
+static void taps_destroy(struct taps *taps)
+{
+	free(taps->first);
+	free(taps->count);
+	free(taps->weight);
+}
+
+/* Area averaging: output index j covers [j * scale, (j + 1) * scale)
+   of the source, each source index is weighted by its overlap. */
+static int taps_init(struct taps *taps, const uint32_t n_src,
+		     const uint32_t n_dst)
+{
+	const double scale = (double)n_src / n_dst;
+
+	taps->n_taps = (uint32_t)scale + 2;
+	taps->first = calloc(n_dst, sizeof(uint32_t));
+	taps->count = calloc(n_dst, sizeof(uint32_t));
+	taps->weight = calloc((size_t)n_dst * taps->n_taps, sizeof(int32_t));
+	if (!taps->first || !taps->count || !taps->weight) {
+		taps_destroy(taps);
+		return -ENOMEM;
+	}
+
+	for (uint32_t j = 0; j < n_dst; j++) {
+		const double lo = j * scale;
+		const double hi = (j + 1) * scale;
+		int32_t *w = taps->weight + (size_t)j * taps->n_taps;
+		int32_t sum = 0;
+
+		taps->first[j] = (uint32_t)lo;
+		for (uint32_t t = 0; t < taps->n_taps; t++) {
+			const uint32_t k = taps->first[j] + t;
+			const double a = k > lo ? k : lo;
+			const double b = k + 1 < hi ? k + 1 : hi;
+
+			if (k >= n_src || b <= a)
+				break;
+			w[t] = (b - a) / scale * (1 << RESAMPLE_SHIFT) + 0.5;
+			sum += w[t];
+			taps->count[j]++;
+		}
+		/* Rounding, such that the weights sum to exactly one. */
+		w[0] += (1 << RESAMPLE_SHIFT) - sum;
+	}
+
+	return 0;
+}
+
+struct downsample_job {
+	uint8_t *dst;
+	const uint8_t *src;
+	uint32_t width;
+	uint32_t height;
+	uint32_t dst_width;
+	uint8_t bps;
+	uint8_t spp;
+	struct taps h;
+	struct taps v;
+	int rc;
+};
+
+/* acc[i] += w * row[i] for n samples. */
+static inline __attribute__((always_inline))
+void acc_row_weighted(int32_t *acc, const uint8_t *row, const int32_t w,
+		      const size_t n, const uint8_t bps)
+{
+	size_t i = 0;
+
+	for (; i + VEC_LANES <= n; i += VEC_LANES) {
+		v4si a;
+		memcpy(&a, acc + i, sizeof(a));
+		a += w * vec_load(row, i, bps);
+		memcpy(acc + i, &a, sizeof(a));
+	}
+	for (; i < n; i++)
+		acc[i] += w * (bps == 2 ? ((const uint16_t *)row)[i] : row[i]);
+}
+
+/* Output rows [begin, end): weighted vertical sum of the source rows
+   scaled back to sample range, then the weighted horizontal sum. */
+static void downsample_rows(const uint32_t begin, const uint32_t end,
+			    void *arg)
+{
+	struct downsample_job *job = arg;
+	const size_t n = (size_t)job->width * job->spp;
+	const int32_t max = job->bps == 2 ? UINT16_MAX : UINT8_MAX;
+	const int32_t half = 1 << (RESAMPLE_SHIFT - 1);
+	int32_t *acc = malloc(n * sizeof(int32_t));
+
+	if (!acc) {
+		job->rc = -ENOMEM;
+		return;
+	}
+
+	for (uint32_t y = begin; y < end; y++) {
+		const int32_t *wv = job->v.weight + (size_t)y * job->v.n_taps;
+
+		memset(acc, 0, n * sizeof(int32_t));
+		for (uint32_t t = 0; t < job->v.count[y]; t++) {
+			const uint8_t *row = job->src +
+				(size_t)(job->v.first[y] + t) * n * job->bps;
+			if (job->bps == 2)
+				acc_row_weighted(acc, row, wv[t], n, 2);
+			else
+				acc_row_weighted(acc, row, wv[t], n, 1);
+		}
+		for (size_t i = 0; i < n; i++)
+			acc[i] = (acc[i] + half) >> RESAMPLE_SHIFT;
+
+		const size_t out = (size_t)y * job->dst_width * job->spp;
+		for (uint32_t x = 0; x < job->dst_width; x++) {
+			const int32_t *wh = job->h.weight +
+				(size_t)x * job->h.n_taps;
+			const int32_t *a = acc + (size_t)job->h.first[x] * job->spp;
+
+			for (uint8_t c = 0; c < job->spp; c++) {
+				int32_t sum = half;
+
+				for (uint32_t t = 0; t < job->h.count[x]; t++)
+					sum += wh[t] * a[t * job->spp + c];
+				sum >>= RESAMPLE_SHIFT;
+				put(job->dst, out + (size_t)x * job->spp + c,
+				    sum > max ? max : sum, job->bps);
+			}
+		}
+	}
+
+	free(acc);
+}
+
+/* Shrink src of width x height to dst_width x dst_height by area
+   averaging, for fractional factors where bin_soft() does not apply. */
+int downsample(uint8_t *dst, const uint32_t dst_width,
+	       const uint32_t dst_height, const uint8_t *src,
+	       const uint32_t width, const uint32_t height,
+	       const uint8_t bps, const uint8_t spp)
+{
+	int rc;
+
+	if (dst_width < 1 || dst_height < 1 || dst_width > width ||
+	    dst_height > height || (bps != 1 && bps != 2) || spp < 1)
+		return -EINVAL;
+
+	struct downsample_job job = {
+		.dst = dst,
+		.src = src,
+		.width = width,
+		.height = height,
+		.dst_width = dst_width,
+		.bps = bps,
+		.spp = spp,
+		.rc = 0
+	};
+
+	rc = taps_init(&job.h, width, dst_width);
+	if (rc)
+		return rc;
+	rc = taps_init(&job.v, height, dst_height);
+	if (rc) {
+		taps_destroy(&job.h);
+		return rc;
+	}
+
+	rc = parallel_for(dst_height, downsample_rows, &job);
+
+	taps_destroy(&job.h);
+	taps_destroy(&job.v);
+
+	return rc ? rc : job.rc;
+}
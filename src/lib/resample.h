@@ -0,0 +1,36 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 only,
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License version 2 for more details (a copy is included
+ * in the LICENSE file that accompanied this code).
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Copyright (c) 2017, Thomas Stibor <thomas@stibor.net>
+ */
+
+#ifndef RESAMPLE_H
+#define RESAMPLE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define BIN_MAX_FACTOR		8
+#define RESAMPLE_SHIFT		14	/* Fixed point weights sum to 1 << 14. */
+
+int bin_soft(uint8_t *dst, const uint8_t *src, const uint32_t width,
+	     const uint32_t height, const uint8_t bps, const uint8_t spp,
+	     const uint32_t factor, const bool average);
+int downsample(uint8_t *dst, const uint32_t dst_width,
+	       const uint32_t dst_height, const uint8_t *src,
+	       const uint32_t width, const uint32_t height,
+	       const uint8_t bps, const uint8_t spp);
+
+#endif	/* RESAMPLE_H */
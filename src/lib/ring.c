@@ -0,0 +1,178 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 only,
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License version 2 for more details (a copy is included
+ * in the LICENSE file that accompanied this code).
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Copyright (c) 2017, Thomas Stibor <thomas@stibor.net>
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "ring.h"
+
+static int ring_init_slots(struct ring *ring, const uint32_t n_slots,
+			   const struct frame *tmpl, struct bufpool *pool)
+{
+	if (!ring || !tmpl || n_slots == 0 || tmpl->size <= 0)
+		return -EINVAL;
+
+	memset(ring, 0, sizeof(struct ring));
+
+	ring->slots = calloc(n_slots, sizeof(struct frame));
+	ring->free = calloc(n_slots, sizeof(uint32_t));
+	ring->ready = calloc(n_slots, sizeof(uint32_t));
+	if (!ring->slots || !ring->free || !ring->ready)
+		goto nomem;
+
+	ring->n_slots = n_slots;
+	ring->pool = pool;
+	for (uint32_t n = 0; n < n_slots; n++) {
+		ring->slots[n] = *tmpl;
+		ring->slots[n].buf = pool ? bufpool_get(pool, tmpl->size) : NULL;
+		if (pool && !ring->slots[n].buf)
+			goto nomem;
+		/* Hand out lower slots first. */
+		ring->free[n_slots - 1 - n] = n;
+	}
+	ring->n_free = n_slots;
+
+	pthread_mutex_init(&ring->mutex, NULL);
+	pthread_cond_init(&ring->cond_free, NULL);
+	pthread_cond_init(&ring->cond_ready, NULL);
+
+	return 0;
+
+nomem:
+	if (ring->slots && pool)
+		for (uint32_t n = 0; n < n_slots; n++)
+			bufpool_put(pool, ring->slots[n].buf);
+	free(ring->slots);
+	free(ring->free);
+	free(ring->ready);
+	memset(ring, 0, sizeof(struct ring));
+
+	return -ENOMEM;
+}
+
+/* Slot buffers are taken from pool and returned by ring_destroy(). */
+int ring_init(struct ring *ring, const uint32_t n_slots,
+	      const struct frame *tmpl, struct bufpool *pool)
+{
+	if (!pool)
+		return -EINVAL;
+
+	return ring_init_slots(ring, n_slots, tmpl, pool);
+}
+
+/* Slots without buffer, the producer points frame->buf to storage
+   it owns before filling a frame. */
+int ring_init_external(struct ring *ring, const uint32_t n_slots,
+		       const struct frame *tmpl)
+{
+	return ring_init_slots(ring, n_slots, tmpl, NULL);
+}
+
+void ring_destroy(struct ring *ring)
+{
+	if (!ring || !ring->slots)
+		return;
+
+	if (ring->pool)
+		for (uint32_t n = 0; n < ring->n_slots; n++)
+			bufpool_put(ring->pool, ring->slots[n].buf);
+	free(ring->slots);
+	free(ring->free);
+	free(ring->ready);
+
+	pthread_mutex_destroy(&ring->mutex);
+	pthread_cond_destroy(&ring->cond_free);
+	pthread_cond_destroy(&ring->cond_ready);
+
+	memset(ring, 0, sizeof(struct ring));
+}
+
+/* Get an empty frame for filling. If no frame is free and drop_oldest
+   is set, the oldest ready (not yet consumed) frame is recycled,
+   otherwise block until a consumer returns a frame. Returns NULL
+   when the ring is closed. */
+struct frame *ring_get_free(struct ring *ring, const bool drop_oldest)
+{
+	struct frame *frame = NULL;
+
+	pthread_mutex_lock(&ring->mutex);
+	while (!ring->closed && ring->n_free == 0) {
+		if (drop_oldest && ring->n_ready > 0) {
+			frame = &ring->slots[ring->ready[ring->head]];
+			ring->head = (ring->head + 1) % ring->n_slots;
+			ring->n_ready--;
+			ring->n_dropped++;
+			goto out;
+		}
+		pthread_cond_wait(&ring->cond_free, &ring->mutex);
+	}
+	if (!ring->closed)
+		frame = &ring->slots[ring->free[--ring->n_free]];
+out:
+	pthread_mutex_unlock(&ring->mutex);
+
+	return frame;
+}
+
+void ring_put_ready(struct ring *ring, struct frame *frame)
+{
+	pthread_mutex_lock(&ring->mutex);
+	ring->ready[(ring->head + ring->n_ready) % ring->n_slots] =
+		frame - ring->slots;
+	ring->n_ready++;
+	pthread_cond_signal(&ring->cond_ready);
+	pthread_mutex_unlock(&ring->mutex);
+}
+
+/* Get the oldest ready frame, block until one is available. Returns
+   NULL when the ring is closed and all ready frames are consumed. */
+struct frame *ring_get_ready(struct ring *ring)
+{
+	struct frame *frame = NULL;
+
+	pthread_mutex_lock(&ring->mutex);
+	while (!ring->closed && ring->n_ready == 0)
+		pthread_cond_wait(&ring->cond_ready, &ring->mutex);
+	if (ring->n_ready > 0) {
+		frame = &ring->slots[ring->ready[ring->head]];
+		ring->head = (ring->head + 1) % ring->n_slots;
+		ring->n_ready--;
+	}
+	pthread_mutex_unlock(&ring->mutex);
+
+	return frame;
+}
+
+void ring_put_free(struct ring *ring, struct frame *frame)
+{
+	pthread_mutex_lock(&ring->mutex);
+	ring->free[ring->n_free++] = frame - ring->slots;
+	pthread_cond_signal(&ring->cond_free);
+	pthread_mutex_unlock(&ring->mutex);
+}
+
+/* No further frames are produced. Consumers drain the remaining
+   ready frames, blocked producers return NULL. */
+void ring_close(struct ring *ring)
+{
+	pthread_mutex_lock(&ring->mutex);
+	ring->closed = true;
+	pthread_cond_broadcast(&ring->cond_free);
+	pthread_cond_broadcast(&ring->cond_ready);
+	pthread_mutex_unlock(&ring->mutex);
+}
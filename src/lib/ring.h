@@ -0,0 +1,58 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 only,
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License version 2 for more details (a copy is included
+ * in the LICENSE file that accompanied this code).
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Copyright (c) 2017, Thomas Stibor <thomas@stibor.net>
+ */
+
+#ifndef RING_H
+#define RING_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include "frame.h"
+#include "bufpool.h"
+
+/* Fixed set of preallocated frames handed between a producer
+   (acquisition) and consumers (writers). A frame is either free,
+   owned by the producer, queued as ready or owned by a consumer. */
+struct ring {
+	struct frame *slots;
+	uint32_t n_slots;
+	uint32_t *free;		/* Stack of free slot indices. */
+	uint32_t n_free;
+	uint32_t *ready;	/* FIFO of ready slot indices. */
+	uint32_t head;
+	uint32_t n_ready;
+	struct bufpool *pool;	/* Of the slot buffers, NULL if external. */
+	bool closed;
+	uint64_t n_dropped;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond_free;
+	pthread_cond_t cond_ready;
+};
+
+int ring_init(struct ring *ring, const uint32_t n_slots,
+	      const struct frame *tmpl, struct bufpool *pool);
+int ring_init_external(struct ring *ring, const uint32_t n_slots,
+		       const struct frame *tmpl);
+void ring_destroy(struct ring *ring);
+struct frame *ring_get_free(struct ring *ring, const bool drop_oldest);
+void ring_put_ready(struct ring *ring, struct frame *frame);
+struct frame *ring_get_ready(struct ring *ring);
+void ring_put_free(struct ring *ring, struct frame *frame);
+void ring_close(struct ring *ring);
+
+#endif	/* RING_H */
@@ -0,0 +1,275 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 only,
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License version 2 for more details (a copy is included
+ * in the LICENSE file that accompanied this code).
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Copyright (c) 2017, Thomas Stibor <thomas@stibor.net>
+ */
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include "log.h"
+#include "ser.h"
+
+/* Timestamps are in 100 ns ticks since 0001-01-01 00:00:00. */
+#define SER_TICKS_PER_SEC	10000000ULL
+#define SER_TICKS_UNIX_EPOCH	621355968000000000ULL
+
+static uint64_t ser_ticks(const double t)
+{
+	return SER_TICKS_UNIX_EPOCH + (uint64_t)(t * SER_TICKS_PER_SEC);
+}
+
+static void put_le32(uint8_t *p, const uint32_t v)
+{
+	for (int n = 0; n < 4; n++)
+		p[n] = (v >> (8 * n)) & 0xff;
+}
+
+static void put_le64(uint8_t *p, const uint64_t v)
+{
+	for (int n = 0; n < 8; n++)
+		p[n] = (v >> (8 * n)) & 0xff;
+}
+
+static int ser_pwrite(const int fd, const void *buf, const size_t len,
+		      off_t off)
+{
+	const uint8_t *p = buf;
+	size_t left = len;
+
+	while (left > 0) {
+		const ssize_t n = pwrite(fd, p, left, off);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+		p += n;
+		off += n;
+		left -= n;
+	}
+
+	return 0;
+}
+
+static int ser_write_header(const struct ser *ser, const uint32_t n_frames)
+{
+	uint8_t hdr[SER_HEADER_SIZE] = {0};
+	uint64_t t_utc = 0;
+	uint64_t t_local = 0;
+
+	/* Start time of the sequence is the time of its earliest frame,
+	   writer threads may have stored frames slightly out of order. */
+	for (uint32_t n = 0; ser->ts && n < n_frames; n++)
+		if (ser->ts[n] && (!t_utc || ser->ts[n] < t_utc))
+			t_utc = ser->ts[n];
+	if (t_utc) {
+		struct tm tm;
+		const time_t t = (t_utc - SER_TICKS_UNIX_EPOCH) /
+			SER_TICKS_PER_SEC;
+
+		localtime_r(&t, &tm);
+		t_local = t_utc + tm.tm_gmtoff * (int64_t)SER_TICKS_PER_SEC;
+	}
+
+	memcpy(hdr, "LUCAM-RECORDER", 14);
+	put_le32(hdr + 14, 0);			/* LuID */
+	put_le32(hdr + 18, ser->color_id);
+	/* Most readers treat 0 as little endian, contrary to the
+	   specification, thus follow what is used in practice. */
+	put_le32(hdr + 22, 0);
+	put_le32(hdr + 26, ser->width);
+	put_le32(hdr + 30, ser->height);
+	put_le32(hdr + 34, ser->depth);
+	put_le32(hdr + 38, n_frames);
+	/* Observer at 42 is left empty. */
+	memcpy(hdr + 82, ser->instrument,
+	       strnlen(ser->instrument, SER_LEN_STRING));
+	/* Telescope at 122 is left empty. */
+	put_le64(hdr + 162, t_local);
+	put_le64(hdr + 170, t_utc);
+
+	return ser_pwrite(ser->fd, hdr, sizeof(hdr), 0);
+}
+
+int32_t ser_color_id(const ASI_IMG_TYPE img_type, const bool is_color,
+		     const ASI_BAYER_PATTERN bayer)
+{
+	if (img_type == ASI_IMG_RGB24)
+		return SER_BGR;
+	if (img_type == ASI_IMG_Y8 || !is_color)
+		return SER_MONO;
+
+	switch (bayer) {
+	case ASI_BAYER_RG:
+		return SER_BAYER_RGGB;
+	case ASI_BAYER_BG:
+		return SER_BAYER_BGGR;
+	case ASI_BAYER_GR:
+		return SER_BAYER_GRBG;
+	case ASI_BAYER_GB:
+		return SER_BAYER_GBRG;
+	default:
+		return SER_MONO;
+	}
+}
+
+int ser_open(struct ser *ser, const char *filename, const struct frame *tmpl,
+	     const int32_t color_id, const char *instrument,
+	     const uint32_t n_frames)
+{
+	int rc;
+
+	if (!ser || !filename || !tmpl || n_frames == 0 || tmpl->size <= 0)
+		return -EINVAL;
+
+	memset(ser, 0, sizeof(struct ser));
+	ser->fd = -1;
+	ser->color_id = color_id;
+	ser->width = tmpl->width;
+	ser->height = tmpl->height;
+	ser->depth = tmpl->img_type == ASI_IMG_RAW16 ? 16 : 8;
+	ser->frame_size = tmpl->size;
+	ser->n_frames = n_frames;
+	strncpy(ser->filename, filename, PATH_MAX);
+	if (instrument)
+		strncpy(ser->instrument, instrument, SER_LEN_STRING);
+
+	ser->ts = calloc(n_frames, sizeof(uint64_t));
+	if (!ser->ts)
+		return -ENOMEM;
+
+	ser->fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (ser->fd < 0) {
+		rc = -errno;
+		C_ERROR(errno, "open '%s'", filename);
+		goto cleanup;
+	}
+
+	/* Reserve the whole sequence upfront, such that frames do not
+	   extend the file one by one. Not supported on every file system,
+	   which is not an error. */
+	rc = posix_fallocate(ser->fd, 0, SER_HEADER_SIZE +
+			     (off_t)n_frames * ser->frame_size);
+	if (rc && rc != EOPNOTSUPP && rc != EINVAL) {
+		C_ERROR(rc, "posix_fallocate '%s'", filename);
+		rc = -rc;
+		goto cleanup;
+	}
+
+	rc = ser_write_header(ser, n_frames);
+	if (rc) {
+		C_ERROR(-rc, "write header '%s'", filename);
+		goto cleanup;
+	}
+
+	pthread_mutex_init(&ser->mutex, NULL);
+
+	return 0;
+
+cleanup:
+	if (ser->fd >= 0)
+		close(ser->fd);
+	ser->fd = -1;
+	free(ser->ts);
+	ser->ts = NULL;
+
+	return rc;
+}
+
+int ser_write(struct ser *ser, const struct frame *frame)
+{
+	int rc;
+	uint32_t idx;
+
+	if (frame->size != ser->frame_size)
+		return -EINVAL;
+
+	/* Index in order of arrival rather than by sequence number, frames
+	   dropped by the ring would otherwise remain as empty frames. */
+	pthread_mutex_lock(&ser->mutex);
+	if (ser->n_written >= ser->n_frames) {
+		pthread_mutex_unlock(&ser->mutex);
+		return -EINVAL;
+	}
+	idx = ser->n_written++;
+	ser->ts[idx] = ser_ticks(frame->t_obs);
+	pthread_mutex_unlock(&ser->mutex);
+
+	/* Straight from the capture buffer at the offset of its index. */
+	rc = ser_pwrite(ser->fd, frame->buf, frame->size, SER_HEADER_SIZE +
+			(off_t)idx * ser->frame_size);
+	if (rc)
+		C_ERROR(-rc, "pwrite '%s'", ser->filename);
+
+	return rc;
+}
+
+int ser_close(struct ser *ser)
+{
+	int rc = 0;
+	uint8_t *trailer = NULL;
+
+	if (ser->fd < 0)
+		return 0;
+
+	/* The frame count is the number of frames written, the reserved
+	   space of frames dropped or never captured is cut off. */
+	const off_t end = SER_HEADER_SIZE +
+		(off_t)ser->n_written * ser->frame_size;
+
+	if (ser->n_written < ser->n_frames) {
+		C_WARN("%u of %u frames written to '%s'", ser->n_written,
+		       ser->n_frames, ser->filename);
+		if (ftruncate(ser->fd, end) < 0) {
+			rc = -errno;
+			C_ERROR(errno, "ftruncate '%s'", ser->filename);
+			goto cleanup;
+		}
+	}
+
+	trailer = malloc((size_t)ser->n_written * sizeof(uint64_t) + 1);
+	if (!trailer) {
+		rc = -ENOMEM;
+		C_ERROR(ENOMEM, "malloc");
+		goto cleanup;
+	}
+	for (uint32_t n = 0; n < ser->n_written; n++)
+		put_le64(trailer + n * sizeof(uint64_t), ser->ts[n]);
+
+	rc = ser_pwrite(ser->fd, trailer, ser->n_written * sizeof(uint64_t),
+			end);
+	if (rc) {
+		C_ERROR(-rc, "write timestamps '%s'", ser->filename);
+		goto cleanup;
+	}
+
+	rc = ser_write_header(ser, ser->n_written);
+	if (rc)
+		C_ERROR(-rc, "write header '%s'", ser->filename);
+
+cleanup:
+	if (close(ser->fd) < 0 && !rc) {
+		rc = -errno;
+		C_ERROR(errno, "close '%s'", ser->filename);
+	}
+	ser->fd = -1;
+	free(trailer);
+	free(ser->ts);
+	ser->ts = NULL;
+	pthread_mutex_destroy(&ser->mutex);
+
+	return rc;
+}
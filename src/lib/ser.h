@@ -0,0 +1,70 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 only,
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License version 2 for more details (a copy is included
+ * in the LICENSE file that accompanied this code).
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Copyright (c) 2017, Thomas Stibor <thomas@stibor.net>
+ */
+
+#ifndef SER_H
+#define SER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <limits.h>
+#include <pthread.h>
+#include "frame.h"
+
+#define SER_HEADER_SIZE	178
+#define SER_LEN_STRING	40
+
+/* ColorID values of the SER header. */
+enum ser_color_id {
+	SER_MONO       = 0,
+	SER_BAYER_RGGB = 8,
+	SER_BAYER_GRBG = 9,
+	SER_BAYER_GBRG = 10,
+	SER_BAYER_BGGR = 11,
+	SER_RGB        = 100,
+	SER_BGR        = 101
+};
+
+/* A SER video file of fixed size frames. Each frame is given the next
+   free index when it arrives and written at its own offset, thus frames
+   can be written concurrently and frames dropped before they reach the
+   file leave no gaps. The per frame timestamp table and the final frame
+   count are written when the file is closed. */
+struct ser {
+	int fd;
+	char filename[PATH_MAX + 1];
+	int32_t color_id;
+	int32_t width;
+	int32_t height;
+	int32_t depth;		/* Bits per plane. */
+	long frame_size;
+	uint32_t n_frames;
+	uint32_t n_written;	/* Frames written, also the next index. */
+	uint64_t *ts;		/* UTC timestamps indexed by frame index. */
+	char instrument[SER_LEN_STRING + 1];
+	pthread_mutex_t mutex;
+};
+
+int32_t ser_color_id(const ASI_IMG_TYPE img_type, const bool is_color,
+		     const ASI_BAYER_PATTERN bayer);
+int ser_open(struct ser *ser, const char *filename, const struct frame *tmpl,
+	     const int32_t color_id, const char *instrument,
+	     const uint32_t n_frames);
+int ser_write(struct ser *ser, const struct frame *frame);
+int ser_close(struct ser *ser);
+
+#endif	/* SER_H */
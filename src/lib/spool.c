@@ -0,0 +1,299 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 only,
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License version 2 for more details (a copy is included
+ * in the LICENSE file that accompanied this code).
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Copyright (c) 2017, Thomas Stibor <thomas@stibor.net>
+ */
+
+#define _GNU_SOURCE		/* sync_file_range() */
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "log.h"
+#include "spool.h"
+
+/* Slots behind the most recently committed one whose pages are
+   written back and released, such that a long spool does not fill
+   the page cache with dirty pages. */
+#define SPOOL_WRITEBACK_LAG	8
+
+#define SPOOL_ROUNDUP(_x) (((_x) + SPOOL_ALIGN - 1) & ~((uint64_t)SPOOL_ALIGN - 1))
+
+static int spool_map(struct spool *spool, const int prot)
+{
+	spool->map = mmap(NULL, spool->map_size, prot, MAP_SHARED, spool->fd, 0);
+	if (spool->map == MAP_FAILED) {
+		spool->map = NULL;
+		C_ERROR(errno, "mmap '%s'", spool->filename);
+		return -errno;
+	}
+	madvise(spool->map, spool->map_size, MADV_SEQUENTIAL);
+
+	spool->hdr = (struct spool_header *)spool->map;
+	spool->index = (struct spool_entry *)(spool->map + spool->hdr->index_off);
+
+	return 0;
+}
+
+int spool_create(struct spool *spool, const char *filename,
+		 const struct frame *tmpl, const uint32_t n_slots,
+		 const char *camera, const bool is_color, const int32_t bayer)
+{
+	int rc;
+
+	if (!spool || !filename || !tmpl || n_slots == 0 || tmpl->size <= 0)
+		return -EINVAL;
+
+	memset(spool, 0, sizeof(struct spool));
+	strncpy(spool->filename, filename, PATH_MAX);
+	spool->writable = true;
+
+	const uint64_t slot_size = SPOOL_ROUNDUP((uint64_t)tmpl->size);
+	const uint64_t index_off = SPOOL_ROUNDUP(sizeof(struct spool_header));
+	const uint64_t data_off = SPOOL_ROUNDUP(index_off +
+		(uint64_t)n_slots * sizeof(struct spool_entry));
+	spool->map_size = data_off + n_slots * slot_size;
+
+	spool->fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (spool->fd < 0) {
+		C_ERROR(errno, "open '%s'", filename);
+		return -errno;
+	}
+
+	/* Allocate all blocks now, downloads into the mapping must not
+	   fault on block allocation or fail with SIGBUS on ENOSPC. */
+	rc = posix_fallocate(spool->fd, 0, spool->map_size);
+	if (rc) {
+		C_ERROR(rc, "posix_fallocate '%s' (%zu bytes)", filename,
+			spool->map_size);
+		rc = -rc;
+		goto cleanup;
+	}
+
+	rc = spool_map(spool, PROT_READ | PROT_WRITE);
+	if (rc)
+		goto cleanup;
+
+	struct spool_header *hdr = spool->hdr;
+	memcpy(hdr->magic, SPOOL_MAGIC, sizeof(SPOOL_MAGIC));
+	hdr->version = SPOOL_VERSION;
+	hdr->img_type = tmpl->img_type;
+	hdr->width = tmpl->width;
+	hdr->height = tmpl->height;
+	hdr->bin = tmpl->bin;
+	hdr->n_slots = n_slots;
+	hdr->n_frames = 0;
+	hdr->is_color = is_color;
+	hdr->bayer = bayer;
+	hdr->x_pix_sz = tmpl->x_pix_sz;
+	hdr->y_pix_sz = tmpl->y_pix_sz;
+	hdr->frame_size = tmpl->size;
+	hdr->slot_size = slot_size;
+	hdr->index_off = index_off;
+	hdr->data_off = data_off;
+	hdr->exp_time = tmpl->exp_time;
+	if (camera)
+		strncpy(hdr->camera, camera, SPOOL_LEN_NAME - 1);
+	spool->index = (struct spool_entry *)(spool->map + index_off);
+	pthread_mutex_init(&spool->mutex, NULL);
+
+	return 0;
+
+cleanup:
+	close(spool->fd);
+	spool->fd = -1;
+	unlink(filename);
+
+	return rc;
+}
+
+int spool_open(struct spool *spool, const char *filename)
+{
+	int rc;
+	struct stat st;
+	struct spool_header hdr;
+
+	memset(spool, 0, sizeof(struct spool));
+	strncpy(spool->filename, filename, PATH_MAX);
+
+	spool->fd = open(filename, O_RDONLY);
+	if (spool->fd < 0) {
+		C_ERROR(errno, "open '%s'", filename);
+		return -errno;
+	}
+
+	if (fstat(spool->fd, &st) < 0) {
+		rc = -errno;
+		C_ERROR(errno, "fstat '%s'", filename);
+		goto cleanup;
+	}
+
+	if (pread(spool->fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+	    memcmp(hdr.magic, SPOOL_MAGIC, sizeof(SPOOL_MAGIC)) ||
+	    hdr.version < SPOOL_VERSION_MIN || hdr.version > SPOOL_VERSION) {
+		rc = -EINVAL;
+		C_ERROR(EINVAL, "'%s' is not a spool file", filename);
+		goto cleanup;
+	}
+
+	spool->map_size = hdr.data_off + hdr.n_slots * hdr.slot_size;
+	if ((uint64_t)st.st_size < spool->map_size ||
+	    hdr.slot_size < hdr.frame_size || hdr.n_frames > hdr.n_slots ||
+	    hdr.index_off + hdr.n_slots * sizeof(struct spool_entry) >
+	    hdr.data_off) {
+		rc = -EINVAL;
+		C_ERROR(EINVAL, "spool '%s' is truncated or corrupt", filename);
+		goto cleanup;
+	}
+
+	rc = spool_map(spool, PROT_READ);
+	if (rc)
+		goto cleanup;
+
+	return 0;
+
+cleanup:
+	close(spool->fd);
+	spool->fd = -1;
+
+	return rc;
+}
+
+uint8_t *spool_slot(struct spool *spool, const uint32_t seq)
+{
+	if (seq < 1 || seq > spool->hdr->n_slots)
+		return NULL;
+
+	return spool->map + spool->hdr->data_off +
+		(uint64_t)(seq - 1) * spool->hdr->slot_size;
+}
+
+int spool_commit(struct spool *spool, const struct frame *frame)
+{
+	uint8_t *slot = spool_slot(spool, frame->seq);
+	const struct spool_header *hdr = spool->hdr;
+
+	if (!slot || (uint64_t)frame->size != hdr->frame_size)
+		return -EINVAL;
+
+	/* Frames not downloaded into the spool are copied. */
+	if (frame->buf != slot)
+		memcpy(slot, frame->buf, frame->size);
+
+	struct spool_entry *entry = &spool->index[frame->seq - 1];
+	entry->t_obs = frame->t_obs;
+	entry->exp_time = frame->exp_time;
+	entry->org = frame->x_org < 0 || frame->y_org < 0 ? 0 :
+		SPOOL_ORG_VALID | (frame->x_org & 0x7fff) << 16 |
+		(frame->y_org & 0xffff);
+	memcpy(entry->date_obs, frame->date_obs, MAX_LEN_ISO8601);
+	entry->seq = frame->seq;
+	pthread_mutex_lock(&spool->mutex);
+	if (frame->seq > spool->hdr->n_frames)
+		spool->hdr->n_frames = frame->seq;
+	pthread_mutex_unlock(&spool->mutex);
+
+	/* Start writeback of this slot and wait for the one lagging
+	   behind, whose pages are then released. */
+	const off_t off = slot - spool->map;
+	sync_file_range(spool->fd, off, hdr->slot_size,
+			SYNC_FILE_RANGE_WRITE);
+	if (frame->seq > SPOOL_WRITEBACK_LAG) {
+		const off_t lag = off - SPOOL_WRITEBACK_LAG * hdr->slot_size;
+		sync_file_range(spool->fd, lag, hdr->slot_size,
+				SYNC_FILE_RANGE_WAIT_BEFORE |
+				SYNC_FILE_RANGE_WRITE |
+				SYNC_FILE_RANGE_WAIT_AFTER);
+		madvise(spool->map + lag, hdr->slot_size, MADV_DONTNEED);
+		posix_fadvise(spool->fd, lag, hdr->slot_size,
+			      POSIX_FADV_DONTNEED);
+	}
+
+	return 0;
+}
+
+/* Frame n (starting at 0) of a spool, its buffer points into the
+   mapping. Returns -ENOENT for a slot never written. */
+int spool_frame(const struct spool *spool, const uint32_t n,
+		struct frame *frame)
+{
+	const struct spool_header *hdr = spool->hdr;
+	const struct spool_entry *entry = &spool->index[n];
+	bool org;
+
+	if (n >= hdr->n_slots)
+		return -EINVAL;
+	if (entry->seq != n + 1)
+		return -ENOENT;
+
+	/* Version 1 has no ROI start, its field is reserved. */
+	org = hdr->version >= 2 && entry->org & SPOOL_ORG_VALID;
+
+	*frame = (struct frame) {
+		.buf = spool->map + hdr->data_off + n * hdr->slot_size,
+		.size = hdr->frame_size,
+		.width = hdr->width,
+		.height = hdr->height,
+		.bin = hdr->bin,
+		.img_type = hdr->img_type,
+		.planes = 1,
+		.seq = entry->seq,
+		.t_obs = entry->t_obs,
+		.exp_time = entry->exp_time,
+		.date_obs = {0},
+		.x_pix_sz = hdr->x_pix_sz,
+		.y_pix_sz = hdr->y_pix_sz,
+		.x_org = org ? (int)(entry->org >> 16 & 0x7fff) : -1,
+		.y_org = org ? (int)(entry->org & 0xffff) : -1,
+		.temp = NAN
+	};
+	memcpy(frame->date_obs, entry->date_obs, MAX_LEN_ISO8601);
+	frame->date_obs[MAX_LEN_ISO8601 - 1] = '\0';
+
+	return 0;
+}
+
+int spool_close(struct spool *spool)
+{
+	int rc = 0;
+
+	if (spool->fd < 0 || !spool->map)
+		return 0;
+
+	if (spool->writable) {
+		const uint32_t n_frames = spool->hdr->n_frames;
+
+		if (n_frames < spool->hdr->n_slots)
+			C_WARN("%u of %u slots written to '%s'", n_frames,
+			       spool->hdr->n_slots, spool->filename);
+		if (msync(spool->map, spool->map_size, MS_SYNC) < 0) {
+			rc = -errno;
+			C_ERROR(errno, "msync '%s'", spool->filename);
+		}
+	}
+
+	munmap(spool->map, spool->map_size);
+	spool->map = NULL;
+	if (close(spool->fd) < 0 && !rc) {
+		rc = -errno;
+		C_ERROR(errno, "close '%s'", spool->filename);
+	}
+	spool->fd = -1;
+	if (spool->writable)
+		pthread_mutex_destroy(&spool->mutex);
+
+	return rc;
+}
@@ -0,0 +1,95 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 only,
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License version 2 for more details (a copy is included
+ * in the LICENSE file that accompanied this code).
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Copyright (c) 2017, Thomas Stibor <thomas@stibor.net>
+ */
+
+#ifndef SPOOL_H
+#define SPOOL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <limits.h>
+#include <pthread.h>
+#include "frame.h"
+
+#define SPOOL_MAGIC		"ASICSPL"
+#define SPOOL_VERSION		2	/* 2: ROI start in the index. */
+#define SPOOL_VERSION_MIN	1
+#define SPOOL_ALIGN		4096
+#define SPOOL_LEN_NAME		64
+#define SPOOL_ORG_VALID		0x80000000
+
+/* On disk layout of a spool: header, index of n_slots entries and
+   n_slots frame slots, each starting at a SPOOL_ALIGN boundary.
+   Fields are in host byte order, a spool is converted on the host
+   (or same architecture) that recorded it. */
+struct spool_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t img_type;
+	uint32_t width;
+	uint32_t height;
+	uint32_t bin;
+	uint32_t n_slots;
+	uint32_t n_frames;	/* Highest sequence number written. */
+	int32_t is_color;
+	int32_t bayer;
+	float x_pix_sz;
+	float y_pix_sz;
+	uint32_t reserved;
+	uint64_t frame_size;
+	uint64_t slot_size;
+	uint64_t index_off;
+	uint64_t data_off;
+	double exp_time;
+	char camera[SPOOL_LEN_NAME];
+};
+
+/* Index entry of slot seq - 1, seq is 0 for slots never written. The
+   ROI start is packed as SPOOL_ORG_VALID | x << 16 | y, 0 if unknown.
+   Version 1 spools have a reserved field instead and no ROI start. */
+struct spool_entry {
+	uint32_t seq;
+	uint32_t org;
+	double t_obs;
+	double exp_time;
+	char date_obs[MAX_LEN_ISO8601];
+};
+
+/* A spool file mapped into memory. Frames are downloaded by the SDK
+   directly into their slot and committed without being copied. */
+struct spool {
+	int fd;
+	char filename[PATH_MAX + 1];
+	bool writable;
+	uint8_t *map;
+	size_t map_size;
+	struct spool_header *hdr;
+	struct spool_entry *index;
+	pthread_mutex_t mutex;
+};
+
+int spool_create(struct spool *spool, const char *filename,
+		 const struct frame *tmpl, const uint32_t n_slots,
+		 const char *camera, const bool is_color, const int32_t bayer);
+int spool_open(struct spool *spool, const char *filename);
+uint8_t *spool_slot(struct spool *spool, const uint32_t seq);
+int spool_commit(struct spool *spool, const struct frame *frame);
+int spool_frame(const struct spool *spool, const uint32_t n,
+		struct frame *frame);
+int spool_close(struct spool *spool);
+
+#endif	/* SPOOL_H */
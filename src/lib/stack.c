@@ -0,0 +1,527 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 only,
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License version 2 for more details (a copy is included
+ * in the LICENSE file that accompanied this code).
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Copyright (c) 2017, Thomas Stibor <thomas@stibor.net>
+ */
+
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "parallel.h"
+#include "stack.h"
+
+#define STACK_DETECT_SIGMA	5.0f	/* Threshold above background. */
+#define STACK_DETECT_STEP	4	/* Subsampling of the background. */
+#define STACK_DETECT_BANDS	16
+#define STACK_BOX		3	/* Half width of the centroid box. */
+#define STACK_MATCH_STARS	12	/* Brightest stars for hypotheses. */
+#define STACK_MATCH_TOL		2.0	/* Pixel. */
+#define STACK_CLIP_MIN		3	/* Samples before clipping starts. */
+
+static inline int32_t sample(const uint8_t *img, const size_t i,
+			     const uint8_t bps)
+{
+	return bps == 2 ? ((const uint16_t *)img)[i] : img[i];
+}
+
+/* Median and noise of a subsample, the latter from the median absolute
+   deviation. */
+static int background(const uint8_t *img, const uint32_t width,
+		      const uint32_t height, const uint8_t bps, float *bg,
+		      float *sigma)
+{
+	const uint32_t n_bins = bps == 2 ? 65536 : 256;
+	uint32_t *hist = calloc(n_bins, sizeof(uint32_t));
+	uint32_t n = 0;
+	uint32_t cum = 0;
+	uint32_t median = 0;
+	uint32_t mad = 0;
+
+	if (!hist)
+		return -ENOMEM;
+
+	for (uint32_t y = 0; y < height; y += STACK_DETECT_STEP)
+		for (uint32_t x = 0; x < width; x += STACK_DETECT_STEP, n++)
+			hist[sample(img, (size_t)y * width + x, bps)]++;
+	for (; median < n_bins && (cum += hist[median]) < n / 2; median++)
+		;
+
+	memset(hist, 0, n_bins * sizeof(uint32_t));
+	for (uint32_t y = 0; y < height; y += STACK_DETECT_STEP)
+		for (uint32_t x = 0; x < width; x += STACK_DETECT_STEP)
+			hist[abs(sample(img, (size_t)y * width + x, bps) -
+				 (int32_t)median)]++;
+	for (cum = 0; mad < n_bins && (cum += hist[mad]) < n / 2; mad++)
+		;
+	free(hist);
+
+	*bg = median;
+	*sigma = 1.4826f * mad;
+	if (*sigma < 1)
+		*sigma = 1;
+
+	return 0;
+}
+
+/* Keep the n_max brightest stars, unordered. */
+static void star_insert(struct stack_star *stars, uint32_t *n_stars,
+			const uint32_t n_max, const struct stack_star *star)
+{
+	uint32_t min = 0;
+
+	if (*n_stars < n_max) {
+		stars[(*n_stars)++] = *star;
+		return;
+	}
+	for (uint32_t i = 1; i < *n_stars; i++)
+		if (stars[i].peak < stars[min].peak)
+			min = i;
+	if (star->peak > stars[min].peak)
+		stars[min] = *star;
+}
+
+static int star_cmp(const void *a, const void *b)
+{
+	const float pa = ((const struct stack_star *)a)->peak;
+	const float pb = ((const struct stack_star *)b)->peak;
+
+	return pa < pb ? 1 : pa > pb ? -1 : 0;
+}
+
+struct detect_job {
+	const uint8_t *img;
+	uint32_t width;
+	uint32_t height;
+	uint8_t bps;
+	float bg;
+	float thr;
+	struct stack_star stars[STACK_DETECT_BANDS][STACK_MAX_STARS];
+	uint32_t n_stars[STACK_DETECT_BANDS];
+};
+
+/* Local maxima above threshold, ties are resolved in favour of the
+   first in raster order. Position is the background subtracted
+   centroid of the surrounding box. */
+static void detect_bands(const uint32_t begin, const uint32_t end, void *arg)
+{
+	struct detect_job *job = arg;
+	const uint32_t w = job->width;
+	const uint32_t border = STACK_BOX + 1;
+
+	for (uint32_t b = begin; b < end; b++) {
+		uint32_t y0 = (uint64_t)job->height * b / STACK_DETECT_BANDS;
+		uint32_t y1 = (uint64_t)job->height * (b + 1) / STACK_DETECT_BANDS;
+
+		if (y0 < border)
+			y0 = border;
+		if (y1 > job->height - border)
+			y1 = job->height - border;
+
+		for (uint32_t y = y0; y < y1; y++) {
+			for (uint32_t x = border; x < w - border; x++) {
+				const size_t i = (size_t)y * w + x;
+				const int32_t v = sample(job->img, i, job->bps);
+
+				if (v <= job->thr ||
+				    v <= sample(job->img, i - w - 1, job->bps) ||
+				    v <= sample(job->img, i - w, job->bps) ||
+				    v <= sample(job->img, i - w + 1, job->bps) ||
+				    v <= sample(job->img, i - 1, job->bps) ||
+				    v < sample(job->img, i + 1, job->bps) ||
+				    v < sample(job->img, i + w - 1, job->bps) ||
+				    v < sample(job->img, i + w, job->bps) ||
+				    v < sample(job->img, i + w + 1, job->bps))
+					continue;
+
+				float sw = 0, sx = 0, sy = 0;
+				for (int32_t dy = -STACK_BOX; dy <= STACK_BOX; dy++) {
+					for (int32_t dx = -STACK_BOX; dx <= STACK_BOX; dx++) {
+						const float s = sample(job->img, i + dy * (int32_t)w + dx,
+								       job->bps) - job->bg;
+						if (s <= 0)
+							continue;
+						sw += s;
+						sx += s * dx;
+						sy += s * dy;
+					}
+				}
+
+				const struct stack_star star = {
+					.x = x + sx / sw,
+					.y = y + sy / sw,
+					.peak = v - job->bg
+				};
+				star_insert(job->stars[b], &job->n_stars[b],
+					    STACK_MAX_STARS, &star);
+			}
+		}
+	}
+}
+
+/* Up to STACK_MAX_STARS brightest stars of an image, sorted by
+   decreasing peak. */
+int stack_detect(const uint8_t *img, const uint32_t width,
+		 const uint32_t height, const uint8_t bytes_per_sample,
+		 struct stack_star *stars, uint32_t *n_stars)
+{
+	int rc;
+	float sigma;
+	struct detect_job *job;
+
+	*n_stars = 0;
+	if (width <= 2 * (STACK_BOX + 1) || height <= 2 * (STACK_BOX + 1))
+		return -EINVAL;
+
+	job = calloc(1, sizeof(struct detect_job));
+	if (!job)
+		return -ENOMEM;
+
+	job->img = img;
+	job->width = width;
+	job->height = height;
+	job->bps = bytes_per_sample;
+	rc = background(img, width, height, bytes_per_sample, &job->bg, &sigma);
+	if (rc)
+		goto cleanup;
+	job->thr = job->bg + STACK_DETECT_SIGMA * sigma;
+
+	rc = parallel_for(STACK_DETECT_BANDS, detect_bands, job);
+	if (rc)
+		goto cleanup;
+
+	for (uint32_t b = 0; b < STACK_DETECT_BANDS; b++)
+		for (uint32_t s = 0; s < job->n_stars[b]; s++)
+			star_insert(stars, n_stars, STACK_MAX_STARS,
+				    &job->stars[b][s]);
+	qsort(stars, *n_stars, sizeof(struct stack_star), star_cmp);
+
+cleanup:
+	free(job);
+
+	return rc;
+}
+
+/* Number of stars of cur which are within STACK_MATCH_TOL of a
+   reference star once transformed, match[k] is the reference star of
+   cur[k] or -1. */
+static uint32_t inliers(const struct stack_star *ref, const uint32_t n_ref,
+			const struct stack_star *cur, const uint32_t n_cur,
+			const struct stack_xform *xf, int32_t *match)
+{
+	uint32_t n = 0;
+
+	for (uint32_t k = 0; k < n_cur; k++) {
+		const double x = xf->cos * cur[k].x - xf->sin * cur[k].y + xf->tx;
+		const double y = xf->sin * cur[k].x + xf->cos * cur[k].y + xf->ty;
+		double best = STACK_MATCH_TOL * STACK_MATCH_TOL;
+
+		match[k] = -1;
+		for (uint32_t i = 0; i < n_ref; i++) {
+			const double d = (ref[i].x - x) * (ref[i].x - x) +
+				(ref[i].y - y) * (ref[i].y - y);
+			if (d < best) {
+				best = d;
+				match[k] = i;
+			}
+		}
+		n += match[k] >= 0;
+	}
+
+	return n;
+}
+
+/* Least squares rotation and translation of the matched stars. */
+static void refine(const struct stack_star *ref, const struct stack_star *cur,
+		   const uint32_t n_cur, const int32_t *match,
+		   struct stack_xform *xf)
+{
+	double px = 0, py = 0, qx = 0, qy = 0, sxx = 0, sxy = 0;
+	uint32_t n = 0;
+
+	for (uint32_t k = 0; k < n_cur; k++) {
+		if (match[k] < 0)
+			continue;
+		px += cur[k].x;
+		py += cur[k].y;
+		qx += ref[match[k]].x;
+		qy += ref[match[k]].y;
+		n++;
+	}
+	if (n < 2)
+		return;
+	px /= n;
+	py /= n;
+	qx /= n;
+	qy /= n;
+
+	for (uint32_t k = 0; k < n_cur; k++) {
+		if (match[k] < 0)
+			continue;
+		const double ax = cur[k].x - px, ay = cur[k].y - py;
+		const double bx = ref[match[k]].x - qx, by = ref[match[k]].y - qy;
+
+		sxx += ax * bx + ay * by;
+		sxy += ax * by - ay * bx;
+	}
+
+	const double theta = atan2(sxy, sxx);
+	xf->cos = cos(theta);
+	xf->sin = sin(theta);
+	xf->tx = qx - (xf->cos * px - xf->sin * py);
+	xf->ty = qy - (xf->sin * px + xf->cos * py);
+}
+
+/* Rotation and translation hypotheses from pairs of the brightest stars
+   of equal separation in both frames, scored by the number of stars
+   they map onto reference stars. */
+static int align(const struct stack_star *ref, const uint32_t n_ref,
+		 const struct stack_star *cur, const uint32_t n_cur,
+		 struct stack_xform *xf)
+{
+	int32_t match[STACK_MAX_STARS];
+	const uint32_t m_ref = n_ref < STACK_MATCH_STARS ? n_ref : STACK_MATCH_STARS;
+	const uint32_t m_cur = n_cur < STACK_MATCH_STARS ? n_cur : STACK_MATCH_STARS;
+	uint32_t best = 0;
+
+	for (uint32_t i = 0; i < m_ref; i++) {
+		for (uint32_t j = i + 1; j < m_ref; j++) {
+			const double rx = ref[j].x - ref[i].x;
+			const double ry = ref[j].y - ref[i].y;
+			const double rd = sqrt(rx * rx + ry * ry);
+
+			for (uint32_t k = 0; k < m_cur; k++) {
+				for (uint32_t l = 0; l < m_cur; l++) {
+					if (k == l)
+						continue;
+					const double cx = cur[l].x - cur[k].x;
+					const double cy = cur[l].y - cur[k].y;
+
+					if (fabs(sqrt(cx * cx + cy * cy) - rd) >
+					    STACK_MATCH_TOL)
+						continue;
+
+					const double theta = atan2(ry, rx) - atan2(cy, cx);
+					struct stack_xform h = {
+						.cos = cos(theta),
+						.sin = sin(theta)
+					};
+					h.tx = ref[i].x - (h.cos * cur[k].x - h.sin * cur[k].y);
+					h.ty = ref[i].y - (h.sin * cur[k].x + h.cos * cur[k].y);
+
+					const uint32_t n = inliers(ref, n_ref, cur, n_cur,
+								   &h, match);
+					if (n > best) {
+						best = n;
+						*xf = h;
+					}
+				}
+			}
+		}
+	}
+	if (best < STACK_MIN_STARS)
+		return -EAGAIN;
+
+	inliers(ref, n_ref, cur, n_cur, xf, match);
+	refine(ref, cur, n_cur, match, xf);
+	xf->n_matched = inliers(ref, n_ref, cur, n_cur, xf, match);
+
+	return xf->n_matched < STACK_MIN_STARS ? -EAGAIN : 0;
+}
+
+int stack_init(struct stack *stack, const uint32_t width,
+	       const uint32_t height, const uint32_t planes,
+	       const uint8_t bytes_per_sample, const float kappa)
+{
+	const size_t n = (size_t)width * height * planes;
+
+	memset(stack, 0, sizeof(struct stack));
+	if (width <= 2 * (STACK_BOX + 1) || height <= 2 * (STACK_BOX + 1) ||
+	    planes < 1 || (bytes_per_sample != 1 && bytes_per_sample != 2))
+		return -EINVAL;
+
+	stack->width = width;
+	stack->height = height;
+	stack->planes = planes;
+	stack->bps = bytes_per_sample;
+	stack->kappa = kappa;
+
+	stack->n = calloc(n, sizeof(uint32_t));
+	if (kappa > 0) {
+		stack->mean = calloc(n, sizeof(float));
+		stack->m2 = calloc(n, sizeof(float));
+	} else
+		stack->sum = calloc(n, sizeof(uint64_t));
+	if (!stack->n || (kappa > 0 && (!stack->mean || !stack->m2)) ||
+	    (kappa <= 0 && !stack->sum)) {
+		stack_destroy(stack);
+		return -ENOMEM;
+	}
+
+	return 0;
+}
+
+struct accumulate_job {
+	struct stack *stack;
+	const uint8_t *buf;
+	struct stack_xform xf;
+};
+
+/* Rows [begin, end) of the reference grid, sampled bilinear from the
+   frame by the inverse transform. */
+static void accumulate_rows(const uint32_t begin, const uint32_t end,
+			    void *arg)
+{
+	struct accumulate_job *job = arg;
+	struct stack *stack = job->stack;
+	const struct stack_xform *xf = &job->xf;
+	const uint32_t w = stack->width;
+	const uint32_t h = stack->height;
+	const size_t plane = (size_t)w * h;
+	const float kappa2 = stack->kappa * stack->kappa;
+	uint64_t rejected = 0;
+
+	for (uint32_t y = begin; y < end; y++) {
+		for (uint32_t x = 0; x < w; x++) {
+			const float px = xf->cos * (x - xf->tx) + xf->sin * (y - xf->ty);
+			const float py = -xf->sin * (x - xf->tx) + xf->cos * (y - xf->ty);
+
+			if (px < 0 || py < 0 || px >= w - 1 || py >= h - 1)
+				continue;
+
+			const uint32_t x0 = px;
+			const uint32_t y0 = py;
+			const float fx = px - x0;
+			const float fy = py - y0;
+			const size_t s = (size_t)y0 * w + x0;
+
+			for (uint32_t p = 0; p < stack->planes; p++) {
+				const size_t o = p * plane;
+				const size_t i = o + (size_t)y * w + x;
+				const float v =
+					(1 - fy) * ((1 - fx) * sample(job->buf, o + s, stack->bps) +
+						    fx * sample(job->buf, o + s + 1, stack->bps)) +
+					fy * ((1 - fx) * sample(job->buf, o + s + w, stack->bps) +
+					      fx * sample(job->buf, o + s + w + 1, stack->bps));
+
+				if (!stack->mean) {
+					stack->sum[i] += (uint64_t)(v * (1 << STACK_SUM_SHIFT) + 0.5f);
+					stack->n[i]++;
+					continue;
+				}
+
+				/* Welford update, after rejecting outliers
+				   against the noise of the samples so far,
+				   at least 1 ADU. */
+				const uint32_t n = stack->n[i];
+				float d = v - stack->mean[i];
+
+				if (n >= STACK_CLIP_MIN) {
+					float var = stack->m2[i] / (n - 1);
+					if (var < 1)
+						var = 1;
+					if (d * d > kappa2 * var) {
+						rejected++;
+						continue;
+					}
+				}
+				stack->n[i] = n + 1;
+				stack->mean[i] += d / (n + 1);
+				stack->m2[i] += d * (v - stack->mean[i]);
+			}
+		}
+	}
+
+	__atomic_fetch_add(&stack->n_rejected, rejected, __ATOMIC_RELAXED);
+}
+
+/* Register a frame (planes of bps samples as set by stack_init()) on
+   the reference stars and accumulate it. The first frame with enough
+   stars becomes the reference. Frames which cannot be registered are
+   skipped with -EAGAIN. */
+int stack_add(struct stack *stack, const uint8_t *buf,
+	      struct stack_xform *xform)
+{
+	int rc;
+	struct stack_star stars[STACK_MAX_STARS];
+	uint32_t n_stars;
+	const size_t plane = (size_t)stack->width * stack->height * stack->bps;
+	struct accumulate_job job = {
+		.stack = stack,
+		.buf = buf,
+		.xf = {.cos = 1, .sin = 0, .tx = 0, .ty = 0, .n_matched = 0}
+	};
+
+	/* Stars of the green plane of color frames. */
+	rc = stack_detect(stack->planes == 3 ? buf + plane : buf,
+			  stack->width, stack->height, stack->bps, stars,
+			  &n_stars);
+	if (rc)
+		return rc;
+
+	if (stack->n_ref == 0) {
+		if (n_stars < STACK_MIN_STARS) {
+			stack->n_failed++;
+			return -EAGAIN;
+		}
+		memcpy(stack->ref, stars, n_stars * sizeof(struct stack_star));
+		stack->n_ref = n_stars;
+		job.xf.n_matched = n_stars;
+	} else {
+		rc = align(stack->ref, stack->n_ref, stars, n_stars, &job.xf);
+		if (rc) {
+			stack->n_failed++;
+			return rc;
+		}
+	}
+
+	rc = parallel_for(stack->height, accumulate_rows, &job);
+	if (rc)
+		return rc;
+	stack->n_frames++;
+	if (xform)
+		*xform = job.xf;
+
+	return 0;
+}
+
+/* Mean of the accumulated samples as planes of floats, 0 where no
+   frame contributed. */
+void stack_image(const struct stack *stack, float *img)
+{
+	const size_t n = (size_t)stack->width * stack->height * stack->planes;
+
+	for (size_t i = 0; i < n; i++) {
+		if (!stack->n[i])
+			img[i] = 0;
+		else if (stack->mean)
+			img[i] = stack->mean[i];
+		else
+			img[i] = (double)stack->sum[i] / stack->n[i] /
+				(1 << STACK_SUM_SHIFT);
+	}
+}
+
+void stack_destroy(struct stack *stack)
+{
+	free(stack->n);
+	free(stack->mean);
+	free(stack->m2);
+	free(stack->sum);
+	stack->n = NULL;
+	stack->mean = NULL;
+	stack->m2 = NULL;
+	stack->sum = NULL;
+}
@@ -0,0 +1,78 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 only,
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License version 2 for more details (a copy is included
+ * in the LICENSE file that accompanied this code).
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Copyright (c) 2017, Thomas Stibor <thomas@stibor.net>
+ */
+
+#ifndef STACK_H
+#define STACK_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define STACK_MAX_STARS		64
+#define STACK_MIN_STARS		3
+#define STACK_SUM_SHIFT		8	/* Fractional bits of the sums. */
+
+struct stack_star {
+	float x;
+	float y;
+	float peak;		/* Above background. */
+};
+
+/* Rigid transform of frame to reference coordinates:
+   x_ref = cos * x - sin * y + tx, y_ref = sin * x + cos * y + ty. */
+struct stack_xform {
+	double cos;
+	double sin;
+	double tx;
+	double ty;
+	uint32_t n_matched;
+};
+
+/* Frames registered on the stars of the first frame and accumulated
+   on its grid. With kappa > 0 a running mean and variance per sample
+   (Welford) is kept and samples farther than kappa sigma from the mean
+   are rejected, otherwise 64 bit fixed point sums. Memory does not
+   depend on the number of frames. Not thread safe, callers serialize. */
+struct stack {
+	uint32_t width;
+	uint32_t height;
+	uint32_t planes;
+	uint8_t bps;
+	float kappa;
+	uint32_t n_frames;
+	uint32_t n_failed;	/* Frames which could not be registered. */
+	uint64_t n_rejected;	/* Samples rejected by sigma clipping. */
+	struct stack_star ref[STACK_MAX_STARS];
+	uint32_t n_ref;
+	uint32_t *n;		/* Per sample. */
+	float *mean;
+	float *m2;
+	uint64_t *sum;
+};
+
+int stack_init(struct stack *stack, const uint32_t width,
+	       const uint32_t height, const uint32_t planes,
+	       const uint8_t bytes_per_sample, const float kappa);
+int stack_detect(const uint8_t *img, const uint32_t width,
+		 const uint32_t height, const uint8_t bytes_per_sample,
+		 struct stack_star *stars, uint32_t *n_stars);
+int stack_add(struct stack *stack, const uint8_t *buf,
+	      struct stack_xform *xform);
+void stack_image(const struct stack *stack, float *img);
+void stack_destroy(struct stack *stack);
+
+#endif	/* STACK_H */
@@ -0,0 +1,195 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 only,
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License version 2 for more details (a copy is included
+ * in the LICENSE file that accompanied this code).
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Copyright (c) 2017, Thomas Stibor <thomas@stibor.net>
+ */
+
+#include <errno.h>
+#include <math.h>
+#include <stdbool.h>
+#include <string.h>
+#include "parallel.h"
+#include "vec.h"
+#include "stats.h"
+
+/* Frames below are counted by the calling thread only. */
+#define STATS_PARALLEL_MIN	(1 << 20)
+
+struct stats_job {
+	uint32_t *hist;
+	const uint8_t *img;
+	size_t n_samples;
+	uint8_t bps;
+	uint32_t n_bands;
+	uint32_t bins;		/* Per band. */
+};
+
+/* Lanes of 8 bit samples count into separate histograms, as runs of
+   equal samples would otherwise serialize on a single counter. */
+static uint32_t stats_sub_hists(const uint8_t bps)
+{
+	return bps == 2 ? 1 : VEC_LANES;
+}
+
+static uint32_t stats_bands(const size_t n_samples)
+{
+	return n_samples < STATS_PARALLEL_MIN ? 1 : parallel_get_threads();
+}
+
+size_t stats_scratch_size(const uint8_t bytes_per_sample)
+{
+	return (size_t)parallel_get_threads() * STATS_BINS(bytes_per_sample) *
+		stats_sub_hists(bytes_per_sample) * sizeof(uint32_t);
+}
+
+/* Scattered increments do not vectorize, lanes of the vector types
+   would have to be extracted one by one, thus the samples are counted
+   as scalars and the histograms of the bands merged as vectors. */
+static inline __attribute__((always_inline))
+void count_band(uint32_t *hist, const uint8_t *img, const size_t begin,
+		const size_t end, const uint8_t bps)
+{
+	const uint32_t bins = STATS_BINS(bps);
+	size_t i = begin;
+
+	if (bps == 2) {
+		const uint16_t *p = (const uint16_t *)img;
+		for (; i < end; i++)
+			hist[p[i]]++;
+		return;
+	}
+
+	for (; i + VEC_LANES <= end; i += VEC_LANES) {
+		hist[img[i]]++;
+		hist[bins + img[i + 1]]++;
+		hist[2 * bins + img[i + 2]]++;
+		hist[3 * bins + img[i + 3]]++;
+	}
+	for (; i < end; i++)
+		hist[img[i]]++;
+}
+
+static void count_bands(const uint32_t begin, const uint32_t end, void *arg)
+{
+	struct stats_job *job = arg;
+
+	for (uint32_t b = begin; b < end; b++) {
+		uint32_t *hist = job->hist + (size_t)b * job->bins;
+		const size_t i0 = job->n_samples * b / job->n_bands;
+		const size_t i1 = job->n_samples * (b + 1) / job->n_bands;
+
+		memset(hist, 0, job->bins * sizeof(uint32_t));
+		if (job->bps == 2)
+			count_band(hist, job->img, i0, i1, 2);
+		else
+			count_band(hist, job->img, i0, i1, 1);
+	}
+}
+
+/* Histogram of the samples in one pass over img, merged into the first
+   STATS_BINS(bytes_per_sample) entries of hist which must provide
+   stats_scratch_size() bytes, and the statistics derived from it. */
+int stats_compute(struct frame_stats *stats, uint32_t *hist,
+		  const uint8_t *img, const size_t n_samples,
+		  const uint8_t bytes_per_sample)
+{
+	int rc;
+	const uint32_t bins = STATS_BINS(bytes_per_sample);
+	const uint32_t max_val = bins - 1;
+	uint32_t or_bits = 0;
+	struct stats_job job = {
+		.hist = hist,
+		.img = img,
+		.n_samples = n_samples,
+		.bps = bytes_per_sample,
+		.n_bands = stats_bands(n_samples),
+		.bins = bins * stats_sub_hists(bytes_per_sample)
+	};
+
+	memset(stats, 0, sizeof(struct frame_stats));
+	if (!n_samples || (bytes_per_sample != 1 && bytes_per_sample != 2))
+		return -EINVAL;
+
+	rc = parallel_for(job.n_bands, count_bands, &job);
+	if (rc)
+		return rc;
+
+	for (size_t s = 1; s < (size_t)job.n_bands * job.bins / bins; s++) {
+		const uint32_t *h = hist + s * bins;
+		for (uint32_t v = 0; v < bins; v += VEC_LANES) {
+			v4si a, b;
+
+			memcpy(&a, hist + v, sizeof(a));
+			memcpy(&b, h + v, sizeof(b));
+			a += b;
+			memcpy(hist + v, &a, sizeof(a));
+		}
+	}
+	for (uint32_t v = 0; v < bins; v++)
+		if (hist[v])
+			or_bits |= v;
+
+	stats->sat_level = or_bits ? max_val & ~((or_bits & -or_bits) - 1) :
+		max_val;
+	stats->n = n_samples;
+	stats->min = max_val;
+
+	double sum = 0;
+	double sum_sq = 0;
+	uint64_t cum = 0;
+	bool median = false;
+	for (uint32_t v = 0; v < bins; v++) {
+		const uint32_t c = hist[v];
+
+		if (!c)
+			continue;
+		if (v < stats->min)
+			stats->min = v;
+		stats->max = v;
+		sum += (double)c * v;
+		sum_sq += (double)c * v * v;
+		cum += c;
+		if (!median && 2 * cum >= n_samples) {
+			stats->median = v;
+			median = true;
+		}
+		if (v >= stats->sat_level)
+			stats->n_saturated += c;
+	}
+
+	stats->mean = sum / n_samples;
+	stats->stddev = sqrt(fmax(sum_sq / n_samples -
+				  stats->mean * stats->mean, 0));
+	stats->clipped = (double)(hist[0] + stats->n_saturated) / n_samples;
+
+	return 0;
+}
+
+/* Smallest sample value of hist which is not exceeded by percentile
+   percent of the n samples. */
+uint32_t stats_percentile(const uint32_t *hist, const uint32_t bins,
+			  const uint64_t n, const double percentile)
+{
+	const double rank = percentile / 100 * n;
+	uint64_t cum = 0;
+
+	for (uint32_t v = 0; v < bins; v++) {
+		cum += hist[v];
+		if (cum && cum >= rank)
+			return v;
+	}
+
+	return bins - 1;
+}
@@ -0,0 +1,51 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 only,
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License version 2 for more details (a copy is included
+ * in the LICENSE file that accompanied this code).
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Copyright (c) 2017, Thomas Stibor <thomas@stibor.net>
+ */
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define STATS_BINS(bps)	((bps) == 2 ? 65536 : 256)
+
+/* Statistics of the samples of a frame, all derived from its
+   histogram. The saturation level is the largest value the sensor
+   can deliver, RAW16 data of sensors with less than 16 bits is left
+   aligned by the SDK, thus the unused low bits are found as zero bits
+   of all samples. */
+struct frame_stats {
+	uint64_t n;
+	uint32_t min;
+	uint32_t max;
+	uint32_t median;
+	double mean;
+	double stddev;
+	uint32_t sat_level;
+	uint64_t n_saturated;
+	double clipped;		/* Fraction of samples at 0 or saturated. */
+};
+
+size_t stats_scratch_size(const uint8_t bytes_per_sample);
+int stats_compute(struct frame_stats *stats, uint32_t *hist,
+		  const uint8_t *img, const size_t n_samples,
+		  const uint8_t bytes_per_sample);
+uint32_t stats_percentile(const uint32_t *hist, const uint32_t bins,
+			  const uint64_t n, const double percentile);
+
+#endif	/* STATS_H */
@@ -0,0 +1,172 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 only,
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License version 2 for more details (a copy is included
+ * in the LICENSE file that accompanied this code).
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Copyright (c) 2017, Thomas Stibor <thomas@stibor.net>
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "asi_util.h"
+#include "log.h"
+#include "stripe.h"
+
+#define STRIPE_ALPHA		0.25	/* Weight of the latest write. */
+#define STRIPE_STALL_PENALTY	2.0	/* Seconds a stalled target rests. */
+
+int stripe_init(struct stripe *stripe, const char *list, const bool by_rate,
+		const double t_stall, const char *manifest)
+{
+	char *dup;
+	char *tok;
+	char *saveptr = NULL;
+
+	if (!stripe || !list)
+		return -EINVAL;
+
+	memset(stripe, 0, sizeof(struct stripe));
+	stripe->by_rate = by_rate;
+	stripe->t_stall = t_stall;
+
+	dup = strdup(list);
+	if (!dup)
+		return -ENOMEM;
+
+	for (tok = strtok_r(dup, ",", &saveptr); tok;
+	     tok = strtok_r(NULL, ",", &saveptr)) {
+		if (stripe->n_targets == STRIPE_MAX_TARGETS) {
+			free(dup);
+			return -E2BIG;
+		}
+		strncpy(stripe->targets[stripe->n_targets++].filename, tok,
+			PATH_MAX);
+	}
+	free(dup);
+
+	if (stripe->n_targets == 0)
+		return -EINVAL;
+
+	if (manifest) {
+		stripe->manifest = fopen(manifest, "w");
+		if (!stripe->manifest) {
+			C_ERROR(errno, "fopen '%s'", manifest);
+			return -errno;
+		}
+		fprintf(stripe->manifest, "# seq target filename bytes "
+			"write_ms status\n");
+	}
+
+	pthread_mutex_init(&stripe->mutex, NULL);
+
+	return 0;
+}
+
+/* Target of the next frame. Targets not written yet are tried first,
+   then round-robin or the target with the highest throughput per
+   frame in flight. Stalled targets are only used if all are. */
+uint32_t stripe_pick(struct stripe *stripe)
+{
+	uint32_t pick = 0;
+	double best = -1;
+	const double t_now = mono_now();
+
+	pthread_mutex_lock(&stripe->mutex);
+	for (uint32_t i = 0; i < stripe->n_targets; i++) {
+		const uint32_t n = (stripe->next + i) % stripe->n_targets;
+		const struct stripe_target *t = &stripe->targets[n];
+		double score;
+
+		if (t->n_written == 0 && t->n_inflight == 0) {
+			pick = n;
+			break;
+		}
+		if (stripe->by_rate)
+			score = t->rate / (1 + t->n_inflight);
+		else
+			/* First one in round-robin order wins. */
+			score = stripe->n_targets - i;
+		if (t->stall_until > t_now)
+			score /= 1e6;
+		if (score > best) {
+			best = score;
+			pick = n;
+		}
+	}
+	stripe->targets[pick].n_inflight++;
+	stripe->next = (pick + 1) % stripe->n_targets;
+	pthread_mutex_unlock(&stripe->mutex);
+
+	return pick;
+}
+
+void stripe_done(struct stripe *stripe, const uint32_t target,
+		 const uint32_t seq, const char *filename, const long bytes,
+		 const double t_write, const int rc)
+{
+	struct stripe_target *t = &stripe->targets[target];
+
+	pthread_mutex_lock(&stripe->mutex);
+	t->n_inflight--;
+	if (!rc) {
+		const double rate = t_write > 0 ? bytes / t_write : 0;
+
+		if (t->n_written++ == 0) {
+			t->rate = rate;
+			t->latency = t_write;
+		} else {
+			t->rate += STRIPE_ALPHA * (rate - t->rate);
+			t->latency += STRIPE_ALPHA * (t_write - t->latency);
+		}
+		t->bytes += bytes;
+	}
+	if (rc || t_write > stripe->t_stall) {
+		t->n_stalls++;
+		t->stall_until = mono_now() + STRIPE_STALL_PENALTY;
+		C_WARN("target '%s' stalled (%.3f ms), de-weighted for %.1f sec",
+		       t->filename, t_write * 1e3, STRIPE_STALL_PENALTY);
+	}
+	if (stripe->manifest)
+		fprintf(stripe->manifest, "%u %u %s %ld %.3f %d\n", seq,
+			target, filename, bytes, t_write * 1e3, rc);
+	pthread_mutex_unlock(&stripe->mutex);
+}
+
+void stripe_report(struct stripe *stripe)
+{
+	pthread_mutex_lock(&stripe->mutex);
+	for (uint32_t n = 0; n < stripe->n_targets; n++) {
+		const struct stripe_target *t = &stripe->targets[n];
+
+		C_MESSAGE("target '%s' written %u frame(s), %.2f MB, "
+			  "%.2f MB/s, latency: %.3f ms, stalls: %u",
+			  t->filename, t->n_written, t->bytes / 1e6,
+			  t->rate / 1e6, t->latency * 1e3, t->n_stalls);
+	}
+	pthread_mutex_unlock(&stripe->mutex);
+}
+
+int stripe_destroy(struct stripe *stripe)
+{
+	int rc = 0;
+
+	if (stripe->manifest && fclose(stripe->manifest)) {
+		rc = -errno;
+		C_ERROR(errno, "fclose manifest");
+	}
+	stripe->manifest = NULL;
+	pthread_mutex_destroy(&stripe->mutex);
+
+	return rc;
+}
@@ -0,0 +1,65 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 only,
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License version 2 for more details (a copy is included
+ * in the LICENSE file that accompanied this code).
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Copyright (c) 2017, Thomas Stibor <thomas@stibor.net>
+ */
+
+#ifndef STRIPE_H
+#define STRIPE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <limits.h>
+#include <pthread.h>
+
+#define STRIPE_MAX_TARGETS	16
+
+/* Output target (directory or disk) of striped per frame files. */
+struct stripe_target {
+	char filename[PATH_MAX + 1];
+	double rate;		/* EWMA of write throughput in bytes/s. */
+	double latency;		/* EWMA of write time in s. */
+	double stall_until;	/* De-weighted until then (mono_now()). */
+	uint32_t n_inflight;
+	uint32_t n_written;
+	uint32_t n_stalls;
+	uint64_t bytes;
+};
+
+/* Distribution of the frames of a sequence across multiple targets,
+   round-robin or weighted by the measured throughput. Targets which
+   stall are skipped for a while. Every frame is recorded in a
+   manifest, such that the sequence can be reassembled. */
+struct stripe {
+	struct stripe_target targets[STRIPE_MAX_TARGETS];
+	uint32_t n_targets;
+	uint32_t next;		/* Round-robin position. */
+	bool by_rate;
+	double t_stall;		/* Write time of a stall in s. */
+	FILE *manifest;
+	pthread_mutex_t mutex;
+};
+
+int stripe_init(struct stripe *stripe, const char *list, const bool by_rate,
+		const double t_stall, const char *manifest);
+uint32_t stripe_pick(struct stripe *stripe);
+void stripe_done(struct stripe *stripe, const uint32_t target,
+		 const uint32_t seq, const char *filename, const long bytes,
+		 const double t_write, const int rc);
+void stripe_report(struct stripe *stripe);
+int stripe_destroy(struct stripe *stripe);
+
+#endif	/* STRIPE_H */
@@ -0,0 +1,151 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 only,
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License version 2 for more details (a copy is included
+ * in the LICENSE file that accompanied this code).
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Copyright (c) 2017, Thomas Stibor <thomas@stibor.net>
+ */
+
+#include <errno.h>
+#include <math.h>
+#include "track.h"
+
+static inline uint32_t sample(const uint8_t *img, const size_t i,
+			      const uint8_t bps)
+{
+	return bps == 2 ? ((const uint16_t *)img)[i] : img[i];
+}
+
+/* Centroid of the samples above half maximum over the background
+   (mean), which is robust for a disk as well as a star and ignores sky
+   glow and noise. Returns -ENOENT for a frame without target. */
+int track_centroid(const uint8_t *img, const uint32_t width,
+		   const uint32_t height, const uint8_t bytes_per_sample,
+		   const uint8_t spp, double *cx, double *cy)
+{
+	double sum = 0;
+	uint32_t max = 0;
+	uint64_t n = 0;
+
+	for (uint32_t y = 0; y < height; y += TRACK_GRID) {
+		for (uint32_t x = 0; x < width; x += TRACK_GRID) {
+			const uint32_t v = sample(img, ((size_t)y * width + x) *
+						  spp, bytes_per_sample);
+			sum += v;
+			if (v > max)
+				max = v;
+			n++;
+		}
+	}
+	if (!n)
+		return -EINVAL;
+
+	const double bg = sum / n;
+	const double thr = bg + (max - bg) / 2;
+	double sw = 0, sx = 0, sy = 0;
+
+	for (uint32_t y = 0; y < height; y += TRACK_GRID) {
+		for (uint32_t x = 0; x < width; x += TRACK_GRID) {
+			const double w = sample(img, ((size_t)y * width + x) *
+						spp, bytes_per_sample) - thr;
+			if (w <= 0)
+				continue;
+			sw += w;
+			sx += w * x;
+			sy += w * y;
+		}
+	}
+	if (sw <= 0)
+		return -ENOENT;
+
+	*cx = sx / sw;
+	*cy = sy / sw;
+
+	return 0;
+}
+
+void track_init(struct track *track, const int sensor_width,
+		const int sensor_height, const int width, const int height,
+		const int margin, const uint32_t lag)
+{
+	*track = (struct track) {
+		.sensor_width = sensor_width,
+		.sensor_height = sensor_height,
+		.width = width,
+		.height = height,
+		.margin = margin,
+		.x = (sensor_width - width) / 2 / 8 * 8,
+		.y = (sensor_height - height) / 2 / 2 * 2,
+		.lag = lag,
+		.settle = 0,
+		.n_moves = 0
+	};
+}
+
+/* Center the ROI on sensor position (cx, cy), within the sensor. */
+void track_center(struct track *track, const double cx, const double cy)
+{
+	int x = lround(cx - track->width / 2.0);
+	int y = lround(cy - track->height / 2.0);
+
+	if (x > track->sensor_width - track->width)
+		x = track->sensor_width - track->width;
+	if (y > track->sensor_height - track->height)
+		y = track->sensor_height - track->height;
+	track->x = x < 0 ? 0 : x / 8 * 8;
+	track->y = y < 0 ? 0 : y / 2 * 2;
+}
+
+/* ROI start of the next captured frame, called once per frame. Frames
+   exposed before the last move report the previous position and false,
+   they are not passed to track_update(). */
+bool track_frame(struct track *track, int *x, int *y)
+{
+	if (track->settle) {
+		track->settle--;
+		*x = track->x_prev;
+		*y = track->y_prev;
+		return false;
+	}
+
+	*x = track->x;
+	*y = track->y;
+
+	return true;
+}
+
+/* Account the centroid (cx, cy) of a frame at the current position in
+   ROI coordinates. Returns true if the ROI was moved, frames already
+   being read out still show the old position, which track_frame()
+   accounts for the next lag frames. */
+bool track_update(struct track *track, const double cx, const double cy)
+{
+
+	if (fabs(cx - track->width / 2.0) <= track->margin &&
+	    fabs(cy - track->height / 2.0) <= track->margin)
+		return false;
+
+	const int x = track->x;
+	const int y = track->y;
+
+	track_center(track, track->x + cx, track->y + cy);
+	if (track->x == x && track->y == y)
+		return false;
+
+	track->x_prev = x;
+	track->y_prev = y;
+	track->settle = track->lag;
+	track->n_moves++;
+
+	return true;
+}
@@ -0,0 +1,59 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 only,
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License version 2 for more details (a copy is included
+ * in the LICENSE file that accompanied this code).
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Copyright (c) 2017, Thomas Stibor <thomas@stibor.net>
+ */
+
+#ifndef TRACK_H
+#define TRACK_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define TRACK_GRID	2	/* Subsampling of the centroid. */
+#define TRACK_SETTLE	2	/* Video frames until a moved ROI applies. */
+
+/* Start position of a ROI on the sensor, which follows a target once
+   its centroid is off the ROI center by more than margin pixels.
+   Positions are in binned pixels, x multiple of 8 and y multiple of 2
+   as required by the SDK. After a move, the lag frames already exposed
+   (in video mode) still arrive at the previous position. */
+struct track {
+	int sensor_width;
+	int sensor_height;
+	int width;
+	int height;
+	int margin;
+	int x;
+	int y;
+	int x_prev;		/* Position before the last move. */
+	int y_prev;
+	uint32_t lag;		/* Frames in flight when the ROI moves. */
+	uint32_t settle;	/* Frames left until the last move applies. */
+	uint32_t n_moves;
+};
+
+int track_centroid(const uint8_t *img, const uint32_t width,
+		   const uint32_t height, const uint8_t bytes_per_sample,
+		   const uint8_t spp, double *cx, double *cy);
+void track_init(struct track *track, const int sensor_width,
+		const int sensor_height, const int width, const int height,
+		const int margin, const uint32_t lag);
+void track_center(struct track *track, const double cx, const double cy);
+bool track_frame(struct track *track, int *x, int *y);
+bool track_update(struct track *track, const double cx, const double cy);
+
+#endif	/* TRACK_H */
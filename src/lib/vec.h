@@ -0,0 +1,84 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 only,
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License version 2 for more details (a copy is included
+ * in the LICENSE file that accompanied this code).
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Copyright (c) 2017, Thomas Stibor <thomas@stibor.net>
+ */
+
+#ifndef VEC_H
+#define VEC_H
+
+#include <stdint.h>
+#include <string.h>
+
+/* Four samples widened to 32 bit. The compiler maps the vector
+   operators to SSE2 or NEON, for 8 and 16 bit samples alike. */
+#define VEC_LANES 4
+
+typedef int32_t v4si __attribute__((vector_size(16)));
+typedef float v4sf __attribute__((vector_size(16)));
+typedef uint16_t v4hu __attribute__((vector_size(8)));
+typedef uint8_t v4qu __attribute__((vector_size(4)));
+
+/* Samples i, ..., i + 3 of an image with 1 or 2 bytes per sample. Called
+   with a constant bps, such that the branch is resolved at compile time. */
+static inline __attribute__((always_inline))
+v4si vec_load(const uint8_t *img, const size_t i, const uint8_t bps)
+{
+	if (bps == 2) {
+		v4hu v;
+		memcpy(&v, img + 2 * i, sizeof(v));
+		return __builtin_convertvector(v, v4si);
+	}
+
+	v4qu v;
+	memcpy(&v, img + i, sizeof(v));
+	return __builtin_convertvector(v, v4si);
+}
+
+/* Store truncated to the sample size, see vec_clamp(). */
+static inline __attribute__((always_inline))
+void vec_store(uint8_t *img, const size_t i, const v4si v, const uint8_t bps)
+{
+	if (bps == 2) {
+		const v4hu s = __builtin_convertvector(v, v4hu);
+		memcpy(img + 2 * i, &s, sizeof(s));
+	} else {
+		const v4qu s = __builtin_convertvector(v, v4qu);
+		memcpy(img + i, &s, sizeof(s));
+	}
+}
+
+static inline v4si vec_sel(const v4si m, const v4si a, const v4si b)
+{
+	return (a & m) | (b & ~m);
+}
+
+static inline v4si vec_abs(const v4si v)
+{
+	const v4si zero = {0};
+
+	return vec_sel(v < zero, -v, v);
+}
+
+static inline v4si vec_clamp(const v4si v, const int32_t max)
+{
+	const v4si zero = {0};
+	const v4si vmax = zero + max;
+	const v4si r = vec_sel(v < zero, zero, v);
+
+	return vec_sel(r > vmax, vmax, r);
+}
+
+#endif	/* VEC_H */
@@ -0,0 +1,109 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 only,
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License version 2 for more details (a copy is included
+ * in the LICENSE file that accompanied this code).
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Copyright (c) 2017, Thomas Stibor <thomas@stibor.net>
+ */
+
+#include <string.h>
+#include <errno.h>
+#include "asi_util.h"
+#include "writer.h"
+
+static void *writer_thread(void *arg)
+{
+	struct writer *writer = arg;
+	struct frame *frame;
+
+	while ((frame = ring_get_ready(writer->ring))) {
+		pthread_mutex_lock(&writer->mutex);
+		const bool failed = writer->rc != 0;
+		pthread_mutex_unlock(&writer->mutex);
+
+		if (failed) {
+			ring_put_free(writer->ring, frame);
+			continue;
+		}
+
+		const double t_start = mono_now();
+		const int rc = writer->write(frame, writer->arg);
+		const double t_write = mono_now() - t_start;
+
+		pthread_mutex_lock(&writer->mutex);
+		if (rc) {
+			writer->n_failed++;
+			if (!writer->rc) {
+				writer->rc = rc;
+				ring_close(writer->ring);
+			}
+		} else
+			writer->n_written++;
+		writer->t_write_sum += t_write;
+		if (t_write > writer->t_write_max)
+			writer->t_write_max = t_write;
+		pthread_mutex_unlock(&writer->mutex);
+
+		if (writer->done)
+			writer->done(frame, rc, t_write, writer->arg);
+
+		ring_put_free(writer->ring, frame);
+	}
+
+	return NULL;
+}
+
+int writer_start(struct writer *writer, struct ring *ring,
+		 const uint32_t n_threads, writer_write_fn write,
+		 writer_done_fn done, void *arg)
+{
+	int rc;
+
+	if (!writer || !ring || !write || n_threads == 0 ||
+	    n_threads > WRITER_MAX_THREADS)
+		return -EINVAL;
+
+	memset(writer, 0, sizeof(struct writer));
+	writer->ring = ring;
+	writer->write = write;
+	writer->done = done;
+	writer->arg = arg;
+	pthread_mutex_init(&writer->mutex, NULL);
+
+	for (uint32_t n = 0; n < n_threads; n++) {
+		rc = pthread_create(&writer->threads[n], NULL, writer_thread,
+				    writer);
+		if (rc) {
+			/* Let the started threads drain and terminate. */
+			ring_close(ring);
+			writer_stop(writer);
+			return -rc;
+		}
+		writer->n_threads++;
+	}
+
+	return 0;
+}
+
+/* Wait until all frames are written, the producer must have closed
+   the ring. Returns the status of the first failed write. */
+int writer_stop(struct writer *writer)
+{
+	for (uint32_t n = 0; n < writer->n_threads; n++)
+		pthread_join(writer->threads[n], NULL);
+	writer->n_threads = 0;
+
+	pthread_mutex_destroy(&writer->mutex);
+
+	return writer->rc;
+}
@@ -0,0 +1,57 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 only,
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License version 2 for more details (a copy is included
+ * in the LICENSE file that accompanied this code).
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Copyright (c) 2017, Thomas Stibor <thomas@stibor.net>
+ */
+
+#ifndef WRITER_H
+#define WRITER_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include "frame.h"
+#include "ring.h"
+
+#define WRITER_MAX_THREADS 16
+
+typedef int (*writer_write_fn)(const struct frame *frame, void *arg);
+typedef void (*writer_done_fn)(const struct frame *frame, const int rc,
+			       const double t_write, void *arg);
+
+/* Pool of threads consuming ready frames of a ring. Every frame is
+   passed to write(), its status and write time to done() (if set).
+   After the first failed write the ring is closed, which stops the
+   producer, and the remaining frames are drained without writing. */
+struct writer {
+	struct ring *ring;
+	uint32_t n_threads;
+	pthread_t threads[WRITER_MAX_THREADS];
+	writer_write_fn write;
+	writer_done_fn done;
+	void *arg;
+	pthread_mutex_t mutex;
+	uint32_t n_written;
+	uint32_t n_failed;
+	double t_write_sum;
+	double t_write_max;
+	int rc;			/* Status of the first failed write. */
+};
+
+int writer_start(struct writer *writer, struct ring *ring,
+		 const uint32_t n_threads, writer_write_fn write,
+		 writer_done_fn done, void *arg);
+int writer_stop(struct writer *writer);
+
+#endif	/* WRITER_H */
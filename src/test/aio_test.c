@@ -0,0 +1,129 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 only,
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License version 2 for more details (a copy is included
+ * in the LICENSE file that accompanied this code).
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Copyright (c) 2017, Thomas Stibor <thomas@stibor.net>
+ */
+
+/* Writes a file spanning more than all io_uring buffers, thus the
+   writer has to wait for its own earlier chunks to complete. The file
+   exists already and is only overwritten if requested. Skipped
+   (exit code 77) when built without liburing. */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdint.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include "log.h"
+#include "aio.h"
+
+#define TEST_SKIP	77
+#define TEST_LEN	((size_t)AIO_BUFS * AIO_BUF_SIZE + AIO_BUF_SIZE + 4093)
+
+int main(void)
+{
+	int rc;
+	int fd = -1;
+	struct aio *aio = NULL;
+	uint8_t *data = NULL;
+	uint8_t *back = NULL;
+	struct stat st;
+	char filename[] = "/tmp/aio_test.XXXXXX";
+
+	api_msg_set_level(API_MSG_ERROR);
+
+	rc = aio_create(&aio, AIO_BUFS, AIO_BUF_SIZE, true);
+	if (rc == -ENOSYS)
+		return TEST_SKIP;
+	if (rc) {
+		C_ERROR(-rc, "aio_create");
+		return EXIT_FAILURE;
+	}
+
+	data = malloc(TEST_LEN);
+	back = malloc(TEST_LEN);
+	if (!data || !back) {
+		rc = -ENOMEM;
+		C_ERROR(ENOMEM, "malloc");
+		goto cleanup;
+	}
+	for (size_t n = 0; n < TEST_LEN; n++)
+		data[n] = (n * 2654435761u) >> 24;
+
+	fd = mkstemp(filename);
+	if (fd < 0) {
+		rc = -errno;
+		C_ERROR(errno, "mkstemp");
+		goto cleanup;
+	}
+
+	rc = aio_write(aio, filename, data, TEST_LEN, false);
+	if (rc != -EEXIST) {
+		C_ERROR(EINVAL, "aio_write '%s' without overwrite: %d",
+			filename, rc);
+		rc = -EINVAL;
+		goto cleanup;
+	}
+	rc = aio_write(aio, filename, data, TEST_LEN, true);
+	if (rc) {
+		C_ERROR(-rc, "aio_write '%s'", filename);
+		goto cleanup;
+	}
+	rc = aio_drain(aio);
+	if (rc) {
+		C_ERROR(-rc, "aio_drain '%s'", filename);
+		goto cleanup;
+	}
+
+	if (fstat(fd, &st) < 0) {
+		rc = -errno;
+		C_ERROR(errno, "fstat '%s'", filename);
+		goto cleanup;
+	}
+	if ((size_t)st.st_size != TEST_LEN) {
+		rc = -EIO;
+		C_ERROR(EIO, "size %lld, expected %zu", (long long)st.st_size,
+			TEST_LEN);
+		goto cleanup;
+	}
+
+	for (size_t off = 0; off < TEST_LEN; ) {
+		const ssize_t n = pread(fd, back + off, TEST_LEN - off, off);
+		if (n <= 0) {
+			rc = n < 0 ? -errno : -EIO;
+			C_ERROR(-rc, "pread '%s'", filename);
+			goto cleanup;
+		}
+		off += n;
+	}
+	if (memcmp(data, back, TEST_LEN)) {
+		rc = -EIO;
+		C_ERROR(EIO, "content of '%s' differs", filename);
+	}
+
+cleanup:
+	if (fd >= 0) {
+		close(fd);
+		unlink(filename);
+	}
+	if (aio_destroy(aio) && !rc)
+		rc = -EIO;
+	free(data);
+	free(back);
+
+	return rc ? EXIT_FAILURE : EXIT_SUCCESS;
+}
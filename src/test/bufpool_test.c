@@ -0,0 +1,129 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 only,
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License version 2 for more details (a copy is included
+ * in the LICENSE file that accompanied this code).
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Copyright (c) 2017, Thomas Stibor <thomas@stibor.net>
+ */
+
+/* The smallest free buffer which is large enough is handed out, frames
+   of alternating sizes reuse their buffers without remapping and free
+   buffers beyond the limit are unmapped least recently used first. */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdint.h>
+#include <unistd.h>
+#include "bufpool.h"
+#include "test_util.h"
+
+#define TEST_ROUNDS	100
+
+static int test_alternate(struct bufpool *pool, const size_t page)
+{
+	int rc = 0;
+	uint8_t *small, *large;
+
+	small = bufpool_get(pool, 3 * page);
+	large = bufpool_get(pool, 8 * page);
+	TEST_CHECK(small && large && small != large);
+	bufpool_put(pool, small);
+	bufpool_put(pool, large);
+
+	/* A remapped buffer would be zero filled, each buffer still
+	   holds what was written two rounds before. */
+	const size_t bytes = pool->bytes;
+	for (int n = 0; n < TEST_ROUNDS; n++) {
+		const size_t size = n & 1 ? 8 * page : 3 * page - 1;
+		uint8_t *buf = bufpool_get(pool, size);
+
+		TEST_CHECK(buf == (n & 1 ? large : small));
+		TEST_CHECK(n < 2 || buf[size - 1] == n - 1);
+		memset(buf, n + 1, size);
+		bufpool_put(pool, buf);
+	}
+	TEST_CHECK(pool->bytes == bytes);
+
+	/* Best fit, the large buffer is left for a large request. */
+	small = bufpool_get(pool, 1);
+	large = bufpool_get(pool, 4 * page);
+	TEST_CHECK(small && large && small != large);
+	TEST_CHECK(pool->bytes == bytes);
+	bufpool_put(pool, small);
+	bufpool_put(pool, large);
+
+cleanup:
+	return rc;
+}
+
+static int test_trim(struct bufpool *pool, const size_t page)
+{
+	int rc = 0;
+	uint8_t *buf[4];
+
+	/* Three free buffers of 2 pages, the oldest one is unmapped
+	   when the pool grows by a fourth buffer. */
+	pool->bytes_free_max = 4 * page;
+	for (int n = 0; n < 3; n++) {
+		buf[n] = bufpool_get(pool, 2 * page);
+		TEST_CHECK(buf[n]);
+	}
+	for (int n = 0; n < 3; n++)
+		bufpool_put(pool, buf[n]);
+	TEST_CHECK(pool->bytes == 6 * page);
+
+	/* Touch buffer 0, making buffer 1 the least recently used. */
+	bufpool_put(pool, bufpool_get(pool, 2 * page));
+	buf[3] = bufpool_get(pool, 3 * page);
+	TEST_CHECK(buf[3]);
+	TEST_CHECK(pool->bytes == 7 * page && pool->bytes_used == 3 * page);
+
+	/* Buffers 0 and 2 are still mapped and handed out again. */
+	uint8_t *b0 = bufpool_get(pool, 2 * page);
+	uint8_t *b2 = bufpool_get(pool, 2 * page);
+	TEST_CHECK(b0 == buf[0] && b2 == buf[2]);
+	bufpool_put(pool, b0);
+	bufpool_put(pool, b2);
+	bufpool_put(pool, buf[3]);
+
+cleanup:
+	return rc;
+}
+
+int main(void)
+{
+	int rc;
+	struct bufpool pool;
+	const size_t page = sysconf(_SC_PAGESIZE);
+
+	api_msg_set_level(API_MSG_ERROR);
+
+	bufpool_init(&pool, 0);
+	rc = test_alternate(&pool, page);
+	bufpool_destroy(&pool);
+
+	if (!rc) {
+		bufpool_init(&pool, 0);
+		rc = test_trim(&pool, page);
+		if (!rc && pool.n_used) {
+			C_ERROR(EINVAL, "%u buffer(s) not returned",
+				pool.n_used);
+			rc = -EINVAL;
+		}
+		bufpool_destroy(&pool);
+	}
+
+	return rc ? EXIT_FAILURE : EXIT_SUCCESS;
+}
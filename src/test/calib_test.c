@@ -0,0 +1,324 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 only,
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License version 2 for more details (a copy is included
+ * in the LICENSE file that accompanied this code).
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Copyright (c) 2017, Thomas Stibor <thomas@stibor.net>
+ */
+
+/* Frames calibrated with master bias, darks and flat of 8, 16 (BZERO)
+   and -32 bit fit files match a reference in double precision, the
+   dark nearest in temperature and exposure is picked and masters of
+   another size are refused. */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <math.h>
+#include "calib.h"
+#include "parallel.h"
+#include "test_util.h"
+
+#define TEST_WIDTH	37
+#define TEST_HEIGHT	5
+#define TEST_N		(TEST_WIDTH * TEST_HEIGHT)
+#define TEST_CARD	80
+#define TEST_BLOCK	2880
+
+static char dir[TEST_LEN_DIR];
+
+static void card(uint8_t *hdr, int *n, const char *key, const char *val)
+{
+	char c[TEST_CARD + 1];
+
+	snprintf(c, sizeof(c), "%-8s= %20s%50s", key, val, "");
+	memcpy(hdr + (*n)++ * TEST_CARD, c, TEST_CARD);
+}
+
+/* Master of bitpix 8, 16 (unsigned by BZERO 32768) or -32 holding
+   v(x, y), exposure exp_time and temperature temp if not NAN. */
+static int master(const char *name, const int bitpix, const uint32_t width,
+		  double (*v)(const uint32_t x, const uint32_t y),
+		  const double exp_time, const double temp)
+{
+	int rc = 0;
+	int n = 0;
+	char path[TEST_LEN_DIR + 16];
+	char val[32];
+	uint8_t hdr[TEST_BLOCK];
+	const size_t size = (size_t)width * TEST_HEIGHT * abs(bitpix) / 8;
+	uint8_t *data = calloc(1, size + TEST_BLOCK);
+	FILE *f;
+
+	if (!data)
+		return -ENOMEM;
+
+	memset(hdr, ' ', sizeof(hdr));
+	card(hdr, &n, "SIMPLE", "T");
+	snprintf(val, sizeof(val), "%d", bitpix);
+	card(hdr, &n, "BITPIX", val);
+	card(hdr, &n, "NAXIS", "2");
+	snprintf(val, sizeof(val), "%u", width);
+	card(hdr, &n, "NAXIS1", val);
+	snprintf(val, sizeof(val), "%u", TEST_HEIGHT);
+	card(hdr, &n, "NAXIS2", val);
+	if (bitpix == 16)
+		card(hdr, &n, "BZERO", "32768");
+	snprintf(val, sizeof(val), "%f", exp_time);
+	card(hdr, &n, "EXPTIME", val);
+	if (!isnan(temp)) {
+		snprintf(val, sizeof(val), "%f", temp);
+		card(hdr, &n, "CCD-TEMP", val);
+	}
+	memcpy(hdr + n * TEST_CARD, "END", 3);
+
+	for (uint32_t y = 0; y < TEST_HEIGHT; y++) {
+		for (uint32_t x = 0; x < width; x++) {
+			const size_t i = (size_t)y * width + x;
+			const float fv = v(x, y);
+			uint32_t u;
+
+			switch (bitpix) {
+			case 8:
+				data[i] = fv;
+				break;
+			case 16:
+				u = (uint32_t)fv ^ 0x8000;
+				data[2 * i] = u >> 8;
+				data[2 * i + 1] = u;
+				break;
+			default:
+				memcpy(&u, &fv, sizeof(u));
+				for (int k = 0; k < 4; k++)
+					data[4 * i + k] = u >> (24 - 8 * k);
+			}
+		}
+	}
+
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	f = fopen(path, "w");
+	if (!f || fwrite(hdr, sizeof(hdr), 1, f) != 1 ||
+	    fwrite(data, (size + TEST_BLOCK - 1) / TEST_BLOCK * TEST_BLOCK,
+		   1, f) != 1)
+		rc = -EIO;
+	if (f && fclose(f))
+		rc = -EIO;
+	if (rc)
+		C_ERROR(EIO, "write '%s'", path);
+	free(data);
+
+	return rc;
+}
+
+static double bias(const uint32_t x, const uint32_t y)
+{
+	return 100 + x + 3 * y;
+}
+
+/* Dark current of one second, the darks scale it by exposure. */
+static double current(const uint32_t x, const uint32_t y)
+{
+	return 50 + (x * 7 + y * 13) % 40;
+}
+
+static double dark_1s(const uint32_t x, const uint32_t y)
+{
+	return bias(x, y) + current(x, y);
+}
+
+static double dark_2s(const uint32_t x, const uint32_t y)
+{
+	return bias(x, y) + 2 * current(x, y);
+}
+
+static double dark_warm(const uint32_t x, const uint32_t y)
+{
+	return bias(x, y) + 4 * current(x, y);
+}
+
+static double flat(const uint32_t x, const uint32_t y)
+{
+	return 120 + (x * 5 + y * 11) % 100;
+}
+
+static double light(const uint32_t x, const uint32_t y)
+{
+	/* Dark pixels below bias and dark are clipped at zero, a few
+	   bright ones saturate after flat fielding. */
+	if (x == 3)
+		return 10;
+	if (x == 30)
+		return UINT16_MAX;
+
+	return 2000 + 300 * ((x * 3 + y) % 17);
+}
+
+static int test_apply(const struct calib *calib, const double exp_time,
+		      const double temp, const double s)
+{
+	int rc = 0;
+	uint16_t src[TEST_N];
+	uint16_t dst[TEST_N];
+	double mean = 0;
+	const struct calib_master *dark = calib_dark(calib, exp_time, temp);
+	double (*dark_fn)(const uint32_t, const uint32_t) =
+		dark == &calib->darks[0] ? dark_1s :
+		dark == &calib->darks[1] ? dark_2s : dark_warm;
+
+	for (uint32_t i = 0; i < TEST_N; i++) {
+		src[i] = light(i % TEST_WIDTH, i / TEST_WIDTH);
+		mean += flat(i % TEST_WIDTH, i / TEST_WIDTH) / TEST_N;
+	}
+
+	rc = calib_apply(calib, (uint8_t *)dst, (uint8_t *)src, TEST_WIDTH,
+			 TEST_HEIGHT, 2, exp_time, temp);
+	TEST_CHECK(rc == 0);
+
+	for (uint32_t i = 0; i < TEST_N; i++) {
+		const uint32_t x = i % TEST_WIDTH;
+		const uint32_t y = i / TEST_WIDTH;
+		double v = (light(x, y) - (1 - s) * bias(x, y) -
+			    s * dark_fn(x, y)) * mean / flat(x, y);
+
+		v = v < 0 ? 0 : v > UINT16_MAX ? UINT16_MAX : v + 0.5;
+		TEST_CHECK(fabs(dst[i] - floor(v)) <= 1);
+	}
+
+cleanup:
+	if (rc)
+		C_ERROR(-rc, "exposure %.1f, temperature %.1f", exp_time,
+			temp);
+
+	return rc;
+}
+
+/* 8 bit frame with a dark only. */
+static int test_dark_only(void)
+{
+	int rc;
+	char path[TEST_LEN_DIR + 16];
+	struct calib calib;
+	uint8_t src[TEST_N];
+	uint8_t dst[TEST_N];
+
+	snprintf(path, sizeof(path), "%s/dark_1s.fit", dir);
+	rc = calib_init(&calib, NULL, path, NULL, false);
+	if (rc)
+		return rc;
+
+	for (uint32_t i = 0; i < TEST_N; i++)
+		src[i] = 255 - i % 200;
+	rc = calib_apply(&calib, dst, src, TEST_WIDTH, TEST_HEIGHT, 1, 1,
+			 NAN);
+	TEST_CHECK(rc == 0);
+	for (uint32_t i = 0; i < TEST_N; i++) {
+		const double v = src[i] - dark_1s(i % TEST_WIDTH,
+						  i / TEST_WIDTH);
+
+		TEST_CHECK(dst[i] == (v < 0 ? 0 : v));
+	}
+
+	/* Frames of another size are refused. */
+	rc = calib_apply(&calib, dst, src, TEST_WIDTH - 1, TEST_HEIGHT, 1, 1,
+			 NAN);
+	TEST_CHECK(rc == -ERANGE);
+	rc = 0;
+
+cleanup:
+	calib_destroy(&calib);
+
+	return rc;
+}
+
+int main(void)
+{
+	int rc;
+	char b[TEST_LEN_DIR + 16], f[TEST_LEN_DIR + 16];
+	char d[3 * (TEST_LEN_DIR + 16)];
+	struct calib calib;
+
+	api_msg_set_level(API_MSG_ERROR);
+	rc = test_tmpdir(dir, sizeof(dir));
+	if (rc)
+		return EXIT_FAILURE;
+
+	rc = master("bias.fit", 16, TEST_WIDTH, bias, 0, -10);
+	if (!rc)
+		rc = master("dark_1s.fit", -32, TEST_WIDTH, dark_1s, 1, -10);
+	if (!rc)
+		rc = master("dark_2s.fit", -32, TEST_WIDTH, dark_2s, 2, -10);
+	if (!rc)
+		rc = master("dark_warm.fit", 16, TEST_WIDTH, dark_warm, 1, 0);
+	if (!rc)
+		rc = master("flat.fit", 8, TEST_WIDTH, flat, 0, NAN);
+	if (!rc)
+		rc = master("small.fit", 8, TEST_WIDTH - 1, flat, 0, NAN);
+	if (rc)
+		goto out;
+
+	snprintf(b, sizeof(b), "%s/bias.fit", dir);
+	snprintf(d, sizeof(d), "%s/dark_1s.fit,%s/dark_2s.fit,%s/dark_warm.fit",
+		 dir, dir, dir);
+	snprintf(f, sizeof(f), "%s/flat.fit", dir);
+
+	/* Nearest temperature first, then nearest exposure. Without a
+	   temperature only the exposure counts. */
+	rc = calib_init(&calib, b, d, f, false);
+	TEST_CHECK(rc == 0);
+	TEST_CHECK(calib.n_darks == 3 && calib.bias.bzero &&
+		   calib.darks[0].temp == -10 && isnan(calib.flat.temp));
+	TEST_CHECK(calib_dark(&calib, 1.9, -9) == &calib.darks[1]);
+	TEST_CHECK(calib_dark(&calib, 1.9, 1) == &calib.darks[2]);
+	TEST_CHECK(calib_dark(&calib, 1.2, NAN) == &calib.darks[0]);
+
+	for (uint32_t threads = 1; threads <= 4 && !rc; threads += 3) {
+		parallel_set_threads(threads);
+		rc = test_apply(&calib, 1.9, -9, 1);
+		if (!rc)
+			rc = test_apply(&calib, 1, 2, 1);
+	}
+	calib_destroy(&calib);
+	if (rc)
+		goto cleanup;
+
+	/* Darks scaled by exposure with the bias removed first. */
+	rc = calib_init(&calib, b, d, f, true);
+	TEST_CHECK(rc == 0);
+	rc = test_apply(&calib, 3, -10, 1.5);
+	calib_destroy(&calib);
+	if (rc)
+		goto cleanup;
+
+	rc = test_dark_only();
+	if (rc)
+		goto cleanup;
+
+	/* Scaling requires a bias, all masters have the same size. */
+	api_msg_set_level(API_MSG_FATAL);
+	TEST_CHECK(calib_init(&calib, NULL, d, NULL, true) == -EINVAL);
+	snprintf(f, sizeof(f), "%s/small.fit", dir);
+	TEST_CHECK(calib_init(&calib, b, NULL, f, false) == -EINVAL);
+	api_msg_set_level(API_MSG_ERROR);
+
+cleanup:
+	api_msg_set_level(API_MSG_ERROR);
+	if (rc)
+		C_ERROR(-rc, "calibration");
+out:
+	test_rmdir(dir);
+
+	return rc ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,193 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 only,
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License version 2 for more details (a copy is included
+ * in the LICENSE file that accompanied this code).
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Copyright (c) 2017, Thomas Stibor <thomas@stibor.net>
+ */
+
+/* Serves requests of a client on the unix socket of the daemon, with
+   captures which violate the command line constraints rejected and
+   cameras not opened just to be closed. */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdint.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "ser.h"
+#include "test_util.h"
+
+#define TEST_CONNECT_TRIES	100
+#define TEST_LEN_LINE		512
+
+/* Send a request and read its response line into reply. */
+static int request(FILE *sock, char *reply, const size_t len,
+		   const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	vfprintf(sock, fmt, ap);
+	va_end(ap);
+	fputc('\n', sock);
+	fflush(sock);
+
+	if (!fgets(reply, len, sock)) {
+		C_ERROR(EIO, "no response");
+		return -EIO;
+	}
+	reply[strcspn(reply, "\n")] = '\0';
+
+	return 0;
+}
+
+static FILE *connect_daemon(const char *path)
+{
+	struct sockaddr_un addr = {.sun_family = AF_UNIX};
+	int fd;
+
+	snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+
+	/* The daemon creates its socket after start up. */
+	for (int n = 0; n < TEST_CONNECT_TRIES; n++) {
+		fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (fd < 0) {
+			C_ERROR(errno, "socket");
+			return NULL;
+		}
+		if (!connect(fd, (struct sockaddr *)&addr, sizeof(addr)))
+			return fdopen(fd, "r+");
+		close(fd);
+		usleep(50000);
+	}
+	C_ERROR(errno, "connect '%s'", path);
+
+	return NULL;
+}
+
+static uint32_t ser_frames(const char *filename)
+{
+	uint8_t *data = NULL;
+	size_t len = 0;
+	uint32_t n_frames = 0;
+
+	if (!test_read_file(filename, &data, &len) && len >= SER_HEADER_SIZE)
+		n_frames = test_le32(data + 38);
+	free(data);
+
+	return n_frames;
+}
+
+static int test_requests(FILE *sock, const char *dir)
+{
+	int rc;
+	char reply[TEST_LEN_LINE];
+	char filename[PATH_MAX + 1];
+	const char *roi = "width=64,height=48,exposure=0.001";
+
+	/* Never opened. */
+	rc = request(sock, reply, sizeof(reply), "close 0");
+	TEST_CHECK(!rc && !strcmp(reply, "ERR -19"));
+
+	rc = request(sock, reply, sizeof(reply), "set 0 gain=100");
+	TEST_CHECK(!rc && !strcmp(reply, "OK"));
+	rc = request(sock, reply, sizeof(reply), "get 0 gain");
+	TEST_CHECK(!rc && !strncmp(reply, "OK gain 100", 11));
+
+	snprintf(filename, sizeof(filename), "%s/seq.ser", dir);
+	rc = request(sock, reply, sizeof(reply), "sequence 0 %s 5 %s",
+		     filename, roi);
+	TEST_CHECK(!rc && !strcmp(reply, "OK"));
+	TEST_CHECK(ser_frames(filename) == 5);
+
+	snprintf(filename, sizeof(filename), "%s/video.ser", dir);
+	rc = request(sock, reply, sizeof(reply), "capture 0 %s video=1,"
+		     "count=20,%s", filename, roi);
+	TEST_CHECK(!rc && !strcmp(reply, "OK"));
+	TEST_CHECK(ser_frames(filename) == 20);
+
+	/* Rejected as on the command line. */
+	rc = request(sock, reply, sizeof(reply), "capture 0 %s/frame.xyz",
+		     dir);
+	TEST_CHECK(!rc && !strcmp(reply, "ERR -22"));
+	rc = request(sock, reply, sizeof(reply), "sequence 0 %s/a.fit,%s/b.ser 2",
+		     dir, dir);
+	TEST_CHECK(!rc && !strcmp(reply, "ERR -22"));
+	rc = request(sock, reply, sizeof(reply), "sequence 0 %s/c.ser 2 "
+		     "interval=-1", dir);
+	TEST_CHECK(!rc && !strcmp(reply, "ERR -22"));
+
+	rc = request(sock, reply, sizeof(reply), "close 0");
+	TEST_CHECK(!rc && !strcmp(reply, "OK"));
+	rc = request(sock, reply, sizeof(reply), "close 0");
+	TEST_CHECK(!rc && !strcmp(reply, "ERR -19"));
+
+	rc = request(sock, reply, sizeof(reply), "shutdown");
+	TEST_CHECK(!rc && !strcmp(reply, "OK"));
+
+cleanup:
+	return rc;
+}
+
+int main(void)
+{
+	int rc;
+	pid_t pid;
+	FILE *sock = NULL;
+	struct stat st;
+	char dir[TEST_LEN_DIR];
+	char path[TEST_LEN_DIR + 16];
+
+	api_msg_set_level(API_MSG_ERROR);
+
+	rc = test_tmpdir(dir, sizeof(dir));
+	if (rc)
+		return EXIT_FAILURE;
+	snprintf(path, sizeof(path), "%s/asic.sock", dir);
+
+	char *const argv[] = {"asic_fake", "-S", path, "-v", "error", NULL};
+	rc = test_spawn(argv, &pid);
+	if (rc)
+		goto cleanup;
+
+	sock = connect_daemon(path);
+	if (!sock) {
+		rc = -EIO;
+		kill(pid, SIGTERM);
+	} else
+		rc = test_requests(sock, dir);
+	if (rc)
+		kill(pid, SIGTERM);
+
+	const int rc_daemon = test_wait(pid);
+	if (!rc && rc_daemon) {
+		C_ERROR(EINVAL, "daemon exit code %d", rc_daemon);
+		rc = -EINVAL;
+	}
+	if (!rc && !stat(path, &st)) {
+		C_ERROR(EEXIST, "socket '%s' not removed", path);
+		rc = -EEXIST;
+	}
+
+cleanup:
+	if (sock)
+		fclose(sock);
+	test_rmdir(dir);
+
+	return rc ? EXIT_FAILURE : EXIT_SUCCESS;
+}
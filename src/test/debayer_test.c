@@ -0,0 +1,273 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 only,
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License version 2 for more details (a copy is included
+ * in the LICENSE file that accompanied this code).
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Copyright (c) 2017, Thomas Stibor <thomas@stibor.net>
+ */
+
+/* Debayering recovers a flat colored field exactly and the vectorized
+   interior matches a scalar reference of the same interpolation, for
+   every Bayer pattern, 8 and 16 bit samples and widths which are no
+   multiple of the vector width. */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "debayer.h"
+#include "parallel.h"
+#include "test_util.h"
+
+#define TEST_WIDTH	37
+#define TEST_HEIGHT	13
+#define TEST_N		(TEST_WIDTH * TEST_HEIGHT)
+
+/* Plane of the color at (x, y) in the same order as debayer.c. */
+static const uint8_t cfa[4][4] = {
+	[BAYER_RG] = {0, 1, 1, 2},
+	[BAYER_BG] = {2, 1, 1, 0},
+	[BAYER_GR] = {1, 0, 2, 1},
+	[BAYER_GB] = {1, 2, 0, 1}
+};
+
+struct img {
+	const uint8_t *p;
+	int bps;
+};
+
+static int color(const enum bayer_pattern pattern, const int x, const int y)
+{
+	return cfa[pattern][2 * (y & 1) + (x & 1)];
+}
+
+static int reflect(int i, const int n)
+{
+	if (i < 0)
+		i = -i;
+	if (i >= n)
+		i = 2 * (n - 1) - i;
+
+	return i;
+}
+
+static int32_t at(const struct img *img, const int x, const int y)
+{
+	const size_t i = (size_t)reflect(y, TEST_HEIGHT) * TEST_WIDTH +
+		reflect(x, TEST_WIDTH);
+
+	return img->bps == 2 ? ((const uint16_t *)img->p)[i] : img->p[i];
+}
+
+static int32_t clamp_sample(const int32_t v, const int bps)
+{
+	const int32_t max = bps == 2 ? UINT16_MAX : UINT8_MAX;
+
+	return v < 0 ? 0 : v > max ? max : v;
+}
+
+static void set(uint8_t *planar, const int bps, const int plane,
+		const int x, const int y, const int32_t v)
+{
+	const size_t i = (size_t)plane * TEST_N + (size_t)y * TEST_WIDTH + x;
+
+	if (bps == 2)
+		((uint16_t *)planar)[i] = v;
+	else
+		planar[i] = v;
+}
+
+/* Average of the nearest samples of each color. */
+static void ref_bilinear(uint8_t *planar, const struct img *m,
+			 const enum bayer_pattern pattern)
+{
+	for (int y = 0; y < TEST_HEIGHT; y++) {
+		for (int x = 0; x < TEST_WIDTH; x++) {
+			const int c = color(pattern, x, y);
+			const int32_t h = at(m, x - 1, y) + at(m, x + 1, y);
+			const int32_t v = at(m, x, y - 1) + at(m, x, y + 1);
+			const int32_t d = at(m, x - 1, y - 1) +
+				at(m, x + 1, y - 1) + at(m, x - 1, y + 1) +
+				at(m, x + 1, y + 1);
+
+			set(planar, m->bps, c, x, y, at(m, x, y));
+			if (c != 1) {
+				set(planar, m->bps, 1, x, y, (h + v + 2) >> 2);
+				set(planar, m->bps, 2 - c, x, y, (d + 2) >> 2);
+			} else {
+				const int ch = color(pattern, x + 1, y);
+
+				set(planar, m->bps, ch, x, y, (h + 1) >> 1);
+				set(planar, m->bps, 2 - ch, x, y, (v + 1) >> 1);
+			}
+		}
+	}
+}
+
+/* Hamilton-Adams green, then red and blue from the green plus the
+   averaged color difference. */
+static void ref_edge(uint8_t *planar, const struct img *m,
+		     const enum bayer_pattern pattern)
+{
+	const struct img g = {planar + TEST_N * m->bps, m->bps};
+
+	for (int y = 0; y < TEST_HEIGHT; y++) {
+		for (int x = 0; x < TEST_WIDTH; x++) {
+			const int32_t c = at(m, x, y);
+			int32_t val;
+
+			if (color(pattern, x, y) == 1) {
+				set(planar, m->bps, 1, x, y, c);
+				continue;
+			}
+
+			const int32_t w = at(m, x - 1, y), e = at(m, x + 1, y);
+			const int32_t n = at(m, x, y - 1), s = at(m, x, y + 1);
+			const int32_t lh = 2 * c - at(m, x - 2, y) -
+				at(m, x + 2, y);
+			const int32_t lv = 2 * c - at(m, x, y - 2) -
+				at(m, x, y + 2);
+			const int32_t dh = abs(w - e) + abs(lh);
+			const int32_t dv = abs(n - s) + abs(lv);
+			const int32_t gh = 2 * (w + e) + lh;
+			const int32_t gv = 2 * (n + s) + lv;
+
+			if (dh < dv)
+				val = (gh + 2) >> 2;
+			else if (dv < dh)
+				val = (gv + 2) >> 2;
+			else
+				val = (gh + gv + 4) >> 3;
+			set(planar, m->bps, 1, x, y, clamp_sample(val, m->bps));
+		}
+	}
+
+	for (int y = 0; y < TEST_HEIGHT; y++) {
+		for (int x = 0; x < TEST_WIDTH; x++) {
+			const int c = color(pattern, x, y);
+			const int32_t gc = at(&g, x, y);
+#define DIFF(_x, _y) (at(m, _x, _y) - at(&g, _x, _y))
+			const int32_t h = DIFF(x - 1, y) + DIFF(x + 1, y);
+			const int32_t v = DIFF(x, y - 1) + DIFF(x, y + 1);
+			const int32_t d = DIFF(x - 1, y - 1) + DIFF(x + 1, y - 1) +
+				DIFF(x - 1, y + 1) + DIFF(x + 1, y + 1);
+#undef DIFF
+			if (c != 1) {
+				set(planar, m->bps, c, x, y, at(m, x, y));
+				set(planar, m->bps, 2 - c, x, y,
+				    clamp_sample(gc + ((d + 2) >> 2), m->bps));
+			} else {
+				const int ch = color(pattern, x + 1, y);
+
+				set(planar, m->bps, ch, x, y,
+				    clamp_sample(gc + ((h + 1) >> 1), m->bps));
+				set(planar, m->bps, 2 - ch, x, y,
+				    clamp_sample(gc + ((v + 1) >> 1), m->bps));
+			}
+		}
+	}
+}
+
+static int test_case(const int bps, const enum bayer_pattern pattern,
+		     const enum debayer_algo algo, const bool flat)
+{
+	int rc;
+	uint8_t raw[TEST_N * 2];
+	uint8_t planar[3 * TEST_N * 2];
+	uint8_t ref[3 * TEST_N * 2];
+	const struct img m = {raw, bps};
+	const int32_t rgb[3] = {100, 150, 50};
+	uint32_t seed = 2463534242u;
+
+	for (int y = 0; y < TEST_HEIGHT; y++) {
+		for (int x = 0; x < TEST_WIDTH; x++) {
+			const size_t i = (size_t)y * TEST_WIDTH + x;
+			int32_t v;
+
+			seed ^= seed << 13;
+			seed ^= seed >> 17;
+			seed ^= seed << 5;
+			if (flat)
+				v = rgb[color(pattern, x, y)] << (bps == 2 ? 8 : 0);
+			else
+				v = seed >> (bps == 2 ? 16 : 24);
+			if (bps == 2)
+				((uint16_t *)raw)[i] = v;
+			else
+				raw[i] = v;
+		}
+	}
+
+	memset(planar, 0xaa, sizeof(planar));
+	rc = debayer(planar, raw, TEST_WIDTH, TEST_HEIGHT, bps, pattern, algo);
+	TEST_CHECK(rc == 0);
+
+	if (flat) {
+		for (int n = 0; n < 3 * TEST_N; n++) {
+			const int32_t v = bps == 2 ?
+				((const uint16_t *)planar)[n] : planar[n];
+
+			TEST_CHECK(v == rgb[n / TEST_N] << (bps == 2 ? 8 : 0));
+		}
+		goto cleanup;
+	}
+
+	if (algo == DEBAYER_BILINEAR)
+		ref_bilinear(ref, &m, pattern);
+	else
+		ref_edge(ref, &m, pattern);
+	TEST_CHECK(!memcmp(planar, ref, 3 * TEST_N * bps));
+
+cleanup:
+	if (rc)
+		C_ERROR(-rc, "%d bit, pattern %d, algorithm %d%s", 8 * bps,
+			pattern, algo, flat ? ", flat field" : "");
+
+	return rc;
+}
+
+int main(void)
+{
+	int rc = 0;
+	uint8_t buf[3 * 4 * 4];
+
+	api_msg_set_level(API_MSG_ERROR);
+
+	for (uint32_t threads = 1; threads <= 4 && !rc; threads += 3) {
+		parallel_set_threads(threads);
+		for (int bps = 1; bps <= 2 && !rc; bps++)
+			for (int p = BAYER_RG; p <= BAYER_GB && !rc; p++)
+				for (int a = DEBAYER_BILINEAR;
+				     a <= DEBAYER_EDGE && !rc; a++) {
+					rc = test_case(bps, p, a, true);
+					if (!rc)
+						rc = test_case(bps, p, a, false);
+				}
+	}
+
+	/* Too small for the border and unknown parameters. */
+	if (!rc)
+		TEST_CHECK(debayer(buf, buf, 3, 4, 1, BAYER_RG,
+				   DEBAYER_BILINEAR) == -EINVAL &&
+			   debayer(buf, buf, 4, 4, 3, BAYER_RG,
+				   DEBAYER_BILINEAR) == -EINVAL &&
+			   debayer(buf, buf, 4, 4, 1, BAYER_GB + 1,
+				   DEBAYER_BILINEAR) == -EINVAL &&
+			   debayer(buf, buf, 4, 4, 1, BAYER_RG,
+				   DEBAYER_NONE) == -EINVAL);
+
+cleanup:
+	return rc ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,659 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 only,
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License version 2 for more details (a copy is included
+ * in the LICENSE file that accompanied this code).
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Copyright (c) 2017, Thomas Stibor <thomas@stibor.net>
+ */
+
+/* Stand in for libASICamera2, linked into asic_fake for the tests.
+   Cameras deliver synthetic frames: the 32 bit little endian frame
+   number in the first four bytes, followed by a gradient shifted by
+   the frame number and a star at the sensor center. Video frames
+   arrive at a fixed rate, frames not fetched in time are dropped as
+   by the camera. The environment configures the cameras:
+     FAKE_ASI_CAMERAS  number of connected cameras [default: 1]
+     FAKE_ASI_FPS      video frame rate [default: 100]
+     FAKE_ASI_WIDTH    sensor width [default: 640]
+     FAKE_ASI_HEIGHT   sensor height [default: 480]
+     FAKE_ASI_COLOR    1 for a color camera with RGGB mosaic */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+#include <ASICamera2.h>
+
+#define FAKE_MAX_CAMERAS	4
+#define FAKE_MAX_CONTROLS	(ASI_ANTI_DEW_HEATER + 1)
+#define FAKE_STAR_RADIUS	8
+#define FAKE_STAR_SIGMA		2.0
+
+struct fake_cam {
+	bool open;
+	bool init;
+	int width;
+	int height;
+	int bin;
+	ASI_IMG_TYPE img_type;
+	int x_org;
+	int y_org;
+	long ctrl[FAKE_MAX_CONTROLS];
+	ASI_BOOL ctrl_auto[FAKE_MAX_CONTROLS];
+	bool video;
+	double t_video;		/* Start of video capture. */
+	uint64_t n_next;	/* Video frame delivered next. */
+	int n_dropped;
+	ASI_EXPOSURE_STATUS exp_status;
+	double t_exp_end;
+	uint32_t n_frames;	/* Frames delivered. */
+};
+
+static const ASI_CONTROL_CAPS fake_caps[] = {
+	{"Gain", "Gain", 600, 0, 0, ASI_TRUE, ASI_TRUE, ASI_GAIN, {0}},
+	{"Exposure", "Exposure Time(us)", 2000000000, 32, 10000, ASI_TRUE,
+	 ASI_TRUE, ASI_EXPOSURE, {0}},
+	{"Offset", "offset", 80, 0, 8, ASI_FALSE, ASI_TRUE, ASI_BRIGHTNESS, {0}},
+	{"BandWidth", "The total data transfer rate percentage", 100, 40, 50,
+	 ASI_TRUE, ASI_TRUE, ASI_BANDWIDTHOVERLOAD, {0}},
+	{"Flip", "Flip: 0->None 1->Horiz 2->Vert 3->Both", 3, 0, 0, ASI_FALSE,
+	 ASI_TRUE, ASI_FLIP, {0}},
+	{"HighSpeedMode", "Is high speed mode:0->No 1->Yes", 1, 0, 0,
+	 ASI_FALSE, ASI_TRUE, ASI_HIGH_SPEED_MODE, {0}},
+	{"Temperature", "Sensor temperature(degrees Celsius)", 1000, -500, 20,
+	 ASI_FALSE, ASI_FALSE, ASI_TEMPERATURE, {0}}
+};
+
+static struct fake_cam cams[FAKE_MAX_CAMERAS];
+static pthread_mutex_t fake_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int env_int(const char *name, const int def)
+{
+	const char *val = getenv(name);
+
+	return val && *val ? atoi(val) : def;
+}
+
+static double mono_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void sleep_until(const double t)
+{
+	const double dt = t - mono_time();
+
+	if (dt <= 0)
+		return;
+
+	struct timespec ts = {
+		.tv_sec = dt,
+		.tv_nsec = (dt - (long)dt) * 1e9
+	};
+	nanosleep(&ts, NULL);
+}
+
+static int n_cameras(void)
+{
+	const int n = env_int("FAKE_ASI_CAMERAS", 1);
+
+	return n < 0 ? 0 : n > FAKE_MAX_CAMERAS ? FAKE_MAX_CAMERAS : n;
+}
+
+static int sensor_width(void)
+{
+	return env_int("FAKE_ASI_WIDTH", 640);
+}
+
+static int sensor_height(void)
+{
+	return env_int("FAKE_ASI_HEIGHT", 480);
+}
+
+static bool is_color(void)
+{
+	return env_int("FAKE_ASI_COLOR", 0) != 0;
+}
+
+static struct fake_cam *lookup(const int id, const bool need_init)
+{
+	if (id < 0 || id >= n_cameras())
+		return NULL;
+	if (!cams[id].open || (need_init && !cams[id].init))
+		return NULL;
+
+	return &cams[id];
+}
+
+static long frame_size(const struct fake_cam *cam)
+{
+	const long pixels = (long)cam->width * cam->height;
+
+	switch (cam->img_type) {
+	case ASI_IMG_RAW16:
+		return pixels * 2;
+	case ASI_IMG_RGB24:
+		return pixels * 3;
+	default:
+		return pixels;
+	}
+}
+
+static void fill_frame(const struct fake_cam *cam, uint8_t *buf,
+		       const uint32_t n)
+{
+	const int spp = cam->img_type == ASI_IMG_RGB24 ? 3 : 1;
+	const double x_star = sensor_width() / 2.0 / cam->bin - cam->x_org;
+	const double y_star = sensor_height() / 2.0 / cam->bin - cam->y_org;
+
+	for (int y = 0; y < cam->height; y++) {
+		for (int x = 0; x < cam->width; x++) {
+			const double dx = x - x_star;
+			const double dy = y - y_star;
+			double val = (x + y + n) & 0x3f;
+
+			if (fabs(dx) < FAKE_STAR_RADIUS &&
+			    fabs(dy) < FAKE_STAR_RADIUS)
+				val += 190 * exp(-(dx * dx + dy * dy) /
+						 (2 * FAKE_STAR_SIGMA *
+						  FAKE_STAR_SIGMA));
+
+			const long idx = ((long)y * cam->width + x) * spp;
+			if (cam->img_type == ASI_IMG_RAW16) {
+				/* Left aligned 12 bit samples. */
+				const uint16_t v = (uint16_t)(val * 16) << 4;
+				buf[idx * 2] = v & 0xff;
+				buf[idx * 2 + 1] = v >> 8;
+			} else
+				for (int s = 0; s < spp; s++)
+					buf[idx + s] = val;
+		}
+	}
+	buf[0] = n & 0xff;
+	buf[1] = n >> 8 & 0xff;
+	buf[2] = n >> 16 & 0xff;
+	buf[3] = n >> 24 & 0xff;
+}
+
+int ASIGetNumOfConnectedCameras(void)
+{
+	return n_cameras();
+}
+
+ASI_ERROR_CODE ASIGetCameraProperty(ASI_CAMERA_INFO *pASICameraInfo,
+				    int iCameraIndex)
+{
+	if (!pASICameraInfo || iCameraIndex < 0 || iCameraIndex >= n_cameras())
+		return ASI_ERROR_INVALID_INDEX;
+
+	memset(pASICameraInfo, 0, sizeof(*pASICameraInfo));
+	snprintf(pASICameraInfo->Name, sizeof(pASICameraInfo->Name),
+		 "ZWO ASI Fake %d", iCameraIndex);
+	pASICameraInfo->CameraID = iCameraIndex;
+	pASICameraInfo->MaxWidth = sensor_width();
+	pASICameraInfo->MaxHeight = sensor_height();
+	pASICameraInfo->IsColorCam = is_color() ? ASI_TRUE : ASI_FALSE;
+	pASICameraInfo->BayerPattern = ASI_BAYER_RG;
+	pASICameraInfo->SupportedBins[0] = 1;
+	pASICameraInfo->SupportedBins[1] = 2;
+	pASICameraInfo->SupportedBins[2] = 4;
+	pASICameraInfo->SupportedVideoFormat[0] = ASI_IMG_RAW8;
+	pASICameraInfo->SupportedVideoFormat[1] = ASI_IMG_RAW16;
+	pASICameraInfo->SupportedVideoFormat[2] = ASI_IMG_Y8;
+	pASICameraInfo->SupportedVideoFormat[3] = is_color() ?
+		ASI_IMG_RGB24 : ASI_IMG_END;
+	pASICameraInfo->SupportedVideoFormat[4] = ASI_IMG_END;
+	pASICameraInfo->PixelSize = 3.75;
+	pASICameraInfo->IsUSB3Host = ASI_TRUE;
+	pASICameraInfo->IsUSB3Camera = ASI_TRUE;
+	pASICameraInfo->ElecPerADU = 1.0;
+
+	return ASI_SUCCESS;
+}
+
+ASI_ERROR_CODE ASIOpenCamera(int iCameraID)
+{
+	if (iCameraID < 0 || iCameraID >= n_cameras())
+		return ASI_ERROR_INVALID_ID;
+
+	pthread_mutex_lock(&fake_mutex);
+	struct fake_cam *cam = &cams[iCameraID];
+	if (!cam->open) {
+		memset(cam, 0, sizeof(*cam));
+		cam->open = true;
+	}
+	pthread_mutex_unlock(&fake_mutex);
+
+	return ASI_SUCCESS;
+}
+
+ASI_ERROR_CODE ASIInitCamera(int iCameraID)
+{
+	ASI_ERROR_CODE rc = ASI_SUCCESS;
+
+	pthread_mutex_lock(&fake_mutex);
+	struct fake_cam *cam = lookup(iCameraID, false);
+	if (!cam) {
+		rc = ASI_ERROR_CAMERA_CLOSED;
+		goto out;
+	}
+	cam->init = true;
+	cam->width = sensor_width();
+	cam->height = sensor_height();
+	cam->bin = 1;
+	cam->img_type = ASI_IMG_RAW8;
+	for (size_t n = 0; n < sizeof(fake_caps) / sizeof(fake_caps[0]); n++)
+		cam->ctrl[fake_caps[n].ControlType] = fake_caps[n].DefaultValue;
+out:
+	pthread_mutex_unlock(&fake_mutex);
+
+	return rc;
+}
+
+ASI_ERROR_CODE ASICloseCamera(int iCameraID)
+{
+	if (iCameraID < 0 || iCameraID >= n_cameras())
+		return ASI_ERROR_INVALID_ID;
+
+	pthread_mutex_lock(&fake_mutex);
+	memset(&cams[iCameraID], 0, sizeof(cams[iCameraID]));
+	pthread_mutex_unlock(&fake_mutex);
+
+	return ASI_SUCCESS;
+}
+
+ASI_ERROR_CODE ASIGetNumOfControls(int iCameraID, int *piNumberOfControls)
+{
+	if (!lookup(iCameraID, true))
+		return ASI_ERROR_CAMERA_CLOSED;
+
+	*piNumberOfControls = sizeof(fake_caps) / sizeof(fake_caps[0]);
+
+	return ASI_SUCCESS;
+}
+
+ASI_ERROR_CODE ASIGetControlCaps(int iCameraID, int iControlIndex,
+				 ASI_CONTROL_CAPS *pControlCaps)
+{
+	if (!lookup(iCameraID, true))
+		return ASI_ERROR_CAMERA_CLOSED;
+	if (iControlIndex < 0 ||
+	    iControlIndex >= (int)(sizeof(fake_caps) / sizeof(fake_caps[0])))
+		return ASI_ERROR_INVALID_INDEX;
+
+	*pControlCaps = fake_caps[iControlIndex];
+
+	return ASI_SUCCESS;
+}
+
+static const ASI_CONTROL_CAPS *lookup_caps(const ASI_CONTROL_TYPE type)
+{
+	for (size_t n = 0; n < sizeof(fake_caps) / sizeof(fake_caps[0]); n++)
+		if (fake_caps[n].ControlType == type)
+			return &fake_caps[n];
+
+	return NULL;
+}
+
+ASI_ERROR_CODE ASIGetControlValue(int iCameraID, ASI_CONTROL_TYPE ControlType,
+				  long *plValue, ASI_BOOL *pbAuto)
+{
+	ASI_ERROR_CODE rc = ASI_SUCCESS;
+
+	pthread_mutex_lock(&fake_mutex);
+	struct fake_cam *cam = lookup(iCameraID, true);
+	if (!cam) {
+		rc = ASI_ERROR_CAMERA_CLOSED;
+		goto out;
+	}
+	if (!lookup_caps(ControlType)) {
+		rc = ASI_ERROR_INVALID_CONTROL_TYPE;
+		goto out;
+	}
+	/* The SDK reports the temperature in 1/10 degree. */
+	*plValue = ControlType == ASI_TEMPERATURE ?
+		cam->ctrl[ControlType] * 10 : cam->ctrl[ControlType];
+	*pbAuto = cam->ctrl_auto[ControlType];
+out:
+	pthread_mutex_unlock(&fake_mutex);
+
+	return rc;
+}
+
+ASI_ERROR_CODE ASISetControlValue(int iCameraID, ASI_CONTROL_TYPE ControlType,
+				  long lValue, ASI_BOOL bAuto)
+{
+	ASI_ERROR_CODE rc = ASI_SUCCESS;
+	const ASI_CONTROL_CAPS *caps = lookup_caps(ControlType);
+
+	pthread_mutex_lock(&fake_mutex);
+	struct fake_cam *cam = lookup(iCameraID, true);
+	if (!cam) {
+		rc = ASI_ERROR_CAMERA_CLOSED;
+		goto out;
+	}
+	if (!caps || !caps->IsWritable) {
+		rc = ASI_ERROR_INVALID_CONTROL_TYPE;
+		goto out;
+	}
+	if (lValue < caps->MinValue)
+		lValue = caps->MinValue;
+	else if (lValue > caps->MaxValue)
+		lValue = caps->MaxValue;
+	cam->ctrl[ControlType] = lValue;
+	cam->ctrl_auto[ControlType] = caps->IsAutoSupported ? bAuto : ASI_FALSE;
+out:
+	pthread_mutex_unlock(&fake_mutex);
+
+	return rc;
+}
+
+ASI_ERROR_CODE ASISetROIFormat(int iCameraID, int iWidth, int iHeight,
+			       int iBin, ASI_IMG_TYPE Img_type)
+{
+	ASI_ERROR_CODE rc = ASI_SUCCESS;
+
+	pthread_mutex_lock(&fake_mutex);
+	struct fake_cam *cam = lookup(iCameraID, true);
+	if (!cam) {
+		rc = ASI_ERROR_CAMERA_CLOSED;
+		goto out;
+	}
+	if (iBin != 1 && iBin != 2 && iBin != 4) {
+		rc = ASI_ERROR_INVALID_SIZE;
+		goto out;
+	}
+	if (iWidth <= 0 || iHeight <= 0 || iWidth % 8 || iHeight % 2 ||
+	    iWidth * iBin > sensor_width() || iHeight * iBin > sensor_height()) {
+		rc = ASI_ERROR_INVALID_SIZE;
+		goto out;
+	}
+	if (Img_type < ASI_IMG_RAW8 || Img_type > ASI_IMG_Y8 ||
+	    (Img_type == ASI_IMG_RGB24 && !is_color())) {
+		rc = ASI_ERROR_INVALID_IMGTYPE;
+		goto out;
+	}
+	cam->width = iWidth;
+	cam->height = iHeight;
+	cam->bin = iBin;
+	cam->img_type = Img_type;
+	/* The ROI is centered after a format change. */
+	cam->x_org = (sensor_width() / iBin - iWidth) / 2 & ~1;
+	cam->y_org = (sensor_height() / iBin - iHeight) / 2 & ~1;
+out:
+	pthread_mutex_unlock(&fake_mutex);
+
+	return rc;
+}
+
+ASI_ERROR_CODE ASIGetROIFormat(int iCameraID, int *piWidth, int *piHeight,
+			       int *piBin, ASI_IMG_TYPE *pImg_type)
+{
+	ASI_ERROR_CODE rc = ASI_SUCCESS;
+
+	pthread_mutex_lock(&fake_mutex);
+	struct fake_cam *cam = lookup(iCameraID, true);
+	if (!cam) {
+		rc = ASI_ERROR_CAMERA_CLOSED;
+		goto out;
+	}
+	*piWidth = cam->width;
+	*piHeight = cam->height;
+	*piBin = cam->bin;
+	*pImg_type = cam->img_type;
+out:
+	pthread_mutex_unlock(&fake_mutex);
+
+	return rc;
+}
+
+ASI_ERROR_CODE ASISetStartPos(int iCameraID, int iStartX, int iStartY)
+{
+	ASI_ERROR_CODE rc = ASI_SUCCESS;
+
+	pthread_mutex_lock(&fake_mutex);
+	struct fake_cam *cam = lookup(iCameraID, true);
+	if (!cam) {
+		rc = ASI_ERROR_CAMERA_CLOSED;
+		goto out;
+	}
+	if (iStartX < 0 || iStartY < 0 ||
+	    iStartX + cam->width > sensor_width() / cam->bin ||
+	    iStartY + cam->height > sensor_height() / cam->bin) {
+		rc = ASI_ERROR_OUTOF_BOUNDARY;
+		goto out;
+	}
+	cam->x_org = iStartX & ~7;
+	cam->y_org = iStartY & ~1;
+out:
+	pthread_mutex_unlock(&fake_mutex);
+
+	return rc;
+}
+
+ASI_ERROR_CODE ASIGetStartPos(int iCameraID, int *piStartX, int *piStartY)
+{
+	ASI_ERROR_CODE rc = ASI_SUCCESS;
+
+	pthread_mutex_lock(&fake_mutex);
+	struct fake_cam *cam = lookup(iCameraID, true);
+	if (!cam) {
+		rc = ASI_ERROR_CAMERA_CLOSED;
+		goto out;
+	}
+	*piStartX = cam->x_org;
+	*piStartY = cam->y_org;
+out:
+	pthread_mutex_unlock(&fake_mutex);
+
+	return rc;
+}
+
+ASI_ERROR_CODE ASIGetDroppedFrames(int iCameraID, int *piDropFrames)
+{
+	ASI_ERROR_CODE rc = ASI_SUCCESS;
+
+	pthread_mutex_lock(&fake_mutex);
+	struct fake_cam *cam = lookup(iCameraID, true);
+	if (!cam)
+		rc = ASI_ERROR_CAMERA_CLOSED;
+	else
+		*piDropFrames = cam->n_dropped;
+	pthread_mutex_unlock(&fake_mutex);
+
+	return rc;
+}
+
+ASI_ERROR_CODE ASIStartVideoCapture(int iCameraID)
+{
+	ASI_ERROR_CODE rc = ASI_SUCCESS;
+
+	pthread_mutex_lock(&fake_mutex);
+	struct fake_cam *cam = lookup(iCameraID, true);
+	if (!cam) {
+		rc = ASI_ERROR_CAMERA_CLOSED;
+		goto out;
+	}
+	if (cam->exp_status == ASI_EXP_WORKING) {
+		rc = ASI_ERROR_EXPOSURE_IN_PROGRESS;
+		goto out;
+	}
+	cam->video = true;
+	cam->t_video = mono_time();
+	cam->n_next = 0;
+	cam->n_dropped = 0;
+out:
+	pthread_mutex_unlock(&fake_mutex);
+
+	return rc;
+}
+
+ASI_ERROR_CODE ASIStopVideoCapture(int iCameraID)
+{
+	ASI_ERROR_CODE rc = ASI_SUCCESS;
+
+	pthread_mutex_lock(&fake_mutex);
+	struct fake_cam *cam = lookup(iCameraID, true);
+	if (!cam)
+		rc = ASI_ERROR_CAMERA_CLOSED;
+	else
+		cam->video = false;
+	pthread_mutex_unlock(&fake_mutex);
+
+	return rc;
+}
+
+/* Frame k of the video leaves the sensor at t_video + (k + 1) * period.
+   Frames which were complete more than one period ago have been
+   overwritten and count as dropped. */
+ASI_ERROR_CODE ASIGetVideoData(int iCameraID, unsigned char *pBuffer,
+			       long lBuffSize, int iWaitms)
+{
+	pthread_mutex_lock(&fake_mutex);
+	struct fake_cam *cam = lookup(iCameraID, true);
+	if (!cam || !cam->video) {
+		pthread_mutex_unlock(&fake_mutex);
+		return cam ? ASI_ERROR_INVALID_SEQUENCE : ASI_ERROR_CAMERA_CLOSED;
+	}
+	if (lBuffSize < frame_size(cam)) {
+		pthread_mutex_unlock(&fake_mutex);
+		return ASI_ERROR_BUFFER_TOO_SMALL;
+	}
+
+	const int fps = env_int("FAKE_ASI_FPS", 100);
+	const double exposure = cam->ctrl[ASI_EXPOSURE] * 1e-6;
+	const double period = fps > 0 && 1.0 / fps > exposure ?
+		1.0 / fps : exposure;
+	const double t_now = mono_time();
+	const uint64_t n_done = (t_now - cam->t_video) / period;
+
+	if (n_done > cam->n_next + 1) {
+		cam->n_dropped += n_done - 1 - cam->n_next;
+		cam->n_next = n_done - 1;
+	}
+
+	const uint64_t n = cam->n_next++;
+	const double t_ready = cam->t_video + (n + 1) * period;
+	pthread_mutex_unlock(&fake_mutex);
+
+	if (t_ready - t_now > iWaitms * 1e-3) {
+		sleep_until(t_now + iWaitms * 1e-3);
+		pthread_mutex_lock(&fake_mutex);
+		cam->n_next--;
+		pthread_mutex_unlock(&fake_mutex);
+		return ASI_ERROR_TIMEOUT;
+	}
+	sleep_until(t_ready);
+	fill_frame(cam, pBuffer, n);
+
+	pthread_mutex_lock(&fake_mutex);
+	cam->n_frames++;
+	pthread_mutex_unlock(&fake_mutex);
+
+	return ASI_SUCCESS;
+}
+
+ASI_ERROR_CODE ASIStartExposure(int iCameraID, ASI_BOOL bIsDark)
+{
+	ASI_ERROR_CODE rc = ASI_SUCCESS;
+
+	(void)bIsDark;
+	pthread_mutex_lock(&fake_mutex);
+	struct fake_cam *cam = lookup(iCameraID, true);
+	if (!cam) {
+		rc = ASI_ERROR_CAMERA_CLOSED;
+		goto out;
+	}
+	if (cam->video) {
+		rc = ASI_ERROR_VIDEO_MODE_ACTIVE;
+		goto out;
+	}
+	if (cam->exp_status == ASI_EXP_WORKING) {
+		rc = ASI_ERROR_EXPOSURE_IN_PROGRESS;
+		goto out;
+	}
+	cam->exp_status = ASI_EXP_WORKING;
+	cam->t_exp_end = mono_time() + cam->ctrl[ASI_EXPOSURE] * 1e-6;
+out:
+	pthread_mutex_unlock(&fake_mutex);
+
+	return rc;
+}
+
+ASI_ERROR_CODE ASIStopExposure(int iCameraID)
+{
+	ASI_ERROR_CODE rc = ASI_SUCCESS;
+
+	pthread_mutex_lock(&fake_mutex);
+	struct fake_cam *cam = lookup(iCameraID, true);
+	if (!cam)
+		rc = ASI_ERROR_CAMERA_CLOSED;
+	else if (cam->exp_status == ASI_EXP_WORKING)
+		cam->exp_status = ASI_EXP_FAILED;
+	pthread_mutex_unlock(&fake_mutex);
+
+	return rc;
+}
+
+ASI_ERROR_CODE ASIGetExpStatus(int iCameraID, ASI_EXPOSURE_STATUS *pExpStatus)
+{
+	ASI_ERROR_CODE rc = ASI_SUCCESS;
+
+	pthread_mutex_lock(&fake_mutex);
+	struct fake_cam *cam = lookup(iCameraID, true);
+	if (!cam) {
+		rc = ASI_ERROR_CAMERA_CLOSED;
+		goto out;
+	}
+	if (cam->exp_status == ASI_EXP_WORKING && mono_time() >= cam->t_exp_end)
+		cam->exp_status = ASI_EXP_SUCCESS;
+	*pExpStatus = cam->exp_status;
+out:
+	pthread_mutex_unlock(&fake_mutex);
+
+	return rc;
+}
+
+ASI_ERROR_CODE ASIGetDataAfterExp(int iCameraID, unsigned char *pBuffer,
+				  long lBuffSize)
+{
+	pthread_mutex_lock(&fake_mutex);
+	struct fake_cam *cam = lookup(iCameraID, true);
+	if (!cam) {
+		pthread_mutex_unlock(&fake_mutex);
+		return ASI_ERROR_CAMERA_CLOSED;
+	}
+	if (cam->exp_status != ASI_EXP_SUCCESS) {
+		pthread_mutex_unlock(&fake_mutex);
+		return ASI_ERROR_GENERAL_ERROR;
+	}
+	if (lBuffSize < frame_size(cam)) {
+		pthread_mutex_unlock(&fake_mutex);
+		return ASI_ERROR_BUFFER_TOO_SMALL;
+	}
+	cam->exp_status = ASI_EXP_IDLE;
+	const uint32_t n = cam->n_frames++;
+	pthread_mutex_unlock(&fake_mutex);
+
+	fill_frame(cam, pBuffer, n);
+
+	return ASI_SUCCESS;
+}
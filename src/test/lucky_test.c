@@ -0,0 +1,174 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 only,
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License version 2 for more details (a copy is included
+ * in the LICENSE file that accompanied this code).
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Copyright (c) 2017, Thomas Stibor <thomas@stibor.net>
+ */
+
+/* The bounded heap keeps exactly the best scored items and hands every
+   other item back once, and the sharpness score ranks a sharp star
+   above a blurred one wherever it is in the frame. */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <math.h>
+#include "lucky.h"
+#include "test_util.h"
+
+#define TEST_ITEMS	1000
+#define TEST_KEEP	16
+#define TEST_WIDTH	64
+#define TEST_HEIGHT	48
+#define TEST_ROI	16
+
+static int cmp_desc(const void *a, const void *b)
+{
+	const double x = *(const double *)a;
+	const double y = *(const double *)b;
+
+	return x < y ? 1 : x > y ? -1 : 0;
+}
+
+static int test_heap(void)
+{
+	int rc;
+	struct lucky lucky;
+	double scores[TEST_ITEMS];
+	double sorted[TEST_ITEMS];
+	int returned[TEST_ITEMS] = {0};
+	void *items[TEST_KEEP];
+	uint32_t seed = 2463534242u;
+
+	rc = lucky_init(&lucky, TEST_KEEP);
+	if (rc) {
+		C_ERROR(-rc, "lucky_init");
+		return rc;
+	}
+
+	for (int n = 0; n < TEST_ITEMS; n++) {
+		seed ^= seed << 13;
+		seed ^= seed >> 17;
+		seed ^= seed << 5;
+		scores[n] = seed / 4294967296.0;
+		sorted[n] = scores[n];
+
+		double *evicted = lucky_offer(&lucky, scores[n], &scores[n]);
+		if (n < TEST_KEEP)
+			TEST_CHECK(!evicted);
+		else
+			TEST_CHECK(evicted);
+		if (evicted)
+			returned[evicted - scores]++;
+	}
+
+	/* An item worse than all kept ones comes straight back. */
+	double worst = -1;
+	TEST_CHECK(lucky_offer(&lucky, worst, &worst) == &worst);
+
+	TEST_CHECK(lucky_drain(&lucky, items) == TEST_KEEP);
+	TEST_CHECK(lucky.n == 0);
+	for (int k = 0; k < TEST_KEEP; k++)
+		returned[(double *)items[k] - scores]++;
+	for (int n = 0; n < TEST_ITEMS; n++)
+		TEST_CHECK(returned[n] == 1);
+
+	/* The kept items are the best ones. */
+	qsort(sorted, TEST_ITEMS, sizeof(double), cmp_desc);
+	for (int k = 0; k < TEST_KEEP; k++)
+		TEST_CHECK(*(double *)items[k] >= sorted[TEST_KEEP - 1]);
+
+cleanup:
+	lucky_destroy(&lucky);
+
+	return rc;
+}
+
+/* Gaussian star of width sigma at (cx, cy) on a black background. */
+static void star(uint8_t *img, const uint8_t bps, const double cx,
+		 const double cy, const double sigma)
+{
+	for (uint32_t y = 0; y < TEST_HEIGHT; y++) {
+		for (uint32_t x = 0; x < TEST_WIDTH; x++) {
+			const double r2 = (x - cx) * (x - cx) +
+				(y - cy) * (y - cy);
+			const double v = 200 * exp(-r2 / (2 * sigma * sigma));
+			const size_t i = (size_t)y * TEST_WIDTH + x;
+
+			if (bps == 2)
+				((uint16_t *)img)[i] = v * 256;
+			else
+				img[i] = v;
+		}
+	}
+}
+
+static int test_score(void)
+{
+	int rc = 0;
+	uint8_t img[TEST_WIDTH * TEST_HEIGHT * 2];
+	double sharp = 0, blurred = 0, moved = 0, wide = 0;
+
+	memset(img, 100, sizeof(img));
+	TEST_CHECK(lucky_score(img, TEST_WIDTH, TEST_HEIGHT, 1, 1,
+			       TEST_ROI) == 0);
+
+	star(img, 1, 20, 20, 1.5);
+	sharp = lucky_score(img, TEST_WIDTH, TEST_HEIGHT, 1, 1, TEST_ROI);
+	star(img, 1, 20, 20, 3);
+	blurred = lucky_score(img, TEST_WIDTH, TEST_HEIGHT, 1, 1, TEST_ROI);
+	TEST_CHECK(sharp > 2 * blurred && blurred > 0);
+
+	/* The region follows the star. */
+	star(img, 1, 44, 28, 1.5);
+	moved = lucky_score(img, TEST_WIDTH, TEST_HEIGHT, 1, 1, TEST_ROI);
+	TEST_CHECK(fabs(moved - sharp) < 1e-3 * sharp);
+
+	/* 16 bit samples rank the same, the score is normalized by the
+	   mean. */
+	star(img, 2, 20, 20, 1.5);
+	wide = lucky_score(img, TEST_WIDTH, TEST_HEIGHT, 2, 1, TEST_ROI);
+	TEST_CHECK(fabs(wide - sharp) < 0.05 * sharp);
+
+	/* Too small frames score 0. */
+	TEST_CHECK(lucky_score(img, 2, 2, 1, 1, TEST_ROI) == 0);
+
+cleanup:
+	if (rc)
+		C_ERROR(-rc, "sharp %f, blurred %f, moved %f, 16 bit %f",
+			sharp, blurred, moved, wide);
+
+	return rc;
+}
+
+int main(void)
+{
+	int rc;
+	struct lucky lucky;
+
+	api_msg_set_level(API_MSG_ERROR);
+
+	rc = test_heap();
+	if (!rc)
+		rc = test_score();
+	if (!rc)
+		TEST_CHECK(lucky_init(&lucky, 0) == -EINVAL &&
+			   lucky_init(&lucky, LUCKY_MAX_FRAMES + 1) == -EINVAL);
+
+cleanup:
+	return rc ? EXIT_FAILURE : EXIT_SUCCESS;
+}
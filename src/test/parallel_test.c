@@ -0,0 +1,115 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 only,
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License version 2 for more details (a copy is included
+ * in the LICENSE file that accompanied this code).
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Copyright (c) 2017, Thomas Stibor <thomas@stibor.net>
+ */
+
+/* Concurrent callers of parallel_for share the worker pool, every item
+   of each call is processed exactly once before the call returns, also
+   for calls nested in a band. */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include "parallel.h"
+#include "test_util.h"
+
+#define TEST_THREADS	4
+#define TEST_CALLERS	4
+#define TEST_CALLS	2000
+#define TEST_ITEMS	97
+
+struct count_job {
+	uint32_t counts[TEST_ITEMS];
+	bool nested;
+};
+
+static void count_items(const uint32_t begin, const uint32_t end, void *arg)
+{
+	struct count_job *job = arg;
+
+	for (uint32_t n = begin; n < end; n++)
+		__atomic_add_fetch(&job->counts[n], 1, __ATOMIC_RELAXED);
+}
+
+static void nested_items(const uint32_t begin, const uint32_t end, void *arg)
+{
+	struct count_job *job = arg;
+
+	for (uint32_t n = begin; n < end; n++) {
+		struct count_job inner = {.counts = {0}, .nested = false};
+
+		parallel_for(TEST_ITEMS, count_items, &inner);
+		for (uint32_t k = 0; k < TEST_ITEMS; k++)
+			if (inner.counts[k] != 1)
+				return;
+		__atomic_add_fetch(&job->counts[n], 1, __ATOMIC_RELAXED);
+	}
+}
+
+static void *caller(void *arg)
+{
+	intptr_t rc = 0;
+
+	UNUSED(arg);
+	for (uint32_t n = 0; n < TEST_CALLS && !rc; n++) {
+		struct count_job job = {.counts = {0}, .nested = n % 100 == 0};
+		const uint32_t n_items = job.nested ? TEST_THREADS * 2 :
+			1 + n % TEST_ITEMS;
+
+		parallel_for(n_items, job.nested ? nested_items : count_items,
+			     &job);
+		for (uint32_t k = 0; k < TEST_ITEMS; k++)
+			if (job.counts[k] != (k < n_items ? 1 : 0))
+				rc = -EINVAL;
+	}
+
+	return (void *)rc;
+}
+
+int main(void)
+{
+	int rc = 0;
+	pthread_t threads[TEST_CALLERS];
+	uint32_t n_started = 0;
+
+	api_msg_set_level(API_MSG_ERROR);
+	parallel_set_threads(TEST_THREADS);
+
+	for (uint32_t n = 0; n < TEST_CALLERS; n++) {
+		rc = pthread_create(&threads[n], NULL, caller, NULL);
+		if (rc) {
+			C_ERROR(rc, "pthread_create");
+			rc = -rc;
+			break;
+		}
+		n_started++;
+	}
+	for (uint32_t n = 0; n < n_started; n++) {
+		void *rc_thread = NULL;
+
+		pthread_join(threads[n], &rc_thread);
+		if ((intptr_t)rc_thread && !rc) {
+			C_ERROR(EINVAL, "items not processed exactly once");
+			rc = -EINVAL;
+		}
+	}
+
+	return rc ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,183 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 only,
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License version 2 for more details (a copy is included
+ * in the LICENSE file that accompanied this code).
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Copyright (c) 2017, Thomas Stibor <thomas@stibor.net>
+ */
+
+/* Software binning matches a plain reference for factors which do and
+   do not divide the image size, interleaved samples and saturation.
+   Downsampling keeps flat fields and unscaled images exactly and
+   agrees with averaging binning up to rounding for integer factors. */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "resample.h"
+#include "parallel.h"
+#include "test_util.h"
+
+#define TEST_WIDTH	27
+#define TEST_HEIGHT	13
+#define TEST_SPP	3
+#define TEST_N		(TEST_WIDTH * TEST_HEIGHT * TEST_SPP)
+
+static uint32_t seed = 2463534242u;
+
+static uint32_t xorshift(void)
+{
+	seed ^= seed << 13;
+	seed ^= seed >> 17;
+	seed ^= seed << 5;
+
+	return seed;
+}
+
+static int32_t get(const uint8_t *img, const size_t i, const int bps)
+{
+	return bps == 2 ? ((const uint16_t *)img)[i] : img[i];
+}
+
+static void fill(uint8_t *img, const size_t n, const int bps, const int flat)
+{
+	for (size_t i = 0; i < n; i++) {
+		const int32_t v = flat >= 0 ? flat :
+			(int32_t)(xorshift() >> (bps == 2 ? 16 : 24));
+
+		if (bps == 2)
+			((uint16_t *)img)[i] = v;
+		else
+			img[i] = v;
+	}
+}
+
+static int test_bin(const int bps, const int spp, const uint32_t f,
+		    const bool average)
+{
+	int rc;
+	uint8_t src[TEST_N * 2];
+	uint8_t dst[TEST_N * 2];
+	const uint32_t w = TEST_WIDTH / f;
+	const uint32_t h = TEST_HEIGHT / f;
+	const int32_t max = bps == 2 ? UINT16_MAX : UINT8_MAX;
+
+	fill(src, (size_t)TEST_WIDTH * TEST_HEIGHT * spp, bps, -1);
+	rc = bin_soft(dst, src, TEST_WIDTH, TEST_HEIGHT, bps, spp, f, average);
+	TEST_CHECK(rc == 0);
+
+	for (uint32_t y = 0; y < h; y++) {
+		for (uint32_t x = 0; x < w; x++) {
+			for (int c = 0; c < spp; c++) {
+				int32_t sum = 0;
+
+				for (uint32_t k = 0; k < f * f; k++)
+					sum += get(src, ((size_t)(y * f + k / f) *
+						   TEST_WIDTH + x * f + k % f) *
+						   spp + c, bps);
+				if (average)
+					sum = (sum + f * f / 2) / (f * f);
+				TEST_CHECK(get(dst, ((size_t)y * w + x) * spp + c,
+					       bps) == (sum > max ? max : sum));
+			}
+		}
+	}
+
+cleanup:
+	if (rc)
+		C_ERROR(-rc, "bin %u, %d bit, %d sample(s)%s", f, 8 * bps, spp,
+			average ? ", average" : "");
+
+	return rc;
+}
+
+static int test_downsample(const int bps, const int spp)
+{
+	int rc;
+	uint8_t src[TEST_N * 2];
+	uint8_t dst[TEST_N * 2];
+	uint8_t bin[TEST_N * 2];
+	const size_t n = (size_t)TEST_WIDTH * TEST_HEIGHT * spp;
+	const int flat = bps == 2 ? 40000 : 200;
+	const int32_t max = bps == 2 ? UINT16_MAX : UINT8_MAX;
+	const int32_t tol = 1 + 2 * (max >> RESAMPLE_SHIFT);
+
+	/* Flat fields stay flat at a fractional factor. */
+	fill(src, n, bps, flat);
+	rc = downsample(dst, 10, 5, src, TEST_WIDTH, TEST_HEIGHT, bps, spp);
+	TEST_CHECK(rc == 0);
+	for (size_t i = 0; i < (size_t)10 * 5 * spp; i++)
+		TEST_CHECK(get(dst, i, bps) == flat);
+
+	/* Unscaled is the identity. */
+	fill(src, n, bps, -1);
+	rc = downsample(dst, TEST_WIDTH, TEST_HEIGHT, src, TEST_WIDTH,
+			TEST_HEIGHT, bps, spp);
+	TEST_CHECK(rc == 0);
+	TEST_CHECK(!memcmp(dst, src, n * bps));
+
+	/* Integer factor 3 over the full 27 x 12 pixels averages the
+	   same blocks as binning, up to rounding of the fixed point
+	   weights in both passes, which is a few counts at 16 bit. */
+	rc = downsample(dst, TEST_WIDTH / 3, 4, src, TEST_WIDTH, 12, bps, spp);
+	TEST_CHECK(rc == 0);
+	rc = bin_soft(bin, src, TEST_WIDTH, 12, bps, spp, 3, true);
+	TEST_CHECK(rc == 0);
+	for (size_t i = 0; i < (size_t)TEST_WIDTH / 3 * 4 * spp; i++)
+		TEST_CHECK(abs(get(dst, i, bps) - get(bin, i, bps)) <= tol);
+
+cleanup:
+	if (rc)
+		C_ERROR(-rc, "downsample %d bit, %d sample(s)", 8 * bps, spp);
+
+	return rc;
+}
+
+int main(void)
+{
+	int rc = 0;
+	uint8_t buf[64];
+
+	api_msg_set_level(API_MSG_ERROR);
+
+	for (uint32_t threads = 1; threads <= 4 && !rc; threads += 3) {
+		parallel_set_threads(threads);
+		for (int bps = 1; bps <= 2 && !rc; bps++) {
+			for (int spp = 1; spp <= TEST_SPP && !rc;
+			     spp += TEST_SPP - 1) {
+				for (uint32_t f = 2; f <= 4 && !rc; f++) {
+					rc = test_bin(bps, spp, f, false);
+					if (!rc)
+						rc = test_bin(bps, spp, f, true);
+				}
+				if (!rc)
+					rc = test_downsample(bps, spp);
+			}
+		}
+	}
+
+	if (!rc)
+		TEST_CHECK(bin_soft(buf, buf, 8, 8, 1, 1, 1, false) == -EINVAL &&
+			   bin_soft(buf, buf, 8, 8, 1, 1, BIN_MAX_FACTOR + 1,
+				    false) == -EINVAL &&
+			   bin_soft(buf, buf, 2, 8, 1, 1, 3, false) == -EINVAL &&
+			   downsample(buf, 9, 4, buf, 8, 8, 1, 1) == -EINVAL &&
+			   downsample(buf, 0, 4, buf, 8, 8, 1, 1) == -EINVAL &&
+			   downsample(buf, 4, 4, buf, 8, 8, 3, 1) == -EINVAL);
+
+cleanup:
+	return rc ? EXIT_FAILURE : EXIT_SUCCESS;
+}
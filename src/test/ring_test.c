@@ -0,0 +1,172 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 only,
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License version 2 for more details (a copy is included
+ * in the LICENSE file that accompanied this code).
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Copyright (c) 2017, Thomas Stibor <thomas@stibor.net>
+ */
+
+/* Frames pass the ring in order, the oldest ready frame is recycled
+   when dropping, closing drains the ready frames and a producer and
+   consumer thread hand over all frames. */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdint.h>
+#include <pthread.h>
+#include "ring.h"
+#include "test_util.h"
+
+#define TEST_SLOTS	4
+#define TEST_FRAMES	10000
+
+static const struct frame tmpl = {
+	.size = 4096,
+	.width = 64,
+	.height = 64,
+	.bin = 1,
+	.img_type = ASI_IMG_RAW8,
+	.planes = 1
+};
+
+static int test_order(struct bufpool *pool)
+{
+	int rc;
+	struct ring ring;
+	struct frame *frames[TEST_SLOTS];
+
+	rc = ring_init(&ring, TEST_SLOTS, &tmpl, pool);
+	if (rc) {
+		C_ERROR(-rc, "ring_init");
+		return rc;
+	}
+
+	for (int n = 0; n < TEST_SLOTS; n++) {
+		frames[n] = ring_get_free(&ring, false);
+		TEST_CHECK(frames[n] && frames[n]->buf);
+		TEST_CHECK(frames[n]->size == tmpl.size);
+		for (int k = 0; k < n; k++)
+			TEST_CHECK(frames[k] != frames[n] &&
+				   frames[k]->buf != frames[n]->buf);
+		frames[n]->seq = n + 1;
+		ring_put_ready(&ring, frames[n]);
+	}
+
+	/* All slots are ready, the oldest one is recycled. */
+	struct frame *frame = ring_get_free(&ring, true);
+	TEST_CHECK(frame == frames[0] && ring.n_dropped == 1);
+	frame->seq = TEST_SLOTS + 1;
+	ring_put_ready(&ring, frame);
+
+	for (int n = 1; n <= TEST_SLOTS; n++) {
+		frame = ring_get_ready(&ring);
+		TEST_CHECK(frame && frame->seq == (uint32_t)n + 1);
+		ring_put_free(&ring, frame);
+	}
+
+	/* Ready frames are drained after closing, then NULL. */
+	frame = ring_get_free(&ring, false);
+	TEST_CHECK(frame);
+	ring_put_ready(&ring, frame);
+	ring_close(&ring);
+	TEST_CHECK(ring_get_ready(&ring) == frame);
+	TEST_CHECK(!ring_get_ready(&ring));
+	TEST_CHECK(!ring_get_free(&ring, false));
+
+cleanup:
+	ring_destroy(&ring);
+
+	return rc;
+}
+
+static void *consume(void *arg)
+{
+	struct ring *ring = arg;
+	struct frame *frame;
+	uint32_t seq = 0;
+	intptr_t rc = 0;
+
+	while ((frame = ring_get_ready(ring))) {
+		if (frame->seq != seq + 1 || frame->buf[0] != (frame->seq & 0xff))
+			rc = -EINVAL;
+		seq = frame->seq;
+		ring_put_free(ring, frame);
+	}
+	if (seq != TEST_FRAMES)
+		rc = -EINVAL;
+
+	return (void *)rc;
+}
+
+static int test_threads(struct bufpool *pool)
+{
+	int rc;
+	struct ring ring;
+	pthread_t thread;
+	void *rc_thread = NULL;
+
+	rc = ring_init(&ring, TEST_SLOTS, &tmpl, pool);
+	if (rc) {
+		C_ERROR(-rc, "ring_init");
+		return rc;
+	}
+
+	rc = pthread_create(&thread, NULL, consume, &ring);
+	if (rc) {
+		C_ERROR(rc, "pthread_create");
+		ring_destroy(&ring);
+		return -rc;
+	}
+
+	/* Blocking producer, no frame is lost. */
+	for (uint32_t n = 1; n <= TEST_FRAMES; n++) {
+		struct frame *frame = ring_get_free(&ring, false);
+		if (!frame)
+			break;
+		frame->seq = n;
+		frame->buf[0] = n & 0xff;
+		ring_put_ready(&ring, frame);
+	}
+	ring_close(&ring);
+	pthread_join(thread, &rc_thread);
+
+	rc = (intptr_t)rc_thread;
+	if (rc)
+		C_ERROR(-rc, "frames consumed out of order or lost");
+	ring_destroy(&ring);
+
+	return rc;
+}
+
+int main(void)
+{
+	int rc;
+	struct bufpool pool;
+
+	api_msg_set_level(API_MSG_ERROR);
+	bufpool_init(&pool, 0);
+
+	rc = test_order(&pool);
+	if (!rc)
+		rc = test_threads(&pool);
+	if (!rc && pool.n_used) {
+		C_ERROR(EINVAL, "%u buffer(s) not returned", pool.n_used);
+		rc = -EINVAL;
+	}
+
+	bufpool_destroy(&pool);
+
+	return rc ? EXIT_FAILURE : EXIT_SUCCESS;
+}
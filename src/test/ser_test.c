@@ -0,0 +1,161 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 only,
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License version 2 for more details (a copy is included
+ * in the LICENSE file that accompanied this code).
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Copyright (c) 2017, Thomas Stibor <thomas@stibor.net>
+ */
+
+/* Frames written concurrently to a SER file are each stored once
+   together with their timestamp, the header counts the frames written
+   and the space reserved for frames never written is cut off. */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include "ser.h"
+#include "test_util.h"
+
+#define TEST_WIDTH	32
+#define TEST_HEIGHT	16
+#define TEST_SIZE	(TEST_WIDTH * TEST_HEIGHT * 2)
+#define TEST_THREADS	4
+#define TEST_FRAMES	64	/* Written, TEST_FRAMES + 8 are reserved. */
+#define TEST_T0		1500000000.0
+
+#define SER_TICKS_PER_SEC	10000000ULL
+#define SER_TICKS_UNIX_EPOCH	621355968000000000ULL
+
+struct writer {
+	pthread_t thread;
+	struct ser *ser;
+	uint32_t first;
+	int rc;
+};
+
+static void *write_frames(void *arg)
+{
+	struct writer *w = arg;
+	uint8_t buf[TEST_SIZE];
+	struct frame frame = {
+		.buf = buf,
+		.size = TEST_SIZE,
+		.width = TEST_WIDTH,
+		.height = TEST_HEIGHT,
+		.bin = 1,
+		.img_type = ASI_IMG_RAW16,
+		.planes = 1
+	};
+
+	for (uint32_t seq = w->first; seq <= TEST_FRAMES && !w->rc;
+	     seq += TEST_THREADS) {
+		frame.seq = seq;
+		frame.t_obs = TEST_T0 + seq * 0.01;
+		memset(buf, seq & 0xff, sizeof(buf));
+		for (int n = 0; n < 4; n++)
+			buf[n] = seq >> (8 * n);
+		w->rc = ser_write(w->ser, &frame);
+	}
+
+	return NULL;
+}
+
+int main(void)
+{
+	int rc;
+	char dir[TEST_LEN_DIR];
+	char filename[TEST_LEN_DIR + 16];
+	uint8_t *data = NULL;
+	size_t len;
+	bool seen[TEST_FRAMES + 1] = {false};
+	struct ser ser;
+	struct writer writers[TEST_THREADS];
+	const struct frame tmpl = {
+		.size = TEST_SIZE,
+		.width = TEST_WIDTH,
+		.height = TEST_HEIGHT,
+		.bin = 1,
+		.img_type = ASI_IMG_RAW16,
+		.planes = 1
+	};
+
+	api_msg_set_level(API_MSG_ERROR);
+	rc = test_tmpdir(dir, sizeof(dir));
+	if (rc)
+		return EXIT_FAILURE;
+	snprintf(filename, sizeof(filename), "%s/test.ser", dir);
+
+	rc = ser_open(&ser, filename, &tmpl, SER_BAYER_RGGB, "ZWO ASI test",
+		      TEST_FRAMES + 8);
+	TEST_CHECK(rc == 0);
+
+	for (int n = 0; n < TEST_THREADS; n++) {
+		writers[n] = (struct writer) {
+			.ser = &ser,
+			.first = n + 1
+		};
+		TEST_CHECK(!pthread_create(&writers[n].thread, NULL,
+					   write_frames, &writers[n]));
+	}
+	for (int n = 0; n < TEST_THREADS; n++) {
+		pthread_join(writers[n].thread, NULL);
+		TEST_CHECK(writers[n].rc == 0);
+	}
+
+	/* Frames never written are cut off on closing. */
+	TEST_CHECK(ser.n_written == TEST_FRAMES);
+	rc = ser_close(&ser);
+	TEST_CHECK(rc == 0);
+
+	rc = test_read_file(filename, &data, &len);
+	TEST_CHECK(rc == 0);
+	TEST_CHECK(len == SER_HEADER_SIZE + TEST_FRAMES *
+		   (TEST_SIZE + sizeof(uint64_t)));
+	TEST_CHECK(!memcmp(data, "LUCAM-RECORDER", 14));
+	TEST_CHECK(test_le32(data + 18) == SER_BAYER_RGGB);
+	TEST_CHECK(test_le32(data + 26) == TEST_WIDTH);
+	TEST_CHECK(test_le32(data + 30) == TEST_HEIGHT);
+	TEST_CHECK(test_le32(data + 34) == 16);
+	TEST_CHECK(test_le32(data + 38) == TEST_FRAMES);
+	TEST_CHECK(!strcmp((char *)data + 82, "ZWO ASI test"));
+
+	/* Each frame once, its timestamp at the same index. The start
+	   time is the one of the earliest frame, which is frame 1. */
+	const uint8_t *trailer = data + SER_HEADER_SIZE +
+		TEST_FRAMES * TEST_SIZE;
+	const uint64_t t_utc = test_le64(data + 170);
+
+	for (uint32_t n = 0; n < TEST_FRAMES; n++) {
+		const uint8_t *p = data + SER_HEADER_SIZE + n * TEST_SIZE;
+		const uint32_t seq = test_le32(p);
+
+		TEST_CHECK(seq >= 1 && seq <= TEST_FRAMES && !seen[seq]);
+		seen[seq] = true;
+		TEST_CHECK(p[TEST_SIZE - 1] == (seq & 0xff));
+		TEST_CHECK(test_le64(trailer + n * sizeof(uint64_t)) ==
+			   SER_TICKS_UNIX_EPOCH + (uint64_t)((TEST_T0 + seq *
+			   0.01) * SER_TICKS_PER_SEC));
+	}
+	TEST_CHECK(t_utc == SER_TICKS_UNIX_EPOCH +
+		   (uint64_t)((TEST_T0 + 0.01) * SER_TICKS_PER_SEC));
+
+cleanup:
+	free(data);
+	test_rmdir(dir);
+
+	return rc ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,191 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 only,
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License version 2 for more details (a copy is included
+ * in the LICENSE file that accompanied this code).
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Copyright (c) 2017, Thomas Stibor <thomas@stibor.net>
+ */
+
+/* Frames committed to a spool, downloaded into their slot or copied,
+   are read back with their meta data, slots never written are
+   reported as missing. */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdint.h>
+#include "spool.h"
+#include "test_util.h"
+
+#define TEST_WIDTH	48
+#define TEST_HEIGHT	20
+#define TEST_SIZE	(TEST_WIDTH * TEST_HEIGHT)
+#define TEST_SLOTS	12
+#define TEST_MISSING	5	/* Sequence number of the slot not written. */
+#define TEST_T0		1500000000.0
+
+static const struct frame tmpl = {
+	.size = TEST_SIZE,
+	.width = TEST_WIDTH,
+	.height = TEST_HEIGHT,
+	.bin = 2,
+	.img_type = ASI_IMG_RAW8,
+	.planes = 1,
+	.exp_time = 0.5,
+	.x_pix_sz = 2.9,
+	.y_pix_sz = 2.9
+};
+
+static int test_write(const char *filename)
+{
+	int rc;
+	struct spool spool;
+	uint8_t buf[TEST_SIZE];
+
+	rc = spool_create(&spool, filename, &tmpl, TEST_SLOTS, "ZWO ASI test",
+			  true, ASI_BAYER_GR);
+	if (rc) {
+		C_ERROR(-rc, "spool_create");
+		return rc;
+	}
+
+	for (uint32_t seq = 1; seq <= TEST_SLOTS; seq++) {
+		struct frame frame = tmpl;
+
+		if (seq == TEST_MISSING)
+			continue;
+
+		/* Odd frames are downloaded into their slot, even ones
+		   are copied. Every third has no ROI start. */
+		frame.buf = seq & 1 ? spool_slot(&spool, seq) : buf;
+		TEST_CHECK(frame.buf);
+		memset(frame.buf, seq, TEST_SIZE);
+		frame.seq = seq;
+		frame.t_obs = TEST_T0 + seq;
+		frame.exp_time = 0.5 * seq;
+		frame.x_org = seq % 3 ? (int)seq * 8 : -1;
+		frame.y_org = seq % 3 ? (int)seq * 2 : -1;
+		snprintf(frame.date_obs, MAX_LEN_ISO8601, "frame %u", seq);
+		rc = spool_commit(&spool, &frame);
+		TEST_CHECK(rc == 0);
+	}
+
+	/* Neither a sequence number outside the spool nor a frame of
+	   different size is accepted. */
+	struct frame frame = tmpl;
+	frame.buf = buf;
+	frame.seq = TEST_SLOTS + 1;
+	TEST_CHECK(!spool_slot(&spool, 0) && !spool_slot(&spool, frame.seq));
+	TEST_CHECK(spool_commit(&spool, &frame) == -EINVAL);
+	frame.seq = 1;
+	frame.size--;
+	TEST_CHECK(spool_commit(&spool, &frame) == -EINVAL);
+
+cleanup:
+	if (spool_close(&spool) && !rc)
+		rc = -EIO;
+
+	return rc;
+}
+
+static int test_read(const char *filename)
+{
+	int rc;
+	struct spool spool;
+	struct frame frame;
+
+	rc = spool_open(&spool, filename);
+	if (rc) {
+		C_ERROR(-rc, "spool_open");
+		return rc;
+	}
+
+	const struct spool_header *hdr = spool.hdr;
+	TEST_CHECK(hdr->version == SPOOL_VERSION);
+	TEST_CHECK(hdr->n_slots == TEST_SLOTS && hdr->n_frames == TEST_SLOTS);
+	TEST_CHECK(hdr->is_color && hdr->bayer == ASI_BAYER_GR);
+	TEST_CHECK(!strcmp(hdr->camera, "ZWO ASI test"));
+	TEST_CHECK(hdr->slot_size % SPOOL_ALIGN == 0 &&
+		   hdr->data_off % SPOOL_ALIGN == 0);
+
+	for (uint32_t n = 0; n < TEST_SLOTS; n++) {
+		const uint32_t seq = n + 1;
+		char date_obs[MAX_LEN_ISO8601];
+
+		rc = spool_frame(&spool, n, &frame);
+		if (seq == TEST_MISSING) {
+			TEST_CHECK(rc == -ENOENT);
+			continue;
+		}
+		TEST_CHECK(rc == 0);
+		TEST_CHECK(frame.seq == seq && frame.size == TEST_SIZE);
+		TEST_CHECK(frame.width == TEST_WIDTH &&
+			   frame.height == TEST_HEIGHT && frame.bin == 2);
+		TEST_CHECK(frame.img_type == ASI_IMG_RAW8);
+		TEST_CHECK(frame.t_obs == TEST_T0 + seq);
+		TEST_CHECK(frame.exp_time == 0.5 * seq);
+		TEST_CHECK(frame.x_pix_sz == tmpl.x_pix_sz);
+		TEST_CHECK(frame.x_org == (seq % 3 ? (int)seq * 8 : -1));
+		TEST_CHECK(frame.y_org == (seq % 3 ? (int)seq * 2 : -1));
+		snprintf(date_obs, sizeof(date_obs), "frame %u", seq);
+		TEST_CHECK(!strcmp(frame.date_obs, date_obs));
+		TEST_CHECK(frame.buf[0] == seq &&
+			   frame.buf[TEST_SIZE - 1] == seq);
+	}
+	rc = spool_frame(&spool, TEST_SLOTS, &frame);
+	TEST_CHECK(rc == -EINVAL);
+	rc = 0;
+
+cleanup:
+	spool_close(&spool);
+
+	return rc;
+}
+
+int main(void)
+{
+	int rc;
+	char dir[TEST_LEN_DIR];
+	char filename[TEST_LEN_DIR + 16];
+
+	api_msg_set_level(API_MSG_ERROR);
+	rc = test_tmpdir(dir, sizeof(dir));
+	if (rc)
+		return EXIT_FAILURE;
+	snprintf(filename, sizeof(filename), "%s/test.spool", dir);
+
+	rc = test_write(filename);
+	if (!rc)
+		rc = test_read(filename);
+
+	/* Anything but a spool is refused. */
+	if (!rc) {
+		const char *other = "/proc/self/status";
+		struct spool spool;
+
+		api_msg_set_level(API_MSG_FATAL);
+		rc = spool_open(&spool, other);
+		api_msg_set_level(API_MSG_ERROR);
+		if (rc != -EINVAL) {
+			C_ERROR(EINVAL, "'%s' opened as spool", other);
+			rc = -EINVAL;
+		} else {
+			rc = 0;
+		}
+	}
+
+	test_rmdir(dir);
+
+	return rc ? EXIT_FAILURE : EXIT_SUCCESS;
+}
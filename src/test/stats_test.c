@@ -0,0 +1,165 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 only,
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License version 2 for more details (a copy is included
+ * in the LICENSE file that accompanied this code).
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Copyright (c) 2017, Thomas Stibor <thomas@stibor.net>
+ */
+
+/* Statistics and the merged histogram of 8 and 16 bit frames match a
+   plain reference, for frames counted by the calling thread alone and
+   in parallel bands, and the saturation level of left aligned 12 bit
+   data is found from its unused low bits. */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdint.h>
+#include <math.h>
+#include "stats.h"
+#include "parallel.h"
+#include "test_util.h"
+
+#define TEST_SMALL	1001
+#define TEST_LARGE	((1 << 20) + 4099)	/* Counted in bands. */
+
+static uint32_t seed = 2463534242u;
+
+static uint32_t xorshift(void)
+{
+	seed ^= seed << 13;
+	seed ^= seed >> 17;
+	seed ^= seed << 5;
+
+	return seed;
+}
+
+/* Samples are random, of 16 bit ones only the upper 12 bits are used
+   and a few are saturated. */
+static void fill(uint8_t *img, const size_t n, const uint8_t bps)
+{
+	for (size_t i = 0; i < n; i++) {
+		if (bps == 1)
+			img[i] = xorshift() >> 24;
+		else
+			((uint16_t *)img)[i] = i % 97 ? (xorshift() >> 20) << 4 :
+				0xfff0;
+	}
+}
+
+static int test_stats(const size_t n, const uint8_t bps)
+{
+	int rc = 0;
+	const uint32_t bins = STATS_BINS(bps);
+	uint8_t *img = malloc(n * bps);
+	uint32_t *hist = malloc(stats_scratch_size(bps));
+	uint64_t *ref = calloc(bins, sizeof(uint64_t));
+	struct frame_stats stats;
+	double sum = 0, sum_sq = 0;
+	uint32_t min = bins, max = 0, median = 0;
+	uint64_t cum = 0;
+	const uint32_t sat_level = bps == 2 ? 0xfff0 : 0xff;
+
+	if (!img || !hist || !ref) {
+		rc = -ENOMEM;
+		C_ERROR(ENOMEM, "malloc");
+		goto cleanup;
+	}
+
+	fill(img, n, bps);
+	for (size_t i = 0; i < n; i++) {
+		const uint32_t v = bps == 2 ? ((uint16_t *)img)[i] : img[i];
+
+		ref[v]++;
+		sum += v;
+		sum_sq += (double)v * v;
+		min = v < min ? v : min;
+		max = v > max ? v : max;
+	}
+	for (uint32_t v = 0; v < bins && 2 * cum < n; v++) {
+		cum += ref[v];
+		median = v;
+	}
+
+	rc = stats_compute(&stats, hist, img, n, bps);
+	TEST_CHECK(rc == 0);
+
+	for (uint32_t v = 0; v < bins; v++)
+		TEST_CHECK(hist[v] == ref[v]);
+	TEST_CHECK(stats.n == n);
+	TEST_CHECK(stats.min == min && stats.max == max);
+	TEST_CHECK(stats.median == median);
+	TEST_CHECK(fabs(stats.mean - sum / n) < 1e-9 * max);
+	TEST_CHECK(fabs(stats.stddev - sqrt(sum_sq / n - (sum / n) *
+					    (sum / n))) < 1e-6 * max);
+	TEST_CHECK(stats.sat_level == sat_level);
+	TEST_CHECK(stats.n_saturated == ref[sat_level]);
+	TEST_CHECK(stats.clipped == (double)(ref[0] + ref[sat_level]) / n);
+
+cleanup:
+	if (rc)
+		C_ERROR(-rc, "%zu samples of %d bit", n, 8 * bps);
+	free(img);
+	free(hist);
+	free(ref);
+
+	return rc;
+}
+
+/* Samples 0, ..., 99 once each. */
+static int test_percentile(void)
+{
+	int rc = 0;
+	uint32_t hist[256] = {0};
+
+	for (uint32_t v = 0; v < 100; v++)
+		hist[v] = 1;
+
+	TEST_CHECK(stats_percentile(hist, 256, 100, 0) == 0);
+	TEST_CHECK(stats_percentile(hist, 256, 100, 50) == 49);
+	TEST_CHECK(stats_percentile(hist, 256, 100, 99.5) == 99);
+	TEST_CHECK(stats_percentile(hist, 256, 100, 100) == 99);
+
+cleanup:
+	return rc;
+}
+
+int main(void)
+{
+	int rc = 0;
+	uint32_t hist[256 * 4];
+	uint8_t img[4] = {0};
+	struct frame_stats stats;
+
+	api_msg_set_level(API_MSG_ERROR);
+
+	for (uint32_t threads = 1; threads <= 4 && !rc; threads += 3) {
+		parallel_set_threads(threads);
+		for (uint8_t bps = 1; bps <= 2 && !rc; bps++) {
+			rc = test_stats(TEST_SMALL, bps);
+			if (!rc)
+				rc = test_stats(TEST_LARGE, bps);
+		}
+	}
+	if (!rc)
+		rc = test_percentile();
+
+	parallel_set_threads(1);
+	if (!rc)
+		TEST_CHECK(stats_compute(&stats, hist, img, 0, 1) == -EINVAL &&
+			   stats_compute(&stats, hist, img, 4, 3) == -EINVAL);
+
+cleanup:
+	return rc ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,157 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 only,
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License version 2 for more details (a copy is included
+ * in the LICENSE file that accompanied this code).
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Copyright (c) 2017, Thomas Stibor <thomas@stibor.net>
+ */
+
+/* Helpers of the tests, which run asic_fake as a child process and
+   check the files it writes. */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdint.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "test_util.h"
+
+/* Start asic_fake with argv, argv[0] is its name. */
+int test_spawn(char *const argv[], pid_t *pid)
+{
+	*pid = fork();
+	if (*pid < 0) {
+		C_ERROR(errno, "fork");
+		return -errno;
+	}
+	if (*pid == 0) {
+		execv(TEST_ASIC, argv);
+		C_ERROR(errno, "execv '%s'", TEST_ASIC);
+		_exit(127);
+	}
+
+	return 0;
+}
+
+/* Exit code of the child, -EINTR if it was terminated by a signal. */
+int test_wait(const pid_t pid)
+{
+	int status;
+
+	while (waitpid(pid, &status, 0) < 0)
+		if (errno != EINTR) {
+			C_ERROR(errno, "waitpid");
+			return -errno;
+		}
+	if (!WIFEXITED(status)) {
+		C_ERROR(EINTR, "'%s' terminated by signal %d", TEST_ASIC,
+			WTERMSIG(status));
+		return -EINTR;
+	}
+
+	return WEXITSTATUS(status);
+}
+
+int test_run(char *const argv[])
+{
+	int rc;
+	pid_t pid;
+
+	rc = test_spawn(argv, &pid);
+
+	return rc ? rc : test_wait(pid);
+}
+
+int test_tmpdir(char *dir, const size_t len)
+{
+	snprintf(dir, len, "/tmp/asic_test.XXXXXX");
+	if (!mkdtemp(dir)) {
+		C_ERROR(errno, "mkdtemp");
+		return -errno;
+	}
+
+	return 0;
+}
+
+/* Remove dir and the files in it. */
+void test_rmdir(const char *dir)
+{
+	char path[PATH_MAX + 1];
+	struct dirent *ent;
+	DIR *d = opendir(dir);
+
+	if (!d)
+		return;
+	while ((ent = readdir(d))) {
+		if (!strcmp(ent->d_name, ".") || !strcmp(ent->d_name, ".."))
+			continue;
+		snprintf(path, sizeof(path), "%s/%s", dir, ent->d_name);
+		unlink(path);
+	}
+	closedir(d);
+	rmdir(dir);
+}
+
+uint32_t test_le32(const uint8_t *p)
+{
+	return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+uint64_t test_le64(const uint8_t *p)
+{
+	return test_le32(p) | (uint64_t)test_le32(p + 4) << 32;
+}
+
+/* Read the whole file into *data, which the caller frees. */
+int test_read_file(const char *filename, uint8_t **data, size_t *len)
+{
+	int rc = 0;
+	struct stat st;
+	const int fd = open(filename, O_RDONLY);
+
+	*data = NULL;
+	if (fd < 0 || fstat(fd, &st) < 0) {
+		rc = -errno;
+		C_ERROR(errno, "open '%s'", filename);
+		goto cleanup;
+	}
+
+	*len = st.st_size;
+	*data = malloc(*len + 1);
+	if (!*data) {
+		rc = -ENOMEM;
+		C_ERROR(ENOMEM, "malloc");
+		goto cleanup;
+	}
+	for (size_t off = 0; off < *len; ) {
+		const ssize_t n = pread(fd, *data + off, *len - off, off);
+		if (n <= 0) {
+			rc = n < 0 ? -errno : -EIO;
+			C_ERROR(-rc, "pread '%s'", filename);
+			free(*data);
+			*data = NULL;
+			goto cleanup;
+		}
+		off += n;
+	}
+
+cleanup:
+	if (fd >= 0)
+		close(fd);
+
+	return rc;
+}
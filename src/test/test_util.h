@@ -0,0 +1,50 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 only,
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License version 2 for more details (a copy is included
+ * in the LICENSE file that accompanied this code).
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Copyright (c) 2017, Thomas Stibor <thomas@stibor.net>
+ */
+
+#ifndef TEST_UTIL_H
+#define TEST_UTIL_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include "log.h"
+
+#define TEST_SKIP	77
+#define TEST_ASIC	"./asic_fake"
+#define TEST_LEN_DIR	64	/* Of the temporary directory. */
+
+/* Fail the test function with -EINVAL, it has to provide int rc and
+   the label cleanup. */
+#define TEST_CHECK(cond)						\
+do {									\
+	if (!(cond)) {							\
+		C_ERROR(EINVAL, "check '%s' failed", #cond);		\
+		rc = -EINVAL;						\
+		goto cleanup;						\
+	}								\
+} while (0)
+
+int test_spawn(char *const argv[], pid_t *pid);
+int test_wait(const pid_t pid);
+int test_run(char *const argv[]);
+int test_tmpdir(char *dir, const size_t len);
+void test_rmdir(const char *dir);
+uint32_t test_le32(const uint8_t *p);
+uint64_t test_le64(const uint8_t *p);
+int test_read_file(const char *filename, uint8_t **data, size_t *len);
+
+#endif	/* TEST_UTIL_H */
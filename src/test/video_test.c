@@ -0,0 +1,168 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 only,
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License version 2 for more details (a copy is included
+ * in the LICENSE file that accompanied this code).
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Copyright (c) 2017, Thomas Stibor <thomas@stibor.net>
+ */
+
+/* Captures video from the fake camera into a ser file and checks that
+   every captured frame is in the file once, with its own content and
+   a timestamp following the frame rate of the camera, and that a
+   failed capture ends with a non-zero exit code. */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdint.h>
+#include <math.h>
+#include "ser.h"
+#include "test_util.h"
+
+#define TEST_FPS	"200"
+#define TEST_COUNT	200
+#define TEST_WIDTH	64
+#define TEST_HEIGHT	48
+
+/* Frame n as written by the fake camera, away from its star. */
+static bool frame_valid(const uint8_t *buf, const uint32_t n, const int bps)
+{
+	if (test_le32(buf) != n)
+		return false;
+	/* RAW16 samples are the 8 bit value left aligned by 8 bits. */
+	for (int x = 8; x < 16; x++) {
+		const uint32_t got = bps == 2 ? buf[x * 2 + 1] : buf[x];
+		if (got != ((x + n) & 0x3f))
+			return false;
+	}
+
+	return true;
+}
+
+static int test_video(const char *dir, const char *type, const int bps)
+{
+	int rc;
+	uint8_t *data = NULL;
+	size_t len = 0;
+	char filename[PATH_MAX + 1];
+	char count[16];
+	char width[16];
+	char height[16];
+
+	snprintf(filename, sizeof(filename), "%s/video_%s.ser", dir, type);
+	snprintf(count, sizeof(count), "%d", TEST_COUNT);
+	snprintf(width, sizeof(width), "%d", TEST_WIDTH);
+	snprintf(height, sizeof(height), "%d", TEST_HEIGHT);
+
+	/* Blocking, the host drops no frame and all captured frames
+	   reach the file. */
+	char *const argv[] = {"asic_fake", "-c", "-V", "-n", count,
+			      "-w", width, "-h", height, "-t", (char *)type,
+			      "-e", "0.001", "-W", "2", "-P", "block",
+			      "-f", filename, "-v", "error", "0", NULL};
+
+	rc = test_run(argv);
+	TEST_CHECK(rc == 0);
+
+	rc = test_read_file(filename, &data, &len);
+	if (rc)
+		goto cleanup;
+
+	const size_t frame_size = (size_t)TEST_WIDTH * TEST_HEIGHT * bps;
+	TEST_CHECK(len >= SER_HEADER_SIZE);
+	TEST_CHECK(!memcmp(data, "LUCAM-RECORDER", 14));
+	TEST_CHECK(test_le32(data + 26) == TEST_WIDTH);
+	TEST_CHECK(test_le32(data + 30) == TEST_HEIGHT);
+	TEST_CHECK(test_le32(data + 34) == (uint32_t)bps * 8);
+
+	const uint32_t n_frames = test_le32(data + 38);
+	TEST_CHECK(n_frames == TEST_COUNT);
+	TEST_CHECK(len == SER_HEADER_SIZE + n_frames * (frame_size + 8));
+
+	/* Writers store frames in order of arrival, thus sort them by
+	   their number, which has gaps where the camera dropped. */
+	uint32_t first = UINT32_MAX;
+	uint32_t last = 0;
+	uint64_t ts_first = 0;
+	uint64_t ts_last = 0;
+	const uint8_t *ts = data + SER_HEADER_SIZE + n_frames * frame_size;
+
+	for (uint32_t n = 0; n < n_frames; n++) {
+		const uint8_t *buf = data + SER_HEADER_SIZE + n * frame_size;
+		const uint32_t seq = test_le32(buf);
+
+		TEST_CHECK(frame_valid(buf, seq, bps));
+		for (uint32_t k = 0; k < n; k++)
+			TEST_CHECK(test_le32(data + SER_HEADER_SIZE +
+					     k * frame_size) != seq);
+		if (seq < first) {
+			first = seq;
+			ts_first = test_le64(ts + n * 8);
+		}
+		if (seq >= last) {
+			last = seq;
+			ts_last = test_le64(ts + n * 8);
+		}
+	}
+
+	/* Timestamps in 100 ns ticks follow the camera frame rate. */
+	const double period = (ts_last - ts_first) * 1e-7 / (last - first);
+	TEST_CHECK(fabs(period * atoi(TEST_FPS) - 1) < 0.25);
+
+cleanup:
+	free(data);
+
+	return rc;
+}
+
+/* A failed capture is reported by the exit code. */
+static int test_failure(const char *dir)
+{
+	int rc;
+	char filename[PATH_MAX + 1];
+
+	snprintf(filename, sizeof(filename), "%s/missing/video.ser", dir);
+	char *const argv[] = {"asic_fake", "-c", "-V", "-n", "10",
+			      "-f", filename, "-v", "error", "0", NULL};
+
+	rc = test_run(argv);
+	TEST_CHECK(rc > 0);
+	rc = 0;
+
+cleanup:
+	return rc;
+}
+
+int main(void)
+{
+	int rc;
+	char dir[TEST_LEN_DIR];
+
+	api_msg_set_level(API_MSG_ERROR);
+	setenv("FAKE_ASI_FPS", TEST_FPS, 1);
+
+	rc = test_tmpdir(dir, sizeof(dir));
+	if (rc)
+		return EXIT_FAILURE;
+
+	rc = test_video(dir, "RAW8", 1);
+	if (!rc)
+		rc = test_video(dir, "RAW16", 2);
+	if (!rc)
+		rc = test_failure(dir);
+
+	test_rmdir(dir);
+
+	return rc ? EXIT_FAILURE : EXIT_SUCCESS;
+}